@@ -144,6 +144,10 @@ SOURCE=.\edbThePagerMgr.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\edbVLPagedCache_test.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\edbVStorage_imp.cpp
 # End Source File
 # End Group
@@ -15,6 +15,7 @@
 //#define PAGED_FILE_UNIT_TEST
 //#define VSTORAGE_UNIT_TEST
 //#define FSTORAGE_UNIT_TEST
+//#define VLPAGED_CACHE_UNIT_TEST
 
 #include "edbError.h"
 #include "edbTests.h"
@@ -49,6 +50,11 @@ main ()
     edb::testPager ();
     std::cerr << "Done with testing Pager." << std::endl;
 #endif
+#ifdef VLPAGED_CACHE_UNIT_TEST
+    std::cerr << "Testing VLPagedCache..." << std::endl;
+    edb::testVLPagedCache ();
+    std::cerr << "Done with testing VLPagedCache." << std::endl;
+#endif
 #ifdef PAGED_FILE_UNIT_TEST
     std::cerr << "Testing PagedFile..." << std::endl;
     edb::testPagedFile ();
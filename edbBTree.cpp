@@ -48,12 +48,15 @@
 #include "edbExceptions.h"
 #include "edbBTree.h"
 #include "edbPagedFile.h"
+#include "edbStats.h"
 #include <string.h>
 #include <math.h>
 #include <malloc.h>
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <set>
+#include <algorithm>
 
 // Code configuration parameters
 inline const char *cpoint(int n, const char *auxmsg=0)
@@ -173,6 +176,12 @@ struct BTreeMasterPage   // version 0
     uint32  nodesize;         // size of non-root page
     uint16  keylen;           // size of key for fixed size key index, 0 for variable
     uint16  vallen;           // size of user value (without overhead)
+    // Optional bloom filter, all zeros for index without one
+    uint64  bloompage;        // first page of filter
+    uint32  bloompages;       // number of pages in filter
+    uint16  bloomhashes;      // number of probes per key
+    uint16  bloomstate;       // BLOOM_CLEAN or BLOOM_DIRTY
+    uint64  bloomremoved;     // pairs removed since filter was built
 } ;
 
 struct BTreeNodeHeader
@@ -196,6 +205,10 @@ struct BTreeFreeHeader
 
 typedef uint32 RangeLenT;
 
+// Bloom filter state in master page. Filter is DIRTY from first
+// modification till flush, and is rebuilt on attach if found so.
+enum { BLOOM_CLEAN = 0, BLOOM_DIRTY = 1 };
+
 const LogPageNumT DanglingPageRef = (LogPageNumT) -1;
 enum { EXPAND_NO=0, EXPAND_INSERT, EXPAND_REMOVE };
 
@@ -318,12 +331,16 @@ public:
     nodesize_(nodesize),
     rootnodesize_(rootnodesize),
     vallen_(vallen),
-    flags_(flags)
+    flags_(flags),
+    version_(0),
+    readahead_(BTREE_READAHEAD_LEAVES)
     {}
     virtual ~BTreeNodeHandler () {}
+    void setReadAhead (uint32 leaves) { readahead_ = leaves; }
     void insert (const void *key, LenT len, const void *val)
     {
         checkInsertParams(key, len, val);
+        ++version_;
         // Find leaf node, providing that all pages on path
         // have place to insert new key
         BTreeNodePtr node (file_, nodesize_);
@@ -357,8 +374,14 @@ public:
     {
         bool first = !cur.ptr_;
         if (cur.ptr_) {
-            // Page already locked, step forward or backward
-            if (!stepCursor (cur)) return false;
+            if (cur.version_ != version_) {
+                // Tree was changed since last fetch - page under cursor
+                // might be split, rotated or reclaimed
+                if (!reposition (cur)) return false;
+            } else {
+                // Page already locked, step forward or backward
+                if (!stepCursor (cur)) return false;
+            }
         } else {
             // First time
             try {
@@ -381,12 +404,36 @@ public:
             cur.free ();
             return false;
         }
+        if (cur.last_) {
+            cur.version_ = version_;
+            readKey (cur, cur.pos_, cur.last_);
+            memcpy (cur.last_ + cur.lastlen_, val, vallen_);
+        }
         return true;
     }
+    // First pair of each run goes through fetch, which deals with start,
+    // leaf change, concurrent modification and end of query; the rest of
+    // leaf is then copied out by fetchRun where the handler can do it.
+    uint32 fetchBatch (BTreeCursor &cur, char *keys, char *vals, uint32 maxRows, LenT klen)
+    {
+        uint32 n = 0;
+        const void *key;
+        LenT len;
+        char *val = vals ? 0 : (char *) alloca (vallen_);
+        while (n < maxRows) {
+            if (!fetch (cur, key, len, vals ? vals + n*vallen_ : val)) break;
+            readKey (cur, cur.pos_, keys + n*klen);
+            ++n;
+            if (n < maxRows)
+                n += fetchRun (cur, keys + n*klen, vals ? vals + n*vallen_ : 0, maxRows - n, klen);
+        }
+        return n;
+    }
     uint64 remove (BTreeCursor &cur)
     {
         uint64 leafStart;
         Trace trace;
+        ++version_;
         try {
             // FIXME: wrong place for BTREE_FLAGS_RANGE, BTreeNodeHandler
             // should not know about it! Push it down by hierarchy.
@@ -432,14 +479,56 @@ public:
         r += countPairs(*(BTreeNodePtr *)&cur, cur.pos_);
         return r;
     }
+    uint64 count()
+    {
+        BTreeNodePtr root (file_, nodesize_);
+        root.fetch (0, 2, (uint32) rootnodeoff_, rootnodesize_);
+        return countPairs(root);
+    }
+    // Unlike getpos, does not require the key to be present - sums counts of
+    // subtrees to the left of the search path and adds leaf bound position
+    uint64 rank(const void *key, LenT len, const void *val, int match)
+    {
+        checkFindParams(key, len, val, match);
+        BTreeNodePtr node (file_, nodesize_);
+        node.fetch (0, 2, (uint32) rootnodeoff_, rootnodesize_);
+        int myMatch = match | BTREE_PARTIAL;
+        uint64 r = 0;
+        while (node.level()) {
+            if (!check (node)) throw FileStructureCorrupt(cpoint(__LINE__));
+            int pos = searchNode (node, key, len, val, myMatch, false);
+            if (pos < 0) throw FileStructureCorrupt(cpoint(__LINE__));
+            if (pos > 0) r += countPairs(node, pos-1);
+            LogPageNumT pg = refAt (node, pos);
+            // empty subtree - nothing else precedes the key
+            if (DanglingPageRef == pg) return r;
+            try { node.fetch (pg); } catch (Error &) { throw FileStructureCorrupt(cpoint(__LINE__)); }
+        }
+        return r + countPairs(node, boundLeaf(node, key, len, val, match));
+    }
+    void select(uint64 pos, void *key, void *val)
+    {
+        BTreeCursor cur;
+        // manually initialize all cursor's relevant fields
+        cur.file_   = &file_;
+        cur.dfltnodesize_ = nodesize_;
+        cur.pos_    = pos;
+        findByPos(cur, 0);
+        readKey (cur, cur.pos_, key);
+        readValue (cur, cur.pos_, val);
+    }
 protected:
     // new node handler signature
     enum { InvalidPos = (uint64) -1 };
     virtual void *getKey (BTreeNodePtr &node, uint16 pos) = 0;
     virtual void readValue (BTreeNodePtrBase &node, uint64 pos, void *val) = 0;
+    virtual void readKey (BTreeNodePtrBase &node, uint64 pos, void *key) = 0;
     virtual int  compareValue(BTreeNodePtrBase &node, uint64 pos, const void *val, uint16 vlen) = 0;
     virtual bool done (BTreeCursor &cur) = 0;
     virtual bool stepCursor (BTreeCursor &cur, bool remove = false) = 0;
+    // Copy out up to max pairs following the cursor in its leaf, leaving the
+    // cursor at the last one. Returns number of pairs, 0 if no fast path.
+    virtual uint32 fetchRun (BTreeCursor &cur, char *keys, char *vals, uint32 max, LenT klen) { return 0; }
     virtual void incrementCounter(Trace &trace) = 0;
     virtual void decrementCounter(Trace &trace, uint64 leafStart, uint64 decrement) = 0;
     virtual uint64 countPairs(BTreeNodePtr &node, uint64 pos = InvalidPos) = 0;
@@ -455,9 +544,12 @@ protected:
     virtual int searchNodeByCount(BTreeNodePtr &node, uint64 &count) = 0;
     virtual uint64 searchLeaf (BTreeNodePtr &node, const void *key, LenT klen, const void *val, int match, bool fInsert) = 0;
     virtual uint64 searchLeafByCount(BTreeNodePtr &node, uint64 count) = 0;
+    // position of lower (upper for BTREE_LAST) bound of key in leaf, never fails
+    virtual uint64 boundLeaf (BTreeNodePtr &node, const void *key, LenT klen, const void *val, int match) = 0;
     virtual bool enoughSpace (BTreeNodePtr &node) = 0;
     virtual bool splitRoot (BTreeNodePtr &node) = 0;
-    virtual bool makeroom (BTreeNodePtr &parent, int nodePos,
+    // nodePos is updated to the position of node which now should receive the key
+    virtual bool makeroom (BTreeNodePtr &parent, int &nodePos,
         const void *key, LenT klen,
         BTreeNodePtr &node) = 0;
     virtual int insert (BTreeNodePtr &node, const void *key, LenT klen, const void *val) = 0;
@@ -470,6 +562,8 @@ protected:
     uint32 rootnodesize_;
     uint16 vallen_;
     uint32 flags_;
+    uint64 version_; // incremented by each modification, see BTreeCursor::version_
+    uint32 readahead_; // see BTree::setReadAhead
     // service for subclasses
     bool newNode (BTreeNodePtr &node)
     {
@@ -608,6 +702,92 @@ private:
             }
         }
     }
+    // Find again place of cursor by pair it returned last time. Cursor is
+    // positioned to the pair following the remembered one in the direction
+    // of query, so the pair could be removed meanwhile.
+    bool reposition(BTreeCursor &cur)
+    {
+        cur.free ();
+        cur.ahead_ = 0;
+        cur.parent_ = (LogPageNumT) -1;
+        const char *key = cur.last_;
+        const char *val = cur.last_ + cur.lastlen_;
+        bool forward = cur.qry_->stepForward();
+        int match = (flags_ & BTREE_FLAGS_DUPLICATE) ? BTREE_BOTH : BTREE_EXACT;
+        if (forward) match |= BTREE_LAST;
+        uint64 r = rank (key, cur.lastlen_, val, match);
+        if (!forward) {
+            if (0 == r) return false;
+            --r;
+        }
+        cur.pos_ = r;
+        try {
+            findByPos(cur, 0);
+        } catch (NotFound &) {
+            cur.free ();
+            return false;
+        }
+        return true;
+    }
+protected:
+    // Forward scan has just stepped into next leaf. Keep up to readahead_
+    // following leaves being read in background, asking for more once half
+    // of them are behind. Cursor remembers the parent they come from and
+    // the next child to ask for, so the tree is searched from the root
+    // once per parent rather than once per window. The remembered parent
+    // is dropped by reposition, as the tree may have changed.
+    void readAhead(BTreeCursor &cur)
+    {
+        if (!readahead_ || !cur.last_) return;
+        if (cur.ahead_) --cur.ahead_;
+        if (cur.ahead_ > readahead_ / 2) return;
+        LogPageNumT *pages = (LogPageNumT *) alloca (readahead_ * sizeof (LogPageNumT));
+        uint32 cnt = 0;
+        try {
+            BTreeNodePtr parent (file_, nodesize_);
+            if ((LogPageNumT) -1 != cur.parent_) {
+                if (0 == cur.parent_) parent.fetch (0, 2, (uint32) rootnodeoff_, rootnodesize_);
+                else parent.fetch (cur.parent_);
+                if (cur.child_ > parent.nkeys()) {
+                    // all children asked for; look for next parent
+                    // once the cursor is past them
+                    if (cur.ahead_) return;
+                    cur.parent_ = (LogPageNumT) -1;
+                }
+            }
+            if ((LogPageNumT) -1 == cur.parent_) {
+                BTreeNodePtr node (file_, nodesize_);
+                Trace trace;
+                int match = (flags_ & BTREE_FLAGS_DUPLICATE) ? BTREE_BOTH : BTREE_EXACT;
+                findLeaf (cur.last_, cur.lastlen_, cur.last_ + cur.lastlen_, match, EXPAND_NO, node, &trace);
+                if (0 == trace.size()) return;
+                BTreeNodePtr &found = trace.rgnp[trace.size()-1];
+                int pos = trace.rgn[trace.size()-1];
+                // leaf under cursor is not the next child - it is the first
+                // leaf of the next parent, try again on next step
+                if (pos >= found.nkeys() || refAt (found, pos+1) != cur.page()) return;
+                parent.assign (found);
+                cur.parent_ = parent.page();
+                cur.child_ = pos + 2;
+                cur.ahead_ = 0;
+            }
+            for (; cur.child_ <= parent.nkeys() && cur.ahead_ + cnt < readahead_; ++cur.child_) {
+                LogPageNumT pg = refAt (parent, cur.child_);
+                if (DanglingPageRef != pg) pages[cnt++] = pg;
+            }
+        } catch (NotFound &) {
+            return;
+        }
+        if (0 == cnt) return;
+        cur.ahead_ += cnt;
+        std::sort (pages, pages + cnt);
+        // leaves lying in a row just after the cursor are read ahead by
+        // the system itself, asking for them only gets in its way
+        if (pages[cnt-1] - pages[0] == cnt - 1 && pages[0] > cur.page()
+            && pages[0] - cur.page() <= readahead_) return;
+        file_.prefetch (pages, cnt);
+    }
+private:
     void findByPos(BTreeCursor &cur, Trace *trace)
     {
         // Find leaf page
@@ -692,6 +872,13 @@ protected:
         const char *vals = np->data+np->nkeys*keylen_;
         memcpy (val, vals+pos*vallen_, vallen_);
     }
+    void readKey (BTreeNodePtrBase &node, uint64 pos, void *key)
+    {
+        const BTreeNodeHeader *np = (const BTreeNodeHeader *) node.body ();
+        assert (0 == np->level);
+        if (pos >= np->nkeys) throw FileStructureCorrupt(cpoint(__LINE__));
+        memcpy (key, np->data+pos*(uint32)keylen_, truekeylen_);
+    }
     int compareValue(BTreeNodePtrBase &node, uint64 pos, const void *val, uint16 vlen)
     {
         const BTreeNodeHeader *np = (const BTreeNodeHeader *) node.body ();
@@ -708,6 +895,49 @@ protected:
         const void *val = node->data+node->nkeys*(uint32)keylen_+pos*(uint32)vallen_;
         return cur.qry_->done(key, keylen_, val, vallen_);
     }
+    uint32 fetchRun (BTreeCursor &cur, char *keys, char *vals, uint32 max, LenT klen) {
+        if (!cur.qry_->stepForward() || !cur.qry_->monotone()) return 0;
+        const BTreeNodeHeader *np = (const BTreeNodeHeader *) cur.body ();
+        uint16 pos = (uint16) cur.pos_ + 1;
+        if (pos >= np->nkeys) return 0;
+        uint32 cnt = min_ (max, (uint32) (np->nkeys - pos));
+        uint64 saved = cur.pos_;
+        cur.pos_ = pos + cnt - 1;
+        if (done (cur)) {
+            // query ends within the run - find first pair ending it
+            uint32 lo = 0, hi = cnt - 1;
+            while (lo < hi) {
+                uint32 mid = (lo + hi) / 2;
+                cur.pos_ = pos + mid;
+                if (done (cur)) hi = mid;
+                else lo = mid + 1;
+            }
+            cnt = lo;
+        }
+        if (0 == cnt) {
+            cur.pos_ = saved;
+            return 0;
+        }
+        const char *src = np->data + pos*(uint32)keylen_;
+        if (keylen_ == klen) {
+            // unique index - keys and values lie in two packed arrays
+            memcpy (keys, src, cnt*klen);
+            if (vals) memcpy (vals, np->data + np->nkeys*(uint32)keylen_ + pos*(uint32)vallen_, cnt*vallen_);
+        } else {
+            // duplicate index - value is the tail of the stored key
+            for (uint32 n = 0; n < cnt; ++n, src += keylen_) {
+                memcpy (keys + n*klen, src, klen);
+                if (vals) memcpy (vals + n*vallen_, src + klen, vallen_);
+            }
+        }
+        cur.pos_ = pos + cnt - 1;
+        if (cur.last_) {
+            cur.version_ = version_;
+            readKey (cur, cur.pos_, cur.last_);
+            readValue (cur, cur.pos_, cur.last_ + cur.lastlen_);
+        }
+        return cnt;
+    }
     bool stepCursor (BTreeCursor &cur, bool remove) {
         // For FixedNodeHandler cur.pos_ is position of pair in node
         // it is 16 bit and equivalent to position of entry
@@ -733,6 +963,7 @@ protected:
                 cur.free ();
                 throw FileStructureCorrupt(cpoint(__LINE__));
             }
+            if (cur.qry_->stepForward() && !remove) readAhead(cur);
             newpos = 0;
         }
         cur.pos_ = cur.qry_->stepForward() ? newpos : ((BTreeNodePtr *)&cur)->nkeys() - 1;
@@ -872,6 +1103,7 @@ protected:
         LogPageNumT pgleft = node.readLeft();
         LogPageNumT pgright = node.readRight();
         LogPageNumT pgcur = node.page();
+        EDB_STAT_RECORD (STAT_BTREE_RECLAIM_LEVEL, node.level());
         if (pgleft > 0) {
             BTreeNodePtr lnode(file_, nodesize_);
             lnode.fetch(pgleft);
@@ -898,6 +1130,7 @@ protected:
             if (pgright <= 0) break; // ??? throw FileStructureCorrupt(cpoint(__LINE__)); 
             node.fetch(pgright);
             chainToFreeList(pgcur);
+            EDB_STAT_RECORD (STAT_BTREE_RECLAIM_LEVEL, node.level());
             ++deleted;
             pgcur = pgright;
             cntNode = countNodePairs(node);
@@ -922,7 +1155,8 @@ protected:
         int n = 0;
         int size = node.nkeys();
         uint64 poscnt;
-        while (n < size && cumul + (poscnt = ReadCount(vals, n)) < count) {
+        // count is zero-based, so child n holds positions [cumul, cumul+poscnt)
+        while (n < size && cumul + (poscnt = ReadCount(vals, n)) <= count) {
             cumul += poscnt; ++n;
         }
         count -= cumul;
@@ -933,6 +1167,14 @@ protected:
         if (count >= node.nkeys()) throw NotFound();
         return count;
     }
+    uint64 boundLeaf (BTreeNodePtr &node, const void *key, LenT klen, const void *val, int match)
+    {
+        const char *keys = node.data();
+        // see DupKeyNodeHandler::searchNode about censoring BTREE_BOTH
+        int m = match;
+        if (klen < truekeylen_) m &= ~BTREE_BOTH;
+        return (findEntry (keys, node.nkeys(), key, klen, val, m) - keys) / keylen_;
+    }
     void incrementCounter(Trace &trace)
     {
         int size = trace.size();
@@ -1140,6 +1382,8 @@ protected:
         // Assign root's level to new nodes
         uint8 level = root.header()->level;
         l.header()->level = r.header()->level = level;
+        EDB_STAT_ADD (STAT_BTREE_ROOT_SPLITS, 1);
+        EDB_STAT_RECORD (STAT_BTREE_SPLIT_LEVEL, level);
 
         // Sibling links
         l.writeRight(r.page());
@@ -1184,7 +1428,7 @@ protected:
         root.mark ();
         return true;
     }
-    bool makeroom (BTreeNodePtr &parent, int nodePos,
+    bool makeroom (BTreeNodePtr &parent, int &nodePos,
         const void *key, LenT klen,
         BTreeNodePtr &node)
     {
@@ -1238,6 +1482,7 @@ protected:
                 count = -count;
                 --nodePos;
             }
+            EDB_STAT_ADD (STAT_BTREE_ROTATIONS, 1);
             rotate (parent, nodePos, count);
             // Find the node where our key now
             // FIXME: change memcmp into keycomp
@@ -1250,6 +1495,7 @@ protected:
             // split for sure
             if (pgs[0] == node.readLeft()) --nodePos;
             uint32 nkeysSum = nkeys+nkeysSib[0];
+            EDB_STAT_RECORD (STAT_BTREE_SPLIT_LEVEL, node.level());
             // First rotate creates new node and move
             // there 2/3 of keys (or 1/3 of sum) from middle node
             // It can fail due to new node creation failure
@@ -1699,17 +1945,35 @@ protected:
     }
     uint64 searchLeafByCount(BTreeNodePtr &node, uint64 count)
     {
-        throw NotFound();
         uint64 cumul = 0;
-        char *vals = getVals(node);
         int n = 0;
         int size = node.nkeys();
         uint32 len;
-        while (n < size && cumul + (len = getEntryLength(node, n)) < count) {
+        while (n < size && cumul + (len = getEntryLength(node, n)) <= count) {
             cumul += len; ++n;
         }
         if (n == size) throw NotFound();
-        return makePos(n, count - cumul);
+        return makePos(n, (uint32) (count - cumul));
+    }
+    uint64 boundLeaf (BTreeNodePtr &node, const void *key, LenT klen, const void *val, int match)
+    {
+        // Expects full length key, see BTree::rank
+        const char *keys = node.data();
+		const char *f = findEntry (keys, node.nkeys (), key, klen, val, match);
+        int entry = (f-keys) / keylen_;
+        // entry is upper bound of range starts, key can fall into preceding range
+        if (entry == 0) return makePos (0, 0);
+        --entry; f -= keylen_;
+		RangeLenT dist = msbdist ((uint8 *) key, (uint8 *) f, keylen_);
+        if (dist >= getEntryLength(node, entry)) return makePos (entry+1, 0);
+        return makePos (entry, (match & BTREE_LAST) ? dist+1 : dist);
+    }
+    void readKey (BTreeNodePtrBase &node, uint64 pos, void *key)
+    {
+        const BTreeNodeHeader *np = (const BTreeNodeHeader *) node.body ();
+        uint32 entry = getEntry (pos);
+        if (entry >= np->nkeys) throw FileStructureCorrupt(cpoint(__LINE__));
+        msbadd ((uint8 *) key, (uint8 *) np->data+entry*(uint32)keylen_, getDist (pos), keylen_);
     }
     bool done (BTreeCursor &cur)
     {
@@ -1719,6 +1983,10 @@ protected:
         readValue(cur, cur.pos_, val);
         return cur.qry_->done(key, keylen_, val, vallen_);
     }
+    // positions are entry/distance pairs, no packed run to copy
+    uint32 fetchRun (BTreeCursor &cur, char *keys, char *vals, uint32 max, LenT klen) {
+        return 0;
+    }
     bool stepCursor (BTreeCursor &cur, bool remove) {
         uint32 entry = getEntry(cur.pos_);
         RangeLenT dist = getDist(cur.pos_);
@@ -1775,6 +2043,7 @@ protected:
                         cur.free ();
                         throw FileStructureCorrupt(cpoint(__LINE__));
                     }
+                    if (!remove) readAhead(cur);
                     entry = 0;
                 }
                 dist = 0;
@@ -1972,6 +2241,7 @@ void BTree::assignHandler ()
 #endif
         }
     }
+    handler_->setReadAhead (readahead_);
 }
 
 /////////////////////////////////////////////////////////////////////
@@ -1988,6 +2258,11 @@ void BTree::prepareMasterPage (BTreeMasterPage &mp)
     mp.rootfreenodeoff = CCBO64(nativeByteOrder_, rootfreenodeoff_);
     mp.flags        = CCBO32(nativeByteOrder_, flags_);
     mp.nodesize     = CCBO32(nativeByteOrder_, nodesize_);
+    mp.bloompage    = CCBO64(nativeByteOrder_, bloompage_);
+    mp.bloompages   = CCBO32(nativeByteOrder_, bloompages_);
+    mp.bloomhashes  = CCBO16(nativeByteOrder_, bloomhashes_);
+    mp.bloomstate   = CCBO16(nativeByteOrder_, BLOOM_CLEAN);
+    mp.bloomremoved = 0;
     mp.keylen       = CCBO16(nativeByteOrder_, keylen_);
     mp.vallen       = CCBO16(nativeByteOrder_, vallen_);
 }
@@ -2013,7 +2288,13 @@ void BTree::prepareNodePage (BTreeNodeHeader &np, uint32 nodesize)
 BTree::BTree ()
 :
 handler_ (0),
-file_ (0)
+file_ (0),
+bloompage_ (0),
+bloompages_ (0),
+bloomhashes_ (0),
+bloomdirty_ (false),
+readahead_ (BTREE_READAHEAD_LEAVES),
+frozen_ (false)
 {
 }
 
@@ -2028,6 +2309,8 @@ bool BTree::attach (BTreeFile &file)
     checkpoint_ = 0;
     if (handler_) detach ();
     file_ = &file;
+    // Replay the write-ahead log, if any, so the file holds the last committed tree
+    if (!file_->checkpoint ()) return false;
     // Read master record and verify it
     BTreeMasterPage *mp =
         (BTreeMasterPage *) file_->fetch (0, 1);
@@ -2066,9 +2349,20 @@ bool BTree::attach (BTreeFile &file)
     // Sanity check - range should have fixed unique key
     if ((flags_ & BTREE_FLAGS_RANGE)
       && ((flags_ & BTREE_FLAGS_VARKEY)
-        || (flags_ & BTREE_FLAGS_DUPLICATE))) return false;
+        || (flags_ & BTREE_FLAGS_DUPLICATE)
+        || (flags_ & BTREE_FLAGS_BLOOM))) return false;
     ++checkpoint_;
+    bloompage_ = CCBO64(nativeByteOrder_, mp->bloompage);
+    bloompages_ = CCBO32(nativeByteOrder_, mp->bloompages);
+    bloomhashes_ = CCBO16(nativeByteOrder_, mp->bloomhashes);
+    bloomdirty_ = false;
+    bool bloomstale = BLOOM_CLEAN != CCBO16(nativeByteOrder_, mp->bloomstate);
+    uint64 bloomremoved = CCBO64(nativeByteOrder_, mp->bloomremoved);
     assignHandler ();
+    // Rebuild filter if we crashed with unflushed modifications, or
+    // if removed keys made it too loose
+    if (bloompages_ && !frozen_ && (bloomstale || 4 * bloomremoved > handler_->count ()))
+        bloomRebuild_ ();
 #if 0 // We now just check that pagesize is compatible with the rest of system
     // At last we can set page size
     file_->setPageSize (nodesize_);
@@ -2083,14 +2377,16 @@ bool BTree::init (BTreeFile &file,
                   LenT vallen,
                   //uint16 pagemult,
                   uint32 flags,
-                  LenT keylen)
+                  LenT keylen,
+                  uint64 bloomkeys)
 {
     checkpoint_ = 0;
     if (handler_) detach ();
     // Sanity check - range should have fixed non-duplicate key
     if ((flags & BTREE_FLAGS_RANGE)
       && ((flags & BTREE_FLAGS_VARKEY)
-        || (flags & BTREE_FLAGS_DUPLICATE))) return false;
+        || (flags & BTREE_FLAGS_DUPLICATE)
+        || (flags & BTREE_FLAGS_BLOOM))) return false;
     ++checkpoint_;
     file_ = &file;
     nativeByteOrder_ = true;
@@ -2113,6 +2409,16 @@ bool BTree::init (BTreeFile &file,
     keylen_ = keylen;
     flags_ = flags;
     vallen_ = vallen;
+    // Bloom filter goes right after master record and root node
+    bloompage_ = bloompages_ = bloomhashes_ = 0;
+    bloomdirty_ = false;
+    if (flags & BTREE_FLAGS_BLOOM) {
+        if (!bloomkeys) bloomkeys = BTREE_BLOOM_DEFAULTKEYS;
+        uint64 pagebits = uint64 (nodesize_) * 8;
+        bloompage_ = 2;
+        bloompages_ = (uint32) ((bloomkeys * BTREE_BLOOM_BITSPERKEY + pagebits - 1) / pagebits);
+        bloomhashes_ = BTREE_BLOOM_HASHES;
+    }
     // We have enough info here to assign node handlers
     assignHandler ();
     // Truncate file
@@ -2130,24 +2436,72 @@ bool BTree::init (BTreeFile &file,
     prepareNodePage (*root, rootnodesize_);
     // Flush master record and root node
     file_->mark (p);
+    // Empty filter
+    for (uint32 n = 0; n < bloompages_; ++n) {
+        char *b = (char *) file_->fake (bloompage_ + n, 1);
+        memset (b, 0, nodesize_);
+        file_->mark (b);
+    }
     return file_->flush ();
 }
 
 /////////////////////////////////////////////////////////////////////
 bool BTree::detach ()
 {
-    bool res = this->flush ();
+    ExclusiveGuard guard (latch_);
+    bool res = flush_ ();
+    if (frozen_) {
+        if (file_) {
+            res = file_->close () && res;
+            delete file_;
+        }
+        frozen_ = false;
+    }
     file_ = 0;
+    bloompage_ = bloompages_ = bloomhashes_ = 0;
 
     delete handler_;
     handler_ = 0;
     return res;
 }
+// The tree on disk is brought up to date while writers are kept out, so
+// the snapshot taken right after sees it whole
+bool BTree::snapshot (BTree &frozen)
+{
+    if (&frozen == this) throw BadParameters(cpoint(__LINE__));
+    BTreeFile *file;
+    {
+        ExclusiveGuard guard (latch_);
+        if (!file_) throw BadParameters(cpoint(__LINE__));
+        if (!flush_ ()) return false;
+        file = &file_->snapshot ();
+    }
+    frozen.detach ();
+    frozen.frozen_ = true;
+    if (!frozen.attach (*file)) {
+        frozen.detach ();
+        return false;
+    }
+    return true;
+}
 
 /////////////////////////////////////////////////////////////////////
 bool BTree::flush  ()
+{
+    ExclusiveGuard guard (latch_);
+    return flush_ ();
+}
+
+bool BTree::flush_ ()
 {
     if (!file_) return true;
+    if (bloomdirty_) {
+        // filter goes to disk together with the tree it covers
+        BTreeMasterPage *mp = (BTreeMasterPage *) file_->fetch (0, 1);
+        mp->bloomstate = CCBO16(nativeByteOrder_, BLOOM_CLEAN);
+        file_->mark (mp);
+        bloomdirty_ = false;
+    }
     return file_->flush ();
 }
 
@@ -2156,12 +2510,28 @@ bool BTree::flush  ()
 void BTree::insert (const void *key, LenT len, const void *val, LenT vlen)
 {
     // FIXME: handler::insert still returns error code
+    ExclusiveGuard guard (latch_);
+    if (frozen_) throw BadParameters(cpoint(__LINE__));
+    if (bloompages_) bloomTouch_ ();
     handler_->insert (key, len, val);
+    if (bloompages_) bloomAdd_ (key);
 }
 
 /////////////////////////////////////////////////////////////////////
 // Start the query
 void BTree::initcursor (BTreeCursor &cur, BTreeQueryBase &qry, uint64 pos)
+{
+    initcursor_ (cur, qry, pos);
+    // buffer for remembering last fetched pair
+    if (!cur.last_ || cur.lastlen_ != keylen_) {
+        delete [] cur.last_;
+        cur.last_ = new char [keylen_ + vallen_];
+        cur.lastlen_ = keylen_;
+    }
+}
+
+// Cursor without revalidation buffer, for one-shot internal use
+void BTree::initcursor_ (BTreeCursor &cur, BTreeQueryBase &qry, uint64 pos)
 {
     if (!(flags_ & BTREE_FLAGS_VARKEY) && qry.len() > keylen_) throw BadParameters(cpoint(__LINE__));
     // Emulate BTreeNodePtrBase constructor, blocked by BTreeCursor's redefinition
@@ -2172,6 +2542,8 @@ void BTree::initcursor (BTreeCursor &cur, BTreeQueryBase &qry, uint64 pos)
     // Cursor's fields
     cur.qry_    = &qry;
     cur.fInit_  = true;
+    cur.ahead_  = 0;
+    cur.parent_ = (LogPageNumT) -1;
 }
 
 /////////////////////////////////////////////////////////////////////
@@ -2190,31 +2562,256 @@ bool BTree::fetch (BTreeCursor &cur, const void *&key, LenT &len, void *val, Len
 {
     if (!cur.fInit_ || vlen < vallen_) throw BadParameters(cpoint(__LINE__, cur.fInit_ ? "vlen < vallen_" : "cursor not initialized"));
     vlen = vallen_;
+    SharedGuard guard (latch_);
     return handler_->fetch (cur, key, len, val);
 }
 
+/////////////////////////////////////////////////////////////////////
+uint32 BTree::fetchBatch (BTreeCursor &cur, void *keybuf, void *valbuf, uint32 maxRows)
+{
+    if (!cur.fInit_ || !keybuf) throw BadParameters(cpoint(__LINE__, cur.fInit_ ? "no key buffer" : "cursor not initialized"));
+    if (flags_ & BTREE_FLAGS_VARKEY) throw BadParameters(cpoint(__LINE__, "variable key index"));
+    SharedGuard guard (latch_);
+    return handler_->fetchBatch (cur, (char *) keybuf, (char *) valbuf, maxRows, keylen_);
+}
+
 /////////////////////////////////////////////////////////////////////
 // Remove all key-value pairs, satisfying the query
 uint64 BTree::remove(BTreeCursor &cur)
 {
     if (!cur.fInit_) throw BadParameters(cpoint(__LINE__));
-    return handler_->remove(cur);
+    ExclusiveGuard guard (latch_);
+    if (frozen_) throw BadParameters(cpoint(__LINE__));
+    if (bloompages_) bloomTouch_ ();
+    uint64 cnt = handler_->remove(cur);
+    if (bloompages_ && cnt) {
+        // removed keys stay in filter until it is rebuilt
+        BTreeMasterPage *mp = (BTreeMasterPage *) file_->fetch (0, 1);
+        mp->bloomremoved = CCBO64(nativeByteOrder_, CCBO64(nativeByteOrder_, mp->bloomremoved) + cnt);
+        file_->mark (mp);
+    }
+    return cnt;
 }
 
 uint64 BTree::getpos(const void *key, LenT len, const void *val, LenT vlen, int match)
 {
+    SharedGuard guard (latch_);
     return handler_->getpos(key, len, val, vlen, match);
 }
 
+/////////////////////////////////////////////////////////////////////
+// Order statistics
+uint64 BTree::count ()
+{
+    SharedGuard guard (latch_);
+    return handler_->count ();
+}
+
+/////////////////////////////////////////////////////////////////////
+uint64 BTree::rank (const void *key, LenT len, const void *val, LenT vlen, int match)
+{
+    SharedGuard guard (latch_);
+    return rank_ (key, len, val, vlen, match);
+}
+
+uint64 BTree::rank_ (const void *key, LenT len, const void *val, LenT vlen, int match)
+{
+    if (!(flags_ & BTREE_FLAGS_VARKEY) && (match & BTREE_PARTIAL) && len < keylen_) {
+        // Complete prefix to full key - zeros give lower bound of the prefix,
+        // 0xff upper one. Range handler can compare only full length keys.
+        char *k = (char *) alloca (keylen_);
+        memcpy (k, key, len);
+        memset (k+len, (match & BTREE_LAST) ? 0xff : 0, keylen_-len);
+        key = k;
+        len = keylen_;
+    }
+    return handler_->rank (key, len, val, match);
+}
+
+/////////////////////////////////////////////////////////////////////
+void BTree::select (uint64 pos, void *key, LenT &klen, void *val, LenT &vlen)
+{
+    if (klen < keylen_ || vlen < vallen_) throw BadParameters(cpoint(__LINE__, klen < keylen_ ? "klen < keylen_" : "vlen < vallen_"));
+    klen = keylen_;
+    vlen = vallen_;
+    SharedGuard guard (latch_);
+    handler_->select (pos, key, val);
+}
+
+/////////////////////////////////////////////////////////////////////
+uint64 BTree::countRange (const void *lo, LenT lolen, const void *hi, LenT hilen, int match)
+{
+    SharedGuard guard (latch_);
+    uint64 l = rank_ (lo, lolen, 0, 0, match & ~BTREE_LAST);
+    uint64 h = rank_ (hi, hilen, 0, 0, match);
+    return h > l ? h - l : 0;
+}
+
+/////////////////////////////////////////////////////////////////////
+// xorshift64* - good enough for sampling, and does not depend on RAND_MAX
+static inline uint64 nextRandom (uint64 &state)
+{
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 2685821657736338717ULL;
+}
+
+uint64 BTree::sample (uint64 k, BTreeSampleSink &sink, uint64 seed)
+{
+    SharedGuard guard (latch_);
+    uint64 n = handler_->count ();
+    if (k > n) k = n;
+    // Floyd's algorithm - k distinct positions out of n in k steps,
+    // set keeps them ordered so descents go left to right
+    std::set<uint64> chosen;
+    uint64 state = seed ? seed : 0x9e3779b97f4a7c15ULL;
+    for (uint64 j = n - k; j < n; ++j) {
+        uint64 t = nextRandom (state) % (j + 1);
+        if (!chosen.insert (t).second) chosen.insert (j);
+    }
+    char *key = (char *) alloca (keylen_);
+    char *val = (char *) alloca (vallen_);
+    for (std::set<uint64>::iterator i = chosen.begin (); i != chosen.end (); ++i) {
+        handler_->select (*i, key, val);
+        sink.take (*i, key, keylen_, val, vallen_);
+    }
+    return k;
+}
+
 /////////////////////////////////////////////////////////////////////
 void BTree::find (const void *key, LenT len, void *val, LenT &vlen, int match)
 {
+    if (!(match & BTREE_PARTIAL) && !mayContain (key, len)) throw NotFound();
     BTreeQueryBase qry(match, true, key, len, val, vlen);
     BTreeCursor cur;
-    initcursor(cur, qry);
+    initcursor_(cur, qry);
     if (!fetch(cur, val, vlen)) throw NotFound();
 }
 
+/////////////////////////////////////////////////////////////////////
+void BTree::setReadAhead (uint32 leaves)
+{
+    ExclusiveGuard guard (latch_);
+    readahead_ = leaves;
+    if (handler_) handler_->setReadAhead (leaves);
+}
+
+/////////////////////////////////////////////////////////////////////
+// Bloom filter
+/////////////////////////////////////////////////////////////////////
+
+// Query running through all pairs, for use with positioned cursor
+class ScanAllQuery : public BTreeQueryBase
+{
+public:
+    ScanAllQuery () : BTreeQueryBase (BTREE_PARTIAL, true, 0, 0)
+    {}
+    bool done (const void *key, LenT len, const void *val, LenT vlen)
+    {
+        return false;
+    }
+} ;
+
+// FNV-1a over the key, spread with splitmix64 finalizer. h1 selects
+// filter page, h2 gives start and step of probes within the page.
+static inline uint64 bloomMix (uint64 h)
+{
+    h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27; h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+static inline void bloomHash (const void *key, LenT len, uint64 &h1, uint64 &h2)
+{
+    const uint8 *p = (const uint8 *) key;
+    uint64 h = 0xcbf29ce484222325ULL;
+    for (LenT n = 0; n < len; ++n) {
+        h ^= p[n];
+        h *= 0x100000001b3ULL;
+    }
+    h1 = bloomMix (h);
+    h2 = bloomMix (h1 ^ 0x9e3779b97f4a7c15ULL);
+}
+
+bool BTree::mayContain (const void *key, LenT len)
+{
+    if (!bloompages_ || len != keylen_) return true;
+    SharedGuard guard (latch_);
+    return bloomTest_ (key);
+}
+
+// Filter state on disk goes DIRTY before the first change it does not
+// cover yet, so that crash in between is noticed by attach
+void BTree::bloomTouch_ ()
+{
+    if (bloomdirty_) return;
+    BTreeMasterPage *mp = (BTreeMasterPage *) file_->fetch (0, 1);
+    mp->bloomstate = CCBO16(nativeByteOrder_, BLOOM_DIRTY);
+    file_->mark (mp);
+    file_->flush ();
+    bloomdirty_ = true;
+}
+
+void BTree::bloomAdd_ (const void *key)
+{
+    uint64 h1, h2;
+    bloomHash (key, keylen_, h1, h2);
+    uint8 *bits = (uint8 *) file_->fetch (bloompage_ + h1 % bloompages_, 1, true);
+    uint32 nbits = nodesize_ * 8;
+    uint64 step = (h2 >> 32) | 1;
+    for (uint16 n = 0; n < bloomhashes_; ++n, h2 += step) {
+        uint32 b = (uint32) (h2 % nbits);
+        bits[b >> 3] |= (uint8) (1 << (b & 7));
+    }
+    file_->mark (bits);
+    file_->unlock (bits);
+}
+
+bool BTree::bloomTest_ (const void *key)
+{
+    uint64 h1, h2;
+    bloomHash (key, keylen_, h1, h2);
+    // locked, so that concurrent reader can not displace the page
+    const uint8 *bits = (const uint8 *) file_->fetch (bloompage_ + h1 % bloompages_, 1, true);
+    uint32 nbits = nodesize_ * 8;
+    uint64 step = (h2 >> 32) | 1;
+    bool res = true;
+    for (uint16 n = 0; n < bloomhashes_ && res; ++n, h2 += step) {
+        uint32 b = (uint32) (h2 % nbits);
+        res = 0 != (bits[b >> 3] & (1 << (b & 7)));
+    }
+    file_->unlock (bits);
+    return res;
+}
+
+void BTree::bloomRebuild_ ()
+{
+    for (uint32 n = 0; n < bloompages_; ++n) {
+        char *b = (char *) file_->fake (bloompage_ + n, 1);
+        memset (b, 0, nodesize_);
+        file_->mark (b);
+    }
+    if (handler_->count ()) {
+        ScanAllQuery qry;
+        BTreeCursor cur;
+        initcursor_ (cur, qry, 0);
+        const void *key;
+        LenT klen = 0;
+        void *val = alloca (vallen_);
+        LenT vlen = vallen_;
+        while (fetch (cur, key, klen, val, vlen))
+            bloomAdd_ (key);
+    }
+    BTreeMasterPage *mp = (BTreeMasterPage *) file_->fetch (0, 1);
+    mp->bloomstate = CCBO16(nativeByteOrder_, BLOOM_CLEAN);
+    mp->bloomremoved = 0;
+    file_->mark (mp);
+    file_->flush ();
+    bloomdirty_ = false;
+}
+
 /////////////////////////////////////////////////////////////////////
 // BTreeCursor
 /////////////////////////////////////////////////////////////////////
@@ -2224,13 +2821,20 @@ BTreeCursor::BTreeCursor ()
     :
     BTreeNodePtrBase (0, 0),
     qry_    (0),
-    fInit_  (false)
+    fInit_  (false),
+    version_ (0),
+    last_   (0),
+    lastlen_ (0),
+    ahead_  (0),
+    parent_ ((LogPageNumT) -1),
+    child_  (0)
 {
 }
 
 /////////////////////////////////////////////////////////////////////
 BTreeCursor::~BTreeCursor ()
 {
+    delete [] last_;
 }
 
 } ; // namespace edb
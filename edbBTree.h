@@ -28,6 +28,23 @@
 // So in multi-threaded setup to provide user with guarantee
 // that memory does not change between calls, this should be
 // somehow reflected in underlying caching interface.
+//
+// BTree may be shared between threads. Readers (find, fetch, getpos
+// and order statistics) run in parallel under shared latch, writers
+// (insert, remove) take it exclusively. Writers can not go in parallel
+// anyway: every insert or remove updates pair counts all the way up
+// to the root. A cursor does not hold the latch between fetches;
+// instead it remembers the last pair returned and tree version, and
+// if a writer intervened, finds its place again from the root.
+// Cursor itself should not be shared between threads. The nodes
+// found in the pager come without its mutex (see Pager_imp::fetch),
+// so the readers meet only on the latch and on the nodes they share.
+//
+// Long scans that should not see (nor wait for) writers go over a
+// snapshot: BTree::snapshot attaches another BTree object to the tree
+// frozen as of the call. It has a latch of its own, so its readers
+// never meet the writers of the live tree. The file needs the shadow
+// set (see PagedFile::setShadow) to keep the pages the snapshot sees.
 
 
 
@@ -37,6 +54,7 @@
 
 #include "edbTypes.h"
 #include "edbExceptions.h"
+#include "edbLatch.h"
 
 // TODO: Parameterize over PagedFile
 #include "edbPagedFile.h"
@@ -89,10 +107,19 @@ const uint32 BTREE_FLAGS_DUPLICATE = 0x00000001;
 const uint32 BTREE_FLAGS_VARKEY = 0x00000002;
 // Does it support key range
 const uint32 BTREE_FLAGS_RANGE  = 0x00000004;
+// Keep bloom filter over keys to answer find for absent key without
+// descending the tree. Not available for range index.
+const uint32 BTREE_FLAGS_BLOOM  = 0x00000008;
 
 // B-tree parameters
 const uint32 BTREE_MINPAGESIZE = 1024;
 const uint16 BTREE_DEFAULTPAGEMULT = 8;
+// Bloom filter sizing - about 1% of false positives at capacity
+const uint64 BTREE_BLOOM_DEFAULTKEYS = 0x100000;
+const uint32 BTREE_BLOOM_BITSPERKEY = 10;
+const uint16 BTREE_BLOOM_HASHES = 7;
+// Number of leaves read ahead by forward cursor scan, 0 turns it off
+const uint32 BTREE_READAHEAD_LEAVES = 16;
 
 // Logical page number
 typedef uint64 LogPageNumT;
@@ -133,6 +160,10 @@ public:
         // One element
         return true;
     }
+    // true if done, once it returned true, stays true for all pairs further
+    // in the direction of movement, like key range limits do. Lets batched
+    // fetch test only the last pair of a run instead of every pair.
+    virtual bool monotone () const { return false; }
 protected:
     friend class BTreeNodeHandler; // remote friendship!
     friend class BTree;
@@ -223,11 +254,28 @@ public:
     uint64          pos_;
     BTreeQueryBase *qry_;
     bool            fInit_;
+    // state for revalidation after concurrent modification
+    uint64          version_;  // tree version at last fetch
+    char           *last_;     // last fetched key followed by value
+    LenT            lastlen_;  // key part length in last_
+    // state of read-ahead in forward scans
+    uint32          ahead_;    // leaves already asked for beyond the cursor
+    LogPageNumT     parent_;   // node they come from, (LogPageNumT) -1 if not known
+    int             child_;    // position of its next child to ask for
 private:
     BTreeCursor (const BTreeCursor &);
     BTreeCursor &operator= (const BTreeCursor &);
 } ; // class BTreeCursor 
 
+// Receiver for entries delivered by BTree::sample. Key and value
+// pointers are valid only during the call.
+class BTreeSampleSink
+{
+public:
+    virtual ~BTreeSampleSink () {}
+    virtual void take (uint64 pos, const void *key, LenT len, const void *val, LenT vlen) = 0;
+} ; // class BTreeSampleSink
+
 
 struct BTreeNodeHeader;
 struct BTreeMasterPage;
@@ -243,11 +291,17 @@ public:
         LenT   vallen,
         //uint16 pagemult=BTREE_DEFAULTPAGEMULT, // how large is the page in 1024 byte chunks
         uint32 flags=BTREE_FLAGS_VARKEY,
-        LenT   keylen=0);
+        LenT   keylen=0,
+        uint64 bloomkeys=0); // expected number of keys, for BTREE_FLAGS_BLOOM only
     // Detach file, flushing all pending buffers
     bool detach ();
     // Flush memory structures to file
     bool flush  ();
+    // Attach frozen to the snapshot of this index as it is now. Frozen
+    // is read only, insert and remove throw BadParameters; its detach
+    // releases the snapshot
+    bool snapshot (BTree &frozen);
+    bool isFrozen () const { return frozen_; }
     // Insert new entry
     void insert (const void *key, LenT len, const void *val, LenT vlen);
     // Start the query. If pos is absent - use qry for finding first element
@@ -258,11 +312,32 @@ public:
     bool fetch (BTreeCursor &cur, void *val, /*inout*/ LenT &vlen);
     // Fetch key and value by cursor
     bool fetch (BTreeCursor &cur, const void *&key, /*inout*/ LenT &klen, void *val, /*inout*/ LenT &vlen);
+    // Fetch up to maxRows pairs by cursor at once. Keys are packed into keybuf
+    // at keySize () stride and values into valbuf at valSize () stride, valbuf
+    // may be 0. Returns number of pairs fetched, less than maxRows only when
+    // the query is over. Fixed key index only.
+    uint32 fetchBatch (BTreeCursor &cur, void *keybuf, void *valbuf, uint32 maxRows);
     // Remove all key-value pairs, satisfying the query
     uint64 remove (BTreeCursor &cur);
 	// return position for entry, designated by cursor
 	uint64 getpos (const void *key, LenT len, const void *val, LenT vlen, int match);
     //
+    // Order statistics, all based on subtree pair counts kept in inner nodes,
+    // so each call costs one root-to-leaf descent.
+    // Total number of key/value pairs in index
+    uint64 count ();
+    // Number of pairs preceding key (lower bound). With BTREE_LAST in match
+    // pairs equal to key are counted as well (upper bound).
+    uint64 rank (const void *key, LenT len, const void *val = 0, LenT vlen = 0, int match = BTREE_PARTIAL);
+    // Copy out key and value of pair at zero-based position pos,
+    // throws NotFound if pos >= count ()
+    void select (uint64 pos, void *key, /*inout*/ LenT &klen, void *val, /*inout*/ LenT &vlen);
+    // Number of pairs with lo <= key < hi; BTREE_LAST in match makes hi inclusive
+    uint64 countRange (const void *lo, LenT lolen, const void *hi, LenT hilen, int match = BTREE_PARTIAL);
+    // Deliver k pairs chosen uniformly at random without replacement,
+    // in key order. Returns number of pairs delivered (min (k, count ()))
+    uint64 sample (uint64 k, BTreeSampleSink &sink, uint64 seed = 0);
+    //
     //
     // Obsolete but still handy
     // Find entry with given key
@@ -276,6 +351,11 @@ public:
 	bool isUnique () const { return 0 == (flags_ & BTREE_FLAGS_DUPLICATE); }
 	bool isVarkey () const { return 0 != (flags_ & BTREE_FLAGS_VARKEY); }
 	bool isRange () const  { return 0 != (flags_ & BTREE_FLAGS_RANGE); }
+	bool hasBloom () const { return 0 != bloompages_; }
+    // false if key is definitely absent; always true for index without filter
+    bool mayContain (const void *key, LenT len);
+    // How many leaves forward scans request from pager in one go
+    void setReadAhead (uint32 leaves);
 
 	BTreeFile* getFile () { return file_; }
 
@@ -295,10 +375,25 @@ protected:
     LenT keylen_;            // length of the key
     LenT vallen_;            // length of payload value
     int  checkpoint_;        // for error tracing
+    RWLatch latch_;          // shared for readers, exclusive for writers
+    // Bloom filter, lives in a row of pages right after the root node
+    uint64 bloompage_;       // first page of filter
+    uint32 bloompages_;      // number of filter pages, 0 if there is no filter
+    uint16 bloomhashes_;     // number of probes per key
+    bool   bloomdirty_;      // filter on disk may lag behind the tree
+    uint32 readahead_;       // leaves to read ahead in forward scans
+    bool   frozen_;          // attached to a snapshot it owns
 private:
     void assignHandler ();
     void prepareMasterPage (BTreeMasterPage &mp);
     void prepareNodePage (BTreeNodeHeader &np, uint32 nodesize);
+    void initcursor_ (BTreeCursor &cur, BTreeQueryBase &qry, uint64 pos = (uint64) -1);
+    bool flush_ ();
+    void bloomTouch_ ();
+    void bloomAdd_ (const void *key);
+    bool bloomTest_ (const void *key);
+    void bloomRebuild_ ();
+    uint64 rank_ (const void *key, LenT len, const void *val, LenT vlen, int match);
 } ; // class BTree
 
 } ; // namespace edb
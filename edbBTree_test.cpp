@@ -16,8 +16,13 @@
 #include <time.h>
 //#include <stdio.h>
 #include <list>
+#include <vector>
 #include "edbSplitFileFactory.h"
 #include "edbPagedFileFactory.h"
+#include "edbWalFactory.h"
+#include "edbThePagerMgr.h"
+#include "edbPager.h"
+#include "edbStats.h"
 #include "portability.h"
 #include <cstring>
 #include <iostream>
@@ -284,6 +289,7 @@ public:
     {
         return memcmp(key_, key, len_) != 0;
     }
+    bool monotone() const { return true; }
 } ;
 
 class UntilTheEnd : public BTreeQueryBase
@@ -295,6 +301,7 @@ public:
     {
         return false;
     }
+    bool monotone() const { return true; }
 } ;
 
 class NKeys : public BTreeQueryBase
@@ -355,10 +362,11 @@ bool testRemove(BTree &bt, uint32 flags, uint64 overstep)
     uint64 pos = bt.getpos(endKey, sizeof(endKey), 0, 0, BTREE_EXACT);
     // printf("Pos: %I64d\n", pos);
     std::cerr << "Pos: " << pos << std::endl;
-    NKeys qry(myKey, sizeof(myKey),101);
+    const uint64 cnt = 101;
+    NKeys qry(myKey, sizeof(myKey), cnt);
     BTreeCursor cur;
     bt.initcursor(cur, qry);
-    int res;
+    uint64 res;
     res = bt.remove(cur);
     time_t tlps = time (0) - tbeg;
     // printf ("Remove result is %d\nElasped %d\n", res, tlps);
@@ -366,7 +374,126 @@ bool testRemove(BTree &bt, uint32 flags, uint64 overstep)
     pos = bt.getpos(endKey, sizeof(endKey), 0, 0, BTREE_EXACT);
     // printf("Pos: %I64d\n", pos);
     std::cerr << "Pos: " << pos << std::endl;
-    return BTREE_OK == res;
+    // remove gives number of pairs removed
+    return cnt == res;
+}
+
+// Runs the query by fetch and by fetchBatch and compares results
+static bool batchScan (BTree &bt, BTreeQueryBase &qry1, BTreeQueryBase &qry2, uint64 &cnt, bool timing)
+{
+    const uint32 rows = 1024;
+    static uint64 keys[rows], vals[rows];
+    std::vector<uint64> one;
+    clock_t tbeg = clock ();
+    BTreeCursor cur;
+    bt.initcursor (cur, qry1);
+    const void *key;
+    uint64 val;
+    LenT klen = 0, vlen = sizeof (val);
+    while (bt.fetch (cur, key, klen, &val, vlen)) {
+        // fetch gives first key of entry for range index, compare values only
+        one.push_back (bt.isRange () ? 0 : *(const uint64 *) key);
+        one.push_back (val);
+    }
+    clock_t tone = clock () - tbeg;
+    tbeg = clock ();
+    BTreeCursor bcur;
+    bt.initcursor (bcur, qry2);
+    bool succ = true;
+    uint32 got;
+    cnt = 0;
+    do {
+        got = bt.fetchBatch (bcur, keys, vals, rows);
+        for (uint32 n = 0; n < got && succ; ++n, ++cnt)
+            succ = 2*cnt+1 < one.size () && (bt.isRange () || one[2*cnt] == keys[n]) && one[2*cnt+1] == vals[n];
+    } while (succ && got == rows);
+    clock_t tbatch = clock () - tbeg;
+    if (timing)
+        std::cerr << "Fetched " << cnt << ", by pair " << tone * 1000 / CLOCKS_PER_SEC
+            << " ms, by batch " << tbatch * 1000 / CLOCKS_PER_SEC << " ms" << std::endl;
+    return succ && 2*cnt == one.size ();
+}
+
+bool testBatch (BTree &bt, uint32 flags, uint64 overstep)
+{
+    const char myKey[] = {0,0,0,0,0,0,0,0};
+    // 7 bytes taken as prefix; the buffer holds a full key, as range
+    // index reads whole key length from the query key
+    const char prefix[] = {0,0,0,0,0,0,1,0};
+    const LenT prefixLen = 7;
+    uint64 cnt;
+    UntilTheEnd all1 (myKey, sizeof (myKey)), all2 (myKey, sizeof (myKey));
+    bool succ = batchScan (bt, all1, all2, cnt, true);
+    // query ending in the middle of a leaf
+    WhileSameKey same1 (prefix, prefixLen), same2 (prefix, prefixLen);
+    succ = succ && batchScan (bt, same1, same2, cnt, false) && cnt > 0;
+    // query which can not be checked per run
+    NKeys n1 (myKey, sizeof (myKey), 3000), n2 (myKey, sizeof (myKey), 3000);
+    succ = succ && batchScan (bt, n1, n2, cnt, false) && cnt == 3000;
+    if (!succ) std::cerr << "Batch fetch mismatch" << std::endl;
+    return succ;
+}
+
+class CountingSink : public BTreeSampleSink
+{
+public:
+    CountingSink() : cnt_(0), last_(0), ordered_(true)
+    {}
+    void take(uint64 pos, const void *key, LenT len, const void *val, LenT vlen)
+    {
+        if (cnt_ && pos <= last_) ordered_ = false;
+        last_ = pos;
+        ++cnt_;
+    }
+    uint64 cnt_;
+    uint64 last_;
+    bool ordered_;
+} ;
+
+bool testRank (BTree &bt, uint32 flags, uint64 overstep)
+{
+    bool failed = false;
+    time_t tbeg = time (0);
+    // duplicate index holds two pairs per key
+    uint64 keymul = (BTREE_FLAGS_DUPLICATE == flags) ? 2 : 1;
+    uint64 lim1 = lim / keymul;
+    uint64 total = bt.count ();
+    if (total != lim) {
+        std::cerr << "count mismatch " << total << std::endl;
+        failed = true;
+    }
+    uint64 i;
+    uint64 n = 0;
+    for (i = 0; i < lim1; i += 97, ++n) {
+        uint64 key = msb64 (i);
+        uint64 lower = bt.rank (&key, sizeof (key));
+        uint64 upper = bt.rank (&key, sizeof (key), 0, 0, BTREE_PARTIAL | BTREE_LAST);
+        uint64 skey, val;
+        LenT klen = sizeof (skey), vlen = sizeof (val);
+        bt.select (i*keymul, &skey, klen, &val, vlen);
+        if (lower != i*keymul || upper != (i+1)*keymul || msb64 (skey) != i) {
+            if (!failed)
+                std::cerr << "rank/select mismatch at " << i << ": " << lower << ", " << upper << ", " << msb64 (skey) << std::endl;
+            failed = true;
+        }
+    }
+    // key range and prefix (7 of 8 bytes cover 256 consecutive keys)
+    uint64 lo = msb64 (lim1/4), hi = msb64 (lim1/2);
+    uint64 cnt = bt.countRange (&lo, sizeof (lo), &hi, sizeof (hi));
+    uint64 pfx = msb64 (lim1/3);
+    uint64 pcnt = bt.countRange (&pfx, sizeof (pfx)-1, &pfx, sizeof (pfx)-1, BTREE_PARTIAL | BTREE_LAST);
+    if (cnt != (lim1/2 - lim1/4)*keymul || pcnt != 256*keymul) {
+        std::cerr << "countRange mismatch " << cnt << ", prefix " << pcnt << std::endl;
+        failed = true;
+    }
+    CountingSink sink;
+    uint64 got = bt.sample (1000, sink);
+    if (got != 1000 || sink.cnt_ != got || !sink.ordered_) {
+        std::cerr << "sample failed, got " << got << ", delivered " << sink.cnt_ << std::endl;
+        failed = true;
+    }
+    std::cerr << n << " rank/select, elapsed " << time(0)-tbeg << std::endl;
+    return !failed;
 }
 
 bool testDriver (const char *testName, uint32 flags)
@@ -388,12 +515,16 @@ bool testDriver (const char *testName, uint32 flags)
     if (bt.init (bf, sizeof (uint64), flags, sizeof (uint64))) {
         succ = succ && testInsert(bt, flags, overstep);
         succ = succ && testSelect(bt, flags, overstep);
+        succ = succ && testRank(bt, flags, overstep);
         succ = succ && testCursor(bt, flags, overstep);
+        succ = succ && testBatch(bt, flags, overstep);
         succ = succ && testRemove(bt, flags, overstep);
         testSelect(bt, flags, overstep);
     } else {
         std::cerr << "Can not init btree over file, checkpoint " << bt.getCheckPoint() << std::endl;
+        succ = false;
     }
+    std::cerr << testName << (succ ? " OK" : " FAILED") << std::endl;
     
 
     // Close files
@@ -406,6 +537,752 @@ bool testDriver (const char *testName, uint32 flags)
     return succ;
 }
 
+// Point lookups with mostly absent keys, on a pool too small to hold
+// the index: filter should save most of the page reads
+const uint64 cBloomKeys = 200000L;
+const uint64 cBloomLookups = 200000L;
+const uint32 cBloomPool = 64;
+
+static bool bloomLookups (const char *title, BTree &bt, uint64 &found)
+{
+    Pager &pager = thePagerMgr ().getPager ();
+    uint64 misses = pager.getMissesCount ();
+    clock_t tbeg = clock ();
+    uint64 state = 1;
+    found = 0;
+    for (uint64 n = 0; n < cBloomLookups; ++n) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        uint64 r = state >> 33;
+        // 90% odd (absent) keys, 10% even (present) keys
+        uint64 i = (r >> 7) % cBloomKeys;
+        uint64 key = msb64 ((r % 10) ? i * 2 + 1 : i * 2), val;
+        LenT vlen = sizeof (val);
+        try {
+            bt.find (&key, sizeof (key), &val, vlen);
+            if (val != key) {
+                thePagerMgr ().releasePager ();
+                return false;
+            }
+            ++found;
+        }
+        catch (NotFound &) {}
+    }
+    std::cerr << title << ": " << found << " found, "
+        << pager.getMissesCount () - misses << " page misses, "
+        << (clock () - tbeg) * 1000 / CLOCKS_PER_SEC << " ms" << std::endl;
+    thePagerMgr ().releasePager ();
+    return true;
+}
+
+bool testBloom ()
+{
+    std::cerr << "Bloom" << std::endl;
+    if (splitFileFactory.exists (TSTDIR, TSTNAME))
+        splitFileFactory.erase (TSTDIR, TSTNAME);
+    if (splitFileFactory.exists (TSTDIR, TSTNAME2))
+        splitFileFactory.erase (TSTDIR, TSTNAME2);
+    BTreeFile& bf = pagedFileFactory.wrap (splitFileFactory.create (TSTDIR, TSTNAME));
+    BTreeFile& pf = pagedFileFactory.wrap (splitFileFactory.create (TSTDIR, TSTNAME2));
+    BTree bt, pt;
+    bool succ = bt.init (bf, sizeof (uint64), BTREE_FLAGS_UNIQUE | BTREE_FLAGS_BLOOM, sizeof (uint64), cBloomKeys)
+        && pt.init (pf, sizeof (uint64), BTREE_FLAGS_UNIQUE, sizeof (uint64))
+        && bt.hasBloom () && !pt.hasBloom ();
+    uint64 i;
+    for (i = 0; succ && i < cBloomKeys; ++i) {
+        uint64 key = msb64 (i * 2);
+        bt.insert (&key, sizeof (key), &key, sizeof (key));
+        pt.insert (&key, sizeof (key), &key, sizeof (key));
+    }
+    // No false negatives, and false positive rate close to design
+    uint64 fp = 0;
+    for (i = 0; succ && i < cBloomKeys; ++i) {
+        uint64 key = msb64 (i * 2);
+        if (!bt.mayContain (&key, sizeof (key))) {
+            std::cerr << "false negative at " << i * 2 << std::endl;
+            succ = false;
+        }
+        key = msb64 (i * 2 + 1);
+        if (bt.mayContain (&key, sizeof (key))) ++fp;
+    }
+    std::cerr << "false positive rate " << (fp * 100.0) / cBloomKeys << "%" << std::endl;
+    if (fp * 50 > cBloomKeys) succ = false;
+    bt.flush ();
+    pt.flush ();
+
+    Pager &pager = thePagerMgr ().getPager ();
+    uint32 poolsize = pager.getPoolSize ();
+    pager.setPoolSize (cBloomPool);
+    uint64 withBloom = 0, without = 0;
+    succ = succ && bloomLookups ("with filter", bt, withBloom)
+        && bloomLookups ("without filter", pt, without)
+        && withBloom == without;
+    pager.setPoolSize (poolsize);
+    thePagerMgr ().releasePager ();
+
+    // Filter survives reattach; removed keys are still reported absent by the tree
+    bt.detach ();
+    succ = succ && bt.attach (bf) && bt.hasBloom ();
+    for (i = 0; succ && i < cBloomKeys; i += 2) {
+        uint64 key = msb64 (i * 2);
+        if (!bt.mayContain (&key, sizeof (key))) succ = false;
+        NKeys qry (&key, sizeof (key), 1);
+        BTreeCursor cur;
+        bt.initcursor (cur, qry);
+        if (1 != bt.remove (cur)) succ = false;
+    }
+    bt.detach ();
+    // more than a quarter removed - filter is rebuilt on attach
+    succ = succ && bt.attach (bf) && bt.count () == cBloomKeys / 2;
+    for (i = 0; succ && i < cBloomKeys; ++i) {
+        uint64 key = msb64 (i * 2), val;
+        LenT vlen = sizeof (val);
+        bool present = true;
+        try { bt.find (&key, sizeof (key), &val, vlen); }
+        catch (NotFound &) { present = false; }
+        if (present != (i & 1) || (present && !bt.mayContain (&key, sizeof (key)))) succ = false;
+    }
+    std::cerr << (succ ? "Bloom OK" : "Bloom FAILED") << std::endl;
+    bt.detach ();
+    pt.detach ();
+    bf.close ();
+    pf.close ();
+    if (splitFileFactory.exists (TSTDIR, TSTNAME))
+        splitFileFactory.erase (TSTDIR, TSTNAME);
+    if (splitFileFactory.exists (TSTDIR, TSTNAME2))
+        splitFileFactory.erase (TSTDIR, TSTNAME2);
+    return succ;
+}
+
+// Full forward scan starting with empty pager pool, with and without
+// leaf read-ahead. Keys are inserted in scattered order, so that leaves
+// do not lie in a row in the file and the system can not read them ahead
+// by itself
+const uint64 cScanKeys = 1000000L;
+const LenT cScanVal = 56;
+
+static bool coldScan (BTree &bt, uint32 readahead)
+{
+    Pager &pager = thePagerMgr ().getPager ();
+    // re-initializing pool drops all cached pages
+    uint32 poolsize = pager.getPoolSize ();
+    pager.setPoolSize (poolsize / 2);
+    pager.setPoolSize (poolsize);
+    bt.setReadAhead (readahead);
+    uint64 misses = pager.getMissesCount ();
+    StatsSnapshot *snap = new StatsSnapshot;
+    statsSnapshot (*snap);
+    uint64 syscalls = snap->counter (STAT_FILE_SYSCALLS);
+    clock_t tbeg = clock ();
+    const char startKey[] = {0,0,0,0,0,0,0,0};
+    UntilTheEnd qry (startKey, sizeof (startKey));
+    BTreeCursor cur;
+    bt.initcursor (cur, qry);
+    const void *key;
+    LenT klen = 0;
+    char val [cScanVal];
+    LenT vlen = sizeof (val);
+    uint64 cnt = 0;
+    bool succ = true;
+    while (bt.fetch (cur, key, klen, val, vlen)) {
+        if (msb64 ((const char *) key) != cnt) succ = false;
+        ++cnt;
+    }
+    clock_t tend = clock ();
+    statsSnapshot (*snap);
+    std::cerr << "read-ahead " << readahead << ": " << cnt << " pairs, "
+        << pager.getMissesCount () - misses << " page reads, "
+        << snap->counter (STAT_FILE_SYSCALLS) - syscalls << " file syscalls, "
+        << (tend - tbeg) * 1000 / CLOCKS_PER_SEC << " ms" << std::endl;
+    delete snap;
+    thePagerMgr ().releasePager ();
+    return succ && cnt == cScanKeys;
+}
+
+bool testScan ()
+{
+    std::cerr << "Cold scan" << std::endl;
+    if (splitFileFactory.exists (TSTDIR, TSTNAME))
+        splitFileFactory.erase (TSTDIR, TSTNAME);
+    BTreeFile& bf = pagedFileFactory.wrap (splitFileFactory.create (TSTDIR, TSTNAME));
+    BTree bt;
+    bool succ = bt.init (bf, cScanVal, BTREE_FLAGS_UNIQUE, sizeof (uint64));
+    char val [cScanVal];
+    memset (val, 0x5a, sizeof (val));
+    // 7919 is prime to cScanKeys, so every key is inserted once
+    for (uint64 i = 0; succ && i < cScanKeys; ++i) {
+        uint64 key = msb64 ((i * 7919) % cScanKeys);
+        bt.insert (&key, sizeof (key), val, sizeof (val));
+    }
+    bt.flush ();
+    succ = succ && coldScan (bt, 0) && coldScan (bt, BTREE_READAHEAD_LEAVES)
+        && coldScan (bt, 4 * BTREE_READAHEAD_LEAVES);
+    std::cerr << (succ ? "Cold scan OK" : "Cold scan FAILED") << std::endl;
+    bt.detach ();
+    bf.close ();
+    if (splitFileFactory.exists (TSTDIR, TSTNAME))
+        splitFileFactory.erase (TSTDIR, TSTNAME);
+    return succ;
+}
+
+#if !defined (_WIN32)
+// Multithreaded mixed read/write load over one shared index
+#include <pthread.h>
+#include <sys/time.h>
+#include <stdio.h>
+
+const uint64 cPreload = 200000L;
+const uint64 cThreadOps = 100000L;
+
+static uint64 msecs ()
+{
+    struct timeval tv;
+    gettimeofday (&tv, 0);
+    return uint64 (tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+}
+
+struct MixedLoad
+{
+    BTree *bt;
+    uint64 base;     // first key inserted by this thread
+    uint64 ops;
+    int    readPct;  // percentage of lookups, the rest are inserts
+    bool   scan;     // run cursor scans instead
+    uint64 seed;
+    uint64 failed;
+} ;
+
+static void *mixedWorker (void *arg)
+{
+    MixedLoad &ld = *(MixedLoad *) arg;
+    uint64 state = ld.seed;
+    uint64 next = ld.base;
+    const char startKey[] = {0,0,0,0,0,0,0,0};
+    for (uint64 n = 0; n < ld.ops; ++n) {
+        if (ld.scan) {
+            // keys must come strictly ascending even when writers split
+            // pages under the cursor
+            UntilTheEnd qry (startKey, sizeof (startKey));
+            BTreeCursor cur;
+            ld.bt->initcursor (cur, qry);
+            const void *key;
+            LenT klen = 0;
+            uint64 val, prev = 0, cnt = 0;
+            LenT vlen = sizeof (val);
+            while (cnt < 1000 && ld.bt->fetch (cur, key, klen, &val, vlen)) {
+                uint64 k = msb64 ((const char *) key);
+                if (cnt && k <= prev) ++ld.failed;
+                prev = k;
+                ++cnt;
+            }
+            n += cnt;
+            continue;
+        }
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        uint64 r = state >> 33;
+        if ((int) (r % 100) < ld.readPct) {
+            uint64 i = (r >> 7) % cPreload;
+            uint64 key = msb64 (i), val;
+            LenT vlen = sizeof (val);
+            try {
+                ld.bt->find (&key, sizeof (key), &val, vlen);
+                if (msb64 (val) != i) ++ld.failed;
+            }
+            catch (NotFound &) { ++ld.failed; }
+        } else {
+            uint64 key = msb64 (next++);
+            ld.bt->insert (&key, sizeof (key), &key, sizeof (key));
+        }
+    }
+    return 0;
+}
+
+bool testConcurrent ()
+{
+    BTree bt;
+    std::cerr << "Concurrent" << std::endl;
+    if (splitFileFactory.exists (TSTDIR, TSTNAME))
+        splitFileFactory.erase (TSTDIR, TSTNAME);
+    BTreeFile& bf = pagedFileFactory.wrap (splitFileFactory.create (TSTDIR, TSTNAME));
+    bool succ = bt.init (bf, sizeof (uint64), BTREE_FLAGS_UNIQUE, sizeof (uint64));
+    uint64 i;
+    for (i = 0; succ && i < cPreload; ++i) {
+        uint64 key = msb64 (i);
+        bt.insert (&key, sizeof (key), &key, sizeof (key));
+    }
+    const int maxThreads = 4;
+    const int pcts[] = {90, 50};
+    uint64 base = cPreload;
+    uint64 expected = cPreload;
+    for (int p = 0; succ && p < sizeof (pcts) / sizeof (*pcts); ++p) {
+        for (int nthreads = 1; nthreads <= maxThreads; nthreads *= 2) {
+            pthread_t th [maxThreads + 1];
+            MixedLoad ld [maxThreads + 1];
+            // one extra thread scanning by cursor
+            int total = nthreads + 1;
+            for (int t = 0; t < total; ++t) {
+                ld[t].bt = &bt;
+                ld[t].base = base;
+                ld[t].ops = cThreadOps;
+                ld[t].readPct = pcts[p];
+                ld[t].scan = (t == nthreads);
+                ld[t].seed = t + 1;
+                ld[t].failed = 0;
+                base += cThreadOps;
+            }
+            uint64 tbeg = msecs ();
+            for (int t = 0; t < total; ++t)
+                pthread_create (&th[t], 0, mixedWorker, &ld[t]);
+            uint64 failed = 0, inserted = 0;
+            for (int t = 0; t < total; ++t) {
+                pthread_join (th[t], 0);
+                failed += ld[t].failed;
+            }
+            uint64 tlps = msecs () - tbeg;
+            for (int t = 0; t < nthreads; ++t) {
+                uint64 state = ld[t].seed;
+                for (uint64 n = 0; n < cThreadOps; ++n) {
+                    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+                    if ((int) ((state >> 33) % 100) >= pcts[p]) ++inserted;
+                }
+            }
+            expected += inserted;
+            std::cerr << nthreads << " threads, " << pcts[p] << "% reads: "
+                << (nthreads * cThreadOps * 1000) / (tlps + 1) << " ops/sec, "
+                << failed << " failures" << std::endl;
+            if (failed) succ = false;
+        }
+    }
+    if (succ && bt.count () != expected) {
+        std::cerr << "count mismatch " << bt.count () << " expected " << expected << std::endl;
+        succ = false;
+    }
+    bt.detach ();
+    bf.close ();
+    if (splitFileFactory.exists (TSTDIR, TSTNAME))
+        splitFileFactory.erase (TSTDIR, TSTNAME);
+    return succ;
+}
+
+// Write-ahead log: the tree is recovered to its last commit from a copy of the files taken amid the changes,
+// with the pages pushed out of a small pool before and after the commits; then the commits are timed
+#define WALNAME "idxlog"
+#define CRASHNAME "idxc"
+#define CRASHWALNAME "idxclog"
+const uint64 cWalKeys = 2000L;  // per transaction
+const uint64 cWalTrans = 10;    // committed before the crash
+const uint64 cWalSpace = 65521; // key numbers are scattered over it
+const uint32 cWalPool = 8;
+const uint64 cWalCommits = 500;
+
+static uint64 walKey (uint64 i)
+{
+    return msb64 ((i * 7919) % cWalSpace);
+}
+
+static void eraseWalFiles ()
+{
+    const char* names [] = {TSTNAME, WALNAME, CRASHNAME, CRASHWALNAME};
+    for (unsigned n = 0; n < sizeof (names) / sizeof (*names); n ++)
+        if (splitFileFactory.exists (TSTDIR, names [n]))
+            splitFileFactory.erase (TSTDIR, names [n]);
+}
+
+// what a crash would leave: the file as the system has it
+static bool copyFile (const char *src, const char *dst)
+{
+    char sname [64], dname [64];
+    sprintf (sname, "%s/%s.0.edb", TSTDIR, src);
+    sprintf (dname, "%s/%s.0.edb", TSTDIR, dst);
+    FILE *in = fopen (sname, "rb");
+    FILE *out = fopen (dname, "wb");
+    bool succ = in && out;
+    char buf [0x10000];
+    size_t got;
+    while (succ && (got = fread (buf, 1, sizeof (buf), in)) > 0)
+        succ = fwrite (buf, 1, got, out) == got;
+    if (in) fclose (in);
+    if (out) fclose (out);
+    return succ;
+}
+
+static bool walCrash ()
+{
+    Pager &pager = thePagerMgr ().getPager ();
+    uint32 poolsize = pager.getPoolSize ();
+    pager.setPoolSize (cWalPool);
+    BTreeFile& bf = pagedFileFactory.wrap (splitFileFactory.create (TSTDIR, TSTNAME));
+    File& log = splitFileFactory.create (TSTDIR, WALNAME);
+    Wal& wal = walFactory.open (log, bf.getPageSize ());
+    bf.setWal (&wal);
+    BTree bt;
+    bool succ = bt.init (bf, sizeof (uint64), BTREE_FLAGS_UNIQUE, sizeof (uint64));
+    uint64 i;
+    for (i = 0; succ && i < cWalKeys * cWalTrans; ++i) {
+        uint64 key = walKey (i);
+        bt.insert (&key, sizeof (key), &i, sizeof (i));
+        if ((i + 1) % cWalKeys == 0)
+            bt.flush ();
+    }
+    // a transaction left unfinished, larger than the pool
+    for (; succ && i < cWalKeys * cWalTrans * 3; ++i) {
+        uint64 key = walKey (i);
+        bt.insert (&key, sizeof (key), &i, sizeof (i));
+    }
+    succ = succ && copyFile (TSTNAME, CRASHNAME) && copyFile (WALNAME, CRASHWALNAME);
+
+    // recover and check the copy
+    BTreeFile& cf = pagedFileFactory.wrap (splitFileFactory.open (TSTDIR, CRASHNAME));
+    File& clog = splitFileFactory.open (TSTDIR, CRASHWALNAME);
+    Wal& cwal = walFactory.open (clog, cf.getPageSize ());
+    cf.setWal (&cwal);
+    BTree ct;
+    succ = succ && ct.attach (cf);
+    if (succ && ct.count () != cWalKeys * cWalTrans) {
+        std::cerr << "recovered " << ct.count () << " keys of " << cWalKeys * cWalTrans << std::endl;
+        succ = false;
+    }
+    for (i = 0; succ && i < cWalKeys * cWalTrans * 3; ++i) {
+        uint64 key = walKey (i), val = 0;
+        LenT vlen = sizeof (val);
+        bool found = true;
+        try {
+            ct.find (&key, sizeof (key), &val, vlen);
+        } catch (NotFound&) {
+            found = false;
+        }
+        if (found != (i < cWalKeys * cWalTrans) || (found && val != i)) {
+            std::cerr << "key " << i << (found ? " recovered wrong" : " lost") << std::endl;
+            succ = false;
+        }
+    }
+    std::cerr << (succ ? "Recovery OK" : "Recovery FAILED") << std::endl;
+    ct.detach ();
+    cf.close ();
+    clog.close ();
+    bt.detach ();
+    bf.close ();
+    log.close ();
+    pager.setPoolSize (poolsize);
+    thePagerMgr ().releasePager ();
+    return succ;
+}
+
+// transactions of a few keys each, committed through the log against flushing the file in place
+static bool walCommits ()
+{
+    const uint64 keysPerCommit = 10;
+    bool succ = true;
+    for (int logged = 0; succ && logged < 2; ++logged) {
+        eraseWalFiles ();
+        BTreeFile& bf = pagedFileFactory.wrap (splitFileFactory.create (TSTDIR, TSTNAME));
+        File* log = 0;
+        Wal* wal = 0;
+        if (logged) {
+            log = &splitFileFactory.create (TSTDIR, WALNAME);
+            wal = &walFactory.open (*log, bf.getPageSize ());
+            bf.setWal (wal);
+        }
+        BTree bt;
+        succ = bt.init (bf, sizeof (uint64), BTREE_FLAGS_UNIQUE, sizeof (uint64));
+        uint64 tbeg = msecs ();
+        for (uint64 i = 0; succ && i < cWalCommits * keysPerCommit; ++i) {
+            uint64 key = walKey (i);
+            bt.insert (&key, sizeof (key), &i, sizeof (i));
+            if ((i + 1) % keysPerCommit == 0)
+                bt.flush ();
+        }
+        uint64 elapsed = msecs () - tbeg;
+        std::cerr << (logged ? "WAL: " : "In place: ") << (elapsed ? cWalCommits * 1000 / elapsed : 0) << " commits/sec";
+        if (wal)
+            std::cerr << ", " << wal->getSyncCount () << " log syncs";
+        std::cerr << std::endl;
+        succ = succ && bt.count () == cWalCommits * keysPerCommit;
+        bt.detach ();
+        bf.close ();
+        if (log)
+            log->close ();
+    }
+    return succ;
+}
+
+// threads committing one page each at a time through one log: the ones coming while an fsync is done share the next
+const uint32 cWalPage = 4096;
+
+struct WalWriter
+{
+    Wal* wal_;
+    uint64 pageno_;
+    uint32 commits_;
+    bool ok_;
+};
+
+static void walWriter (void* arg)
+{
+    WalWriter& w = *(WalWriter*) arg;
+    std::vector <char> page (cWalPage);
+    try {
+        for (uint32 c = 0; c < w.commits_; ++c) {
+            memset (&page [0], (char) c, cWalPage);
+            memcpy (&page [0], &c, sizeof (c));
+            w.wal_->append (w.pageno_, &page [0], 1);
+            w.wal_->sync (w.wal_->commit ());
+        }
+    } catch (Error&) {
+        w.ok_ = false;
+    }
+}
+
+static bool walThreads ()
+{
+    const uint32 threadCounts [] = {1, 4, 16};
+    bool succ = true;
+    for (unsigned t = 0; succ && t < sizeof (threadCounts) / sizeof (*threadCounts); ++t) {
+        uint32 threads = threadCounts [t];
+        uint32 perThread = (uint32) cWalCommits / threads;
+        eraseWalFiles ();
+        File& log = splitFileFactory.create (TSTDIR, WALNAME);
+        Wal& wal = walFactory.open (log, cWalPage);
+        std::vector <WalWriter> writers (threads);
+        std::vector <Thread> workers (threads);
+        uint64 tbeg = msecs ();
+        uint32 i;
+        for (i = 0; i < threads; ++i) {
+            WalWriter w = {&wal, i, perThread, true};
+            writers [i] = w;
+            workers [i].start (walWriter, &writers [i]);
+        }
+        for (i = 0; i < threads; ++i)
+            workers [i].join ();
+        uint64 elapsed = msecs () - tbeg;
+        uint64 commits = (uint64) perThread * threads;
+        std::cerr << "WAL, " << threads << " threads: " << (elapsed ? commits * 1000 / elapsed : 0) << " commits/sec, " << wal.getSyncCount () << " log syncs" << std::endl;
+        for (i = 0; i < threads; ++i)
+            succ = succ && writers [i].ok_;
+        succ = succ && wal.getCommitCount () == commits && wal.getSyncCount () <= commits;
+        delete &wal;
+        log.close ();
+
+        // every commit returned from sync is on disk: the log reopened has the last image of each page
+        File& relog = splitFileFactory.open (TSTDIR, WALNAME);
+        Wal& rewal = walFactory.open (relog, cWalPage);
+        std::vector <char> page (cWalPage);
+        for (i = 0; succ && i < threads; ++i) {
+            uint32 c = 0;
+            succ = rewal.read (i, &page [0]);
+            memcpy (&c, &page [0], sizeof (c));
+            if (!succ || c != perThread - 1) {
+                std::cerr << "page " << i << " not recovered from the log" << std::endl;
+                succ = false;
+            }
+        }
+        delete &rewal;
+        relog.close ();
+    }
+    return succ;
+}
+
+bool testWal ()
+{
+    std::cerr << "Write-ahead log" << std::endl;
+    eraseWalFiles ();
+    bool succ = walCrash () && walCommits () && walThreads ();
+    eraseWalFiles ();
+    return succ;
+}
+
+// Snapshots: scans over the frozen tree, going on while a writer splits every leaf
+// of the live one and flushes it, see the tree exactly as it was; the old pages
+// are kept in the shadow file until the last snapshot is closed
+#define SHADOWNAME "idxshadow"
+const uint64 cSnapKeys = 100000L;
+const uint64 cSnapFlush = 5000L; // writer inserts between flushes
+const uint32 cSnapPool = 64;
+
+struct SnapScan
+{
+    BTree *bt;
+    uint64 keys;        // the snapshot has keys 0, 2, ... 2 * (keys - 1), valued by their number
+    volatile bool *stop;
+    uint64 scans;
+    uint64 failed;
+} ;
+
+static bool snapCheck (BTree &bt, uint64 keys)
+{
+    const char startKey[] = {0,0,0,0,0,0,0,0};
+    UntilTheEnd qry (startKey, sizeof (startKey));
+    BTreeCursor cur;
+    bt.initcursor (cur, qry);
+    const void *key;
+    LenT klen = 0;
+    uint64 val, cnt = 0;
+    LenT vlen = sizeof (val);
+    while (bt.fetch (cur, key, klen, &val, vlen)) {
+        if (msb64 ((const char *) key) != 2 * cnt || val != cnt) return false;
+        ++cnt;
+    }
+    return cnt == keys && bt.count () == keys;
+}
+
+static void *snapScanner (void *arg)
+{
+    SnapScan &sc = *(SnapScan *) arg;
+    do {
+        if (!snapCheck (*sc.bt, sc.keys)) ++sc.failed;
+        ++sc.scans;
+    } while (!*sc.stop);
+    return 0;
+}
+
+bool testSnapshot ()
+{
+    std::cerr << "Snapshot" << std::endl;
+    const char* names [] = {TSTNAME, SHADOWNAME};
+    unsigned n;
+    for (n = 0; n < sizeof (names) / sizeof (*names); n ++)
+        if (splitFileFactory.exists (TSTDIR, names [n]))
+            splitFileFactory.erase (TSTDIR, names [n]);
+    Pager &pager = thePagerMgr ().getPager ();
+    uint32 poolsize = pager.getPoolSize ();
+    pager.setPoolSize (cSnapPool);
+    BTreeFile& bf = pagedFileFactory.wrap (splitFileFactory.create (TSTDIR, TSTNAME));
+    File& shadow = splitFileFactory.create (TSTDIR, SHADOWNAME);
+    bf.setShadow (&shadow);
+    BTree bt;
+    bool succ = bt.init (bf, sizeof (uint64), BTREE_FLAGS_UNIQUE, sizeof (uint64));
+    uint64 i;
+    for (i = 0; succ && i < cSnapKeys; ++i) {
+        uint64 key = msb64 (2 * i);
+        bt.insert (&key, sizeof (key), &i, sizeof (i));
+    }
+    BTree frozen;
+    succ = succ && bt.snapshot (frozen);
+    bool rejected = false;
+    try {
+        uint64 key = msb64 (1);
+        frozen.insert (&key, sizeof (key), &i, sizeof (i));
+    } catch (BadParameters &) {
+        rejected = true;
+    }
+    succ = succ && rejected && frozen.isFrozen ();
+
+    volatile bool stop = false;
+    SnapScan sc = {&frozen, cSnapKeys, &stop, 0, 0};
+    pthread_t th;
+    pthread_create (&th, 0, snapScanner, &sc);
+    uint64 tbeg = msecs ();
+    for (i = 0; succ && i < cSnapKeys; ++i) {
+        uint64 key = msb64 (2 * i + 1);
+        bt.insert (&key, sizeof (key), &i, sizeof (i));
+        if ((i + 1) % cSnapFlush == 0)
+            bt.flush ();
+    }
+    bt.flush ();
+    uint64 tlps = msecs () - tbeg;
+    stop = true;
+    pthread_join (th, 0);
+    std::cerr << cSnapKeys << " inserts beside the snapshot scans: "
+        << (cSnapKeys * 1000) / (tlps + 1) << " inserts/sec, " << sc.scans << " scans, "
+        << sc.failed << " failures, shadow " << shadow.length () << " bytes" << std::endl;
+    succ = succ && !sc.failed && shadow.length () > 0;
+
+    // the second snapshot sees the writer's keys; the first one still does not
+    BTree later;
+    succ = succ && bt.snapshot (later) && later.count () == 2 * cSnapKeys;
+    succ = succ && snapCheck (frozen, cSnapKeys) && frozen.detach () && later.count () == 2 * cSnapKeys;
+    later.detach ();
+    succ = succ && shadow.length () == 0;
+    std::cerr << (succ ? "Snapshot OK" : "Snapshot FAILED") << std::endl;
+    bt.detach ();
+    bf.close ();
+    shadow.close ();
+    pager.setPoolSize (poolsize);
+    thePagerMgr ().releasePager ();
+    for (n = 0; n < sizeof (names) / sizeof (*names); n ++)
+        if (splitFileFactory.exists (TSTDIR, names [n]))
+            splitFileFactory.erase (TSTDIR, names [n]);
+    return succ;
+}
+
+// Statistics: a tree built and emptied by a thread that is gone by the time
+// of the snapshot still shows in it, in every layer it went through
+const uint64 cStatKeys = 50000L;
+const uint32 cStatPool = 8;
+
+static void *statWorker (void *arg)
+{
+    bool &succ = *(bool *) arg;
+    BTreeFile& bf = pagedFileFactory.wrap (splitFileFactory.create (TSTDIR, TSTNAME));
+    BTree bt;
+    succ = bt.init (bf, sizeof (uint64), BTREE_FLAGS_UNIQUE, sizeof (uint64));
+    for (uint64 i = 0; succ && i < cStatKeys; ++i) {
+        uint64 key = msb64 (i);
+        bt.insert (&key, sizeof (key), &i, sizeof (i));
+    }
+    const char startKey[] = {0,0,0,0,0,0,0,0};
+    UntilTheEnd qry (startKey, sizeof (startKey));
+    BTreeCursor cur;
+    bt.initcursor (cur, qry);
+    succ = succ && bt.remove (cur) == cStatKeys;
+    bt.detach ();
+    bf.close ();
+    return 0;
+}
+
+bool testStats ()
+{
+    std::cerr << "Statistics" << std::endl;
+    // the buckets hold the values they are found for
+    bool succ = true;
+    uint64 v;
+    for (v = 0; v < 100000; v += 1 + v / 7)
+        succ = succ && statBucketLow (statBucket (v)) <= v && v <= statBucketHigh (statBucket (v));
+    succ = succ && statBucket (UINT64_MAX) == STAT_BUCKETS - 1 && statBucketHigh (STAT_BUCKETS - 1) == UINT64_MAX;
+    if (!statsEnabled ()) {
+        StatsSnapshot snap;
+        statsSnapshot (snap);
+        succ = succ && snap.count (STAT_FETCH_HIT_NS) == 0;
+        std::cerr << (succ ? "Statistics OK (compiled out)" : "Statistics FAILED") << std::endl;
+        return succ;
+    }
+    if (splitFileFactory.exists (TSTDIR, TSTNAME))
+        splitFileFactory.erase (TSTDIR, TSTNAME);
+    Pager &pager = thePagerMgr ().getPager ();
+    uint32 poolsize = pager.getPoolSize ();
+    pager.setPoolSize (cStatPool);
+    statsReset ();
+    bool built = false;
+    pthread_t th;
+    pthread_create (&th, 0, statWorker, &built);
+    pthread_join (th, 0);
+    StatsSnapshot* snap = new StatsSnapshot;
+    statsSnapshot (*snap);
+    statsDump (std::cerr);
+    succ = succ && built;
+    succ = succ && snap->counter (STAT_PAGER_FETCH_HITS) > 0 && snap->counter (STAT_PAGER_FETCH_MISSES) > 0;
+    // one fetch in STAT_SAMPLE is timed, counting on from where the thread's block was left
+    uint64 timed = snap->count (STAT_FETCH_HIT_NS) + snap->count (STAT_FETCH_MISS_NS);
+    uint64 fetched = snap->counter (STAT_PAGER_FETCH_HITS) + snap->counter (STAT_PAGER_FETCH_MISSES);
+    succ = succ && timed >= fetched / STAT_SAMPLE && timed <= fetched / STAT_SAMPLE + 1;
+    succ = succ && snap->percentile (STAT_FETCH_HIT_NS, 50.0) <= snap->maximum (STAT_FETCH_HIT_NS);
+    succ = succ && snap->counter (STAT_PAGER_PAGES_READ) > 0 && snap->sum (STAT_DUMP_PAGES) > 0;
+    succ = succ && snap->sum (STAT_FILE_WRITE_BYTES) > 0 && snap->counter (STAT_FILE_SYSCALLS) >= snap->count (STAT_FILE_WRITE_BYTES);
+    succ = succ && snap->count (STAT_BTREE_SPLIT_LEVEL) > 0 && snap->counter (STAT_BTREE_ROOT_SPLITS) > 0;
+    succ = succ && snap->count (STAT_BTREE_RECLAIM_LEVEL) > 0;
+    // a reset starts the counting anew
+    statsReset ();
+    statsSnapshot (*snap);
+    succ = succ && snap->counter (STAT_PAGER_FETCH_HITS) == 0 && snap->count (STAT_DUMP_PAGES) == 0;
+    delete snap;
+    std::cerr << (succ ? "Statistics OK" : "Statistics FAILED") << std::endl;
+    pager.setPoolSize (poolsize);
+    thePagerMgr ().releasePager ();
+    if (splitFileFactory.exists (TSTDIR, TSTNAME))
+        splitFileFactory.erase (TSTDIR, TSTNAME);
+    return succ;
+}
+#endif
+
 #if 0
 //const uint64 badkey =  681318;
 //const uint64 badinsind= 2729364;
@@ -503,6 +1380,7 @@ bool testDupBadKey ()
         splitFileFactory.erase (TSTDIR, TSTNAME);
     return succ;
 }
+
 #endif
 
 namespace edb {
@@ -547,9 +1425,17 @@ bool testBTree ()
         1000000, elapsed 23
         1000000, elapsed 7
     */
-    testDriver ("Duplicate", BTREE_FLAGS_DUPLICATE);
-    testDriver ("Unique", BTREE_FLAGS_UNIQUE);
-    testDriver ("Range", BTREE_FLAGS_RANGE);
-    return true;
+    bool succ = testDriver ("Duplicate", BTREE_FLAGS_DUPLICATE);
+    succ = testDriver ("Unique", BTREE_FLAGS_UNIQUE) && succ;
+    succ = testDriver ("Range", BTREE_FLAGS_RANGE) && succ;
+    testBloom ();
+    testScan ();
+#if !defined (_WIN32)
+    testConcurrent ();
+    testWal ();
+    testSnapshot ();
+    testStats ();
+#endif
+    return succ;
 }
 } // namespace edb
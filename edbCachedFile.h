@@ -35,6 +35,9 @@ public:
     virtual bool        close          () = 0;
     virtual bool        hintAdd        (FileCacheHint* hints, int hintno) = 0;
     virtual bool        hintReset      () = 0;
+    virtual void*       pin            (FilePos offset, BufLen& size) = 0; // see FileCache::pin
+    virtual void        unpin          (const void* data, bool dirty) = 0;
+    virtual File&       file           () = 0; // the wrapped file; it misses the pages the cache holds dirty until commit ()
 };
 
 class CachedFileFactory
@@ -87,6 +87,16 @@ bool CachedFile_imp::hintReset ()
     return cache_.hintReset (file_);
 }
 
+void* CachedFile_imp::pin (FilePos offset, BufLen& size)
+{
+    return cache_.pin (file_, offset, size);
+}
+
+void CachedFile_imp::unpin (const void* data, bool dirty)
+{
+    cache_.unpin (data, dirty);
+}
+
 CachedFile& CachedFileFactory_imp::wrap (File& file)
 {
     // get the cache
@@ -40,6 +40,9 @@ public:
     bool        close          ();
     bool        hintAdd        (FileCacheHint* hints, int hintno);
     bool        hintReset      ();
+    void*       pin            (FilePos offset, BufLen& size);
+    void        unpin          (const void* data, bool dirty);
+    File&       file           () { return file_; }
 
     friend class CachedFileFactory_imp;
 };
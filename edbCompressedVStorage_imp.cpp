@@ -0,0 +1,651 @@
+//////////////////////////////////////////////////////////////////////////////
+//// This software module is developed by SciDM (Scientific Data Management) in 1998-2015
+//// 
+//// This program is free software; you can redistribute, reuse,
+//// or modify it with no restriction, under the terms of the MIT License.
+//// 
+//// This program is distributed in the hope that it will be useful,
+//// but WITHOUT ANY WARRANTY; without even the implied warranty of
+//// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//// 
+//// For any questions please contact Denis Kaznadzey at dkaznadzey@yahoo.com
+//////////////////////////////////////////////////////////////////////////////
+
+
+#include "edbCompressedVStorage_imp.h"
+#include "edbExceptions.h"
+#include "edbLZ4.h"
+#include <stddef.h>
+#include <string.h>
+
+namespace edb
+{
+
+static const BufLen PACK_CHUNK = 0x10000; // unpacked size of a frame
+static const uint64 FRAME_RAW = 0x8000000000000000ULL; // the frame is stored unpacked
+static const BufLen STORE_PORTION = 0x100000; // large new records are written by portions of about this size
+
+
+void CompressedVStorage_imp::Remap::remap (RecLocator oldLocator, RecLocator newLocator, RecLen length)
+{
+    PackHdr hdr;
+    storage_.read_hdr_ (hdr, newLocator);
+    switch (hdr.kind_)
+    {
+        case PACK_META:
+            storage_.meta_ = newLocator;
+            break;
+        case PACK_BODY:
+            storage_.store_.writeRec (hdr.link_, &newLocator, sizeof (newLocator), offsetof (PackHdr, link_));
+            break;
+        case PACK_STUB:
+            storage_.store_.writeRec (hdr.link_, &newLocator, sizeof (newLocator), offsetof (PackHdr, link_));
+            target_.remap (oldLocator, newLocator, hdr.length_);
+            break;
+        case PACK_HEAD:
+            target_.remap (oldLocator, newLocator, hdr.length_);
+            break;
+        default:
+            throw FileStructureCorrupt ();
+    }
+}
+
+void CompressedVStorage_imp::Unpack::records (const VRecDescriptor* recs, const void* const* data, uint32 number)
+{
+    std::vector <VRecDescriptor> found;
+    std::vector <const void*> unpacked;
+    std::vector <Buffer> plain (number);
+    for (uint32 ridx = 0; ridx < number; ridx ++)
+    {
+        PackHdr hdr;
+        memcpy (&hdr, data [ridx], sizeof (hdr));
+        if (hdr.kind_ != PACK_HEAD && hdr.kind_ != PACK_BODY)
+            continue;
+        VRecDescriptor rec;
+        rec.locator_ = (hdr.kind_ == PACK_HEAD) ? recs [ridx].locator_ : hdr.link_;
+        rec.length_ = hdr.length_;
+        plain [ridx].resize ((size_t) hdr.length_ + 1);
+        storage_.unpack_image_ ((const char*) data [ridx], hdr, &plain [ridx][0]);
+        found.push_back (rec);
+        unpacked.push_back (&plain [ridx][0]);
+    }
+    if (found.size ())
+        target_.records (&found [0], &unpacked [0], (uint32) found.size ());
+}
+
+CompressedVStorage_imp::CompressedVStorage_imp (VStorage_imp& store)
+:
+store_ (store),
+meta_ (RECLOCATOR_MAX),
+chunk_ (PACK_CHUNK),
+bodies_ (0)
+{
+}
+
+CompressedVStorage_imp::~CompressedVStorage_imp ()
+{
+    delete &store_;
+}
+
+void CompressedVStorage_imp::setup_ ()
+{
+    plain_.resize (chunk_);
+    packed_.resize (lz4Bound (chunk_));
+    memset (&plain_ [0], 0, chunk_);
+    BufLen zlen = lz4Compress (&plain_ [0], chunk_, &packed_ [0], chunk_ - 1);
+    zeros_.assign (packed_.begin (), packed_.begin () + zlen);
+}
+
+void CompressedVStorage_imp::init_ ()
+{
+    PackHdr meta = {PACK_META, chunk_, 0, 0, RECLOCATOR_MAX};
+    meta_ = store_.addRec (&meta, sizeof (meta));
+    setup_ ();
+}
+
+void CompressedVStorage_imp::open_ ()
+{
+    // the meta record is the first one
+    VRecDescriptor rec;
+    if (!store_.firstRec (rec))
+        throw FileStructureCorrupt ();
+    PackHdr meta;
+    read_hdr_ (meta, rec.locator_);
+    if (meta.kind_ != PACK_META || !meta.chunk_)
+        throw FileStructureCorrupt ();
+    meta_ = rec.locator_;
+    chunk_ = meta.chunk_;
+    bodies_ = meta.length_;
+    setup_ ();
+}
+
+void CompressedVStorage_imp::read_hdr_ (PackHdr& hdr, RecLocator locator)
+{
+    store_.readRec (locator, &hdr, sizeof (hdr));
+}
+
+RecLocator CompressedVStorage_imp::resolve_ (PackHdr& hdr, RecLocator locator)
+{
+    read_hdr_ (hdr, locator);
+    if (hdr.kind_ == PACK_HEAD)
+        return locator;
+    if (hdr.kind_ != PACK_STUB)
+        throw BadLocator ();
+    RecLocator body = hdr.link_;
+    read_hdr_ (hdr, body);
+    if (hdr.kind_ != PACK_BODY || hdr.link_ != locator)
+        throw FileStructureCorrupt ();
+    return body;
+}
+
+void CompressedVStorage_imp::read_ends_ (RecLocator holder, const PackHdr& hdr, uint32 first, uint32 count, FrameEnds& ends)
+{
+    ends.resize (count);
+    if (count)
+        store_.readRec (holder, &ends [0], count * sizeof (uint64), sizeof (PackHdr) + hdr.stored_ + (RecOff) first * sizeof (uint64));
+}
+
+BufLen CompressedVStorage_imp::chunklen_ (RecLen length, uint32 chunk) const
+{
+    return (BufLen) min_ (chunk_, length - (RecOff) chunk * chunk_);
+}
+
+RecLen CompressedVStorage_imp::image_ (const PackHdr& hdr) const
+{
+    return sizeof (PackHdr) + hdr.stored_ + (RecLen) chunks_ (hdr.length_) * sizeof (uint64);
+}
+
+void CompressedVStorage_imp::add_frame_ (const char* plain, BufLen len, Buffer& frames, FrameEnds& ends, uint64 base)
+{
+    const char* frame;
+    BufLen flen;
+    uint64 raw = 0;
+    if (!plain && len == chunk_)
+    {
+        frame = &zeros_ [0];
+        flen = (BufLen) zeros_.size ();
+    }
+    else
+    {
+        if (!plain)
+        {
+            memset (&plain_ [0], 0, len);
+            plain = &plain_ [0];
+        }
+        // the frame is kept only if it is shorter than the data
+        flen = (len > 1) ? lz4Compress (plain, len, &packed_ [0], len - 1) : 0;
+        frame = &packed_ [0];
+        if (!flen)
+        {
+            frame = plain;
+            flen = len;
+            raw = FRAME_RAW;
+        }
+    }
+    frames.insert (frames.end (), frame, frame + flen);
+    ends.push_back (((ends.empty () ? base : (ends.back () & ~FRAME_RAW)) + flen) | raw);
+}
+
+void CompressedVStorage_imp::unpack_ (RecLocator holder, uint64 start, uint64 end, BufLen len)
+{
+    BufLen flen = (BufLen) ((end & ~FRAME_RAW) - start);
+    if (end & FRAME_RAW)
+    {
+        if (flen != len)
+            throw FileStructureCorrupt ();
+        store_.readRec (holder, &plain_ [0], len, sizeof (PackHdr) + start);
+        return;
+    }
+    if (flen > packed_.size ())
+        throw FileStructureCorrupt ();
+    store_.readRec (holder, &packed_ [0], flen, sizeof (PackHdr) + start);
+    if (lz4Decompress (&packed_ [0], flen, &plain_ [0], len) != len)
+        throw FileStructureCorrupt ();
+}
+
+RecLocator CompressedVStorage_imp::replace_ (RecLocator& locator, PackHdr& hdr, RecLocator holder, RecLen image, RecLen start, RecLen end, const Buffer& data, bool canMove)
+{
+    RecLen newImage = image - (end - start) + data.size ();
+    if (holder == locator && !canMove && newImage > store_.getRecLen (holder) && !store_.extendRec_ (holder, newImage))
+    {
+        // the record can not grow in place: its frames go to a body, the record becomes the stub
+        RecLocator body = store_.allocRec (newImage);
+        store_.move_data_ (holder + sizeof (VStorage_imp::BlockHdr), holder + sizeof (VStorage_imp::BlockHdr) + image, body + sizeof (VStorage_imp::BlockHdr));
+        store_.reallocRec (holder, sizeof (PackHdr)); // shrinking is done in place
+        hdr.kind_ = PACK_BODY;
+        hdr.link_ = locator;
+        holder = body;
+        bodies_ ++;
+    }
+    RecLocator moved = store_.sliceRec (holder, data.size () ? &data [0] : NULL, (BufLen) data.size (), start, end - start, image);
+    if (holder == locator)
+        locator = moved;
+    holder = moved;
+    store_.writeRec (holder, &hdr, sizeof (hdr));
+    if (holder != locator)
+    {
+        PackHdr stub = {PACK_STUB, 0, hdr.length_, 0, holder};
+        store_.writeRec (locator, &stub, sizeof (stub));
+    }
+    return holder;
+}
+
+RecLocator CompressedVStorage_imp::store_new_ (const void* data, RecLen len)
+{
+    uint32 count = chunks_ (len);
+    PackHdr hdr = {PACK_HEAD, 0, len, 0, RECLOCATOR_MAX};
+    Buffer image (sizeof (hdr));
+    FrameEnds ends;
+    // allocRec reserves the room for the data to be written, large records are allocated for the frames stored as is
+    RecLen room = sizeof (hdr) + len + (RecLen) count * sizeof (uint64);
+    RecLocator locator = data ? RECLOCATOR_MAX : store_.allocRec (room);
+    RecOff written = 0;
+    for (uint32 chunk = 0; chunk < count; chunk ++)
+    {
+        add_frame_ (data ? (const char*) data + (RecOff) chunk * chunk_ : NULL, chunklen_ (len, chunk), image, ends, 0);
+        if (image.size () >= STORE_PORTION && chunk + 1 < count)
+        {
+            if (locator == RECLOCATOR_MAX)
+                locator = store_.allocRec (room);
+            store_.writeRec (locator, &image [0], (BufLen) image.size (), written);
+            written += image.size ();
+            image.clear ();
+        }
+    }
+    hdr.stored_ = count ? (ends.back () & ~FRAME_RAW) : 0;
+    if (count)
+        image.insert (image.end (), (const char*) &ends [0], (const char*) &ends [0] + count * sizeof (uint64));
+    if (locator == RECLOCATOR_MAX)
+    {
+        memcpy (&image [0], &hdr, sizeof (hdr));
+        return store_.addRec (&image [0], image.size ());
+    }
+    store_.writeRec (locator, &image [0], (BufLen) image.size (), written);
+    store_.writeRec (locator, &hdr, sizeof (hdr));
+    if (!data)
+        return locator;
+    return store_.reallocRec (locator, written + image.size ()); // shrinks in place
+}
+
+void CompressedVStorage_imp::unpack_image_ (const char* image, const PackHdr& hdr, char* dest) const
+{
+    const char* frames = image + sizeof (PackHdr);
+    const char* ends = frames + hdr.stored_;
+    uint64 start = 0;
+    for (uint32 chunk = 0; chunk < chunks_ (hdr.length_); chunk ++)
+    {
+        uint64 end;
+        memcpy (&end, ends + chunk * sizeof (uint64), sizeof (end));
+        BufLen clen = chunklen_ (hdr.length_, chunk);
+        BufLen flen = (BufLen) ((end & ~FRAME_RAW) - start);
+        if (end & FRAME_RAW)
+        {
+            if (flen != clen)
+                throw FileStructureCorrupt ();
+            memcpy (dest, frames + start, clen);
+        }
+        else if (lz4Decompress (frames + start, flen, dest, clen) != clen)
+            throw FileStructureCorrupt ();
+        dest += clen;
+        start = end & ~FRAME_RAW;
+    }
+}
+
+bool CompressedVStorage_imp::skip_ (VRecDescriptor& rec)
+{
+    while (true)
+    {
+        PackHdr hdr;
+        read_hdr_ (hdr, rec.locator_);
+        if (hdr.kind_ == PACK_HEAD || hdr.kind_ == PACK_STUB)
+        {
+            rec.length_ = hdr.length_;
+            return true;
+        }
+        if (!store_.nextRec (rec))
+            return false;
+    }
+}
+
+// record - level operations 
+bool CompressedVStorage_imp::isValid (RecLocator locator)
+{
+    if (!store_.isValid (locator))
+        return false;
+    PackHdr hdr;
+    read_hdr_ (hdr, locator);
+    return hdr.kind_ == PACK_HEAD || hdr.kind_ == PACK_STUB;
+}
+
+RecLocator CompressedVStorage_imp::allocRec (RecLen len)
+{
+    return store_new_ (NULL, len);
+}
+
+RecLen CompressedVStorage_imp::getRecLen (RecLocator locator)
+{
+    PackHdr hdr;
+    read_hdr_ (hdr, locator);
+    if (hdr.kind_ != PACK_HEAD && hdr.kind_ != PACK_STUB)
+        throw BadLocator ();
+    return hdr.length_;
+}
+
+RecLocator CompressedVStorage_imp::addRec (const void* data, RecLen len)
+{
+    return store_new_ (data, len);
+}
+
+RecLocator CompressedVStorage_imp::reallocRec (RecLocator locator, RecLen len)
+{
+    PackHdr hdr;
+    RecLocator holder = resolve_ (hdr, locator);
+    if (len == hdr.length_)
+        return locator;
+    // the full chunks common to both lengths stay, the rest of the frames and all the ends are rewritten
+    uint32 oldCount = chunks_ (hdr.length_);
+    uint32 count = chunks_ (len);
+    uint32 keep = (uint32) (min_ (hdr.length_, len) / chunk_);
+    FrameEnds ends;
+    read_ends_ (holder, hdr, 0, oldCount, ends);
+    uint64 base = keep ? (ends [keep - 1] & ~FRAME_RAW) : 0;
+    uint64 cutEnd = (keep < oldCount) ? ends [keep] : 0;
+    ends.resize (keep);
+    Buffer tail;
+    for (uint32 chunk = keep; chunk < count; chunk ++)
+    {
+        BufLen clen = chunklen_ (len, chunk);
+        if (chunk < oldCount) // the old chunk, cut or padded with zeros
+        {
+            BufLen oldClen = chunklen_ (hdr.length_, chunk);
+            unpack_ (holder, base, cutEnd, oldClen);
+            if (clen > oldClen)
+                memset (&plain_ [oldClen], 0, clen - oldClen);
+            add_frame_ (&plain_ [0], clen, tail, ends, base);
+        }
+        else
+            add_frame_ (NULL, clen, tail, ends, base);
+    }
+    if (count)
+        tail.insert (tail.end (), (const char*) &ends [0], (const char*) &ends [0] + count * sizeof (uint64));
+    RecLen image = image_ (hdr);
+    hdr.length_ = len;
+    hdr.stored_ = count ? (ends.back () & ~FRAME_RAW) : 0;
+    replace_ (locator, hdr, holder, image, sizeof (PackHdr) + base, image, tail, true);
+    return locator;
+}
+
+bool CompressedVStorage_imp::readRec (RecLocator locator, void* data, BufLen len, RecOff offset)
+{
+    PackHdr hdr;
+    RecLocator holder = resolve_ (hdr, locator);
+    if (offset + len > hdr.length_)
+        throw BadParameters ();
+    if (!len)
+        return true;
+    uint32 first = (uint32) (offset / chunk_);
+    uint32 last = (uint32) ((offset + len - 1) / chunk_);
+    // the ends of the frames before and within the range
+    uint32 from = first ? first - 1 : 0;
+    FrameEnds ends;
+    read_ends_ (holder, hdr, from, last - from + 1, ends);
+    char* dest = (char*) data;
+    for (uint32 chunk = first; chunk <= last; chunk ++)
+    {
+        uint64 start = chunk ? (ends [chunk - 1 - from] & ~FRAME_RAW) : 0;
+        uint64 end = ends [chunk - from];
+        RecOff cstart = (RecOff) chunk * chunk_;
+        BufLen clen = chunklen_ (hdr.length_, chunk);
+        BufLen pfrom = (BufLen) (max_ (offset, cstart) - cstart);
+        BufLen pto = (BufLen) (min_ (offset + len, cstart + clen) - cstart);
+        if (end & FRAME_RAW)
+            store_.readRec (holder, dest, pto - pfrom, sizeof (PackHdr) + start + pfrom);
+        else
+        {
+            unpack_ (holder, start, end, clen);
+            memcpy (dest, &plain_ [pfrom], pto - pfrom);
+        }
+        dest += pto - pfrom;
+    }
+    return true;
+}
+
+bool CompressedVStorage_imp::readRecs (const VRecDescriptor* recs, uint32 number, void* const* buffers)
+{
+    if (!number)
+        return true;
+    // the headers, the headers of the bodies of the forwarded records, then the whole images, each by one pass of the store
+    std::vector <PackHdr> hdrs (number);
+    std::vector <RecLocator> holders (number);
+    std::vector <VRecDescriptor> reads (number);
+    std::vector <void*> dests (number);
+    uint32 ridx;
+    for (ridx = 0; ridx < number; ridx ++)
+    {
+        reads [ridx].locator_ = recs [ridx].locator_;
+        reads [ridx].length_ = sizeof (PackHdr);
+        dests [ridx] = &hdrs [ridx];
+    }
+    store_.readRecs (&reads [0], number, &dests [0]);
+    uint32 stubs = 0;
+    for (ridx = 0; ridx < number; ridx ++)
+    {
+        holders [ridx] = recs [ridx].locator_;
+        if (hdrs [ridx].kind_ == PACK_STUB)
+        {
+            holders [ridx] = hdrs [ridx].link_;
+            reads [stubs].locator_ = hdrs [ridx].link_;
+            dests [stubs ++] = &hdrs [ridx];
+        }
+        else if (hdrs [ridx].kind_ != PACK_HEAD)
+            throw BadLocator ();
+    }
+    if (stubs)
+        store_.readRecs (&reads [0], stubs, &dests [0]);
+    std::vector <Buffer> images (number);
+    for (ridx = 0; ridx < number; ridx ++)
+    {
+        const PackHdr& hdr = hdrs [ridx];
+        if (holders [ridx] != recs [ridx].locator_ && (hdr.kind_ != PACK_BODY || hdr.link_ != recs [ridx].locator_))
+            throw FileStructureCorrupt ();
+        if (recs [ridx].length_ > hdr.length_)
+            throw BadParameters ();
+        images [ridx].resize ((size_t) image_ (hdr));
+        reads [ridx].locator_ = holders [ridx];
+        reads [ridx].length_ = images [ridx].size ();
+        dests [ridx] = &images [ridx][0];
+    }
+    store_.readRecs (&reads [0], number, &dests [0]);
+    Buffer plain;
+    for (ridx = 0; ridx < number; ridx ++)
+    {
+        const PackHdr& hdr = hdrs [ridx];
+        if (recs [ridx].length_ == hdr.length_)
+            unpack_image_ (&images [ridx][0], hdr, (char*) buffers [ridx]);
+        else
+        {
+            plain.resize ((size_t) hdr.length_ + 1);
+            unpack_image_ (&images [ridx][0], hdr, &plain [0]);
+            memcpy (buffers [ridx], &plain [0], (size_t) recs [ridx].length_);
+        }
+    }
+    return true;
+}
+
+bool CompressedVStorage_imp::writeRec (RecLocator locator, const void* data, BufLen len, RecOff offset)
+{
+    PackHdr hdr;
+    RecLocator holder = resolve_ (hdr, locator);
+    if (offset + len > hdr.length_)
+        throw BadParameters ();
+    if (!len)
+        return true;
+    uint32 count = chunks_ (hdr.length_);
+    uint32 first = (uint32) (offset / chunk_);
+    uint32 last = (uint32) ((offset + len - 1) / chunk_);
+    // the ends of the frames from the one before the range to the last one
+    uint32 from = first ? first - 1 : 0;
+    FrameEnds ends;
+    read_ends_ (holder, hdr, from, count - from, ends);
+    uint64 base = first ? (ends [0] & ~FRAME_RAW) : 0;
+    uint64 oldEnd = ends [last - from] & ~FRAME_RAW;
+    // pack the chunks touched by the write
+    Buffer frames;
+    FrameEnds newEnds;
+    const char* src = (const char*) data;
+    for (uint32 chunk = first; chunk <= last; chunk ++)
+    {
+        RecOff cstart = (RecOff) chunk * chunk_;
+        BufLen clen = chunklen_ (hdr.length_, chunk);
+        if (offset <= cstart && offset + len >= cstart + clen)
+            add_frame_ (src + (cstart - offset), clen, frames, newEnds, base);
+        else
+        {
+            uint64 start = chunk ? (ends [chunk - 1 - from] & ~FRAME_RAW) : 0;
+            unpack_ (holder, start, ends [chunk - from], clen);
+            BufLen pfrom = (BufLen) (max_ (offset, cstart) - cstart);
+            BufLen pto = (BufLen) (min_ (offset + len, cstart + clen) - cstart);
+            memcpy (&plain_ [pfrom], src + (cstart + pfrom - offset), pto - pfrom);
+            add_frame_ (&plain_ [0], clen, frames, newEnds, base);
+        }
+    }
+    // the frames after the range shift
+    uint64 newEnd = base + frames.size ();
+    for (uint32 chunk = last + 1; chunk < count; chunk ++)
+    {
+        uint64 end = ends [chunk - from];
+        newEnds.push_back ((end & FRAME_RAW) | ((end & ~FRAME_RAW) - oldEnd + newEnd));
+    }
+    RecLen image = image_ (hdr);
+    hdr.stored_ = hdr.stored_ - oldEnd + newEnd;
+    holder = replace_ (locator, hdr, holder, image, sizeof (PackHdr) + base, sizeof (PackHdr) + oldEnd, frames, false);
+    store_.writeRec (holder, &newEnds [0], (BufLen) (newEnds.size () * sizeof (uint64)), sizeof (PackHdr) + hdr.stored_ + (RecOff) first * sizeof (uint64));
+    return true;
+}
+
+bool CompressedVStorage_imp::freeRec (RecLocator locator)
+{
+    PackHdr hdr;
+    read_hdr_ (hdr, locator);
+    if (hdr.kind_ == PACK_STUB)
+    {
+        store_.freeRec (hdr.link_);
+        bodies_ --;
+    }
+    else if (hdr.kind_ != PACK_HEAD)
+        throw BadLocator ();
+    return store_.freeRec (locator);
+}
+
+RecLocator CompressedVStorage_imp::sliceRec (RecLocator locator, const void* data, BufLen data_len, RecOff offset, RecLen old_data_len, RecLen full_len)
+{
+    // rebuilt as a whole
+    RecLen length = getRecLen (locator);
+    if (length < full_len) throw BadParameters ();
+    if (old_data_len && offset + old_data_len > full_len) throw BadParameters ();
+    RecLen newlen = (offset > full_len) ? offset + data_len : full_len + data_len - old_data_len;
+    Buffer content ((size_t) newlen);
+    char* dest = newlen ? &content [0] : NULL;
+    readRec (locator, dest, (BufLen) min_ (offset, full_len));
+    if (offset < full_len)
+        readRec (locator, dest + offset + data_len, (BufLen) (full_len - offset - old_data_len), offset + old_data_len);
+    if (data_len)
+        memcpy (dest + offset, data, data_len);
+    RecLocator newLocator = store_new_ (dest, newlen);
+    freeRec (locator);
+    return newLocator;
+}
+
+void* CompressedVStorage_imp::mapRec (RecLocator locator, RecOff offset, BufLen& len, bool write)
+{
+    return NULL;
+}
+
+void CompressedVStorage_imp::unmapRec (const void* data, bool dirty)
+{
+}
+
+// hinted prefetch 
+void CompressedVStorage_imp::hintAdd (VRecDescriptor* descriptors, uint32 number)
+{
+}
+
+void CompressedVStorage_imp::hintReset ()
+{
+}
+
+// record enumeration
+RecNum CompressedVStorage_imp::getRecCount () const
+{
+    return store_.getRecCount () - 1 - bodies_;
+}
+
+bool CompressedVStorage_imp::firstRec (VRecDescriptor& rec)
+{
+    if (!store_.firstRec (rec))
+        return false;
+    return skip_ (rec);
+}
+
+bool CompressedVStorage_imp::nextRec (VRecDescriptor& rec)
+{
+    rec.length_ = store_.getRecLen (rec.locator_);
+    if (!store_.nextRec (rec))
+        return false;
+    return skip_ (rec);
+}
+
+void CompressedVStorage_imp::scan (VRecScan& receiver, uint32 threads)
+{
+    Unpack unpack (*this, receiver);
+    store_.scan (unpack, threads);
+}
+
+// storage - level operations     
+bool CompressedVStorage_imp::flush ()
+{
+    PackHdr meta = {PACK_META, chunk_, bodies_, 0, RECLOCATOR_MAX};
+    store_.writeRec (meta_, &meta, sizeof (meta));
+    return store_.flush ();
+}
+
+bool CompressedVStorage_imp::close ()
+{
+    PackHdr meta = {PACK_META, chunk_, bodies_, 0, RECLOCATOR_MAX};
+    store_.writeRec (meta_, &meta, sizeof (meta));
+    return store_.close ();
+}
+
+bool CompressedVStorage_imp::isOpen () const
+{
+    return store_.isOpen ();
+}
+
+bool CompressedVStorage_imp::compact (VRecRemap& remap, uint64 maxBytes)
+{
+    Remap bodyRemap (*this, remap);
+    return store_.compact (bodyRemap, maxBytes);
+}
+
+// statistics
+uint64 CompressedVStorage_imp::usedSpace () const
+{
+    return store_.usedSpace ();
+}
+
+uint64 CompressedVStorage_imp::freeSpace () const
+{
+    return store_.freeSpace ();
+}
+
+uint64 CompressedVStorage_imp::usedCount () const
+{
+    return store_.usedCount () - 1 - bodies_;
+}
+
+uint64 CompressedVStorage_imp::freeCount () const
+{
+    return store_.freeCount ();
+}
+
+};
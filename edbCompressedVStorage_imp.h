@@ -0,0 +1,140 @@
+//////////////////////////////////////////////////////////////////////////////
+//// This software module is developed by SciDM (Scientific Data Management) in 1998-2015
+//// 
+//// This program is free software; you can redistribute, reuse,
+//// or modify it with no restriction, under the terms of the MIT License.
+//// 
+//// This program is distributed in the hope that it will be useful,
+//// but WITHOUT ANY WARRANTY; without even the implied warranty of
+//// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//// 
+//// For any questions please contact Denis Kaznadzey at dkaznadzey@yahoo.com
+//////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef edbCompressedVStorage_imp_h
+#define edbCompressedVStorage_imp_h
+
+#include "edbVStorage_imp.h"
+#include <vector>
+
+namespace edb
+{
+
+// Variable-length storage keeping every record compressed. Sits on top of the VStorage_imp of 
+// a file with PackedSignature; each record of that storage holds:
+// HEADER       (sizeof (PackHdr)) bytes                kind, unpacked length, length of the frames, link
+// FRAMES       (PackHdr::stored_) bytes                the record cut to PACK_CHUNK pieces, each packed 
+//                                                      by lz4Compress or stored as is when it does not shrink
+// FRAME ENDS   (chunk count * sizeof (uint64)) bytes   end of each frame relative to FRAMES start, FRAME_RAW bit 
+//                                                      set for the frames stored as is
+// so that a read at an offset only unpacks the frames it touches. A record that outgrows its block when 
+// rewritten (writeRec may not change the locator) is moved to a body record, and its original block 
+// is cut down to a stub holding the body locator. The first record of the file holds the storage 
+// parameters (meta record). mapRec is not supported: VRecStream falls back to read and write.
+
+class CompressedVStorage_imp : public VStorage
+{
+    enum { PACK_META = 0x4d6b6150, PACK_HEAD = 0x486b6150, PACK_STUB = 0x536b6150, PACK_BODY = 0x426b6150 };
+    struct PackHdr
+    {
+        uint32      kind_;
+        uint32      chunk_;     // meta: unpacked size of the frames, unused otherwise
+        RecLen      length_;    // unpacked record length; meta: number of bodies
+        RecLen      stored_;    // length of the frames
+        RecLocator  link_;      // stub: the body; body: the stub; RECLOCATOR_MAX otherwise
+    };
+    typedef std::vector <uint64> FrameEnds;
+    typedef std::vector <char> Buffer;
+
+    // remaps the locators for VStorage_imp::compact: keeps stubs and bodies linked, hides the bodies from the caller
+    class Remap : public VRecRemap
+    {
+    public:
+                Remap (CompressedVStorage_imp& storage, VRecRemap& target) : storage_ (storage), target_ (target) {}
+        void    remap (RecLocator oldLocator, RecLocator newLocator, RecLen length);
+    private:
+        CompressedVStorage_imp& storage_;
+        VRecRemap& target_;
+    };
+
+    // unpacks the records found by VStorage_imp::scan, passes on the user ones (the bodies under their stubs' locators)
+    class Unpack : public VRecScan
+    {
+    public:
+                Unpack (const CompressedVStorage_imp& storage, VRecScan& target) : storage_ (storage), target_ (target) {}
+        void    records (const VRecDescriptor* recs, const void* const* data, uint32 number);
+    private:
+        const CompressedVStorage_imp& storage_;
+        VRecScan& target_;
+    };
+
+    VStorage_imp&   store_;
+    RecLocator      meta_; // locator of the meta record
+    BufLen          chunk_;
+    uint64          bodies_;
+    Buffer          plain_; // one unpacked chunk
+    Buffer          packed_; // one packed chunk
+    Buffer          zeros_; // packed frame of a full chunk of zeros
+
+protected:
+    void        setup_         (); // allocates the buffers for the chunk size, packs the chunk of zeros
+    void        read_hdr_      (PackHdr& hdr, RecLocator locator); // reads the header of the record at locator
+    RecLocator  resolve_       (PackHdr& hdr, RecLocator locator); // reads the header of the frames holder of the user record (the record or its body), returns its locator
+    void        read_ends_     (RecLocator holder, const PackHdr& hdr, uint32 first, uint32 count, FrameEnds& ends); // reads count frame ends starting from first
+    uint32      chunks_        (RecLen length) const { return (uint32) ((length + chunk_ - 1) / chunk_); }
+    BufLen      chunklen_      (RecLen length, uint32 chunk) const; // unpacked length of the chunk
+    RecLen      image_         (const PackHdr& hdr) const; // length of the stored image of the frames holder
+    void        add_frame_     (const char* plain, BufLen len, Buffer& frames, FrameEnds& ends, uint64 base); // packs len bytes (zeros if plain is NULL), appends the frame and its end
+    void        unpack_        (RecLocator holder, uint64 start, uint64 end, BufLen len); // reads the frame [start, end) of len unpacked bytes into plain_
+    RecLocator  replace_       (RecLocator& locator, PackHdr& hdr, RecLocator holder, RecLen image, RecLen start, RecLen end, const Buffer& data, bool canMove); // replaces [start, end) of the holder's image, writes the headers
+    RecLocator  store_new_     (const void* data, RecLen len); // creates the record of len bytes of data, or zeros if data is NULL
+    bool        skip_          (VRecDescriptor& rec); // advances the enumeration to a user record
+    void        unpack_image_  (const char* image, const PackHdr& hdr, char* dest) const; // unpacks the record from its stored image
+
+public:
+                CompressedVStorage_imp  (VStorage_imp& store);
+                ~CompressedVStorage_imp ();
+    void        init_          (); // puts the meta record into the empty storage
+    void        open_          (); // reads the meta record
+
+    // record - level operations 
+    bool        isValid        (RecLocator locator);
+    RecLocator  allocRec       (RecLen len);
+    RecLen      getRecLen      (RecLocator locator);
+    RecLocator  addRec         (const void* data, RecLen len);
+    RecLocator  reallocRec     (RecLocator locator, RecLen len);
+    bool        readRec        (RecLocator locator, void* data, BufLen len, RecOff offset = 0);
+    bool        readRecs       (const VRecDescriptor* recs, uint32 number, void* const* buffers);
+    bool        writeRec       (RecLocator locator, const void* data, BufLen len, RecOff offset = 0);
+    bool        freeRec        (RecLocator locator);
+	RecLocator  sliceRec       (RecLocator locator, const void* data, BufLen data_len, RecOff offset, RecLen old_data_len, RecLen full_len);
+    void*       mapRec         (RecLocator locator, RecOff offset, BufLen& len, bool write);
+    void        unmapRec       (const void* data, bool dirty);
+
+    // hinted prefetch 
+    void        hintAdd        (VRecDescriptor* descriptors, uint32 number);
+    void        hintReset      ();
+
+    // record enumeration
+    RecNum      getRecCount    () const;
+    bool        firstRec	   (VRecDescriptor& rec);
+    bool        nextRec	       (VRecDescriptor& rec);
+    void        scan           (VRecScan& receiver, uint32 threads);
+
+    // storage - level operations     
+    bool        flush          ();
+    bool        close          ();
+    bool        isOpen         () const;
+    bool        compact        (VRecRemap& remap, uint64 maxBytes);
+
+    // statistics; the space is the one taken by the packed records
+    uint64      usedSpace      () const;
+    uint64      freeSpace      () const;
+    uint64      usedCount      () const;
+    uint64      freeCount      () const;
+};
+
+};
+
+#endif
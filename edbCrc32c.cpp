@@ -0,0 +1,203 @@
+//////////////////////////////////////////////////////////////////////////////
+//// This software module is developed by SciDM (Scientific Data Management) in 1998-2015
+//// 
+//// This program is free software; you can redistribute, reuse,
+//// or modify it with no restriction, under the terms of the MIT License.
+//// 
+//// This program is distributed in the hope that it will be useful,
+//// but WITHOUT ANY WARRANTY; without even the implied warranty of
+//// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//// 
+//// For any questions please contact Denis Kaznadzey at dkaznadzey@yahoo.com
+//////////////////////////////////////////////////////////////////////////////
+
+#include "edbCrc32c.h"
+#include <string.h>
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#define CRC32C_SSE42
+#include <nmmintrin.h>
+#define CRC32C_TARGET __attribute__ ((target ("sse4.2")))
+#elif defined (_MSC_VER) && (defined (_M_X64) || defined (_M_IX86))
+#define CRC32C_SSE42
+#include <nmmintrin.h>
+#include <intrin.h>
+#define CRC32C_TARGET
+#endif
+
+namespace edb
+{
+
+static const uint32 CRC32C_POLY = 0x82f63b78; // reflected
+
+// the table for the bytewise computation, made on first use
+static uint32 crcTable [256];
+static bool crcTableReady = false;
+
+static void makeTable ()
+{
+    for (uint32 i = 0; i < 256; i ++)
+    {
+        uint32 c = i;
+        for (int b = 0; b < 8; b ++)
+            c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : (c >> 1);
+        crcTable [i] = c;
+    }
+    crcTableReady = true;
+}
+
+static uint32 crc32cTable (const unsigned char* p, size_t len, uint32 c)
+{
+    if (!crcTableReady) makeTable ();
+    while (len --)
+        c = crcTable [(c ^ *p ++) & 0xff] ^ (c >> 8);
+    return c;
+}
+
+#if defined (CRC32C_SSE42)
+
+static bool detectSse42 ()
+{
+#if defined (_MSC_VER)
+    int info [4];
+    __cpuid (info, 1);
+    return (info [2] & (1 << 20)) != 0;
+#else
+    __builtin_cpu_init ();
+    return __builtin_cpu_supports ("sse4.2") != 0;
+#endif
+}
+
+// The instruction takes three cycles, but a new one can start every cycle: three streams of the data are 
+// run at once, on the adjacent blocks, and their checksums are put together after, by shifting the checksum of 
+// the preceding blocks over the length of a block (as if it was followed by that many zeros).
+// The shift is a linear operator over GF(2), applied by the tables for the four bytes of the checksum
+static const size_t LONG_BLOCK = 0x2000;
+static const size_t SHORT_BLOCK = 0x100;
+static uint32 longShift [4][256];
+static uint32 shortShift [4][256];
+
+static uint32 matrixTimes (const uint32* mat, uint32 vec)
+{
+    uint32 sum = 0;
+    for (; vec; vec >>= 1, mat ++)
+        if (vec & 1)
+            sum ^= *mat;
+    return sum;
+}
+
+static void matrixSquare (uint32* square, const uint32* mat)
+{
+    for (int n = 0; n < 32; n ++)
+        square [n] = matrixTimes (mat, mat [n]);
+}
+
+// the operator appending len zero bytes, len being a power of two
+static void makeShift (uint32 table [4][256], size_t len)
+{
+    uint32 op [32], sq [32];
+    // one zero bit
+    op [0] = CRC32C_POLY;
+    for (int n = 1; n < 32; n ++)
+        op [n] = 1u << (n - 1);
+    // squared three times for a byte, then once per doubling
+    for (size_t bits = 1; bits < len * 8; bits <<= 1)
+    {
+        matrixSquare (sq, op);
+        memcpy (op, sq, sizeof (op));
+    }
+    for (uint32 n = 0; n < 256; n ++)
+    {
+        table [0][n] = matrixTimes (op, n);
+        table [1][n] = matrixTimes (op, n << 8);
+        table [2][n] = matrixTimes (op, n << 16);
+        table [3][n] = matrixTimes (op, n << 24);
+    }
+}
+
+static inline uint32 shift (uint32 table [4][256], uint32 c)
+{
+    return table [0][c & 0xff] ^ table [1][(c >> 8) & 0xff] ^ table [2][(c >> 16) & 0xff] ^ table [3][c >> 24];
+}
+
+static bool initSse42 ()
+{
+    if (!detectSse42 ()) return false;
+    makeShift (longShift, LONG_BLOCK);
+    makeShift (shortShift, SHORT_BLOCK);
+    return true;
+}
+
+static const bool hasSse42 = initSse42 ();
+
+#if defined (__x86_64__) || defined (_M_X64)
+#define CRC32C_WORD uint64
+#define CRC32C_STEP _mm_crc32_u64
+#else
+#define CRC32C_WORD uint32
+#define CRC32C_STEP _mm_crc32_u32
+#endif
+
+// runs three streams over the data by blocks of the given size while it lasts
+CRC32C_TARGET static uint32 crc32cStreams (const unsigned char*& p, size_t& len, uint32 c, size_t block, uint32 table [4][256])
+{
+    CRC32C_WORD c0 = c;
+    while (len >= block * 3)
+    {
+        CRC32C_WORD c1 = 0, c2 = 0;
+        const unsigned char* end = p + block;
+        for (; p < end; p += sizeof (CRC32C_WORD))
+        {
+            c0 = CRC32C_STEP ((uint32) c0, *(const CRC32C_WORD*) p);
+            c1 = CRC32C_STEP ((uint32) c1, *(const CRC32C_WORD*) (p + block));
+            c2 = CRC32C_STEP ((uint32) c2, *(const CRC32C_WORD*) (p + block * 2));
+        }
+        c0 = shift (table, (uint32) c0) ^ (uint32) c1;
+        c0 = shift (table, (uint32) c0) ^ (uint32) c2;
+        p += block * 2;
+        len -= block * 3;
+    }
+    return (uint32) c0;
+}
+
+// the unaligned head and the tail go by bytes
+CRC32C_TARGET static uint32 crc32cSse42 (const unsigned char* p, size_t len, uint32 c)
+{
+    while (len && ((size_t) p & 7))
+    {
+        c = _mm_crc32_u8 (c, *p ++);
+        len --;
+    }
+    c = crc32cStreams (p, len, c, LONG_BLOCK, longShift);
+    c = crc32cStreams (p, len, c, SHORT_BLOCK, shortShift);
+    CRC32C_WORD cw = c;
+    for (; len >= sizeof (CRC32C_WORD); len -= sizeof (CRC32C_WORD), p += sizeof (CRC32C_WORD))
+        cw = CRC32C_STEP ((uint32) cw, *(const CRC32C_WORD*) p);
+    c = (uint32) cw;
+    while (len --)
+        c = _mm_crc32_u8 (c, *p ++);
+    return c;
+}
+
+#endif
+
+uint32 crc32c (const void* data, size_t len, uint32 crc)
+{
+    const unsigned char* p = (const unsigned char*) data;
+#if defined (CRC32C_SSE42)
+    if (hasSse42)
+        return ~crc32cSse42 (p, len, ~crc);
+#endif
+    return ~crc32cTable (p, len, ~crc);
+}
+
+bool crc32cHardware ()
+{
+#if defined (CRC32C_SSE42)
+    return hasSse42;
+#else
+    return false;
+#endif
+}
+
+};
@@ -0,0 +1,33 @@
+//////////////////////////////////////////////////////////////////////////////
+//// This software module is developed by SciDM (Scientific Data Management) in 1998-2015
+//// 
+//// This program is free software; you can redistribute, reuse,
+//// or modify it with no restriction, under the terms of the MIT License.
+//// 
+//// This program is distributed in the hope that it will be useful,
+//// but WITHOUT ANY WARRANTY; without even the implied warranty of
+//// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//// 
+//// For any questions please contact Denis Kaznadzey at dkaznadzey@yahoo.com
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef edbCrc32c_h
+#define edbCrc32c_h
+
+#include "edbTypes.h"
+#include <stddef.h>
+
+// CRC32C (Castagnoli polynomial, as iSCSI and ext4 use it). Computed by the SSE 4.2 crc32 instruction 
+// when the processor has it, by table otherwise; both give the same values. Used for the page checksums of the Pager
+
+namespace edb
+{
+
+// the checksum of len bytes; passing the checksum of the preceding bytes as crc continues it
+uint32 crc32c (const void* data, size_t len, uint32 crc = 0);
+// true if the instruction is used
+bool   crc32cHardware ();
+
+};
+
+#endif
@@ -28,6 +28,8 @@ public:
     bool        close          (File& file);
     bool        hintAdd        (File& file, FileCacheHint* hints, int hintno);
     bool        hintReset      (File& file);
+    void*       pin            (File& file, FilePos offset, BufLen& size) { return NULL; }
+    void        unpin          (const void* data, bool dirty) {}
 
     uint32      getSize        () const;
     bool        setSize        (uint32 size);
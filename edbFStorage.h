@@ -31,6 +31,15 @@ public:
     virtual bool        readRec        (RecNum recnum, void* data) = 0;
     virtual bool        writeRec       (RecNum recnum, void* data) = 0;
     virtual bool        freeRec        (RecNum recnum) = 0;
+    // bulk operations: data holds the records one after another, reclen bytes each. Bit i of valid (if not NULL) is set 
+    // for the i-th record transferred, cleared for the free and missing ones, whose data is left untouched. 
+    // Return the number of records transferred
+    // records first .. first + count - 1, read or written by runs of adjacent records 
+    virtual RecNum      readRecs       (RecNum first, RecNum count, void* data, uint8* valid = NULL) = 0;
+    virtual RecNum      writeRecs      (RecNum first, RecNum count, const void* data, uint8* valid = NULL) = 0;
+    // records recnums [0] .. recnums [number - 1], in any order; the ones lying close to each other share a read or write
+    virtual RecNum      readRecsAt     (const RecNum* recnums, uint32 number, void* data, uint8* valid = NULL) = 0;
+    virtual RecNum      writeRecsAt    (const RecNum* recnums, uint32 number, const void* data, uint8* valid = NULL) = 0;
 
     // hinted prefetch 
     virtual void        hintAdd        (RecNum* recnum_buffer, uint32 number) = 0;
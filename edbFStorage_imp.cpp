@@ -14,6 +14,7 @@
 #define FStorageFactory_defined
 #include "edbFStorage_imp.h"
 #include "edbExceptions.h"
+#include <algorithm>
 
 namespace edb
 {
@@ -22,6 +23,11 @@ FStorageFactory& fStorageFactory = theFactory;
 
 #define FSTORAGE_IMP_DEBUG
 
+// bulk operations move up to BULK_SPAN bytes of the file by one call; the listed records 
+// lying up to BULK_GAP bytes apart share the call
+static const FilePos BULK_SPAN = 0x100000;
+static const FilePos BULK_GAP = 0x1000;
+
 inline FilePos FStorage_imp::first_ ()
 {
     return sizeof (FileHdr) + hdr_.hdrsize_;
@@ -30,9 +36,14 @@ inline FilePos FStorage_imp::first_free_ ()
 {
     return offset_ (hdr_.rectotal_);   
 }
+inline FilePos FStorage_imp::slotlen_ ()
+{
+    // a free record holds the free list link
+    return max_ (hdr_.reclen_, (FRecLen) sizeof (RecNum)) + 1;
+}
 inline FilePos FStorage_imp::offset_ (RecNum recno)
 {
-    return first_ () + recno * (hdr_.reclen_ + 1);
+    return first_ () + recno * slotlen_ ();
 }
 
 FStorage_imp::FStorage_imp   (File& file)
@@ -56,7 +67,7 @@ void FStorage_imp::open_ ()
     hdr_.clean_ ();
     if (file_.seek (0) != 0) 
         throw SeekError ();
-    if (file_.read (&hdr_, sizeof (hdr_) != sizeof (hdr_)))
+    if (file_.read (&hdr_, sizeof (hdr_)) != sizeof (hdr_))
         throw WrongFileType ();
     if (memcmp (hdr_.sign_, FileSignature, sizeof (FileSignature)))
         throw WrongFileType ();
@@ -91,10 +102,32 @@ bool FStorage_imp::isValid (RecNum recnum)
 RecNum FStorage_imp::allocRec ()
 {
     RecNum unused = hdr_.rectotal_;
-    hdr_.rectotal_ ++;
+    FilePos off;
+    if (hdr_.freehead_ != RECNUM_MAX)
+    {
+        // take the head of the free list
+        unused = hdr_.freehead_;
+        off = offset_ (unused);
+        uint8 freeflag;
+        RecNum next;
+        if (file_.seek (off) != off) 
+            throw SeekError ();
+        if (file_.read (&freeflag, sizeof (freeflag)) != sizeof (freeflag)) 
+            throw ReadError ();
+        if (file_.read (&next, sizeof (next)) != sizeof (next)) 
+            throw ReadError ();
+        if (freeflag != FREEFLAG || (next != RECNUM_MAX && next >= hdr_.rectotal_) || !hdr_.freetotal_)
+            throw FileStructureCorrupt ();
+        hdr_.freehead_ = next;
+        hdr_.freetotal_ --;
+    }
+    else
+    {
+        off = offset_ (unused);
+        hdr_.rectotal_ ++;
+    }
 
     uint8 freeflag = USEDFLAG;
-    FilePos off = offset_ (unused);
     if (file_.seek (off) != off) 
         throw SeekError ();
     if (file_.write (&freeflag, sizeof (freeflag)) != sizeof (freeflag)) 
@@ -175,16 +208,162 @@ bool FStorage_imp::freeRec (RecNum recnum)
     if (freeflag == FREEFLAG)
         return false;
 
-    freeflag = FREEFLAG;
+    // the record becomes the head of the free list
+    char slot [sizeof (freeflag) + sizeof (RecNum)];
+    slot [0] = FREEFLAG;
+    memcpy (slot + sizeof (freeflag), &hdr_.freehead_, sizeof (RecNum));
     if (file_.seek (off) != off) 
         throw SeekError ();
-    if (file_.write (&freeflag, sizeof (freeflag)) != sizeof (freeflag)) 
+    if (file_.write (slot, sizeof (slot)) != sizeof (slot)) 
         throw WriteError ();
+    hdr_.freehead_ = recnum;
     hdr_.freetotal_ ++;
     return true;
 }
 
 
+inline RecNum FStorage_imp::runlen_ ()
+{
+    return max_ (BULK_SPAN / slotlen_ (), (FilePos) 1);
+}
+
+void FStorage_imp::run_ (RecNum first, RecNum count, std::vector <char>& buf, bool write)
+{
+    BufLen len = (BufLen) (count * slotlen_ ());
+    buf.resize (len);
+    FilePos off = offset_ (first);
+    if (file_.seek (off) != off) 
+        throw SeekError ();
+    if (write)
+    {
+        if (file_.write (&buf [0], len) != len) 
+            throw WriteError ();
+    }
+    else if (file_.read (&buf [0], len) != len) 
+        throw ReadError ();
+}
+
+bool FStorage_imp::transfer_ (std::vector <char>& buf, RecNum slot, char* rdata, const char* wdata)
+{
+    char* rec = &buf [(size_t) (slot * slotlen_ ())];
+    uint8 freeflag = *rec;
+#ifdef FSTORAGE_IMP_DEBUG
+    if (freeflag != FREEFLAG && freeflag != USEDFLAG)
+        ERR("Wrong value for free flag!");
+#endif
+    if (freeflag == FREEFLAG)
+        return false;
+    if (rdata)
+        memcpy (rdata, rec + 1, hdr_.reclen_);
+    else
+        memcpy (rec + 1, wdata, hdr_.reclen_);
+    return true;
+}
+
+RecNum FStorage_imp::bulk_ (RecNum first, RecNum count, char* rdata, const char* wdata, uint8* valid)
+{
+    if (valid)
+        memset (valid, 0, (size_t) ((count + 7) / 8));
+    if (first >= hdr_.rectotal_)
+        return 0;
+    count = min_ (count, hdr_.rectotal_ - first);
+    std::vector <char> buf;
+    RecNum done = 0;
+    for (RecNum start = 0; start < count; )
+    {
+        RecNum len = min_ (count - start, runlen_ ());
+        run_ (first + start, len, buf, false);
+        RecNum moved = 0;
+        for (RecNum slot = 0; slot < len; slot ++)
+        {
+            RecNum pos = start + slot;
+            if (!transfer_ (buf, slot, rdata ? rdata + pos * hdr_.reclen_ : NULL, wdata ? wdata + pos * hdr_.reclen_ : NULL))
+                continue;
+            if (valid)
+                valid [pos / 8] |= (uint8) (1 << (pos % 8));
+            moved ++;
+        }
+        // the free records go back with their links as read
+        if (wdata && moved)
+            run_ (first + start, len, buf, true);
+        done += moved;
+        start += len;
+    }
+    return done;
+}
+
+// orders the indexes of the record numbers
+struct ByRecNum
+{
+    ByRecNum (const RecNum* recnums) : recnums_ (recnums) {}
+    bool operator () (uint32 i1, uint32 i2) const { return recnums_ [i1] < recnums_ [i2]; }
+    const RecNum* recnums_;
+};
+
+RecNum FStorage_imp::gather_ (const RecNum* recnums, uint32 number, char* rdata, const char* wdata, uint8* valid)
+{
+    if (valid)
+        memset (valid, 0, (number + 7) / 8);
+    std::vector <uint32> order (number);
+    for (uint32 idx = 0; idx < number; idx ++)
+        order [idx] = idx;
+    // stable: of the repeated records, the last one in the list is written last
+    std::stable_sort (order.begin (), order.end (), ByRecNum (recnums));
+    RecNum gap = BULK_GAP / slotlen_ ();
+    std::vector <char> buf;
+    RecNum done = 0;
+    uint32 pos = 0;
+    while (pos < number && recnums [order [pos]] < hdr_.rectotal_)
+    {
+        // the run of records reached by one call
+        RecNum first = recnums [order [pos]];
+        uint32 end = pos + 1;
+        while (end < number)
+        {
+            RecNum recnum = recnums [order [end]];
+            if (recnum >= hdr_.rectotal_ || recnum - first >= runlen_ () || recnum > recnums [order [end - 1]] + gap + 1)
+                break;
+            end ++;
+        }
+        RecNum len = recnums [order [end - 1]] - first + 1;
+        run_ (first, len, buf, false);
+        RecNum moved = 0;
+        for (; pos < end; pos ++)
+        {
+            uint32 idx = order [pos];
+            if (!transfer_ (buf, recnums [idx] - first, rdata ? rdata + (RecNum) idx * hdr_.reclen_ : NULL, wdata ? wdata + (RecNum) idx * hdr_.reclen_ : NULL))
+                continue;
+            if (valid)
+                valid [idx / 8] |= (uint8) (1 << (idx % 8));
+            moved ++;
+        }
+        if (wdata && moved)
+            run_ (first, len, buf, true);
+        done += moved;
+    }
+    return done;
+}
+
+RecNum FStorage_imp::readRecs (RecNum first, RecNum count, void* data, uint8* valid)
+{
+    return bulk_ (first, count, (char*) data, NULL, valid);
+}
+
+RecNum FStorage_imp::writeRecs (RecNum first, RecNum count, const void* data, uint8* valid)
+{
+    return bulk_ (first, count, NULL, (const char*) data, valid);
+}
+
+RecNum FStorage_imp::readRecsAt (const RecNum* recnums, uint32 number, void* data, uint8* valid)
+{
+    return gather_ (recnums, number, (char*) data, NULL, valid);
+}
+
+RecNum FStorage_imp::writeRecsAt (const RecNum* recnums, uint32 number, const void* data, uint8* valid)
+{
+    return gather_ (recnums, number, NULL, (const char*) data, valid);
+}
+
 // hinted prefetch 
 void FStorage_imp::hintAdd (RecNum* recnum_buffer, uint32 number)
 {
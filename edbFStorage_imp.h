@@ -18,6 +18,7 @@
 #include "edbFStorage.h"
 
 #include <string.h>
+#include <vector>
 
 // Layout of the FixedLengthStorage file:
 // --- BEGIN OF FILE ---
@@ -26,11 +27,14 @@
 // rectotal     sizeof (RecNum)
 // freetotal    sizeof (RecNum)
 // headersize   sizeof (FRecLen)
+// freehead     sizeof (RecNum)                 first record of the free list, RECNUM_MAX if none
 // header       headersize bytes
 // Records array - rectotal records
 //      consists of Records:
 //          1 byte          freeflag (USEDFLAG for used; FREEFLAG for free)
-//          reclen bytes    data
+//          reclen bytes    data; at least sizeof (RecNum) bytes are taken
+//      in the free records, the data starts with the number of the next free record (RECNUM_MAX for the last one),
+//      so that allocRec reuses the most recently freed record
 
 
 namespace edb
@@ -51,12 +55,13 @@ class FStorage_imp : public FStorage
     struct FileHdr 
     {
         FileHdr () { clean_ (); }
-        void clean_ () { reclen_ = 0, rectotal_ = 0L, freetotal_ = 0L, hdrsize_ = 0; memset (sign_, 0, sizeof (FileSignature)); }
+        void clean_ () { reclen_ = 0, rectotal_ = 0L, freetotal_ = 0L, hdrsize_ = 0, freehead_ = RECNUM_MAX; memset (sign_, 0, sizeof (FileSignature)); }
         char        sign_ [sizeof (FileSignature)];
         FRecLen     reclen_;
         RecNum      rectotal_;
         RecNum      freetotal_;
         FRecLen     hdrsize_;
+        RecNum      freehead_;
     };
 #ifdef _MSC_VER
 //#pragma warning (pop)
@@ -73,6 +78,12 @@ class FStorage_imp : public FStorage
     FilePos     first_ ();
     FilePos     first_free_ ();
     FilePos     offset_ (RecNum recno);
+    FilePos     slotlen_ (); // the length of the record in the file, with the free flag
+    RecNum      runlen_ (); // the number of records moved by one bulk read or write
+    void        run_    (RecNum first, RecNum count, std::vector <char>& buf, bool write); // reads or writes count whole records at first
+    bool        transfer_ (std::vector <char>& buf, RecNum slot, char* rdata, const char* wdata); // copies the data of the slot-th record of the run in buf to rdata or from wdata; false if the record is free
+    RecNum      bulk_   (RecNum first, RecNum count, char* rdata, const char* wdata, uint8* valid); // readRecs / writeRecs of a range
+    RecNum      gather_ (const RecNum* recnums, uint32 number, char* rdata, const char* wdata, uint8* valid); // readRecsAt / writeRecsAt
 
                 FStorage_imp   (File& file);
 public:
@@ -83,6 +94,10 @@ public:
     bool        readRec        (RecNum recnum, void* data);
     bool        writeRec       (RecNum recnum, void* data);
     bool        freeRec        (RecNum recnum);
+    RecNum      readRecs       (RecNum first, RecNum count, void* data, uint8* valid = NULL);
+    RecNum      writeRecs      (RecNum first, RecNum count, const void* data, uint8* valid = NULL);
+    RecNum      readRecsAt     (const RecNum* recnums, uint32 number, void* data, uint8* valid = NULL);
+    RecNum      writeRecsAt    (const RecNum* recnums, uint32 number, const void* data, uint8* valid = NULL);
 
     // hinted prefetch 
     void        hintAdd        (RecNum* recnum_buffer, uint32 number);
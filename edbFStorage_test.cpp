@@ -23,6 +23,9 @@
 #include <iomanip>
 #include "i64out.h"
 #include <set>
+#include <string.h>
+#include <time.h>
+#include <vector>
 
 namespace edb
 {
@@ -153,8 +156,204 @@ static bool naiveTest ()
     return true;
 }
 
+// random frees and allocations over a fixed number of live records: the freed records are reused,
+// so the file does not grow past the live set
+static const uint32 CHURNRECS = 10000;
+static const uint32 CHURNSTEPS = 1000000;
+static const uint32 CHURNREPORT = 200000;
+
+static bool churnTest ()
+{
+    if (splitFileFactory.exists (tstd, tstn))
+        splitFileFactory.erase (tstd, tstn);
+    File& f = splitFileFactory.create (tstd, tstn);
+    File& cf = cachedFileFactory.wrap (f);
+    FStorage& fs = fStorageFactory.init (cf, reclen, hdrlen);
+    char buf [reclen];
+    memset (buf, 0, reclen);
+    RecNum* live = new RecNum [CHURNRECS];
+    uint32 idx;
+    for (idx = 0; idx < CHURNRECS; idx ++)
+    {
+        *(uint64*) buf = idx;
+        live [idx] = fs.addRec (buf);
+    }
+    fs.flush ();
+    uint64 initLen = cf.length ();
+    clock_t start = clock ();
+    for (uint32 step = 1; step <= CHURNSTEPS; step ++)
+    {
+        idx = (uint32) ((rand () * (RAND_MAX + 1.0) + rand ()) / ((RAND_MAX + 1.0) * (RAND_MAX + 1.0)) * CHURNRECS);
+        if (!fs.readRec (live [idx], buf) || *(uint64*) buf != idx)
+            ERR ("churnTest: record lost");
+        fs.freeRec (live [idx]);
+        live [idx] = fs.addRec (buf);
+        if (step % CHURNREPORT == 0)
+        {
+            fs.flush ();
+            std::cerr << "Steps : " << std::setw (9) << step << ", file size : " << std::setw (9) << cf.length () << ", records : " << fs.getRecCount () + fs.getFreeCount () << ", elapsed " << (double) (clock () - start) / CLOCKS_PER_SEC << " sec" << std::endl;
+        }
+    }
+    if (fs.getRecCount () != CHURNRECS || fs.getFreeCount () != 0 || cf.length () != initLen)
+        ERR ("churnTest: file grew under churn");
+    // the free list survives reopening
+    for (idx = 0; idx < CHURNRECS; idx += 2)
+        fs.freeRec (live [idx]);
+    fs.close ();
+    File& rf = splitFileFactory.open (tstd, tstn);
+    File& rcf = cachedFileFactory.wrap (rf);
+    FStorage& rfs = fStorageFactory.wrap (rcf);
+    if (rfs.getFreeCount () != CHURNRECS / 2)
+        ERR ("churnTest: free count lost on reopen");
+    for (idx = 0; idx < CHURNRECS; idx ++)
+    {
+        if (idx % 2 == 0)
+        {
+            *(uint64*) buf = idx;
+            live [idx] = rfs.addRec (buf);
+        }
+        else if (!rfs.readRec (live [idx], buf) || *(uint64*) buf != idx)
+            ERR ("churnTest: record lost on reopen");
+    }
+    if (rfs.getFreeCount () != 0 || rfs.getRecCount () != CHURNRECS)
+        ERR ("churnTest: free records not reused after reopen");
+    rfs.close ();
+    delete [] live;
+    splitFileFactory.erase (tstd, tstn);
+    return true;
+}
+
+// bulk and listed record I/O against the per-record loop, on an uncached and a cached file
+static const uint32 BULKRECS = 200000;
+static const uint32 BULKRUN = 4096;
+static const uint32 BULKLIST = 256;
+static const uint32 BULKLISTS = 2000;
+static const uint32 BULKWINDOW = 4096;
+
+static uint32 bulkValue (RecNum recnum, uint32 version)
+{
+    return (uint32) recnum * 3 + version;
+}
+
+static double secs (clock_t start)
+{
+    return (double) (clock () - start) / CLOCKS_PER_SEC;
+}
+
+static void checkBulk (const char* data, const uint8* valid, const RecNum* recnums, uint32 number, uint32 version)
+{
+    for (uint32 idx = 0; idx < number; idx ++)
+    {
+        bool used = (recnums [idx] % 10 != 7);
+        if (used != ((valid [idx / 8] >> (idx % 8)) & 1))
+            ERR ("bulkTest: wrong validity bit");
+        if (used && *(uint32*) (data + idx * reclen) != bulkValue (recnums [idx], version))
+            ERR ("bulkTest: wrong record data");
+    }
+}
+
+static bool bulkTest ()
+{
+    std::vector <char> data (BULKRUN * reclen);
+    std::vector <uint8> valid (BULKRUN / 8);
+    std::vector <RecNum> recnums (BULKRUN);
+    char buf [reclen];
+    memset (buf, 0, reclen);
+    for (int cached = 0; cached < 2; cached ++)
+    {
+        if (splitFileFactory.exists (tstd, tstn))
+            splitFileFactory.erase (tstd, tstn);
+        File& f = splitFileFactory.create (tstd, tstn);
+        File& sf = cached ? cachedFileFactory.wrap (f) : f;
+        FStorage& fs = fStorageFactory.init (sf, reclen);
+        const char* mode = cached ? "cached: " : "uncached: ";
+        RecNum recnum;
+        for (recnum = 0; recnum < BULKRECS; recnum ++)
+        {
+            *(uint32*) buf = bulkValue (recnum, 0);
+            fs.addRec (buf);
+        }
+        for (recnum = 7; recnum < BULKRECS; recnum += 10)
+            fs.freeRec (recnum);
+        fs.flush ();
+
+        // sequential
+        clock_t start = clock ();
+        for (recnum = 0; recnum < BULKRECS; recnum ++)
+            if (fs.readRec (recnum, buf) != (recnum % 10 != 7) || (recnum % 10 != 7 && *(uint32*) buf != bulkValue (recnum, 0)))
+                ERR ("bulkTest: readRec failed");
+        double single = secs (start);
+        start = clock ();
+        for (recnum = 0; recnum < BULKRECS; recnum += BULKRUN)
+        {
+            uint32 count = (uint32) min_ ((RecNum) BULKRUN, BULKRECS - recnum);
+            fs.readRecs (recnum, count, &data [0], &valid [0]);
+            for (uint32 idx = 0; idx < count; idx ++)
+                recnums [idx] = recnum + idx;
+            checkBulk (&data [0], &valid [0], &recnums [0], count, 0);
+        }
+        std::cerr << mode << "sequential read of " << BULKRECS << " records: by readRec " << single << " sec, by readRecs " << secs (start) << " sec" << std::endl;
+
+        // random lists over the whole file and within windows
+        for (int windowed = 0; windowed < 2; windowed ++)
+        {
+            srand (BULKRECS);
+            double list = 0;
+            single = 0;
+            for (uint32 lno = 0; lno < BULKLISTS; lno ++)
+            {
+                uint32 base = windowed ? rand () % (BULKRECS - BULKWINDOW) : 0;
+                uint32 range = windowed ? BULKWINDOW : BULKRECS;
+                for (uint32 idx = 0; idx < BULKLIST; idx ++)
+                    recnums [idx] = base + (uint32) ((rand () * (RAND_MAX + 1.0) + rand ()) / ((RAND_MAX + 1.0) * (RAND_MAX + 1.0)) * range);
+                start = clock ();
+                for (uint32 idx = 0; idx < BULKLIST; idx ++)
+                    fs.readRec (recnums [idx], &data [idx * reclen]);
+                single += secs (start);
+                start = clock ();
+                fs.readRecsAt (&recnums [0], BULKLIST, &data [0], &valid [0]);
+                list += secs (start);
+                checkBulk (&data [0], &valid [0], &recnums [0], BULKLIST, 0);
+            }
+            std::cerr << mode << BULKLISTS << " lists of " << BULKLIST << " records" << (windowed ? " within windows" : "") << ": by readRec " << single << " sec, by readRecsAt " << list << " sec" << std::endl;
+        }
+
+        // writes leave the free records and the free list alone
+        for (recnum = 0; recnum < BULKRECS; recnum += BULKRUN)
+        {
+            uint32 count = (uint32) min_ ((RecNum) BULKRUN, BULKRECS - recnum);
+            RecNum used = 0;
+            for (uint32 idx = 0; idx < count; idx ++)
+            {
+                *(uint32*) &data [idx * reclen] = bulkValue (recnum + idx, 1);
+                if ((recnum + idx) % 10 != 7)
+                    used ++;
+            }
+            if (fs.writeRecs (recnum, count, &data [0], &valid [0]) != used)
+                ERR ("bulkTest: writeRecs wrote free records");
+        }
+        for (uint32 idx = 0; idx < BULKLIST; idx ++)
+        {
+            recnums [idx] = (uint32) rand () % BULKRECS;
+            *(uint32*) &data [idx * reclen] = bulkValue (recnums [idx], 1);
+        }
+        fs.writeRecsAt (&recnums [0], BULKLIST, &data [0], &valid [0]);
+        checkBulk (&data [0], &valid [0], &recnums [0], BULKLIST, 1);
+        for (recnum = 0; recnum < BULKRECS; recnum ++)
+            if (recnum % 10 != 7 && (!fs.readRec (recnum, buf) || *(uint32*) buf != bulkValue (recnum, 1)))
+                ERR ("bulkTest: writeRecs lost data");
+        if (fs.allocRec () != BULKRECS - 3)
+            ERR ("bulkTest: free list broken");
+        fs.close ();
+    }
+    splitFileFactory.erase (tstd, tstn);
+    return true;
+}
+
 bool testFStorage ()
 {
+    bulkTest ();
+    churnTest ();
 	return naiveTest ();
 }
 
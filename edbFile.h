@@ -32,6 +32,8 @@ public:
     virtual bool        chsize         (FilePos newLength) = 0;
     virtual bool        commit         () = 0;
     virtual bool        close          () = 0;
+    // starts reading the range into the system cache in the background, where the system can; does not wait
+    virtual void        prefetch       (FilePos pos, FilePos len) {}
 };
 
 
@@ -36,6 +36,10 @@ public:
     virtual bool        close          (File& file) = 0;
     virtual bool        hintAdd        (File& file, FileCacheHint* hints, int hintno) = 0;
     virtual bool        hintReset      (File& file) = 0;
+    // direct access to the cached bytes at offset: locks the page and returns a pointer into it, 
+    // reducing size to what is left on that page; NULL if the cache does not keep pages
+    virtual void*       pin            (File& file, FilePos offset, BufLen& size) = 0;
+    virtual void        unpin          (const void* data, bool dirty) = 0; // unlocks the pinned page, marking it dirty if it was changed
 
     virtual uint32      getSize        () const = 0;
     virtual bool        setSize        (uint32 size) = 0;
@@ -31,21 +31,41 @@ public:
 
     virtual Fid         open           (const char* fname) = 0; // makes sure file is open and remembers in the managed set
     virtual Fid         create         (const char* fname) = 0; // creates the file and remembers in the managed set 
+    virtual int         openMany       (const char* const* fnames, int count, Fid* fids, FilePos* sizes = NULL, int threads = 1) = 0; // opens the (distinct) files as open does, by several threads at once, 
+                                                                // leaving open as many handles as the pool has room for; puts -1 into fids for the ones not found,
+                                                                // the file lengths into sizes if given. Returns the number of files opened
     virtual Fid         findFid        (const char* fname) = 0; // if the file open, returns fid; otherwise return -1
     virtual bool        isOpen         (const char* fname) = 0; // hecks weather the file is managed through handle cache. This does not relate to being PHYSICALLY open
     virtual bool        isValid        (Fid fid) = 0;           // checks weather the fileId is valid (open)
     virtual const char* findName       (Fid fid) = 0;           // finds the name for Fid if valid; otherwise, returns NULL
     virtual bool        close          (Fid fid) = 0;           // closes the file if open and removes entry from managed set
-    virtual int         handle         (Fid fid) = 0;           // returns the file handle; file pointer is positioned at the place last operation leaved it
+    virtual int         handle         (Fid fid) = 0;           // returns the file handle, valid until the next call from any thread; the file pointer is not kept over handle drops - use positional i/o
+    virtual int         acquire        (Fid fid) = 0;           // returns the file handle, kept open until release; may be called from several threads at once
+    virtual void        release        (Fid fid) = 0;
     virtual bool        commit         (Fid fid) = 0;           // makes sure  the file is actually flushed to disk (on currently closed just does nothing)
 
     virtual int         getPoolSize    () const = 0;            // handle pool size get and set
     virtual void        setPoolSize    (int newSize) = 0;       
     virtual uint64      getDropCount   () const = 0;            // how many handle displacements occured since the instantiation of handle manager
+    virtual uint64      getHitCount    () const = 0;            // how many times the handle was found open
 };
 
 #ifndef FileHandleMgr_defined
     extern FileHandleMgr& fileHandleMgr;
+
+// Scope guard holding a file handle acquired from fileHandleMgr
+class PinnedHandle
+{
+public:
+    PinnedHandle (Fid fid) : fid_ (fid), h_ (fileHandleMgr.acquire (fid)) {}
+    ~PinnedHandle () { fileHandleMgr.release (fid_); }
+    operator int () const { return h_; }
+private:
+    Fid fid_;
+    int h_;
+    PinnedHandle (const PinnedHandle&);
+    PinnedHandle& operator = (const PinnedHandle&);
+};
 #endif
 
 // exceptions
@@ -35,33 +35,117 @@ FileHandleMgr& fileHandleMgr = theFileHandleMgr;
 
 const int DEFAULT_HANDLE_POOL_SIZE = 200;
 
+// refs_ of a handle being closed: far below any count of pins
+static const int64 CLOSING = -((int64) 1 << 40);
+
+static const size_t INITIAL_BUCKETS = 0x400;
+
+// FNV-1a
+static uint32 hashName (const char* fname)
+{
+    uint32 hash = 2166136261u;
+    while (*fname)
+        hash = (hash ^ (unsigned char) *fname ++) * 16777619u;
+    return hash;
+}
+
 FileHandleMgr_imp::FileHandleMgr_imp ()
 {
+    memset (chunks_, 0, sizeof (chunks_));
+    fidcount_ = 0;
+    hand_ = 0;
+    names_ = 0;
+    buckets_.resize (INITIAL_BUCKETS, -1);
     poolSize_ = DEFAULT_HANDLE_POOL_SIZE;
-    drops_ = 0L;
+}
+
+FileHandleMgr_imp::~FileHandleMgr_imp ()
+{
+    for (int chunk = 0; chunk < MAX_CHUNKS && chunks_ [chunk]; chunk ++)
+        delete [] chunks_ [chunk];
 }
 
 Fid FileHandleMgr_imp::add (const char* fname)
 {
-    // find empty place
     Fid fid;
-    for (fid = 0; fid < files_.size (); fid ++)
+    if (freefids_.size ())
     {
-        FileInfo& fi = files_ [fid];
-        if (fi.free_)
-        {
-            fi.init (fname);
-            return fid;
-        }
+        fid = freefids_.back ();
+        freefids_.pop_back ();
     }
-    fid = files_.size ();
-    files_.resize (fid + 1);
-    files_ [fid].name_ = fname;
+    else
+    {
+        if (fidcount_ == MAX_CHUNKS * CHUNK_SIZE) ERR("Too many files");
+        fid = fidcount_;
+        if (!chunks_ [fid >> CHUNK_BITS])
+            chunks_ [fid >> CHUNK_BITS] = new FileInfo [CHUNK_SIZE];
+        fidcount_ ++;
+    }
+    FileInfo& fi = info_ (fid);
+    fi.name_ = fname;
+    fi.free_ = false;
+    hashin_ (fid);
     return fid;
 }
 
+Fid FileHandleMgr_imp::find_ (const char* fname) const
+{
+    uint32 hash = hashName (fname);
+    for (Fid fid = buckets_ [hash & (buckets_.size () - 1)]; fid != -1; fid = info_ (fid).hnext_)
+    {
+        const FileInfo& fi = info_ (fid);
+        if (fi.hash_ == hash && fi.name_ == fname)
+            return fid;
+    }
+    return -1;
+}
+
+void FileHandleMgr_imp::hashin_ (Fid fid)
+{
+    if (names_ >= buckets_.size ())
+        rehash_ (buckets_.size () * 2);
+    FileInfo& fi = info_ (fid);
+    fi.hash_ = hashName (fi.name_.c_str ());
+    Fid& head = buckets_ [fi.hash_ & (buckets_.size () - 1)];
+    fi.hnext_ = head;
+    head = fid;
+    names_ ++;
+}
+
+void FileHandleMgr_imp::hashout_ (Fid fid)
+{
+    FileInfo& fi = info_ (fid);
+    Fid* link = &buckets_ [fi.hash_ & (buckets_.size () - 1)];
+    while (*link != fid)
+        link = &info_ (*link).hnext_;
+    *link = fi.hnext_;
+    fi.hnext_ = -1;
+    names_ --;
+}
+
+void FileHandleMgr_imp::rehash_ (size_t buckets)
+{
+    buckets_.assign (buckets, -1);
+    for (Fid fid = 0; fid < fidcount_; fid ++)
+    {
+        FileInfo& fi = info_ (fid);
+        if (fi.free_) continue;
+        Fid& head = buckets_ [fi.hash_ & (buckets - 1)];
+        fi.hnext_ = head;
+        head = fid;
+    }
+}
+
+FileInfo* FileHandleMgr_imp::valid_ (Fid fid) const
+{
+    if (fid < 0 || fid >= fidcount_) return NULL;
+    FileInfo& fi = info_ (fid);
+    return fi.free_ ? NULL : &fi;
+}
+
 Fid FileHandleMgr_imp::open (const char* fname)
 {
+    MutexGuard guard (mutex_);
     // if allready open:
     if (findFid (fname) != -1) throw FileAllreadyOpen ();
     // test weather can open
@@ -74,6 +158,7 @@ Fid FileHandleMgr_imp::open (const char* fname)
 
 Fid FileHandleMgr_imp::create (const char* fname)
 {
+    MutexGuard guard (mutex_);
     // if allready open:
     if (findFid (fname) != -1) throw FileAllreadyOpen ();
     // test weather can open
@@ -84,98 +169,233 @@ Fid FileHandleMgr_imp::create (const char* fname)
     return add (fname);
 }
 
-Fid FileHandleMgr_imp::findFid (const char* fname)
+struct OpenJob
 {
-    NameFidMap::iterator itr = name2fid_.find (fname);
-    if (itr == name2fid_.end ())
-        return -1;
+    const char* const* fnames_;
+    int*        handles_;
+    FilePos*    sizes_;
+    int         count_;
+    int         keep_; // the handles of the files past this many are closed at once
+    Atomic      next_;
+};
+
+static void openFiles (void* arg)
+{
+    OpenJob& job = *(OpenJob*) arg;
+    int i;
+    while ((i = (int) job.next_.add (1) - 1) < job.count_)
+    {
+        int h = ::sci_sopen (job.fnames_ [i], _O_BINARY|_O_RDWR, _SH_DENYWR);
+        job.handles_ [i] = h;
+        if (h == -1) continue;
+        if (job.sizes_)
+            job.sizes_ [i] = ::sci_filelength (h);
+        if (i >= job.keep_)
+        {
+            ::sci_close (h);
+            job.handles_ [i] = -2; // opened but not kept
+        }
+    }
+}
+
+// the files are opened by the threads each taking the next one; the handles that fit into the pool 
+// are entered into the ring as they are, so the first accesses find them open
+int FileHandleMgr_imp::openMany (const char* const* fnames, int count, Fid* fids, FilePos* sizes, int threads)
+{
+    MutexGuard guard (mutex_);
+    int i;
+    for (i = 0; i < count; i ++)
+        if (find_ (fnames [i]) != -1) throw FileAllreadyOpen ();
+    if (threads < 1) threads = 1;
+    if (threads > count) threads = count;
+
+    std::vector <int> handles (count);
+    OpenJob job;
+    job.fnames_ = fnames;
+    job.handles_ = count ? &handles [0] : NULL;
+    job.sizes_ = sizes;
+    job.count_ = count;
+    job.keep_ = max_ (poolSize_ - (int) ring_.size (), 0);
+    if (threads > 1)
+    {
+        Thread* workers = new Thread [threads - 1];
+        for (i = 0; i < threads - 1; i ++)
+            workers [i].start (openFiles, &job);
+        openFiles (&job);
+        for (i = 0; i < threads - 1; i ++)
+            workers [i].join ();
+        delete [] workers;
+    }
     else
-        return (*itr).second;
+        openFiles (&job);
+
+    int opened = 0;
+    for (i = 0; i < count; i ++)
+    {
+        if (handles [i] == -1)
+        {
+            fids [i] = -1;
+            continue;
+        }
+        fids [i] = add (fnames [i]);
+        if (handles [i] != -2)
+            ring_in_ (fids [i], handles [i]);
+        opened ++;
+    }
+    return opened;
+}
+
+Fid FileHandleMgr_imp::findFid (const char* fname)
+{
+    MutexGuard guard (mutex_);
+    return find_ (fname);
 }
 
 bool FileHandleMgr_imp::isOpen (const char* fname)
 {
-    return (name2fid_.find (fname) != name2fid_.end ());
+    MutexGuard guard (mutex_);
+    return find_ (fname) != -1;
 }
 
 bool FileHandleMgr_imp::isValid (Fid fid)
 {
-    if (fid >= files_.size ()) return false;
-    if (files_ [fid].free_) return false;
-    return true;
+    return valid_ (fid) != NULL;
 }
 
 const char* FileHandleMgr_imp::findName (Fid fid)
 {
-    if (!isValid (fid)) return NULL;
-    return files_ [fid].name_.c_str ();
+    FileInfo* fi = valid_ (fid);
+    if (!fi) return NULL;
+    return fi->name_.c_str ();
+}
+
+void FileHandleMgr_imp::unring_ (FileInfo& fi)
+{
+    Fid last = ring_.back ();
+    ring_ [fi.ringpos_] = last;
+    info_ (last).ringpos_ = fi.ringpos_;
+    ring_.pop_back ();
 }
 
 bool FileHandleMgr_imp::close (Fid fid)
 {
-    if (!isValid (fid)) throw FileNotOpen ();
-    FileInfo& fi = files_ [fid];
-    if (fi.handle_ != -1)
+    MutexGuard guard (mutex_);
+    FileInfo* fip = valid_ (fid);
+    if (!fip) throw FileNotOpen ();
+    FileInfo& fi = *fip;
+    if (!fi.refs_.cas (0, CLOSING)) ERR("Closing the file with its handle acquired");
+    if (fi.handle_.get () != -1)
     {
-        if (::sci_close (fi.handle_) == -1) ERR("Unable to close file: invalid handle");
-        fi.handle_ = -1;
-        mru_.erase (fi.mrupos_);
+        if (::sci_close ((int) fi.handle_.get ()) == -1) ERR("Unable to close file: invalid handle");
+        fi.handle_.set (-1);
+        unring_ (fi);
     }
-    name2fid_.erase (fi.name_.c_str ());
+    hashout_ (fid);
     fi.free_ = true;
+    fi.refs_.add (-CLOSING);
+    freefids_.push_back (fid);
     return true;
 }
 
-int FileHandleMgr_imp::handle (Fid fid)
+void FileHandleMgr_imp::ring_in_ (Fid fid, int h)
+{
+    FileInfo& fi = info_ (fid);
+    fi.ringpos_ = ring_.size ();
+    ring_.push_back (fid);
+    fi.handle_.set (h);
+}
+
+// closes the handle found next by the CLOCK hand; false if all of them are pinned
+bool FileHandleMgr_imp::evict_ ()
+{
+    // the first round may only clear the use bits
+    for (size_t step = 0; step < 2 * ring_.size (); step ++)
+    {
+        if (hand_ >= ring_.size ())
+            hand_ = 0;
+        FileInfo& fi = info_ (ring_ [hand_]);
+        if (fi.used_.get ())
+            fi.used_.set (0);
+        else if (fi.refs_.cas (0, CLOSING))
+        {
+            ::sci_close ((int) fi.handle_.get ());
+            fi.handle_.set (-1);
+            unring_ (fi);
+            fi.refs_.add (-CLOSING);
+            drops_.add (1);
+            return true;
+        }
+        hand_ ++;
+    }
+    return false;
+}
+
+int FileHandleMgr_imp::acquire (Fid fid)
 {
-    int ret = -1;
-    if (!isValid (fid)) throw FileNotOpen ();
-    FileInfo& fi = files_ [fid];
-    if (fi.handle_ == -1)
+    FileInfo* fip = valid_ (fid);
+    if (!fip) throw FileNotOpen ();
+    FileInfo& fi = *fip;
+    // open and not being closed: pinned as it is
+    if (fi.refs_.add (1) > 0)
     {
-        if (mru_.size () == poolSize_)
+        int64 h = fi.handle_.get ();
+        if (h != -1)
         {
-            // drop the least recently used file, remembering the state
-            FileInfo& lru_file = files_ [mru_.back ()];
-            mru_.pop_back ();
-            lru_file.position_ = sci_tell (lru_file.handle_);
-            ::sci_close (lru_file.handle_);
-            lru_file.handle_ = -1;
-            drops_ ++;
+            fi.used_.set (1);
+            hits_.add (1);
+            return (int) h;
         }
+    }
+    fi.refs_.add (-1);
+
+    MutexGuard guard (mutex_);
+    if (fi.free_) throw FileNotOpen ();
+    if (fi.handle_.get () == -1)
+    {
+        while ((int) ring_.size () >= poolSize_ && evict_ ())
+            ;
         const char* fname = fi.name_.c_str ();
-        ret = fi.handle_ = ::sci_sopen (fname, _O_BINARY|_O_RDWR, _SH_DENYWR);
-        if (ret == -1)
+        int h = ::sci_sopen (fname, _O_BINARY|_O_RDWR, _SH_DENYWR);
+        if (h == -1)
         {
             ers << "Unable to open file "<< fname << ", OS error " << errno << " : " << strerror (errno);
             ERR ("");
         }
-        if (fi.position_ != ::sci_lseek (ret, fi.position_, SEEK_SET))
-        {
-            ERR ("Seek error");
-        }
-        mru_.push_front (fid);
-        fi.mrupos_ = mru_.begin ();
+        ring_in_ (fid, h);
     }
     else
-    {
-        // move to the beginning of mru list
-        mru_.erase (fi.mrupos_);
-        mru_.push_front (fid);
-        fi.mrupos_ = mru_.begin (); 
-        ret = fi.handle_;
-    }
+        hits_.add (1);
+    fi.refs_.add (1);
+    fi.used_.set (1);
+    return (int) fi.handle_.get ();
+}
+
+void FileHandleMgr_imp::release (Fid fid)
+{
+    FileInfo* fi = valid_ (fid);
+    if (!fi) throw FileNotOpen ();
+    fi->refs_.add (-1);
+}
+
+int FileHandleMgr_imp::handle (Fid fid)
+{
+    int ret = acquire (fid);
+    release (fid);
     return ret;
 }
 
 bool FileHandleMgr_imp::commit (Fid fid)
 {
-    int ret = -1;
-    if (!isValid (fid)) throw FileNotOpen ();
-    FileInfo& fi = files_ [fid];
-    if (fi.handle_ != -1)
-       ::sci_commit (fi.handle_);
-    // we do not treat the commit as an access, so we do not move file to the beginning of mru list
+    FileInfo* fi = valid_ (fid);
+    if (!fi) throw FileNotOpen ();
+    // we do not treat the commit as an access, so the handle is not marked used
+    if (fi->refs_.add (1) > 0)
+    {
+        int64 h = fi->handle_.get ();
+        if (h != -1)
+            ::sci_commit ((int) h);
+    }
+    fi->refs_.add (-1);
     return true;
 }
 
@@ -187,13 +407,20 @@ int FileHandleMgr_imp::getPoolSize () const
 void FileHandleMgr_imp::setPoolSize (int newSize)
 {
     if (newSize < 1) ERR("Internal")
+    MutexGuard guard (mutex_);
     poolSize_ = newSize;
+    while ((int) ring_.size () > poolSize_ && evict_ ())
+        ;
 }
 
 uint64 FileHandleMgr_imp::getDropCount () const
 {
-    return drops_;
+    return drops_.get ();
 }
 
-};
+uint64 FileHandleMgr_imp::getHitCount () const
+{
+    return hits_.get ();
+}
 
+};
@@ -18,62 +18,84 @@
 #pragma warning (disable : 4786)
 #endif
 
-#include <map>
 #include <string>
-#include <list>
 #include <vector>
 #include <string.h>
 #include "edbFileHandleMgr.h"
+#include "edbLatch.h"
 
 namespace edb
 {
 
-typedef std::list <Fid> FidList;
-
+// A managed file. Its handle is looked up and pinned without locking: refs_ goes up first, and the handle 
+// found then stays open until the matching release. A handle is closed only after refs_ is swung 
+// from 0 to CLOSING, which turns the lookups running meanwhile to the locked path
 struct FileInfo
 {
-    FileInfo () {init ("");}
-    FileInfo (const char* name) {init (name);} 
-    void init (const char* name) { name_ = name; handle_ = -1; position_ = 0; free_ = false; }
+    FileInfo () : handle_ (-1), refs_ (0), used_ (0), ringpos_ (0), hash_ (0), hnext_ (-1), free_ (true) {}
     std::string name_;
-    int         handle_;
-    long        position_;
-    FidList::iterator mrupos_;
+    Atomic      handle_; // -1 if not open
+    Atomic      refs_; // pins; negative while the handle is being closed
+    Atomic      used_; // the CLOCK bit: pinned since the hand passed last
+    size_t      ringpos_; // in ring_, if open
+    uint32      hash_; // of the name
+    Fid         hnext_; // next in the hash bucket
     bool        free_;
 };
-struct StringCompare
-{   bool operator () (const char* s1, const char* s2) const
-    {  return (strcmp (s1, s2) < 0); } };
-
-typedef std::map    <const char*, Fid, StringCompare> NameFidMap;
-typedef std::vector <FileInfo> FileInfoVect;
+typedef std::vector <Fid> FidVect;
 
+// The FileInfo records are kept by chunks that never move, so that a Fid is resolved without locking.
+// The names are found through a hash table chained through the records, doubled as the names outnumber the buckets.
+// The open handles are kept in a ring swept by the CLOCK hand: a handle pinned since the last sweep 
+// is spared once, an unpinned one not used since then is closed. If all the handles are pinned, 
+// the pool overflows rather than waits
 class FileHandleMgr_imp : public FileHandleMgr
 {
-    FileInfoVect files_;
-    NameFidMap   name2fid_;
-    FidList      mru_;
+    enum { CHUNK_BITS = 10, CHUNK_SIZE = 1 << CHUNK_BITS, MAX_CHUNKS = 0x1000 };
+    FileInfo*    chunks_ [MAX_CHUNKS];
+    Fid          fidcount_;
+    FidVect      freefids_;
+    FidVect      buckets_; // first Fid of each chain, -1 for none
+    size_t       names_;
+    FidVect      ring_;
+    size_t       hand_;
     int          poolSize_;
+    Mutex        mutex_; // for everything but the pinning of an open handle
     // some statisticss
-    uint64       drops_;
+    Atomic       hits_;
+    Atomic       drops_;
 
     Fid          add (const char* fname);
+    Fid          find_ (const char* fname) const;
+    void         hashin_ (Fid fid);
+    void         hashout_ (Fid fid);
+    void         rehash_ (size_t buckets);
+    void         ring_in_ (Fid fid, int h);
+    FileInfo&    info_ (Fid fid) const { return chunks_ [fid >> CHUNK_BITS][fid & (CHUNK_SIZE - 1)]; }
+    FileInfo*    valid_ (Fid fid) const;
+    bool         evict_ ();
+    void         unring_ (FileInfo& fi);
         
 public:
                  FileHandleMgr_imp ();
+                 ~FileHandleMgr_imp ();
     Fid          open           (const char* fname);
     Fid          create         (const char* fname);
+    int          openMany       (const char* const* fnames, int count, Fid* fids, FilePos* sizes = NULL, int threads = 1);
     Fid          findFid        (const char* fname);
     bool         isOpen         (const char* fname);
     bool         isValid        (Fid fid);
     const char*  findName       (Fid fid);
     bool         close          (Fid fid);
     int          handle         (Fid fid);
+    int          acquire        (Fid fid);
+    void         release        (Fid fid);
     bool         commit         (Fid fid);
 
     int          getPoolSize    () const;
     void         setPoolSize    (int newSize);
     uint64       getDropCount   () const;
+    uint64       getHitCount    () const;
 };
 
 
@@ -30,6 +30,10 @@
 #include <io.h>
 #endif
 #include "portability.h"
+#include "edbLatch.h"
+#if !defined (_WIN32)
+#include <sys/time.h>
+#endif
 
 #define FILENO 100
 #define POOLSIZE 98
@@ -118,10 +122,138 @@ static void speedTest ()
 
 }
 
+#if defined (SCI_HAVE_PREAD)
+// random reads over many segment-like files through a pool several times smaller, by one and by several threads.
+// Most reads go to a hot subset not much smaller than the pool
+static const int SEGFILES = 2000;
+static const int SEGPOOL = 200;
+static const int SEGHOT = 150;
+static const uint32 SEGLEN = 0x10000;
+static const uint32 SEGREAD = 0x1000;
+static const int SEGOPS = 400000;
+
+struct SegReader
+{
+    Fid*    fids_;
+    int     ops_;
+    uint32  seed_;
+    int     errors_;
+};
+
+static uint32 nextRand (uint32& seed)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+static void segReader (void* arg)
+{
+    SegReader& r = *(SegReader*) arg;
+    char buf [SEGREAD];
+    for (int i = 0; i < r.ops_; i ++)
+    {
+        int fno = (nextRand (r.seed_) % 10) ? (int) (nextRand (r.seed_) % SEGHOT) : (int) (nextRand (r.seed_) % SEGFILES);
+        uint32 off = (nextRand (r.seed_) % (SEGLEN / SEGREAD)) * SEGREAD;
+        int h = fileHandleMgr.acquire (r.fids_ [fno]);
+        if (::sci_pread (h, buf, SEGREAD, off) != SEGREAD || *(int*) buf != fno)
+            r.errors_ ++;
+        fileHandleMgr.release (r.fids_ [fno]);
+    }
+}
+
+static bool segmentReadTest ()
+{
+    fileHandleMgr.setPoolSize (SEGPOOL);
+    std::vector <Fid> fids (SEGFILES);
+    std::vector <int> data (SEGLEN / sizeof (int));
+    char name [100];
+    int i;
+    for (i = 0; i < SEGFILES; i ++)
+    {
+        sprintf (name, "seg.%d.tst", i);
+        ::sci_unlink (name);
+        fids [i] = fileHandleMgr.create (name);
+        if (fids [i] == -1)
+        {
+            std::cerr << "Unable to create file : " << name << std::endl;
+            return false;
+        }
+        data.assign (data.size (), i);
+        int h = fileHandleMgr.acquire (fids [i]);
+        ::sci_pwrite (h, &data [0], SEGLEN, 0);
+        fileHandleMgr.release (fids [i]);
+    }
+    const int threadCounts [] = {1, 4};
+    bool ok = true;
+    for (unsigned t = 0; t < sizeof (threadCounts) / sizeof (*threadCounts); t ++)
+    {
+        int threads = threadCounts [t];
+        std::vector <SegReader> readers (threads);
+        Thread* workers = new Thread [threads];
+        uint64 hits = fileHandleMgr.getHitCount (), drops = fileHandleMgr.getDropCount ();
+        struct timeval tb, te;
+        gettimeofday (&tb, 0);
+        for (i = 0; i < threads; i ++)
+        {
+            SegReader r = {&fids [0], SEGOPS / threads, (uint32) i + 1, 0};
+            readers [i] = r;
+            workers [i].start (segReader, &readers [i]);
+        }
+        int errors = 0;
+        for (i = 0; i < threads; i ++)
+        {
+            workers [i].join ();
+            errors += readers [i].errors_;
+        }
+        gettimeofday (&te, 0);
+        delete [] workers;
+        uint64 usec = uint64 (te.tv_sec - tb.tv_sec) * 1000000 + te.tv_usec - tb.tv_usec;
+        hits = fileHandleMgr.getHitCount () - hits;
+        drops = fileHandleMgr.getDropCount () - drops;
+        std::cerr << SEGOPS << " random reads over " << SEGFILES << " files, pool of " << SEGPOOL << ", " << threads << " thread(s): " 
+                  << (usec ? (uint64) SEGOPS * 1000000 / usec : 0) << " reads/sec, " << hits << " hits, " << drops << " drops, " << errors << " errors" << std::endl;
+        if (errors)
+            ok = false;
+    }
+    // the files are found by name, and opened back all at once
+    std::vector <std::string> names (SEGFILES);
+    std::vector <const char*> nameptrs (SEGFILES);
+    for (i = 0; i < SEGFILES; i ++)
+    {
+        sprintf (name, "seg.%d.tst", i);
+        names [i] = name;
+        nameptrs [i] = names [i].c_str ();
+        if (fileHandleMgr.findFid (name) != fids [i])
+        {
+            std::cerr << "File not found by name : " << name << std::endl;
+            ok = false;
+        }
+        fileHandleMgr.close (fids [i]);
+    }
+    std::vector <FilePos> sizes (SEGFILES);
+    if (fileHandleMgr.openMany (&nameptrs [0], SEGFILES, &fids [0], &sizes [0], 4) != SEGFILES)
+    {
+        std::cerr << "Not all the files opened back" << std::endl;
+        return false;
+    }
+    for (i = 0; i < SEGFILES; i ++)
+    {
+        if (sizes [i] != SEGLEN || fileHandleMgr.findFid (nameptrs [i]) != fids [i]) 
+            ok = false;
+        fileHandleMgr.close (fids [i]);
+        ::sci_unlink (nameptrs [i]);
+    }
+    return ok;
+}
+#endif
+
 bool testFileHandleMgr ()
 {
     // naiveTest ();
     speedTest ();
+#if defined (SCI_HAVE_PREAD)
+    if (!segmentReadTest ()) return false;
+#endif
     
     std::cerr << "Done" << std::endl;
 
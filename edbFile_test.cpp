@@ -24,6 +24,13 @@
 
 #include "edbCachedFile_imp.h"
 #include "edbPagedFile_imp.h"
+#include "edbSplitFile_imp.h"
+#include "edbExceptions.h"
+
+#if !defined (_WIN32)
+#include <sys/time.h>
+#include <sys/stat.h>
+#endif
 
 
 namespace edb
@@ -272,9 +279,206 @@ static bool repeatTest ()
     return true;
 }
 
+// segment size chosen at creation and found again on open; writes and reads crossing the segment ends
+static bool segmentTest ()
+{
+    if (splitFileFactory.exists (TESTDIR, TESTNAME))
+        splitFileFactory.erase (TESTDIR, TESTNAME);
+
+    const FilePos segsize = 0x101000; // 1 Mb and 4 Kb
+    const BufLen piece = 0x10007;
+    const uint32 pieces = 80; // about 5 segments
+    char* buf = new char [piece];
+    File& f = splitFileFactory.create (TESTDIR, TESTNAME, segsize);
+    uint32 p;
+    BufLen i;
+    for (p = 0; p < pieces; p ++)
+    {
+        for (i = 0; i < piece; i ++)
+            buf [i] = (char) (p * 7 + i);
+        f.write (buf, piece);
+    }
+    f.close ();
+
+    File& f1 = splitFileFactory.open (TESTDIR, TESTNAME);
+    if (dynamic_cast <SplitFile_imp&> (f1).segmentSize () != segsize) ERR ("segmentTest: segment size not kept");
+    if (f1.length () != (FilePos) piece * pieces) ERR ("segmentTest: wrong length after reopen");
+    for (p = pieces; p > 0; p --)
+    {
+        f1.seek ((FilePos) (p - 1) * piece);
+        if (f1.read (buf, piece) != piece) ERR ("segmentTest: short read");
+        for (i = 0; i < piece; i ++)
+            if (buf [i] != (char) ((p - 1) * 7 + i)) ERR ("segmentTest: wrong data");
+    }
+    // cut within the second segment, then grow again: the regrown part reads as zeroes
+    FilePos cut = segsize + 100;
+    f1.chsize (cut);
+    f1.chsize (segsize * 3);
+    f1.seek (cut - 1);
+    f1.read (buf, piece);
+    if (buf [0] != (char) ((cut - 1) / piece * 7 + (cut - 1) % piece) || buf [1] || buf [piece - 1]) ERR ("segmentTest: wrong data after size change");
+    f1.close ();
+    delete [] buf;
+
+    splitFileFactory.erase (TESTDIR, TESTNAME);
+    if (splitFileFactory.exists (TESTDIR, TESTNAME)) ERR ("segmentTest: file not erased");
+    std::cerr << "Segments of " << segsize << " bytes: Ok" << std::endl;
+    return true;
+}
+
+#if !defined (_WIN32)
+static uint64 msecs ()
+{
+    struct timeval tv;
+    gettimeofday (&tv, 0);
+    return uint64 (tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+}
+
+static uint64 diskUsage (FilePos segsize, FilePos length)
+{
+    uint64 used = 0;
+    for (int32 fno = 0; (FilePos) fno * segsize < length; fno ++)
+    {
+        char name [2048];
+        name4number (TESTDIR "/" TESTNAME, fno, name, sizeof (name));
+        struct stat st;
+        if (stat (name, &st) == 0)
+            used += (uint64) st.st_blocks * 512;
+    }
+    return used;
+}
+
+// appends by pieces of varying size, as the storages do, with the default and with small segments
+static bool appendTest ()
+{
+    const FilePos total = 0x40000000; // 1 Gb
+    const FilePos segsizes [] = {SPLIT_FACTOR, 0x4000000}; // 1 Gb, 64 Mb
+    const BufLen maxpiece = 0x20000;
+    char* buf = new char [maxpiece];
+    memset (buf, 0x5a, maxpiece);
+    for (unsigned s = 0; s < sizeof (segsizes) / sizeof (*segsizes); s ++)
+    {
+        if (splitFileFactory.exists (TESTDIR, TESTNAME))
+            splitFileFactory.erase (TESTDIR, TESTNAME);
+        File& f = splitFileFactory.create (TESTDIR, TESTNAME, segsizes [s]);
+        srand (1);
+        uint64 tbeg = msecs ();
+        FilePos done = 0;
+        while (done < total)
+        {
+            BufLen len = 0x1000 + (BufLen) rand () % (maxpiece - 0x1000);
+            f.write (buf, len);
+            done += len;
+        }
+        f.commit ();
+        uint64 elapsed = msecs () - tbeg;
+        f.close ();
+        std::cerr << "Append of " << done / 0x100000 << " Mb by segments of " << segsizes [s] / 0x100000 << " Mb: " 
+                  << elapsed << " msec, " << (elapsed ? done / 0x100000 * 1000 / elapsed : 0) << " Mb/sec; " 
+                  << diskUsage (segsizes [s], done) / 0x100000 << " Mb on disk" << std::endl;
+        if (diskUsage (segsizes [s], done) > done + 0x100000) ERR ("appendTest: reserved space not given back on close");
+    }
+    delete [] buf;
+    splitFileFactory.erase (TESTDIR, TESTNAME);
+    return true;
+}
+
+// multi-Gb transfers by large requests spanning several segments: one thread against a few, one segment each
+static bool spreadTest ()
+{
+    const FilePos total = 0x80000000; // 2 Gb
+    const FilePos segsize = 0x4000000; // 64 Mb
+    const BufLen request = 0x10000000; // 256 Mb, 4 segments
+    const uint32 threadCounts [] = {1, 4};
+    char* buf = new char [request];
+    uint64 sums [2];
+    for (unsigned t = 0; t < sizeof (threadCounts) / sizeof (*threadCounts); t ++)
+    {
+        if (splitFileFactory.exists (TESTDIR, TESTNAME))
+            splitFileFactory.erase (TESTDIR, TESTNAME);
+        splitFileFactory.setIoThreads (threadCounts [t]);
+        File& f = splitFileFactory.create (TESTDIR, TESTNAME, segsize);
+        FilePos done;
+        uint64 tbeg = msecs ();
+        // the requests start off the segment ends
+        f.write (buf, 0x1234);
+        for (done = 0x1234; done + request <= total; done += request)
+        {
+            for (BufLen i = 0; i < request; i += 0x1000)
+                *(uint64*) (buf + i) = done + i;
+            f.write (buf, request);
+        }
+        f.commit ();
+        uint64 wtime = msecs () - tbeg;
+        tbeg = msecs ();
+        sums [t] = 0;
+        for (done = 0x1234; done + request <= total; done += request)
+        {
+            f.seek (done);
+            if (f.read (buf, request) != request) ERR ("spreadTest: short read");
+            for (BufLen i = 0; i < request; i += 0x1000)
+            {
+                if (*(uint64*) (buf + i) != done + i) ERR ("spreadTest: wrong data");
+                sums [t] += *(uint64*) (buf + i);
+            }
+        }
+        uint64 rtime = msecs () - tbeg;
+        f.close ();
+        std::cerr << "Requests of " << request / 0x100000 << " Mb over " << segsize / 0x100000 << " Mb segments by " << threadCounts [t] << " thread(s): write " 
+                  << (wtime ? done / 0x100000 * 1000 / wtime : 0) << " Mb/sec, read " << (rtime ? done / 0x100000 * 1000 / rtime : 0) << " Mb/sec" << std::endl;
+    }
+    splitFileFactory.setIoThreads (1);
+    delete [] buf;
+    splitFileFactory.erase (TESTDIR, TESTNAME);
+    return sums [0] == sums [1];
+}
+
+// opening a file of 10k segments, looked for and opened by one thread against a few
+static bool openTest ()
+{
+    const FilePos segsize = 0x1000;
+    const int32 segments = 10000;
+    const uint32 threadCounts [] = {1, 4};
+    if (splitFileFactory.exists (TESTDIR, TESTNAME))
+        splitFileFactory.erase (TESTDIR, TESTNAME);
+    char* buf = new char [segsize];
+    File& f = splitFileFactory.create (TESTDIR, TESTNAME, segsize);
+    for (int32 s = 0; s < segments; s ++)
+    {
+        memset (buf, (char) s, segsize);
+        f.write (buf, (BufLen) segsize);
+    }
+    f.write (buf, 100);
+    f.close ();
+    for (unsigned t = 0; t < sizeof (threadCounts) / sizeof (*threadCounts); t ++)
+    {
+        splitFileFactory.setIoThreads (threadCounts [t]);
+        uint64 tbeg = msecs ();
+        File& f1 = splitFileFactory.open (TESTDIR, TESTNAME);
+        uint64 otime = msecs () - tbeg;
+        if (f1.length () != segsize * segments + 100) ERR ("openTest: wrong length");
+        f1.seek (segsize * (segments - 1));
+        if (f1.read (buf, (BufLen) segsize) != segsize || buf [0] != (char) (segments - 1)) ERR ("openTest: wrong data");
+        tbeg = msecs ();
+        f1.close ();
+        uint64 ctime = msecs () - tbeg;
+        std::cerr << "File of " << segments + 1 << " segments opened by " << threadCounts [t] << " thread(s) in " << otime << " msec, closed in " << ctime << " msec" << std::endl;
+    }
+    splitFileFactory.setIoThreads (1);
+    delete [] buf;
+    splitFileFactory.erase (TESTDIR, TESTNAME);
+    return true;
+}
+#endif
+
 bool testFile ()
 {
     std::cerr << "Running file tests" << std::endl;
+#if !defined (_WIN32)
+    if (!segmentTest () || !appendTest () || !spreadTest () || !openTest ()) return false;
+#else
+    if (!segmentTest ()) return false;
+#endif
     return repeatTest ();
     return naiveTest ();
     return sizeTest ();
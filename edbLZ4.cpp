@@ -0,0 +1,191 @@
+//////////////////////////////////////////////////////////////////////////////
+//// This software module is developed by SciDM (Scientific Data Management) in 1998-2015
+//// 
+//// This program is free software; you can redistribute, reuse,
+//// or modify it with no restriction, under the terms of the MIT License.
+//// 
+//// This program is distributed in the hope that it will be useful,
+//// but WITHOUT ANY WARRANTY; without even the implied warranty of
+//// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//// 
+//// For any questions please contact Denis Kaznadzey at dkaznadzey@yahoo.com
+//////////////////////////////////////////////////////////////////////////////
+
+
+#include "edbLZ4.h"
+#include "edbExceptions.h"
+#include <string.h>
+
+namespace edb
+{
+
+static const uint32 MINMATCH = 4;
+static const uint32 LASTLITERALS = 5; // the block always ends with at least that many literals
+static const uint32 MFLIMIT = 12; // the last match starts at least that far from the block end
+static const uint32 MAX_DISTANCE = 0xFFFF;
+static const uint32 HASH_LOG = 12;
+static const uint32 MIN_HASH_LOG = 8; // short inputs use the smaller part of the table, which is cleared faster
+static const uint32 SKIP_TRIGGER = 6; // search step grows by one each 2^SKIP_TRIGGER bytes without a match
+
+inline uint32 read32_ (const uint8* p)
+{
+    uint32 v;
+    memcpy (&v, p, sizeof (v));
+    return v;
+}
+
+inline uint32 hash_ (uint32 seq, uint32 hashLog)
+{
+    return (seq * 2654435761U) >> (32 - hashLog);
+}
+
+// writes the length remainder as the run of 255s closed by a smaller byte
+inline uint8* put_len_ (uint8* op, BufLen len)
+{
+    while (len >= 255)
+    {
+        *op ++ = 255;
+        len -= 255;
+    }
+    *op ++ = (uint8) len;
+    return op;
+}
+
+// emits a sequence: literals [anchor, ip) followed by the match (offset, mlen); mlen == 0 for the final literals
+static uint8* put_seq_ (uint8* op, const uint8* oend, const uint8* anchor, const uint8* ip, BufLen offset, BufLen mlen)
+{
+    BufLen lit = (BufLen) (ip - anchor);
+    if ((BufLen) (oend - op) < 1 + lit + lit / 255 + 1 + (mlen ? 2 + mlen / 255 + 1 : 0))
+        return NULL;
+    uint8* token = op ++;
+    *token = (uint8) ((lit < 15 ? lit : 15) << 4);
+    if (lit >= 15)
+        op = put_len_ (op, lit - 15);
+    memcpy (op, anchor, lit);
+    op += lit;
+    if (mlen)
+    {
+        *op ++ = (uint8) offset;
+        *op ++ = (uint8) (offset >> 8);
+        mlen -= MINMATCH;
+        *token |= (uint8) (mlen < 15 ? mlen : 15);
+        if (mlen >= 15)
+            op = put_len_ (op, mlen - 15);
+    }
+    return op;
+}
+
+BufLen lz4Compress (const void* src, BufLen srclen, void* dst, BufLen dstcap)
+{
+    const uint8* base = (const uint8*) src;
+    const uint8* ip = base;
+    const uint8* anchor = base;
+    const uint8* iend = base + srclen;
+    uint8* op = (uint8*) dst;
+    const uint8* oend = op + dstcap;
+
+    if (srclen > MFLIMIT)
+    {
+        const uint8* mflimit = iend - MFLIMIT;
+        const uint8* matchlimit = iend - LASTLITERALS;
+        uint32 hashLog = HASH_LOG;
+        while (hashLog > MIN_HASH_LOG && (1U << (hashLog + 1)) > srclen)
+            hashLog --;
+        uint32 table [1 << HASH_LOG];
+        memset (table, 0, sizeof (uint32) << hashLog);
+        ip ++;
+        while (ip < mflimit)
+        {
+            uint32 seq = read32_ (ip);
+            uint32 h = hash_ (seq, hashLog);
+            const uint8* ref = base + table [h];
+            table [h] = (uint32) (ip - base);
+            if (ip - ref > MAX_DISTANCE || read32_ (ref) != seq)
+            {
+                ip += 1 + ((ip - anchor) >> SKIP_TRIGGER);
+                continue;
+            }
+            // extend the match backwards over the pending literals, then forward
+            while (ip > anchor && ref > base && ip [-1] == ref [-1])
+                ip --, ref --;
+            const uint8* mp = ip + MINMATCH;
+            const uint8* rp = ref + MINMATCH;
+            while (mp < matchlimit && *mp == *rp)
+                mp ++, rp ++;
+            op = put_seq_ (op, oend, anchor, ip, (BufLen) (ip - ref), (BufLen) (mp - ip));
+            if (!op)
+                return 0;
+            ip = anchor = mp;
+            if (ip < mflimit)
+                table [hash_ (read32_ (ip - 2), hashLog)] = (uint32) (ip - 2 - base);
+        }
+    }
+    op = put_seq_ (op, oend, anchor, iend, 0, 0);
+    if (!op)
+        return 0;
+    return (BufLen) (op - (uint8*) dst);
+}
+
+BufLen lz4Decompress (const void* src, BufLen srclen, void* dst, BufLen dstcap)
+{
+    const uint8* ip = (const uint8*) src;
+    const uint8* iend = ip + srclen;
+    uint8* op = (uint8*) dst;
+    uint8* oend = op + dstcap;
+    while (ip < iend)
+    {
+        uint32 token = *ip ++;
+        // literals
+        BufLen lit = token >> 4;
+        if (lit == 15)
+        {
+            uint32 b;
+            do
+            {
+                if (ip == iend) throw FileStructureCorrupt ();
+                b = *ip ++;
+                lit += b;
+            }
+            while (b == 255);
+        }
+        if ((BufLen) (iend - ip) < lit || (BufLen) (oend - op) < lit)
+            throw FileStructureCorrupt ();
+        memcpy (op, ip, lit);
+        op += lit;
+        ip += lit;
+        if (ip == iend) // the final sequence has no match
+            break;
+        // match
+        if (iend - ip < 2)
+            throw FileStructureCorrupt ();
+        BufLen offset = ip [0] | (ip [1] << 8);
+        ip += 2;
+        if (!offset || offset > (BufLen) (op - (uint8*) dst))
+            throw FileStructureCorrupt ();
+        BufLen mlen = token & 15;
+        if (mlen == 15)
+        {
+            uint32 b;
+            do
+            {
+                if (ip == iend) throw FileStructureCorrupt ();
+                b = *ip ++;
+                mlen += b;
+            }
+            while (b == 255);
+        }
+        mlen += MINMATCH;
+        if ((BufLen) (oend - op) < mlen)
+            throw FileStructureCorrupt ();
+        const uint8* ref = op - offset;
+        if (offset >= mlen)
+            memcpy (op, ref, mlen);
+        else
+            for (BufLen i = 0; i < mlen; i ++) // overlapping copy repeats the pattern
+                op [i] = ref [i];
+        op += mlen;
+    }
+    return (BufLen) (op - (uint8*) dst);
+}
+
+};
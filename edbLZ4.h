@@ -0,0 +1,37 @@
+//////////////////////////////////////////////////////////////////////////////
+//// This software module is developed by SciDM (Scientific Data Management) in 1998-2015
+//// 
+//// This program is free software; you can redistribute, reuse,
+//// or modify it with no restriction, under the terms of the MIT License.
+//// 
+//// This program is distributed in the hope that it will be useful,
+//// but WITHOUT ANY WARRANTY; without even the implied warranty of
+//// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//// 
+//// For any questions please contact Denis Kaznadzey at dkaznadzey@yahoo.com
+//////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef edbLZ4_h
+#define edbLZ4_h
+
+#include "edbTypes.h"
+
+// Compressor and decompressor for the LZ4 block format (the frames it produces are readable by the 
+// reference lz4 library and vice versa). Used for the record frames of the compressed VStorage
+
+namespace edb
+{
+
+// the largest compressed size of srclen bytes
+inline BufLen lz4Bound (BufLen srclen) { return srclen + srclen / 255 + 16; }
+
+// compresses srclen bytes from src into dst, returns the compressed length or 0 if it exceeds dstcap
+BufLen lz4Compress   (const void* src, BufLen srclen, void* dst, BufLen dstcap);
+// decompresses the block of srclen bytes, returns the decompressed length; 
+// throws FileStructureCorrupt if the block is malformed or decompresses to more than dstcap bytes
+BufLen lz4Decompress (const void* src, BufLen srclen, void* dst, BufLen dstcap);
+
+};
+
+#endif
@@ -0,0 +1,265 @@
+//////////////////////////////////////////////////////////////////////////////
+//// This software module is developed by SciDM (Scientific Data Management) in 1998-2015
+////
+//// This program is free software; you can redistribute, reuse,
+//// or modify it with no restriction, under the terms of the MIT License.
+////
+//// This program is distributed in the hope that it will be useful,
+//// but WITHOUT ANY WARRANTY; without even the implied warranty of
+//// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+////
+//// For any questions please contact Denis Kaznadzey at dkaznadzey@yahoo.com
+//////////////////////////////////////////////////////////////////////////////
+
+// Thin portable wrappers over OS synchronization primitives.
+// Define EDB_NO_THREADS to turn all of them into no-ops
+// for strictly single-threaded builds.
+
+#ifndef edbLatch_h
+#define edbLatch_h
+
+#include "edbTypes.h"
+
+#if defined (EDB_NO_THREADS)
+#elif defined (_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+namespace edb
+{
+
+// Recursive mutex - the same thread may re-enter
+class Mutex
+{
+public:
+#if defined (EDB_NO_THREADS)
+    void acquire () {}
+    void release () {}
+#elif defined (_WIN32)
+    Mutex ()  { InitializeCriticalSection (&cs_); }
+    ~Mutex () { DeleteCriticalSection (&cs_); }
+    void acquire () { EnterCriticalSection (&cs_); }
+    void release () { LeaveCriticalSection (&cs_); }
+private:
+    CRITICAL_SECTION cs_;
+#else
+    Mutex ()
+    {
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init (&attr);
+        pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+        pthread_mutex_init (&mutex_, &attr);
+        pthread_mutexattr_destroy (&attr);
+    }
+    ~Mutex () { pthread_mutex_destroy (&mutex_); }
+    void acquire () { pthread_mutex_lock (&mutex_); }
+    void release () { pthread_mutex_unlock (&mutex_); }
+private:
+    pthread_mutex_t mutex_;
+#endif
+#if !defined (EDB_NO_THREADS)
+    Mutex (const Mutex&);
+    Mutex& operator = (const Mutex&);
+#endif
+friend class CondVar;
+};
+
+// Condition variable over a Mutex the waiting thread holds once: wait releases it until woken, then takes it again.
+// Wakes may be spurious, so the condition is checked in a loop. Without threads wait returns at once
+class CondVar
+{
+public:
+#if defined (EDB_NO_THREADS)
+    void wait      (Mutex&) {}
+    void broadcast () {}
+#elif defined (_WIN32)
+    CondVar () { InitializeConditionVariable (&cond_); }
+    void wait      (Mutex& mutex) { SleepConditionVariableCS (&cond_, &mutex.cs_, INFINITE); }
+    void broadcast () { WakeAllConditionVariable (&cond_); }
+private:
+    CONDITION_VARIABLE cond_;
+#else
+    CondVar ()  { pthread_cond_init (&cond_, NULL); }
+    ~CondVar () { pthread_cond_destroy (&cond_); }
+    void wait      (Mutex& mutex) { pthread_cond_wait (&cond_, &mutex.mutex_); }
+    void broadcast () { pthread_cond_broadcast (&cond_); }
+private:
+    pthread_cond_t cond_;
+#endif
+#if !defined (EDB_NO_THREADS)
+    CondVar (const CondVar&);
+    CondVar& operator = (const CondVar&);
+#endif
+};
+
+// Shared / exclusive latch. Not recursive: a thread holding it
+// must not try to take it again.
+class RWLatch
+{
+public:
+#if defined (EDB_NO_THREADS)
+    void shared    () {}
+    void exclusive () {}
+    void release   () {}
+#elif defined (_WIN32)
+    RWLatch () : excl_ (false) { InitializeSRWLock (&lock_); }
+    void shared    () { AcquireSRWLockShared (&lock_); }
+    void exclusive () { AcquireSRWLockExclusive (&lock_); excl_ = true; }
+    void release   ()
+    {
+        if (excl_) { excl_ = false; ReleaseSRWLockExclusive (&lock_); }
+        else ReleaseSRWLockShared (&lock_);
+    }
+private:
+    SRWLOCK lock_;
+    bool    excl_;
+#else
+    RWLatch ()  { pthread_rwlock_init (&lock_, NULL); }
+    ~RWLatch () { pthread_rwlock_destroy (&lock_); }
+    void shared    () { pthread_rwlock_rdlock (&lock_); }
+    void exclusive () { pthread_rwlock_wrlock (&lock_); }
+    void release   () { pthread_rwlock_unlock (&lock_); }
+private:
+    pthread_rwlock_t lock_;
+#endif
+#if !defined (EDB_NO_THREADS)
+    RWLatch (const RWLatch&);
+    RWLatch& operator = (const RWLatch&);
+#endif
+};
+
+// 64-bit integer changed by several threads at once; each operation is a full barrier
+class Atomic
+{
+public:
+    Atomic (int64 v = 0) : v_ (v) {}
+#if defined (EDB_NO_THREADS)
+    int64 get () const { return v_; }
+    void  set (int64 v) { v_ = v; }
+    int64 add (int64 d) { return v_ += d; }
+    bool  cas (int64 expected, int64 desired) { if (v_ != expected) return false; v_ = desired; return true; }
+private:
+    int64 v_;
+#elif defined (_WIN32)
+    int64 get () const { return InterlockedCompareExchange64 ((LONGLONG volatile*) &v_, 0, 0); }
+    void  set (int64 v) { InterlockedExchange64 (&v_, v); }
+    int64 add (int64 d) { return InterlockedExchangeAdd64 (&v_, d) + d; }
+    bool  cas (int64 expected, int64 desired) { return InterlockedCompareExchange64 (&v_, desired, expected) == expected; }
+private:
+    LONGLONG volatile v_;
+#else
+    int64 get () const { return __atomic_load_n (&v_, __ATOMIC_SEQ_CST); }
+    void  set (int64 v) { __atomic_store_n (&v_, v, __ATOMIC_SEQ_CST); }
+    int64 add (int64 d) { return __atomic_add_fetch (&v_, d, __ATOMIC_SEQ_CST); }
+    bool  cas (int64 expected, int64 desired) { return __atomic_compare_exchange_n (&v_, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); }
+private:
+    int64 v_;
+#endif
+    Atomic (const Atomic&);
+    Atomic& operator = (const Atomic&);
+};
+
+// 64-bit integer changed by several threads at once, with no ordering against the other memory: for the
+// counters and flags which only must not be torn or lose an update
+class RelaxedAtomic
+{
+public:
+    RelaxedAtomic (int64 v = 0) : v_ (v) {}
+#if defined (EDB_NO_THREADS)
+    int64 get () const { return v_; }
+    void  set (int64 v) { v_ = v; }
+    int64 add (int64 d) { return v_ += d; }
+private:
+    int64 v_;
+#elif defined (_WIN32)
+    int64 get () const { return InterlockedCompareExchange64 ((LONGLONG volatile*) &v_, 0, 0); }
+    void  set (int64 v) { InterlockedExchange64 (&v_, v); }
+    int64 add (int64 d) { return InterlockedExchangeAdd64 (&v_, d) + d; }
+private:
+    LONGLONG volatile v_;
+#else
+    int64 get () const { return __atomic_load_n (&v_, __ATOMIC_RELAXED); }
+    void  set (int64 v) { __atomic_store_n (&v_, v, __ATOMIC_RELAXED); }
+    int64 add (int64 d) { return __atomic_add_fetch (&v_, d, __ATOMIC_RELAXED); }
+private:
+    int64 v_;
+#endif
+    RelaxedAtomic (const RelaxedAtomic&);
+    RelaxedAtomic& operator = (const RelaxedAtomic&);
+};
+
+// Worker thread running fn (arg) until join. Without threads the function runs in start
+class Thread
+{
+public:
+    typedef void (*Func) (void* arg);
+#if defined (EDB_NO_THREADS)
+    void start (Func fn, void* arg) { fn (arg); }
+    void join  () {}
+#elif defined (_WIN32)
+    Thread () : h_ (NULL) {}
+    ~Thread () { join (); }
+    void start (Func fn, void* arg)
+    {
+        fn_ = fn, arg_ = arg;
+        h_ = CreateThread (NULL, 0, run_, this, 0, NULL);
+        if (!h_) fn (arg);
+    }
+    void join  () { if (h_) { WaitForSingleObject (h_, INFINITE); CloseHandle (h_); h_ = NULL; } }
+private:
+    static DWORD WINAPI run_ (LPVOID self) { ((Thread*) self)->fn_ (((Thread*) self)->arg_); return 0; }
+    HANDLE h_;
+    Func fn_;
+    void* arg_;
+#else
+    Thread () : started_ (false) {}
+    ~Thread () { join (); }
+    void start (Func fn, void* arg)
+    {
+        fn_ = fn, arg_ = arg;
+        started_ = (pthread_create (&th_, NULL, run_, this) == 0);
+        if (!started_) fn (arg);
+    }
+    void join  () { if (started_) { pthread_join (th_, NULL); started_ = false; } }
+private:
+    static void* run_ (void* self) { ((Thread*) self)->fn_ (((Thread*) self)->arg_); return NULL; }
+    pthread_t th_;
+    bool started_;
+    Func fn_;
+    void* arg_;
+#endif
+};
+
+// Scope guards
+class MutexGuard
+{
+public:
+    MutexGuard (Mutex& m) : m_ (m) { m_.acquire (); }
+    ~MutexGuard () { m_.release (); }
+private:
+    Mutex& m_;
+};
+
+class SharedGuard
+{
+public:
+    SharedGuard (RWLatch& l) : l_ (l) { l_.shared (); }
+    ~SharedGuard () { l_.release (); }
+private:
+    RWLatch& l_;
+};
+
+class ExclusiveGuard
+{
+public:
+    ExclusiveGuard (RWLatch& l) : l_ (l) { l_.exclusive (); }
+    ~ExclusiveGuard () { l_.release (); }
+private:
+    RWLatch& l_;
+};
+
+};
+
+#endif
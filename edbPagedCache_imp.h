@@ -16,72 +16,73 @@
 
 #include "edbPagedCache.h"
 #include "edbPager.h"
+#include "edbSlabArena.h"
+#include "edbPtrMap.h"
 
-#include <list>
-#include <map>
+#include <vector>
 
 namespace edb
 {
 
+// Buffers spanning several pages are assembled in memory of their own; single-page ones are served by the pager.
+// The buffers, each with its header, are allocated from a slab arena limited to the cache size. They are found 
+// by data pointer through a flat hash table, and by file and offset through an array kept in that order; 
+// the most recently used list is threaded through the headers.
+// The buffers of a file never overlap, so the ordered array is an interval index: a range lying within a buffer 
+// is served by a pointer into it (such inner pointers are entered into the hash table too, chained from their 
+// buffer), and a range reaching into some buffers gets a new one covering them all, assembled from their data 
+// and the pages between them
 class PagedCache_imp : public PagedCache
 {
 private:
-    struct BufKey
-    {
-        BufKey (File& f, FilePos off) : file_ (&f), off_ (off) {}
-        bool operator < (const BufKey& bk) const 
-        { 
-            return (file_ == bk.file_) ? (off_ < bk.off_) : (off_ < bk.off_); 
-        }
-        bool operator == (const BufKey& bk) const 
-        { 
-            return ((file_ == bk.file_) && (off_ == bk.off_)); 
-        }
-        bool operator != (const BufKey& bk) const 
-        {
-            return !operator == (bk);
-        }
-        File*   file_;
-        FilePos off_;
-    };
     struct Buffer
     {
-        Buffer () { init (NULL, 0, 0, NULL); }
-        void init (File* file, FilePos off, BufLen size, void* data)
+        void init (File* file, FilePos off, BufLen size)
         { 
-            file_ = file, off_ = off, size_ = size, data_ = data, lockcnt_ = 0, markcnt_ = 0; 
+            file_ = file, off_ = off, size_ = size, lockcnt_ = 0, markcnt_ = 0, mruprev_ = NULL, mrunext_ = NULL, inner_ = NULL; 
         }
+        void* data () { return this + 1; } // the data follow the header
         File* file_;
         FilePos off_;
         BufLen size_;
         int32 lockcnt_;
         int32 markcnt_;
-        std::list<Buffer*>::iterator mrupos_;
-        void* data_;
+        Buffer* mruprev_; // toward the most recently used
+        Buffer* mrunext_;
+        const void* inner_; // the last inner pointer given out
+    };
+    struct Bref
+    {
+        Buffer* buf_;
+        const void* next_; // the inner pointer given out before this one
     };
-    typedef std::map <BufKey, Buffer> Bkeymap;
-    typedef std::map <const void*, Buffer*> Bptrmap;
-    typedef std::list <Buffer*> Bptrlist;
+    typedef std::vector <Buffer*> Bindex;
+    typedef PtrMap <Bref> Bptrmap;
 
     Pager&      pager_;
-    Bkeymap     keymap_;
+    SlabArena   arena_;
+    Bindex      index_; // ordered by file and offset
     Bptrmap     ptrmap_;
-    Bptrlist    mrulist_;
-    uint32      maxsize_;
-    uint32      cursize_;
+    Buffer*     mruhead_;
+    Buffer*     mrutail_;
 
 
-    Buffer&     fetch_          (File& file, FilePos off, BufLen len);
-    Buffer&     fake_           (File& file, FilePos off, BufLen len);
+    void*       access_         (File& file, FilePos off, BufLen len, bool lock, bool read);
+    Buffer&     place_          (File& file, FilePos off, BufLen len, bool read); // assembles a buffer covering the range and the buffers it reaches into
+    void*       inner_          (Buffer& buf, FilePos off); // pointer to the data of buf at file offset off
+    Buffer*     lookup_         (const void* ptr);
     void        dump_           (Buffer& buf);
     void        free_           (Buffer& buf);
 
-    void        resolve_overlaps_(const Bkeymap::iterator& itr, const BufKey& key, BufLen len);
-    void        process_overlaps_(File& file, FilePos off, BufLen len);
+    size_t      find_           (File* file, FilePos off) const; // position in index_ of the first buffer at or after off in file
+    Buffer*     covering_       (File& file, FilePos off, BufLen len) const; // the buffer holding all of the range
+    bool        overlapped_     (File& file, FilePos off, BufLen len) const;
     void        check_paged_overlaps_ (File& file, FilePos off, BufLen len);
-    void        ensurespace_    (BufLen len);
-    Buffer&     add_            (BufKey& key, BufLen len);
-    void        fill_           (Buffer& buf);
+    void        evict_          (uint32 sizeClass); // dumps and frees an unlocked buffer, the least recently used one of the class if found near the end of the list
+    Buffer&     alloc_          (File& file, FilePos off, BufLen len);
+    void        link_           (Buffer& buf);
+    void        fill_           (Buffer& buf, FilePos from, FilePos to);
+    void        touch_          (Buffer& buf); // moves the buffer to the head of the most recently used list
 
 
 
@@ -128,4 +129,4 @@ public:
 	
 };
 
-#endif
\ No newline at end of file
+#endif
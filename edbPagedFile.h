@@ -16,6 +16,7 @@
 
 #include "edbTypes.h"
 #include "edbFile.h"
+#include "edbWal.h"
 
 namespace edb
 {
@@ -34,7 +35,14 @@ public:
     virtual bool       marked            (const void* page) = 0; // checks whether page is dirty
     virtual void       mark              (const void* page) = 0; // marks page as dirty
     virtual void       unmark            (const void* page) = 0; // marks page as clean
-    virtual bool       flush             () = 0; // flush buffers to file; makes sure the information is written to a device
+    virtual uint32     prefetch          (const FilePos* pagenos, uint32 count) = 0; // starts reading pages ahead of use (see Pager::prefetch)
+    virtual bool       flush             () = 0; // flush buffers to file; makes sure the information is written to a device. With a write-ahead log, commits to the log
+    virtual void       setWal            (Wal* wal) = 0; // keeps the changes in the write-ahead log (see Pager::setWal); the log must stay until the file is closed or the log is set to NULL
+    virtual Wal*       getWal            () = 0;
+    virtual bool       checkpoint        () = 0; // puts the committed pages kept in the log into the file (the recovery after a crash); nothing to do without a log
+    virtual void       setShadow         (File* shadow) = 0; // keeps the old page images the snapshots see in shadow (see Pager::setShadow)
+    virtual PagedFile& snapshot          () = 0; // read-only view of the file as it is now, not seeing the later changes; closing it releases the snapshot. Needs the shadow
+    virtual void       setChecksums      (File* sums) = 0; // checks the pages read against their checksums kept in sums (see Pager::setChecksums)
     virtual FilePos    length            () = 0; // returns length of the file
     virtual bool       chsize            (FilePos newSize) = 0; // changes the size of the file
     virtual bool       close             () = 0; // closes the file
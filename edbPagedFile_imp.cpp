@@ -24,7 +24,8 @@ PagedFileFactory& pagedFileFactory = theFactory;
 PagedFile_imp::PagedFile_imp (File& file, Pager& pager)
 :
 file_ (file),
-pager_ (&pager)
+pager_ (&pager),
+owner_ (false)
 {
     flen_ = file.length ();
 }
@@ -32,6 +33,7 @@ pager_ (&pager)
 PagedFile_imp::~PagedFile_imp ()
 {
     if (file_.isOpen ()) pager_->close (file_);
+    if (owner_) delete &file_;
 }
 
 void PagedFile_imp::checkLen_ (FilePos pageno, uint32 count)
@@ -84,11 +86,54 @@ void PagedFile_imp::unmark (const void* page)
     pager_->unmark (page);
 }
 
+uint32 PagedFile_imp::prefetch (const FilePos* pagenos, uint32 count)
+{
+    return pager_->prefetch (file_, pagenos, count);
+}
+
 bool PagedFile_imp::flush ()
 {
     return pager_->commit (file_);
 }
 
+void PagedFile_imp::setWal (Wal* wal)
+{
+    pager_->setWal (file_, wal);
+}
+
+Wal* PagedFile_imp::getWal ()
+{
+    return pager_->getWal (file_);
+}
+
+// the pages past the end of the file may be in the log only
+bool PagedFile_imp::checkpoint ()
+{
+    bool result = pager_->checkpoint (file_);
+    FilePos flen = file_.length ();
+    if (flen_ < flen) flen_ = flen;
+    return result;
+}
+
+void PagedFile_imp::setShadow (File* shadow)
+{
+    pager_->setShadow (file_, shadow);
+}
+
+void PagedFile_imp::setChecksums (File* sums)
+{
+    pager_->setChecksums (file_, sums);
+}
+
+// the snapshot pages are cached by the same pager, as of other file
+PagedFile& PagedFile_imp::snapshot ()
+{
+    File& file = pager_->snapshot (file_);
+    PagedFile_imp& snapshot = *new PagedFile_imp (file, *pager_);
+    snapshot.owner_ = true;
+    return snapshot;
+}
+
 FilePos PagedFile_imp::length ()
 {
     return flen_;
@@ -119,6 +164,8 @@ void PagedFile_imp::setPageSize       (uint32 newPageSize)
 {
     if (!newPageSize) ERR("Zero page size requested");
     uint32 oldPageSize = pager_->getPageSize ();
+    if (pager_->getWal (file_)) ERR("Page size of a file kept with a log cannot change");
+    if (owner_) ERR("Page size of a snapshot cannot change");
     Pager& pager = thePagerMgr().getPager (newPageSize);
     thePagerMgr().releasePager (oldPageSize);
     pager_ = &pager;
@@ -26,6 +26,7 @@ private:
     File&         file_;
     Pager*        pager_;
     FilePos       flen_;
+    bool          owner_; // the file is the snapshot made for this one
     void          checkLen_ (FilePos pageno, uint32 count);
 protected:
                   PagedFile_imp (File& file, Pager& pager);
@@ -39,7 +40,14 @@ public:
     bool          marked            (const void* page);
     void          mark              (const void* page);
     void          unmark            (const void* page);
+    uint32        prefetch          (const FilePos* pagenos, uint32 count);
     bool          flush             ();
+    void          setWal            (Wal* wal);
+    Wal*          getWal            ();
+    bool          checkpoint        ();
+    void          setShadow         (File* shadow);
+    PagedFile&    snapshot          ();
+    void          setChecksums      (File* sums);
     FilePos       length            ();
     bool          chsize            (FilePos newSize);
     bool          close             ();
@@ -15,6 +15,7 @@
 #define edbPager_h
 
 #include "edbFile.h"
+#include "edbWal.h"
 
 namespace edb
 {
@@ -31,16 +32,26 @@ public:
     virtual bool        marked      (const void* page) = 0; // checks whether the page(s) is(are) dirty
     virtual void        mark        (const void* page) = 0; // marks page(s) as dirty
     virtual void        unmark      (const void* page) = 0; // marks page(s) as clean
-    virtual bool        commit      (File& file) = 0; // flushes the buffers to disk
+    virtual bool        commit      (File& file) = 0; // flushes the buffers to disk; for a file kept with a log, commits the dirty pages to the log instead
     virtual bool        chsize      (File& file, FilePos newSize) = 0; // changes size of a file and releases cache pages which are no longer valid
     virtual bool        close       (File& file) = 0; // flushes data to file and closes it
     virtual bool        detach      (File& file) = 0; // flushes data to file and forgets the buffers; if any of them locked, throws exception
+    virtual void        setWal      (File& file, Wal* wal) = 0; // keeps the changes to the file in the write-ahead log: the dirty pages go to the log, the file gets them after commit; NULL checkpoints and stops that
+    virtual Wal*        getWal      (File& file) = 0;
+    virtual bool        checkpoint  (File& file) = 0; // puts into the file the committed pages it lacks, the cached ones first, and empties its log; does nothing for a file without a log
+    virtual void        setShadow   (File& file, File* shadow) = 0; // keeps in shadow the old images of the pages the snapshots of the file still see; NULL only when no snapshots are open. Not for a file kept with a log
+    virtual File&       snapshot    (File& file) = 0; // writes out the dirty pages and returns the read-only file seeing this one as it is now, whatever is written through the pager later; 
+                                                      // closing it releases the snapshot. Needs the shadow set
+    virtual void        setChecksums (File& file, File* sums) = 0; // keeps the CRC32C of every page of the file written out in sums, and checks the pages read against it, 
+                                                      // throwing FileStructureCorrupt on mismatch; sums gets up to date by commit, or by checkpoint for a file kept with a log; 
+                                                      // set again, it is taken anew from the pages the file has, as after a crash, unless closed by close () or by NULL with none of the pages left unwritten. NULL stops that
 
     virtual uint64      pageno      (const void* page) = 0; // finds the page number cached in page buffer
     virtual File&       file        (const void* page) = 0; // finds the file which portion is cached in page buffer
     virtual void*       pageaddr    (const void* ptr, uint32* count = NULL) = 0; // returns the proper base page address for pointer or NULL if not managed or invalid
 
     virtual void*       checkpage   (File& file, uint64 pageno, uint32* count = NULL) = 0; // determins weather the page is currently cached; returns address of cached page or NULL if not cached
+    virtual uint32      prefetch    (File& file, const uint64* pagenos, uint32 count) = 0; // has the file start reading the listed single pages ahead of use (File::prefetch), skipping cached ones; adjacent pages go in one request. Returns number of pages asked for
 
     virtual uint32      getPageSize () const = 0;
     virtual uint32      getPoolSize () const = 0;
@@ -14,6 +14,8 @@
 #define edbPagerFactory_defined
 #include "edbPager_imp.h"
 #include "edbExceptions.h"
+#include "edbCrc32c.h"
+#include "edbStats.h"
 #include <vector>
 #include <string.h>
 
@@ -41,6 +43,10 @@ namespace edb
 #define FAVOR_MIN_WRITE_VOLUME
 // #define FAVOR_LONG_DUMPS
 static const uint32 MEM_PAGE_SIZE = 0x1000; // 4 Kb
+// the checksums file starts with the state record: the signature, and whether the checksums were closed matching the file
+static const uint32 SUMS_SIGN = 0x736d7553; // "Sums" on disk
+static const uint32 SUMS_CLOSED = 0;
+static const uint32 SUMS_OPEN = 1;
 
 
 static PagerFactory_imp theFactory;
@@ -58,7 +64,11 @@ dumpcnt_ (0),
 hits_ (0),
 misses_ (0),
 last_dumped_ (UINT32_MAX),
-cur_pageuse_ (0L)
+cur_pageuse_ (0L),
+loggedcnt_ (0),
+hints_ (NULL),
+hintmask_ (0),
+relayout_ (0)
 {
     init_ (pagesize, poolsize);
 }
@@ -68,6 +78,13 @@ Pager_imp::~Pager_imp ()
     // calling detach_ ensures that all dirty pages are saved. 
     // If some files not fully saved are closed by this time, exception will be thrown on write attempt
     detach_ ();
+    for (Shadowmap::iterator itr = shadows_.begin (); itr != shadows_.end (); itr ++)
+        delete (*itr).second;
+    for (Summap::iterator itr = checksums_.begin (); itr != checksums_.end (); itr ++)
+    {
+        savesums_ (*(*itr).second);
+        delete (*itr).second;
+    }
 }
 
 uint32 Pager_imp::process_overlaps_ (File& file, FilePos pageno, uint32 count)
@@ -108,7 +125,7 @@ uint32 Pager_imp::process_overlaps_ (File& file, FilePos pageno, uint32 count)
         if (page.page_ + subordcount > pageno)
         {
 #ifdef PAGER_IMP_DEBUG
-            if (page.lockcnt_)
+            if (page.lockcnt_.get ())
                 ERR("process_overlaps_: overlap with locked slotrange");
 #endif
             // save markcnt      
@@ -187,7 +204,7 @@ bool Pager_imp::uninterrupted_hlp_range_ (uint32 ccnt)
 #ifdef PAGER_IMP_DEBUG
         if (page.free_)
             ERR("uninterrupted_hlp_range_: free page encountered");
-        if (page.lockcnt_)
+        if (page.lockcnt_.get ())
             ERR("uninterrupted_hlp_range_: locked page encountered");
         if (page.masters_)
             ERR("uninterrupted_hlp_range_: masterpage encountered");
@@ -219,7 +236,7 @@ uint32 Pager_imp::assemble_hlp_slotrange_ (uint32 ccnt)
 #ifdef PAGER_IMP_DEBUG
         if (page.free_)
             ERR("assemble_hlp_slotrange_: free page encountered");
-        if (page.lockcnt_)
+        if (page.lockcnt_.get ())
             ERR("assemble_hlp_slotrange_: locked page encountered");
         if (page.masters_)
             ERR("assemble_hlp_slotrange_: masterpage encountered");
@@ -287,6 +304,7 @@ void Pager_imp::fill_ (uint32 slotidx, File& file, FilePos pageno, uint32 count,
 
                 // copy the contents of common page
                 memcpy (arena_ + (slotidx + pgi) * pagesize_, arena_ + common_slotidx * pagesize_, pagesize_);
+                setlogged_ (slotidx + pgi, pages_ [common_slotidx].logged_);
                 // carry the mark count (Count (not bool) here becomes confusing. Just sum them up - this really does no matter ;))
                 firstslot.markcnt_ += pages_ [common_slotidx].markcnt_;
                 // update hit counter 
@@ -348,9 +366,10 @@ void Pager_imp::markfree_ (uint32 slotidx)
     freelist_.push_front (slotidx);
     page.freelist_pos_ = freelist_.begin ();
     page.free_ = true;
-    page.lockcnt_ = 0;
+    // lockcnt_ is left as it is: a hit without the mutex may have it raised for a moment and will take it back
     page.markcnt_ = 0;
     page.masters_ = 0;
+    setlogged_ (slotidx, false);
 }
 
 void Pager_imp::markused_ (uint32 slotidx)
@@ -419,6 +438,7 @@ void Pager_imp::popmru_ (uint32 slotidx)
     mrulist_.erase (page.mrulist_pos_);
     mrulist_.push_front (slotidx);
     page.mrulist_pos_ = mrulist_.begin ();
+    page.referenced_.set (0);
     page.useno_ = cur_pageuse_;
     cur_pageuse_ ++;
 }
@@ -454,7 +474,7 @@ void Pager_imp::addmaster_ (uint32 slotidx)
 #ifdef PAGER_IMP_DEBUG
     if (page.free_)
         ERR("addmaster_: page is free");
-    if (page.lockcnt_)
+    if (page.lockcnt_.get ())
         ERR("addmaster_: page is locked");
     if (!page.masters_)
         ERR("addmaster_: page masters_ == 0");
@@ -466,6 +486,7 @@ void Pager_imp::addmaster_ (uint32 slotidx)
     mrulist_.push_front (slotidx);
     page.mrulist_pos_ = mrulist_.begin ();
     addrmap_ [PageKey (*page.file_, page.page_)] = slotidx;
+    page.referenced_.set (0);
     page.useno_ = cur_pageuse_;
     cur_pageuse_ ++;
 #ifdef PAGER_IMP_DEBUG
@@ -484,7 +505,7 @@ void Pager_imp::removemaster_ (uint32 slotidx)
 #ifdef PAGER_IMP_DEBUG
     if (page.free_)
         ERR("removemaster_: page is free");
-    if (page.lockcnt_)
+    if (page.lockcnt_.get ())
         ERR("removemaster_: page is locked");
     if (!page.masters_)
         ERR("removemaster_: page masters_ == 0");
@@ -521,12 +542,10 @@ void Pager_imp::dump_ (uint32 slotidx)
     if (!page.masters_)
         ERR("dump_: subordinate slot passed");
 #endif
-    if (page.markcnt_)
+    if (page.markcnt_ || haslogged_ (slotidx, page.masters_))
     {
         // write it 
-        FilePos fileoff = page.page_*pagesize_;
-        if (page.file_->seek (fileoff) != fileoff) ERR("Seek error");
-        if (page.file_->write (arena_ + slotidx*pagesize_, page.masters_*pagesize_) != page.masters_*pagesize_) ERR("Write error");
+        write_ (slotidx, page.masters_, page.markcnt_ != 0);
         // release dirty flag
         page.markcnt_ = 0;
         // update dumpcnt_ if prev dump was 'too far away'
@@ -537,7 +556,7 @@ void Pager_imp::dump_ (uint32 slotidx)
     }
 }
 
-void Pager_imp::dumpslots_ (uint32 slotidx, uint32 count)
+void Pager_imp::dumpslots_ (uint32 slotidx, uint32 count, bool changed)
 {
 #ifdef PAGER_IMP_DEBUG
     if (slotidx >= poolsize_)
@@ -549,9 +568,7 @@ void Pager_imp::dumpslots_ (uint32 slotidx, uint32 count)
         ERR("dumpslot_: free slot passed");
 #endif
     // write it 
-    FilePos fileoff = page.page_*pagesize_;
-    if (page.file_->seek (fileoff) != fileoff) ERR("Seek error");
-    if (page.file_->write (arena_ + slotidx*pagesize_, pagesize_*count) != pagesize_*count) ERR("Write error");
+    write_ (slotidx, count, changed);
 
     // update dumpcnt_ if prev dump was 'too far away'
     if (!(page.page_ >= last_dumped_ && page.page_ <= last_dumped_ + (GAP_FACTOR-1)))
@@ -560,6 +577,72 @@ void Pager_imp::dumpslots_ (uint32 slotidx, uint32 count)
     last_dumped_ = page.page_+1; 
 }
 
+void Pager_imp::write_ (uint32 slotidx, uint32 count, bool changed)
+{
+    Page& page = pages_ [slotidx];
+    EDB_STAT_RECORD (STAT_DUMP_PAGES, count);
+    Wal* wal = wal_ (*page.file_);
+    if (!wal)
+    {
+        // the snapshots keep seeing the pages as they were
+        Shadow* shadow = shadow_ (*page.file_);
+        if (shadow)
+            shadow->preserve (page.page_, count);
+        // no sync for the checksums: they are saved by the commit and put on disk when closed
+        PageSums* ps = pagesums_ (*page.file_);
+        if (ps)
+            stagesums_ (*ps, page.page_, count, arena_ + slotidx*pagesize_);
+        FilePos fileoff = page.page_*pagesize_;
+        if (page.file_->seek (fileoff) != fileoff) ERR("Seek error");
+        if (page.file_->write (arena_ + slotidx*pagesize_, pagesize_*count) != pagesize_*count) ERR("Write error");
+        return;
+    }
+    uint32 si;
+    if (changed)
+    {
+        // not committed yet: the file must not get it, the log keeps it for reading back
+        wal->append (page.page_, arena_ + slotidx*pagesize_, count);
+        for (si = slotidx; si < slotidx + count; si ++)
+            setlogged_ (si, false);
+        return;
+    }
+    // the committed images the file lacks, by runs of adjacent slots, after the log is on disk
+    wal->flush ();
+    PageSums* ps = pagesums_ (*page.file_);
+    for (si = slotidx; si < slotidx + count; )
+    {
+        if (!pages_ [si].logged_)
+        {
+            si ++;
+            continue;
+        }
+        uint32 runend = si + 1;
+        while (runend < slotidx + count && pages_ [runend].logged_)
+            runend ++;
+        FilePos fileoff = pages_ [si].page_*pagesize_;
+        if (page.file_->seek (fileoff) != fileoff) ERR("Seek error");
+        if (page.file_->write (arena_ + si*pagesize_, pagesize_*(runend - si)) != pagesize_*(runend - si)) ERR("Write error");
+        if (ps)
+            logsums_ (*ps, pages_ [si].page_, runend - si, arena_ + si*pagesize_);
+        wal->applied (pages_ [si].page_, runend - si);
+        for (; si < runend; si ++)
+            setlogged_ (si, false);
+    }
+}
+
+// the images from the log are not checked: their checksums may be on disk only after the checkpoint
+void Pager_imp::overlay_ (File& file, FilePos pageno, uint32 count, char* data)
+{
+    Wal* wal = wal_ (file);
+    PageSums* ps = pagesums_ (file);
+    if (!wal && !ps) return;
+    for (uint32 pgi = 0; pgi < count; pgi ++)
+    {
+        if (wal && wal->read (pageno + pgi, data + pgi*pagesize_)) continue;
+        if (ps) verify_ (*ps, pageno + pgi, data + pgi*pagesize_);
+    }
+}
+
 
 void Pager_imp::free_ (uint32 slotidx)
 {
@@ -573,7 +656,7 @@ void Pager_imp::free_ (uint32 slotidx)
         ERR("free_: slot allready free");
     if (!master_page.masters_)
         ERR("free_: slot is subordinate");
-    if (master_page.lockcnt_)
+    if (master_page.lockcnt_.get ())
         ERR("free_: slotrange is locked");
 #endif
     uint32 end_slot = slotidx + master_page.masters_;
@@ -605,7 +688,7 @@ void Pager_imp::free_ (uint32 slotidx)
                 ERR("free_: slot allready free");
             if (page.masters_)
                 ERR("free_: subordinate slot marked as master");
-            if (page.lockcnt_)
+            if (page.lockcnt_.get ())
                 ERR("free_: subordinate slot is locked");
         }
 #endif
@@ -623,7 +706,7 @@ void Pager_imp::freeslot_ (uint32 slotidx)
 #ifdef PAGER_IMP_DEBUG
     if (page.free_)
         ERR("freeslot_: slot allready free");
-    if (page.masters_ && page.lockcnt_)
+    if (page.masters_ && page.lockcnt_.get ())
         ERR("freeslot_: page is locked");
 #endif
     if (page.masters_)
@@ -656,7 +739,9 @@ void Pager_imp::read_ (uint32 slotidx, File& file, FilePos pageno, uint32 count)
         ERR("read_: slotrange length is too big (>MAX_PAGEROW_LEN)");
 #endif 
     if (file.seek (pageno*pagesize_) != pageno*pagesize_) throw IOError ("Seek error");
+    EDB_STAT_ADD (STAT_PAGER_PAGES_READ, count);
     if (file.read (arena_ + slotidx*pagesize_, count*pagesize_) == -1) throw IOError ("Read error"); // beyonf EOF read may return lesser then requested. This is Ok (?-for fake, what about fetch?)
+    overlay_ (file, pageno, count, arena_ + slotidx*pagesize_);
     for (uint32 si = 0; si < count; si ++)
     {
         Page& page = pages_ [slotidx + si];
@@ -665,6 +750,17 @@ void Pager_imp::read_ (uint32 slotidx, File& file, FilePos pageno, uint32 count)
     }
 }
 
+bool Pager_imp::cached_ (File& file, FilePos pageno)
+{
+    // the last slotrange starting at or before pageno
+    Pkeymap::iterator itr = addrmap_.upper_bound (PageKey (file, pageno));
+    if (itr == addrmap_.begin ())
+        return false;
+    itr --;
+    const PageKey& key = (*itr).first;
+    return key.file_ == &file && key.page_ + pages_ [(*itr).second].masters_ > pageno;
+}
+
 void Pager_imp::lock_ (uint32 slotidx)
 {
 #ifdef PAGER_IMP_DEBUG
@@ -678,7 +774,7 @@ void Pager_imp::lock_ (uint32 slotidx)
     if (!page.masters_)
         ERR("lock_: page is subordinate");
 #endif
-    page.lockcnt_ ++;
+    page.lockcnt_.add (1);
 }
 
 void Pager_imp::unlock_ (uint32 slotidx)
@@ -694,8 +790,9 @@ void Pager_imp::unlock_ (uint32 slotidx)
     if (!page.masters_)
         ERR("unlock_: page is subordinate");
 #endif
-    if (page.lockcnt_ > 0)
-        page.lockcnt_ --;
+    // runs without the mutex too
+    if (page.lockcnt_.add (-1) < 0)
+        page.lockcnt_.add (1);
 }
 
 bool Pager_imp::locked_ (uint32 slotidx)
@@ -711,7 +808,7 @@ bool Pager_imp::locked_ (uint32 slotidx)
     if (!page.masters_)
         ERR("locked_: page is subordinate");
 #endif
-    return page.lockcnt_ > 0;
+    return page.lockcnt_.get () > 0;
 }
 
 void Pager_imp::mark_ (uint32 slotidx)
@@ -763,11 +860,216 @@ bool Pager_imp::marked_ (uint32 slotidx)
     return page.markcnt_ > 0;
 }
 
+bool Pager_imp::dirty_ (uint32 slotidx)
+{
+    Page& page = pages_ [slotidx];
+    return page.markcnt_ > 0 || haslogged_ (slotidx, page.masters_);
+}
+
+bool Pager_imp::haslogged_ (uint32 slotidx, uint32 count)
+{
+    if (!loggedcnt_) return false;
+    for (uint32 si = slotidx; si < slotidx + count; si ++)
+        if (pages_ [si].logged_)
+            return true;
+    return false;
+}
+
+void Pager_imp::setlogged_ (uint32 slotidx, bool logged)
+{
+    Page& page = pages_ [slotidx];
+    if (page.logged_ == logged) return;
+    page.logged_ = logged;
+    if (logged) loggedcnt_ ++;
+    else loggedcnt_ --;
+}
+
+Wal* Pager_imp::wal_ (File& file)
+{
+    if (wals_.empty ()) return NULL;
+    Walmap::iterator itr = wals_.find (&file);
+    return (itr == wals_.end ()) ? NULL : (*itr).second;
+}
+
+Shadow* Pager_imp::shadow_ (File& file)
+{
+    if (shadows_.empty ()) return NULL;
+    Shadowmap::iterator itr = shadows_.find (&file);
+    return (itr == shadows_.end ()) ? NULL : (*itr).second;
+}
+
+Pager_imp::PageSums* Pager_imp::pagesums_ (File& file)
+{
+    if (checksums_.empty ()) return NULL;
+    Summap::iterator itr = checksums_.find (&file);
+    return (itr == checksums_.end ()) ? NULL : (*itr).second;
+}
+
+// the computed 0 is kept as 1, so that 0 means no checksum
+uint32 Pager_imp::pagesum_ (const char* data)
+{
+    uint32 sum = crc32c (data, pagesize_);
+    return sum ? sum : 1;
+}
+
+// A page written in place may be torn or lost by a crash, so its entry keeps the checksum of the image the file 
+// surely has as well, until the file is synced. The pages written for the first time have no such image and are 
+// not checked until then. Nothing goes on disk here: a crash may leave the file with the pages whose checksums 
+// are not saved, so the checksums not closed with the file are taken anew from it (see setChecksums)
+void Pager_imp::stagesums_ (PageSums& ps, FilePos pageno, uint32 count, const char* data)
+{
+    if (ps.sums_.size () < pageno + count)
+    {
+        PageSum none = {0, 0};
+        ps.sums_.resize ((size_t) (pageno + count), none);
+    }
+    bool changed = false;
+    for (uint32 pgi = 0; pgi < count; pgi ++)
+    {
+        PageSum& entry = ps.sums_ [(size_t) (pageno + pgi)];
+        ps.written_.insert (pageno + pgi);
+        uint32 sum = pagesum_ (data + pgi*pagesize_);
+        if (sum == entry.sum_) continue;
+        entry.sum_ = sum;
+        changed = true;
+    }
+    if (changed)
+    {
+        ps.dirtyfrom_ = min_ (ps.dirtyfrom_, pageno);
+        ps.dirtyto_ = max_ (ps.dirtyto_, pageno + count);
+    }
+}
+
+// the file is synced: the pages written have the images of their latest checksums
+void Pager_imp::settlesums_ (PageSums& ps)
+{
+    for (std::set <uint64>::iterator itr = ps.written_.begin (); itr != ps.written_.end () && *itr < ps.sums_.size (); itr ++)
+    {
+        PageSum& entry = ps.sums_ [(size_t) *itr];
+        if (entry.prev_ == entry.sum_) continue;
+        entry.prev_ = entry.sum_;
+        ps.dirtyfrom_ = min_ (ps.dirtyfrom_, *itr);
+        ps.dirtyto_ = max_ (ps.dirtyto_, *itr + 1);
+    }
+    ps.written_.clear ();
+}
+
+// the log keeps the images until the file has them on disk, so no other one is accepted
+void Pager_imp::logsums_ (PageSums& ps, FilePos pageno, uint32 count, const char* data)
+{
+    if (ps.sums_.size () < pageno + count)
+    {
+        PageSum none = {0, 0};
+        ps.sums_.resize ((size_t) (pageno + count), none);
+    }
+    for (uint32 pgi = 0; pgi < count; pgi ++)
+    {
+        PageSum& entry = ps.sums_ [(size_t) (pageno + pgi)];
+        entry.sum_ = entry.prev_ = pagesum_ (data + pgi*pagesize_);
+    }
+    ps.dirtyfrom_ = min_ (ps.dirtyfrom_, pageno);
+    ps.dirtyto_ = max_ (ps.dirtyto_, pageno + count);
+}
+
+void Pager_imp::verify_ (PageSums& ps, FilePos pageno, const char* data)
+{
+    if (pageno >= ps.sums_.size ()) return;
+    const PageSum& entry = ps.sums_ [(size_t) pageno];
+    if (!entry.sum_ || !entry.prev_) return;
+    uint32 sum = pagesum_ (data);
+    if (sum != entry.sum_ && sum != entry.prev_) throw FileStructureCorrupt ("Page checksum mismatch");
+}
+
+void Pager_imp::savesums_ (PageSums& ps)
+{
+    if (ps.dirtyfrom_ >= ps.dirtyto_) return;
+    FilePos off = (ps.dirtyfrom_ + 1) * sizeof (PageSum);
+    BufLen len = (BufLen) ((ps.dirtyto_ - ps.dirtyfrom_) * sizeof (PageSum));
+    if (ps.store_.seek (off) != off) throw IOError ("Seek error");
+    if (ps.store_.write (&ps.sums_ [(size_t) ps.dirtyfrom_], len) != len) throw IOError ("Write error");
+    ps.dirtyfrom_ = UINT64_MAX;
+    ps.dirtyto_ = 0;
+}
+
+void Pager_imp::marksums_ (PageSums& ps, uint32 state)
+{
+    PageSum head = {SUMS_SIGN, state};
+    if (ps.store_.seek (0) != 0) throw IOError ("Seek error");
+    if (ps.store_.write (&head, sizeof (head)) != sizeof (head)) throw IOError ("Write error");
+    if (!ps.store_.commit ()) throw IOError ("Commit error");
+}
+
+// With the file synced, and none of its pages waiting in the slots or in the log, the checksums saved match it 
+// and are closed: they are taken as they are when set again. Otherwise they are taken anew from the file then
+void Pager_imp::closesums_ (PageSums& ps, File& file)
+{
+    bool pending = wal_ (file) != NULL;
+    for (Pkeymap::iterator itr = addrmap_.lower_bound (PageKey (file, 0L));
+        !pending && itr != addrmap_.end () && (*itr).first.file_ == &file;
+        itr ++)
+        pending = pages_ [(*itr).second].markcnt_ != 0;
+    if (pending || !file.commit ())
+    {
+        savesums_ (ps);
+        return;
+    }
+    settlesums_ (ps);
+    savesums_ (ps);
+    // the entries are on disk before the state says they match
+    if (!ps.store_.commit ()) throw IOError ("Commit error");
+    marksums_ (ps, SUMS_CLOSED);
+}
+
+// the marked slotranges go to the log; their slots hold the committed images then, to be written to the file when dumped
+uint64 Pager_imp::logcommit_ (File& file, Wal& wal)
+{
+    for (Pkeymap::iterator itr = addrmap_.lower_bound (PageKey (file, 0L));
+        itr != addrmap_.end () && (*itr).first.file_ == &file;
+        itr ++)
+    {
+        uint32 slotidx = (*itr).second;
+        Page& page = pages_ [slotidx];
+        if (!page.markcnt_) continue;
+        wal.append (page.page_, arena_ + slotidx*pagesize_, page.masters_);
+        page.markcnt_ = 0;
+        for (uint32 si = slotidx; si < slotidx + page.masters_; si ++)
+            setlogged_ (si, true);
+    }
+    return wal.commit ();
+}
+
+// the cached committed images are written first, by the slotranges in file order; the log supplies the rest.
+// The slotranges marked again hold no committed images any more. The checksums of the images the log supplies,
+// also those recovered after a crash, are taken from the log
+bool Pager_imp::checkpoint_ (File& file, Wal& wal)
+{
+    for (Pkeymap::iterator itr = addrmap_.lower_bound (PageKey (file, 0L));
+        itr != addrmap_.end () && (*itr).first.file_ == &file;
+        itr ++)
+    {
+        uint32 slotidx = (*itr).second;
+        Page& page = pages_ [slotidx];
+        if (!page.markcnt_ && haslogged_ (slotidx, page.masters_))
+            write_ (slotidx, page.masters_, false);
+    }
+    PageSums* ps = pagesums_ (file);
+    if (ps)
+    {
+        wal.flush ();
+        std::vector <char> image (pagesize_);
+        for (uint64 pageno = wal.committed (0, &image [0]); pageno != UINT64_MAX; pageno = wal.committed (pageno + 1, &image [0]))
+            logsums_ (*ps, pageno, 1, &image [0]);
+        savesums_ (*ps);
+    }
+    return wal.checkpoint (file);
+}
+
 void Pager_imp::init_ (uint32 pagesize, uint32 poolsize)
 {
     // remember pagesize and poolsize
     pagesize_ = pagesize;
     poolsize_ = poolsize;
+    loggedcnt_ = 0;
     // allocate page descriptors array
     pages_ = new Page [poolsize_];
     if (!pages_) ERR("Not enough memory for page pool");
@@ -788,10 +1090,18 @@ void Pager_imp::init_ (uint32 pagesize, uint32 poolsize)
     // allocate temporary (helper) buffer
     hlpbuf_ = new uint32 [poolsize_];
     if (!hlpbuf_) ERR ("Not enough memory for temp set");
+    // the hints table is a power of two at least twice the pool, so that few pages share an entry
+    uint32 hintsize = 1;
+    while (hintsize < poolsize_ * 2)
+        hintsize <<= 1;
+    hints_ = new uint32 [hintsize];
+    memset (hints_, 0, hintsize * sizeof (uint32));
+    hintmask_ = hintsize - 1;
 }
 
 void Pager_imp::detach_ (bool freedata)
 {
+    Relayout relayout (*this);
     // dump all dirty slotranges, remembering them in hlpbuf_ for further freing
     // (we cnot free them right here because map iterator gets invalidated on element removal)
     uint32 toFreeNo = 0;
@@ -819,9 +1129,17 @@ void Pager_imp::detach_ (bool freedata)
         // remove everything from freelist as well - after detach_ the init_ should be called, so freelist will populate again
         freelist_.clear ();
         // delete all the buffers allocated during initialization
-        if (pages_)  { delete [] pages_;  pages_ = NULL;  }
+        if (pages_)
+        {
+            // the hits counted in the slots are kept over the pool change
+            for (uint32 slotidx = 0; slotidx < poolsize_; slotidx ++)
+                hits_ += pages_ [slotidx].quickhits_.get ();
+            delete [] pages_;
+            pages_ = NULL;
+        }
         if (arenabuf_) { delete [] arenabuf_; arenabuf_ = NULL; arena_ = NULL; }
         if (hlpbuf_) { delete [] hlpbuf_; hlpbuf_ = NULL; }
+        if (hints_) { delete [] hints_; hints_ = NULL; }
     }
 }
 
@@ -843,6 +1161,7 @@ uint32 Pager_imp::fetch_ (File& file, FilePos pageno, uint32 count)
             return slotidx;
         }
     }
+    Relayout relayout (*this);
 
     // find overlaps
     uint32 common_count = process_overlaps_ (file, pageno, count);
@@ -852,7 +1171,22 @@ uint32 Pager_imp::fetch_ (File& file, FilePos pageno, uint32 count)
     // allocate space for the count pages. Do not discard the common pages.
     uint32 slotidx = allocate_ (count, common_count);
     // move / read the pages
-    fill_ (slotidx, file, pageno, count, common_count);
+    try
+    {
+        fill_ (slotidx, file, pageno, count, common_count);
+    }
+    catch (...)
+    {
+        // the range that could not be read is not cached; the common pages stay, each on its own
+        for (uint32 si = slotidx; si < slotidx + count; si ++)
+            markfree_ (si);
+        for (uint32 ci = 0; ci < common_count; ci ++)
+        {
+            pages_ [hlpbuf_ [ci]].masters_ = 1;
+            addmaster_ (hlpbuf_ [ci]);
+        }
+        throw;
+    }
     // free common slots
     free_hlp_buf_ (common_count);
     // return the new first page
@@ -876,6 +1210,7 @@ uint32 Pager_imp::fake_ (File& file, FilePos pageno, uint32 count)
             return slotidx;
         }
     }
+    Relayout relayout (*this);
     // find overlaps
     uint32 common_count = process_overlaps_ (file, pageno, count);
     // allocate space for the count pages. Do not discard the common pages.
@@ -921,7 +1256,7 @@ void Pager_imp::makerange_ (uint32 slotidx, uint32 count)
             uint32 rangelen = masterslot.masters_;
 
 #if defined (FAVOR_LONG_DUMPS)
-            if (masterslot.markcnt_)
+            if (dirty_ (masteridx))
             {
                 uint32 dumpcnt;
                 Pkeymap::iterator pagerow_begin = dump_len_ (masteridx, dumpcnt);
@@ -931,7 +1266,7 @@ void Pager_imp::makerange_ (uint32 slotidx, uint32 count)
 #endif
                 dumpx_ (pagerow_begin);
 #ifdef PAGER_IMP_DEBUG
-                if (masterslot.markcnt_)
+                if (dirty_ (masteridx))
                     ERR("makerange_: internal");
 #endif
             }
@@ -939,7 +1274,7 @@ void Pager_imp::makerange_ (uint32 slotidx, uint32 count)
 
 #ifdef PAGER_IMP_DEBUG
             // DEBUG check whether not locked
-            if (masterslot.lockcnt_)
+            if (masterslot.lockcnt_.get ())
                 ERR("makerange_: overlap with locked range");
 #endif
             // save markcnt      
@@ -957,8 +1292,8 @@ void Pager_imp::makerange_ (uint32 slotidx, uint32 count)
             uint32 inner_begin = max_ (slotidx, masteridx);
             uint32 inner_end   = min_ (slotidx + count, masteridx + rangelen); 
 #if defined (FAVOR_MIN_WRITE_VOLUME)
-            if (markcnt)
-                dumpslots_ (inner_begin, inner_end - inner_begin);
+            if (markcnt || haslogged_ (inner_begin, inner_end - inner_begin))
+                dumpslots_ (inner_begin, inner_end - inner_begin, markcnt != 0);
 #endif
 
             // if there is postceeding portion, separate it; copy mark count
@@ -996,6 +1331,7 @@ void Pager_imp::makerange_ (uint32 slotidx, uint32 count)
             slot.masters_ = 0;
             slot.markcnt_ = 0;
         }
+        setlogged_ (si, false);
     }
 }
 
@@ -1004,6 +1340,7 @@ void Pager_imp::makerange_ (uint32 slotidx, uint32 count)
 
 uint32 Pager_imp::lookupfree_ (uint32 count, uint32 preserved_count)
 {
+    promote_ ();
     // pick from free list such that has 'count' unlocked slots left
     uint64 best_weight = 0;
     uint32 iter_count = 0;
@@ -1060,6 +1397,30 @@ uint32 Pager_imp::lookupfree_ (uint32 count, uint32 preserved_count)
     throw NoCacheSpace ();
 }
 
+void Pager_imp::promote_ ()
+{
+    // the second chance: the pages hit without the mutex did not move in the MRU list on the hit,
+    // they do now when they come to its tail. Stops after as many pages not hit as lookupfree_ weighs
+    uint32 passed = 0;
+    uint32 left = (uint32) addrmap_.size ();
+    Ilist::iterator itr = mrulist_.end ();
+    while (left && passed < UNIMPROVED_COUNT)
+    {
+        -- itr;
+        -- left;
+        uint32 slotidx = *itr;
+        if (pages_ [slotidx].referenced_.get ())
+        {
+            Ilist::iterator tail = itr;
+            tail ++;
+            popmru_ (slotidx);
+            itr = tail;
+        }
+        else
+            passed ++;
+    }
+}
+
 Pager_imp::AVAIL Pager_imp::check_avail_left_ (uint32 slotidx, uint32 count, uint32 preserved_count, uint64& weight)
 {
 #ifdef DEBUG_PAGHER_IMP
@@ -1097,9 +1458,9 @@ Pager_imp::AVAIL Pager_imp::check_avail_left_ (uint32 slotidx, uint32 count, uin
             // check whether locked
             uint32 masteridx = getmaster_ (slotidx + i);
             Page& masterpage = pages_ [masteridx];
-            if (masterpage.lockcnt_)
+            if (masterpage.lockcnt_.get () || masterpage.pins_.get ())
                 return NOT_AVAIL;
-            if (!masterpage.markcnt_)
+            if (!dirty_ (masteridx))
             {
 #if defined (FAVOR_LONG_DUMPS)
                 weight += (cur_pageuse_ - masterpage.useno_ + 1)*LONG_ENOUGH_SEQ*CLEAN_SLOT_FACTOR;
@@ -1145,7 +1506,7 @@ Pager_imp::Pkeymap::iterator Pager_imp::dump_len_ (uint32 slotidx, uint32& lengt
         if ((*next_step).first.file_ != page.file_) 
             break;
         Page& prevpage = pages_ [(*next_step).second];
-        if (!prevpage.markcnt_)
+        if (!dirty_ ((*next_step).second))
             break;
         if (prevpage.page_ + prevpage.masters_ + GAP_FACTOR < (*itr_r).first.page_)
             break;
@@ -1164,7 +1525,7 @@ Pager_imp::Pkeymap::iterator Pager_imp::dump_len_ (uint32 slotidx, uint32& lengt
         Page& curpage = pages_ [(*itr_f).second];
         if ((*next_step).first.page_ > curpage.page_ + curpage.masters_ + GAP_FACTOR)
             break;
-        if (!pages_[(*next_step).second].markcnt_)
+        if (!dirty_ ((*next_step).second))
             break;
         itr_f = next_step;
         length += curpage.masters_;
@@ -1189,7 +1550,7 @@ void Pager_imp::dumpx_ (Pager_imp::Pkeymap::iterator begin)
         Page& curpage = pages_ [(*itr_f).second];
         if ((*next_step).first.page_ > curpage.page_ + curpage.masters_ + GAP_FACTOR)
             break;
-        if (!pages_[(*next_step).second].markcnt_)
+        if (!dirty_ ((*next_step).second))
             break;
         itr_f = next_step;
         length += curpage.masters_;
@@ -1199,17 +1560,75 @@ void Pager_imp::dumpx_ (Pager_imp::Pkeymap::iterator begin)
 ///////////////////////////////////////////////////////////////////////////////////////
 // Public methods
 
+uint32 Pager_imp::hint_ (File& file, FilePos pageno) const
+{
+    uint64 key = ((uint64) (size_t) &file) ^ (pageno * 0x9E3779B97F4A7C15ULL);
+    return ((uint32) (key ^ (key >> 32))) & hintmask_;
+}
+
+void* Pager_imp::quickfetch_ (File& file, FilePos pageno, bool lock, uint32 count)
+{
+    int64 layout = layout_.get ();
+    if (layout & 1)
+        return NULL;
+    // the slot fields may be changing under the reads below; if so, layout_ will not be the same after the pin
+    uint32 slotidx = hints_ [hint_ (file, pageno)];
+    Page& page = pages_ [slotidx];
+    if (page.free_ || !page.masters_ || page.file_ != &file || page.page_ != pageno || page.masters_ != count)
+        return NULL;
+    // the lock wanted is the pin
+    Atomic& pin = lock ? page.lockcnt_ : page.pins_;
+    pin.add (1);
+    if (layout_.get () != layout)
+    {
+        pin.add (-1);
+        return NULL;
+    }
+    page.referenced_.set (1);
+    page.quickhits_.add (count);
+    if (!lock)
+        pin.add (-1);
+    return slotaddr_ (slotidx);
+}
+
 void* Pager_imp::fetch (File& file, uint64 pageno, bool lock, uint32 count)
 {
+    EDB_STAT_START (started);
+    void* data = quickfetch_ (file, pageno, lock, count);
+    if (data)
+    {
+        EDB_STAT_ADD (STAT_PAGER_FETCH_HITS, 1);
+        EDB_STAT_LATENCY (STAT_FETCH_HIT_NS, started);
+        return data;
+    }
+    MutexGuard guard (mutex_);
+#if defined (EDB_STATS)
+    uint64 misses = misses_;
+#endif
     uint32 slotidx = fetch_ (file, pageno, count);
+    hints_ [hint_ (file, pageno)] = slotidx;
     if (lock)
         lock_ (slotidx);
+#if defined (EDB_STATS)
+    if (misses_ == misses)
+    {
+        EDB_STAT_ADD (STAT_PAGER_FETCH_HITS, 1);
+        EDB_STAT_LATENCY (STAT_FETCH_HIT_NS, started);
+    }
+    else
+    {
+        EDB_STAT_ADD (STAT_PAGER_FETCH_MISSES, 1);
+        EDB_STAT_LATENCY (STAT_FETCH_MISS_NS, started);
+    }
+#endif
     return slotaddr_ (slotidx);
 }
 
 void* Pager_imp::fake (File& file, uint64 pageno, bool lock, uint32 count)
 {
+    MutexGuard guard (mutex_);
     uint32 slotidx = fake_ (file, pageno, count);
+    hints_ [hint_ (file, pageno)] = slotidx;
     if (lock)
         lock_ (slotidx);
     return slotaddr_ (slotidx);
@@ -1217,36 +1636,57 @@ void* Pager_imp::fake (File& file, uint64 pageno, bool lock, uint32 count)
 
 bool Pager_imp::locked (const void* buffer)
 {
+    MutexGuard guard (mutex_);
     return locked_ (slotidx_ (buffer));
 }
 
 void Pager_imp::lock (const void* buffer)
 {
+    MutexGuard guard (mutex_);
     lock_ (slotidx_ (buffer));
 }
 
 void Pager_imp::unlock (const void* buffer)
 {
+    // the lock count alone changes; the slot stays with the page while it is locked
     unlock_ (slotidx_ (buffer));
 }
 
 bool Pager_imp::marked (const void* buffer)
 {
+    MutexGuard guard (mutex_);
     return marked_ (slotidx_ (buffer));
 }
 
 void Pager_imp::mark (const void* buffer)
 {
+    MutexGuard guard (mutex_);
     mark_ (slotidx_ (buffer));
 }
 
 void Pager_imp::unmark (const void* buffer)
 {
+    MutexGuard guard (mutex_);
     unmark_ (slotidx_ (buffer));
 }
 
 bool Pager_imp::commit (File& file)
 {
+    Wal* wal;
+    uint64 lsn = 0;
+    {
+        MutexGuard guard (mutex_);
+        wal = wal_ (file);
+        if (wal)
+            lsn = logcommit_ (file, *wal);
+    }
+    if (wal)
+    {
+        // outside of the pager lock, so that the threads committing meanwhile share the fsync
+        wal->sync (lsn);
+        return true;
+    }
+    MutexGuard guard (mutex_);
     // for every slotrange belonging to a file
     for (Pkeymap::iterator itr = addrmap_.lower_bound (PageKey (file, 0L));
         itr != addrmap_.end () && (*itr).first.file_ == &file;
@@ -1261,19 +1701,53 @@ bool Pager_imp::commit (File& file)
             ERR("commit: free page in addrmap");
         if (!page.masters_)
             ERR("commit: subordinate page in addrmap");
-        if (page.lockcnt_)
+        if (page.lockcnt_.get ())
             ERR("commit: locked page found");
 #endif 
         dump_ ((*itr).second);
     }
-    return file.commit ();
+    if (!file.commit ()) return false;
+    // the pages written are on disk: their checksums alone are kept. They are not synced: until closed,
+    // the checksums are taken anew from the file after a crash
+    PageSums* ps = pagesums_ (file);
+    if (ps)
+    {
+        settlesums_ (*ps);
+        savesums_ (*ps);
+    }
+    return true;
 }
 
 bool Pager_imp::chsize (File& file, FilePos newSize)
 {
+    MutexGuard guard (mutex_);
+    // the size change is not logged: the pages the log keeps beyond it must not come back later
+    Wal* wal = wal_ (file);
+    if (wal)
+    {
+        logcommit_ (file, *wal);
+        checkpoint_ (file, *wal);
+    }
     // if newSize < current size:
     if (newSize < file.length ())
     {
+        Relayout relayout (*this);
+        // the pages cut off, including the partial one, go to the snapshots seeing them
+        Shadow* shadow = shadow_ (file);
+        if (shadow)
+        {
+            uint64 lastpage = (file.length () + pagesize_ - 1) / pagesize_;
+            for (uint64 pg = newSize / pagesize_; pg < lastpage; pg += MAX_DUMP_LEN)
+                shadow->preserve (pg, (uint32) min_ (lastpage - pg, (uint64) MAX_DUMP_LEN));
+        }
+        // the partial page left is not checksummed any more
+        PageSums* ps = pagesums_ (file);
+        if (ps && ps->sums_.size () > newSize / pagesize_)
+        {
+            ps->sums_.resize ((size_t) (newSize / pagesize_));
+            ps->dirtyto_ = min_ (ps->dirtyto_, (uint64) ps->sums_.size ());
+            if (!ps->store_.chsize ((ps->sums_.size () + 1) * sizeof (PageSum))) throw IOError ("Truncate error");
+        }
         // mark all releasing pages as free. Do not dump anything
         uint32 toFreeNo = 0;
         // for every slotrange belonging to a file
@@ -1291,7 +1765,7 @@ bool Pager_imp::chsize (File& file, FilePos newSize)
                 ERR("chsize: free page in addrmap");
             if (!page.masters_)
                 ERR("chsize: subordinate page in addrmap");
-            if (page.lockcnt_)
+            if (page.lockcnt_.get ())
                 ERR("chsize: locked page found");
 #endif 
             // save into hlpbuf_ for later freing (cannot free here - removal from map invalidates iterator)
@@ -1306,12 +1780,43 @@ bool Pager_imp::chsize (File& file, FilePos newSize)
 
 bool Pager_imp::close (File& file)
 {
+    MutexGuard guard (mutex_);
+    Shadow* shadow = shadow_ (file);
+    if (shadow)
+    {
+        if (!shadow->empty ()) ERR("The file has open snapshots")
+        delete shadow;
+        shadows_.erase (&file);
+    }
+    Wal* wal = wal_ (file);
+    if (wal)
+    {
+        logcommit_ (file, *wal);
+        checkpoint_ (file, *wal);
+        wals_.erase (&file);
+    }
     detach (file);
+    PageSums* ps = pagesums_ (file);
+    if (ps)
+    {
+        closesums_ (*ps, file);
+        delete ps;
+        checksums_.erase (&file);
+    }
     return file.close ();
 }
 
 bool Pager_imp::detach (File& file)
 {
+    MutexGuard guard (mutex_);
+    // for a file with a log, what gets flushed is committed
+    Wal* wal = wal_ (file);
+    if (wal)
+    {
+        logcommit_ (file, *wal);
+        wal->flush ();
+    }
+    Relayout relayout (*this);
     uint32 toFreeNo = 0;
     // for every slotrange belonging to a file
     for (Pkeymap::iterator itr = addrmap_.lower_bound (PageKey (file, 0L));
@@ -1325,7 +1830,7 @@ bool Pager_imp::detach (File& file)
             ERR("detach: free page in addrmap");
         if (!page.masters_)
             ERR("detach: subordinate page in addrmap");
-        if (page.lockcnt_)
+        if (page.lockcnt_.get ())
             ERR("detach: locked page found");
 #endif 
         // dump and save into hlpbuf_ for later freing (cannot free here - removal from map invalidates iterator)
@@ -1339,21 +1844,149 @@ bool Pager_imp::detach (File& file)
     // free all saved slotranges
     for (uint32 d = 0; d < toFreeNo; d ++)
         free_ (hlpbuf_ [d]);
+    PageSums* ps = pagesums_ (file);
+    if (ps)
+        savesums_ (*ps);
     return true;
 }
 
+void Pager_imp::setWal (File& file, Wal* wal)
+{
+    MutexGuard guard (mutex_);
+    Wal* cur = wal_ (file);
+    if (cur == wal) return;
+    if (wal && wal->getPageSize () != pagesize_) ERR("Log page size does not match the pager's")
+    if (wal && shadow_ (file)) ERR("The file kept with the shadow for snapshots cannot have a log")
+    if (cur)
+    {
+        logcommit_ (file, *cur);
+        checkpoint_ (file, *cur);
+        wals_.erase (&file);
+    }
+    if (wal)
+        wals_ [&file] = wal;
+}
+
+Wal* Pager_imp::getWal (File& file)
+{
+    MutexGuard guard (mutex_);
+    return wal_ (file);
+}
+
+bool Pager_imp::checkpoint (File& file)
+{
+    MutexGuard guard (mutex_);
+    Wal* wal = wal_ (file);
+    if (!wal) return true;
+    return checkpoint_ (file, *wal);
+}
+
+void Pager_imp::setShadow (File& file, File* store)
+{
+    MutexGuard guard (mutex_);
+    Shadow* shadow = shadow_ (file);
+    if (shadow)
+    {
+        if (!shadow->empty ()) ERR("The file has open snapshots")
+        delete shadow;
+        shadows_.erase (&file);
+    }
+    if (!store) return;
+    if (wal_ (file)) ERR("The file kept with a log cannot have the shadow for snapshots")
+    shadows_ [&file] = new Shadow (file, *store, pagesize_);
+}
+
+// the file on disk gets what the cache has, so that the snapshot reading it sees that
+File& Pager_imp::snapshot (File& file)
+{
+    MutexGuard guard (mutex_);
+    Shadow* shadow = shadow_ (file);
+    if (!shadow) ERR("No shadow file set for the snapshots")
+    for (Pkeymap::iterator itr = addrmap_.lower_bound (PageKey (file, 0L));
+        itr != addrmap_.end () && (*itr).first.file_ == &file;
+        itr ++)
+        dump_ ((*itr).second);
+    return shadow->snapshot ();
+}
+
+void Pager_imp::setChecksums (File& file, File* store)
+{
+    MutexGuard guard (mutex_);
+    PageSums* ps = pagesums_ (file);
+    if (ps)
+    {
+        closesums_ (*ps, file);
+        delete ps;
+        checksums_.erase (&file);
+    }
+    if (!store) return;
+    ps = new PageSums (*store);
+    PageSum head = {SUMS_SIGN, SUMS_CLOSED};
+    uint64 records = store->length () / sizeof (PageSum);
+    if (records)
+    {
+        if (store->seek (0) != 0 || store->read (&head, sizeof (head)) != sizeof (head))
+        {
+            delete ps;
+            throw IOError ("Read error");
+        }
+        if (head.sum_ != SUMS_SIGN)
+        {
+            delete ps;
+            throw FileStructureCorrupt ("Not a page checksums file");
+        }
+        ps->sums_.resize ((size_t) (records - 1));
+        BufLen len = (BufLen) (ps->sums_.size () * sizeof (PageSum));
+        if (len && store->read (&ps->sums_ [0], len) != len)
+        {
+            delete ps;
+            throw IOError ("Read error");
+        }
+    }
+    checksums_ [&file] = ps;
+    // Not closed, the checksums may lack the images of the pages written since they were put on disk, torn ones 
+    // as well: once the file is synced, each page keeps the image it has. The page changed before that is not found
+    if (head.prev_ != SUMS_CLOSED)
+    {
+        std::vector <char> image;
+        for (uint64 pageno = 0; pageno < ps->sums_.size (); pageno ++)
+        {
+            PageSum& entry = ps->sums_ [(size_t) pageno];
+            if (!entry.sum_) continue;
+            if (image.empty ())
+            {
+                if (!file.commit ()) throw IOError ("Commit error");
+                image.resize (pagesize_);
+            }
+            FilePos off = pageno*pagesize_;
+            if (file.seek (off) != off || file.read (&image [0], pagesize_) != pagesize_) continue;
+            uint32 sum = pagesum_ (&image [0]);
+            if (sum == entry.sum_ && sum == entry.prev_) continue;
+            entry.sum_ = entry.prev_ = sum;
+            ps->dirtyfrom_ = min_ (ps->dirtyfrom_, pageno);
+            ps->dirtyto_ = max_ (ps->dirtyto_, pageno + 1);
+        }
+        savesums_ (*ps);
+    }
+    // open until closed with the file: the pages written meanwhile may have no checksums on disk
+    marksums_ (*ps, SUMS_OPEN);
+}
+
 uint64 Pager_imp::pageno (const void* data)
 {
+    MutexGuard guard (mutex_);
     return pages_ [slotidx_ (data)].page_;
 }
 
 File& Pager_imp::file (const void* data)
 {
+    MutexGuard guard (mutex_);
     return *pages_ [slotidx_ (data)].file_;
 }
 
 void* Pager_imp::pageaddr (const void* ptr, uint32* count)
 {
+    MutexGuard guard (mutex_);
     if (((const char*) ptr) < arena_ || ((const char*) ptr) > arena_ + pagesize_*poolsize_)
         return NULL;
     uint32 off = ((const char*) ptr) - arena_;
@@ -1368,6 +2001,7 @@ void* Pager_imp::pageaddr (const void* ptr, uint32* count)
 
 void* Pager_imp::checkpage (File& file, uint64 pageno, uint32* count)
 {
+    MutexGuard guard (mutex_);
     Pkeymap::iterator itr = addrmap_.find (PageKey (file, pageno));
     if (itr == addrmap_.end ())
         return NULL;
@@ -1388,6 +2022,32 @@ void* Pager_imp::checkpage (File& file, uint64 pageno, uint32* count)
     }
 }
 
+// no slots are taken: the file reads the pages into the system cache meanwhile, and fetch finds them there
+uint32 Pager_imp::prefetch (File& file, const uint64* pagenos, uint32 count)
+{
+    MutexGuard guard (mutex_);
+    uint32 advised = 0;
+    uint32 idx = 0;
+    while (idx < count)
+    {
+        if (cached_ (file, pagenos [idx]))
+        {
+            idx ++;
+            continue;
+        }
+        // the row of adjacent pages not in cache goes in one request
+        uint32 row = 1;
+        while (idx + row < count 
+            && pagenos [idx + row] == pagenos [idx] + row 
+            && !cached_ (file, pagenos [idx + row]))
+            row ++;
+        file.prefetch (pagenos [idx]*pagesize_, ((FilePos) row)*pagesize_);
+        advised += row;
+        idx += row;
+    }
+    return advised;
+}
+
 uint64 Pager_imp::getDumpCount () const
 {
     return dumpcnt_;
@@ -1395,7 +2055,10 @@ uint64 Pager_imp::getDumpCount () const
 
 uint64 Pager_imp::getHitsCount () const
 {
-    return hits_;
+    uint64 hits = hits_;
+    for (uint32 slotidx = 0; slotidx < poolsize_; slotidx ++)
+        hits += pages_ [slotidx].quickhits_.get ();
+    return hits;
 }
 
 uint64 Pager_imp::getMissesCount () const
@@ -1413,8 +2076,10 @@ uint32 Pager_imp::getPoolSize () const
     return poolsize_;
 }
 
+// the pool is reallocated: no other calls may run meanwhile, as the hits without the mutex do not wait for it
 bool Pager_imp::setPoolSize (uint32 poolsize)
 {
+    MutexGuard guard (mutex_);
 #ifdef PAGER_IMP_DEBUG
     if (poolsize == 0) ERR("setPoolSize: Zero pool size requested");
 #endif
@@ -15,8 +15,12 @@
 #define edbPager_imp_h
 
 #include "edbPager.h"
+#include "edbLatch.h"
+#include "edbShadow_imp.h"
 #include <list>
 #include <map>
+#include <set>
+#include <vector>
 
 namespace edb
 {
@@ -42,15 +46,37 @@ protected:
     };
 
     typedef std::map <PageKey, uint32> Pkeymap;
+    typedef std::map <File*, Wal*> Walmap;
+    typedef std::map <File*, Shadow*> Shadowmap;
+
+    struct PageSum // the checksum of the latest page image, and of the image the file surely has until that one is synced; 0 for none
+    {
+        uint32  sum_;
+        uint32  prev_;
+    };
+    struct PageSums // the checksums of the pages of a file, kept in memory and saved to their file in the ranges changed, after its state record
+    {
+        PageSums (File& store) : store_ (store), dirtyfrom_ (UINT64_MAX), dirtyto_ (0) {}
+        File&   store_;
+        std::vector <PageSum> sums_; // by page number
+        std::set <uint64> written_; // the pages written in place since the file was last synced
+        uint64  dirtyfrom_; // the range of sums_ changed since saved
+        uint64  dirtyto_;
+    };
+    typedef std::map <File*, PageSums*> Summap;
 
     struct Page
     {
-        Page () : free_ (true), markcnt_ (0), lockcnt_ (0), masters_ (0), useno_ (0L) {}
+        Page () : free_ (true), logged_ (false), referenced_ (0), markcnt_ (0), lockcnt_ (0), pins_ (0), quickhits_ (0), masters_ (0), useno_ (0L) {}
         File*   file_; // file which contains the page
         uint64  page_; // page number in file
         bool    free_; // free flag, =true if node is unused
+        bool    logged_; // the slot holds the committed page image which is in the log but not in the file yet
+        RelaxedAtomic referenced_; // nonzero if hit without the lock since the page last went to the front of the MRU list
         uint32  markcnt_; // mark count
-        uint32  lockcnt_; // lock count
+        Atomic  lockcnt_; // lock count; the hits without the mutex locking the page pin it with this count
+        Atomic  pins_; // hits without the mutex checking the page; the slot is not given to other pages while pinned
+        RelaxedAtomic quickhits_; // pages hit in the slot without the mutex, over all the pages it held
         uint32  masters_; // number of pages in a row managed together with this page. For managed pages, masters_ = 0
         uint64  useno_;
         Ilist::iterator mrulist_pos_; // position of the page in MRU list
@@ -68,9 +94,34 @@ protected:
     uint32*     hlpbuf_;        // buffer to hold temporary sets of pageidxses (for deletes) - to avoid heap allocs/frees
     FilePos     last_dumped_;   // the previous page written to a disk (for non-continous dumps counting)
     uint64      cur_pageuse_;   // page use counter
+    Walmap      wals_;          // the write-ahead logs of the files kept with them
+    uint32      loggedcnt_;     // number of slots with logged_ set
+    Shadowmap   shadows_;       // the keepers of the old page images for the snapshots of the files
+    Summap      checksums_;     // the page checksums of the files checked on read
 
     uint32      pagesize_;      // size of the page
     uint32      poolsize_;      // size of the pages pool (in number of pages)
+    Mutex       mutex_;         // serializes public calls - pager is shared by all files with same page size
+                                // except for the hits found through hints_ and the unlocks
+
+    // The hits go without the mutex: hints_ tells the slot where the page was last seen, and the slot is
+    // taken if it still holds the page. Anything changing which pages the slots hold (or choosing a slot to
+    // take over) runs with layout_ odd. The reader pins the slot first and checks layout_ after, while the
+    // slot chooser makes layout_ odd first and checks the pins after, so either the reader backs off or
+    // the slot is seen in use.
+    uint32*     hints_;         // slot by the hash of the file and the page number; a guess, checked on use
+    uint32      hintmask_;
+    Atomic      layout_;        // incremented on entering and on leaving the changes of the slots' pages
+    uint32      relayout_;      // depth of the nested changes
+    class Relayout
+    {
+    public:
+        Relayout (Pager_imp& pager) : pager_ (pager) { if (!pager_.relayout_ ++) pager_.layout_.add (1); }
+        ~Relayout () { if (!-- pager_.relayout_) pager_.layout_.add (1); }
+    private:
+        Pager_imp& pager_;
+    };
+    friend class Relayout;
 
     // helper methods
     uint32      process_overlaps_ (File& file, FilePos pageno, uint32 count); // finds all in-cache overlapping ranges. 
@@ -93,10 +144,14 @@ protected:
     void        removemaster_ (uint32 slotidx); // removes slot from the master lists: addrmap_ and mrulist_
 
     void        dump_       (uint32 slotidx);   // if slotrange is dirty, writes the contents to file and clears dirty state
-    void        dumpslots_  (uint32 slotidx, uint32 count); // unconditionally writes the contents of slots to file
+    void        dumpslots_  (uint32 slotidx, uint32 count, bool changed); // unconditionally writes the contents of slots to file (or, if changed, to its log)
+    void        write_      (uint32 slotidx, uint32 count, bool changed); // writes the pages of the slots out: the changed ones of a file with a log go to the log, 
+                                                // otherwise just the logged ones go to such a file
+    void        overlay_    (File& file, FilePos pageno, uint32 count, char* data); // replaces the pages just read with their images from the log if the file lacks them, checks the others against their checksums
     void        free_       (uint32 slotidx);   // removes the slotrange from all referring lists and returns to free storage
     void        freeslot_   (uint32 slotidx);   // unconditionally removes the slot from all referring lists if any and returns to free storage
     void        read_       (uint32 slotidx, File& file, FilePos pageno, uint32 count = 1); // reads the contents of the page range into the slotrange
+    bool        cached_     (File& file, FilePos pageno); // checks whether the page is covered by some cached slotrange
 
     void        lock_       (uint32 slotidx);   // Increments lock count on the pagerange starting with slotidx;
     void        unlock_     (uint32 slotidx);   // Decrements lock count on the pagerange starting with slotidx;
@@ -104,12 +159,31 @@ protected:
     void        mark_       (uint32 slotidx);   // Increments mark count on the pagerange starting with slotidx;
     void        unmark_     (uint32 slotidx);   // Decrements lock count on the pagerange starting with slotidx;
     bool        marked_     (uint32 slotidx);   // Checks the pagerange starting with slotidx for being marked as dirty;
+    bool        dirty_      (uint32 slotidx);   // Checks whether the pagerange starting with slotidx needs to be written out: marked, or holding logged pages
+    bool        haslogged_  (uint32 slotidx, uint32 count); // Checks whether any of the slots is logged
+    void        setlogged_  (uint32 slotidx, bool logged);
+    Wal*        wal_        (File& file);       // the log of the file, NULL if none
+    uint64      logcommit_  (File& file, Wal& wal); // appends the marked pages of the file to the log and commits them there; returns the commit position
+    bool        checkpoint_ (File& file, Wal& wal);
+    Shadow*     shadow_     (File& file);       // the keeper of the old page images for the snapshots of the file, NULL if none
+    PageSums*   pagesums_   (File& file);       // the page checksums of the file, NULL if it has none
+    uint32      pagesum_    (const char* data); // the checksum of the page image
+    void        stagesums_  (PageSums& ps, FilePos pageno, uint32 count, const char* data); // sets the checksums of the pages written in place
+    void        settlesums_ (PageSums& ps);     // keeps only the latest checksums of the pages written in place, once the file is synced
+    void        logsums_    (PageSums& ps, FilePos pageno, uint32 count, const char* data); // sets the checksums of the committed images from the log the file gets
+    void        verify_     (PageSums& ps, FilePos pageno, const char* data); // checks the page just read against its checksums
+    void        savesums_   (PageSums& ps);     // writes out the changed checksums
+    void        marksums_   (PageSums& ps, uint32 state); // writes the state record of the checksums and puts them on disk
+    void        closesums_  (PageSums& ps, File& file); // saves the checksums no longer kept for the file, as matching it if they can
 
 
     // high-level methods
     void        init_       (uint32 pagesize, uint32 poolsize); // initializes the internal data structures
     void        detach_     (bool freedata = true); // flashes and frees all data / frees all structures if freedata is true
     uint32      fetch_      (File& file, FilePos pageno, uint32 count); // fetches the page(s), returns data address
+    uint32      hint_       (File& file, FilePos pageno) const; // the index into hints_ for the page
+    void*       quickfetch_ (File& file, FilePos pageno, bool lock, uint32 count); // the page(s) if a hint finds them, NULL otherwise; runs without the mutex
+    void        promote_    ();                 // moves the pages hit without the lock from the tail of MRU list to its front
     uint32      fake_       (File& file, FilePos pageno, uint32 count); // fake-fetches the page(s), returns data address
     uint32      allocate_   (uint32 count, uint32 preserved_count = 0); // allocates the count continous slots. Uses ((free or LRU) + longest dump + not-locked + not-preserved) strategy 
                                                                         // the preserved slots are those which indexes are stored in hlpbuf_; their number is preserved_count
@@ -141,12 +215,19 @@ public:
     bool        chsize      (File& file, FilePos newSize);
     bool        close       (File& file);
     bool        detach      (File& file);
+    void        setWal      (File& file, Wal* wal);
+    Wal*        getWal      (File& file);
+    bool        checkpoint  (File& file);
+    void        setShadow   (File& file, File* shadow);
+    File&       snapshot    (File& file);
+    void        setChecksums (File& file, File* sums);
 
     uint64      pageno      (const void* data);
     File&       file        (const void* data);
     void*       pageaddr    (const void* data, uint32* count = NULL);
 
     void*       checkpage   (File& file, uint64 pageno, uint32* count = NULL);
+    uint32      prefetch    (File& file, const uint64* pagenos, uint32 count);
 
     uint32      getPageSize () const;
     uint32      getPoolSize () const;
@@ -18,6 +18,9 @@
 #include "edbPagerFactory.h"
 
 #include "edbSplitFileFactory.h"
+#include "edbWalFactory.h"
+#include "edbCrc32c.h"
+#include "edbExceptions.h"
 
 #include <stdio.h>
 #include <time.h>
@@ -171,9 +174,310 @@ bool boundsTest ()
     return true;
 }
 
+// Page checksums: the known CRC32C value; the time of writing the pages out and reading them back
+// with checksums and without; the page changed behind the pager's back found on read; the page written
+// and lost by a crash, or torn, found or not as it should; the checksums a crash leaves taken anew from the file
+static const char* tsums = "pager_tst_sums";
+static const char* tcfile = "pager_tst_c";
+static const char* tcsums = "pager_tst_c_sums";
+static const uint32 SUMPAGES = 0x4000; // 64 Mb in 4 Kb pages, more than the pool holds
+static const int SUMROUNDS = 3;
+static const uint32 SUMSIZE = 2 * sizeof (uint32); // per page in the checksums file: of the page and of its image before; the state record takes as much
+
+// what a crash would leave: the file as the system has it
+static bool copyFile (const char* src, const char* dst)
+{
+    char sname [64], dname [64];
+    sprintf (sname, "%s/%s.0.edb", tdir, src);
+    sprintf (dname, "%s/%s.0.edb", tdir, dst);
+    FILE* in = fopen (sname, "rb");
+    FILE* out = fopen (dname, "wb");
+    bool succ = in && out;
+    char buf [0x10000];
+    size_t got;
+    while (succ && (got = fread (buf, 1, sizeof (buf), in)) > 0)
+        succ = fwrite (buf, 1, got, out) == got;
+    if (in) fclose (in);
+    if (out) fclose (out);
+    return succ;
+}
+
+// the best time of a few rounds, each with a new pager writing new contents; returns -1 if a page reads back wrong
+static double sumRounds (File& file, File* sums, bool write)
+{
+    double best = -1;
+    for (int round = 0; round < SUMROUNDS; round ++)
+    {
+        Pager& pager = pagerFactory.create (pagesize, poolsize);
+        if (sums) pager.setChecksums (file, sums);
+        clock_t stt = clock ();
+        for (uint32 pg = 0; pg < SUMPAGES; pg ++)
+        {
+            uint32* page = (uint32*) (write ? pager.fake (file, pg) : pager.fetch (file, pg));
+            if (write)
+            {
+                memset (page, (pg + round) & 0xff, pagesize);
+                *page = pg;
+                pager.mark (page);
+            }
+            else if (*page != pg)
+                return -1;
+        }
+        if (write)
+            pager.commit (file);
+        pager.detach (file);
+        double t = double (clock () - stt) / CLOCKS_PER_SEC;
+        if (best < 0 || t < best) best = t;
+        pager.setChecksums (file, NULL);
+        delete &pager;
+    }
+    return best;
+}
+
+static bool checksumTest ()
+{
+    uint32 known = crc32c ("123456789", 9);
+    std::cerr << "CRC32C " << (crc32cHardware () ? "by SSE 4.2" : "by table") << std::endl;
+    if (known != 0xe3069283 || crc32c ("56789", 5, crc32c ("1234", 4)) != known)
+    {
+        std::cerr << "Wrong CRC32C of the check string" << std::endl;
+        return false;
+    }
+    const char* names [] = {tfile, tsums, tcfile, tcsums};
+    unsigned n;
+    for (n = 0; n < sizeof (names) / sizeof (*names); n ++)
+        if (splitFileFactory.exists (tdir, names [n]))
+            splitFileFactory.erase (tdir, names [n]);
+    File& file = splitFileFactory.create (tdir, tfile);
+    File& sums = splitFileFactory.create (tdir, tsums);
+
+    double wplain = sumRounds (file, NULL, true);
+    double wsums = sumRounds (file, &sums, true);
+    double rplain = sumRounds (file, NULL, false);
+    double rsums = sumRounds (file, &sums, false);
+    bool succ = wplain >= 0 && wsums >= 0 && rplain >= 0 && rsums >= 0 && sums.length () == (SUMPAGES + 1) * SUMSIZE;
+    std::cerr << SUMPAGES << " pages written in " << wplain << " s, with checksums " << wsums 
+              << " s; read in " << rplain << " s, with checksums " << rsums << " s" << std::endl;
+
+    // one bit flipped in the file
+    const uint32 badpage = 5;
+    char c;
+    file.seek (badpage * pagesize + 100);
+    file.read (&c, 1);
+    c ^= 1;
+    file.seek (badpage * pagesize + 100);
+    file.write (&c, 1);
+    Pager& pager = pagerFactory.create (pagesize, poolsize);
+    pager.setChecksums (file, &sums);
+    bool found = false;
+    try
+    {
+        pager.fetch (file, badpage - 1, false, 3);
+    }
+    catch (FileStructureCorrupt&)
+    {
+        found = true;
+    }
+    // the pages around are fine, and the bad one stays out of the cache
+    succ = succ && found && *(uint32*) pager.fetch (file, badpage - 1) == badpage - 1 && *(uint32*) pager.fetch (file, badpage + 1) == badpage + 1;
+    found = false;
+    try
+    {
+        pager.fetch (file, badpage);
+    }
+    catch (FileStructureCorrupt&)
+    {
+        found = true;
+    }
+    succ = succ && found;
+    // the page rewritten is right again
+    uint32* page = (uint32*) pager.fake (file, badpage);
+    memset (page, 0, pagesize);
+    pager.mark (page);
+    pager.commit (file);
+    pager.detach (file);
+    succ = succ && *(uint32*) pager.fetch (file, badpage) == 0;
+    // written again and not committed: the file may have either image after a crash, but not a torn one
+    char old [pagesize];
+    file.seek (badpage * pagesize);
+    file.read (old, pagesize);
+    page = (uint32*) pager.fetch (file, badpage);
+    memset (page, 0x5a, pagesize);
+    *page = 1;
+    pager.mark (page);
+    pager.detach (file);
+    succ = succ && *(uint32*) pager.fetch (file, badpage) == 1;
+    pager.detach (file);
+    file.seek (badpage * pagesize);
+    file.write (old, pagesize / 2);
+    found = false;
+    try
+    {
+        pager.fetch (file, badpage);
+    }
+    catch (FileStructureCorrupt&)
+    {
+        found = true;
+    }
+    succ = succ && found;
+    file.seek (badpage * pagesize + pagesize / 2);
+    file.write (old + pagesize / 2, pagesize / 2);
+    succ = succ && *(uint32*) pager.fetch (file, badpage) == 0;
+    // the checksums left open by a crash keep the image the file has, and the other one is found
+    pager.detach (file);
+    succ = succ && copyFile (tfile, tcfile) && copyFile (tsums, tcsums);
+    File& cfile = splitFileFactory.open (tdir, tcfile);
+    File& csums = splitFileFactory.open (tdir, tcsums);
+    Pager& cpager = pagerFactory.create (pagesize, poolsize);
+    cpager.setChecksums (cfile, &csums);
+    succ = succ && *(uint32*) cpager.fetch (cfile, badpage) == 0;
+    cpager.detach (cfile);
+    memset (old, 0x5a, pagesize);
+    *(uint32*) old = 1;
+    cfile.seek (badpage * pagesize);
+    cfile.write (old, pagesize);
+    found = false;
+    try
+    {
+        cpager.fetch (cfile, badpage);
+    }
+    catch (FileStructureCorrupt&)
+    {
+        found = true;
+    }
+    succ = succ && found;
+    cpager.setChecksums (cfile, NULL);
+    cpager.close (cfile);
+    delete &cpager;
+    csums.close ();
+    // the partial page left by cutting the file is not checked
+    pager.chsize (file, 10 * pagesize + 10);
+    succ = succ && sums.length () == (10 + 1) * SUMSIZE;
+    pager.setChecksums (file, NULL);
+    pager.close (file);
+    delete &pager;
+    sums.close ();
+    for (n = 0; n < sizeof (names) / sizeof (*names); n ++)
+        splitFileFactory.erase (tdir, names [n]);
+    std::cerr << (succ ? "Checksums OK" : "Checksums FAILED") << std::endl;
+    return succ;
+}
+
+// Page checksums of a file kept with a log: the pages read back checked through the commits and the checkpoint, 
+// and from the copy of the files a crash leaves with the committed pages in the log only; the checkpoint of the 
+// copy takes their checksums from the log, so the page changed behind the pager's back is found after it
+static const char* tlog = "pager_tst_log";
+static const char* tclog = "pager_tst_c_log";
+static const uint32 LOGPAGES = 256;
+
+static void writePages (Pager& pager, File& file, uint32 count, uint32 value)
+{
+    for (uint32 pg = 0; pg < count; pg ++)
+    {
+        uint32* page = (uint32*) pager.fake (file, pg);
+        memset (page, value, pagesize);
+        *page = pg + value;
+        pager.mark (page);
+    }
+    pager.commit (file);
+}
+
+// the first count pages have the value given, the rest the one before it
+static bool readPages (Pager& pager, File& file, uint32 count, uint32 value)
+{
+    try
+    {
+        for (uint32 pg = 0; pg < LOGPAGES; pg ++)
+            if (*(uint32*) pager.fetch (file, pg) != pg + value - (pg < count ? 0 : 1))
+                return false;
+    }
+    catch (FileStructureCorrupt&)
+    {
+        return false;
+    }
+    return true;
+}
+
+static bool walChecksumTest ()
+{
+    const char* names [] = {tfile, tsums, tlog, tcfile, tcsums, tclog};
+    unsigned n;
+    for (n = 0; n < sizeof (names) / sizeof (*names); n ++)
+        if (splitFileFactory.exists (tdir, names [n]))
+            splitFileFactory.erase (tdir, names [n]);
+    File& file = splitFileFactory.create (tdir, tfile);
+    File& sums = splitFileFactory.create (tdir, tsums);
+    File& log = splitFileFactory.create (tdir, tlog);
+    Pager& pager = pagerFactory.create (pagesize, poolsize);
+    Wal& wal = walFactory.open (log, pagesize);
+    pager.setWal (file, &wal);
+    pager.setChecksums (file, &sums);
+    writePages (pager, file, LOGPAGES, 1);
+    pager.checkpoint (file);
+    bool succ = sums.length () == (LOGPAGES + 1) * SUMSIZE && readPages (pager, file, LOGPAGES, 1);
+    // half of the pages committed again; the pager keeps them, the file has them in the log only
+    writePages (pager, file, LOGPAGES / 2, 2);
+    succ = succ && readPages (pager, file, LOGPAGES / 2, 2);
+    succ = succ && copyFile (tfile, tcfile) && copyFile (tsums, tcsums) && copyFile (tlog, tclog);
+
+    // recover the copy
+    File& cfile = splitFileFactory.open (tdir, tcfile);
+    File& csums = splitFileFactory.open (tdir, tcsums);
+    File& clog = splitFileFactory.open (tdir, tclog);
+    Pager& cpager = pagerFactory.create (pagesize, poolsize);
+    Wal& cwal = walFactory.open (clog, pagesize);
+    cpager.setWal (cfile, &cwal);
+    cpager.setChecksums (cfile, &csums);
+    succ = succ && readPages (cpager, cfile, LOGPAGES / 2, 2);
+    cpager.checkpoint (cfile);
+    succ = succ && clog.length () == 0;
+    cpager.detach (cfile);
+    succ = succ && readPages (cpager, cfile, LOGPAGES / 2, 2);
+    // one bit flipped in a page the checkpoint wrote
+    const uint32 badpage = 3;
+    char c;
+    cfile.seek (badpage * pagesize + 100);
+    cfile.read (&c, 1);
+    c ^= 1;
+    cfile.seek (badpage * pagesize + 100);
+    cfile.write (&c, 1);
+    cpager.detach (cfile);
+    bool found = false;
+    try
+    {
+        cpager.fetch (cfile, badpage);
+    }
+    catch (FileStructureCorrupt&)
+    {
+        found = true;
+    }
+    succ = succ && found;
+    cpager.setChecksums (cfile, NULL);
+    cpager.setWal (cfile, NULL);
+    cpager.close (cfile);
+    delete &cpager;
+    delete &cwal;
+    csums.close ();
+    clog.close ();
+
+    pager.setChecksums (file, NULL);
+    pager.setWal (file, NULL);
+    pager.close (file);
+    delete &pager;
+    delete &wal;
+    sums.close ();
+    log.close ();
+    for (n = 0; n < sizeof (names) / sizeof (*names); n ++)
+        splitFileFactory.erase (tdir, names [n]);
+    std::cerr << (succ ? "Checksums with log OK" : "Checksums with log FAILED") << std::endl;
+    return succ;
+}
+
 bool testPager ()
 {
     // return boundsTest ();
+    if (!checksumTest ()) return false;
+    if (!walChecksumTest ()) return false;
     return naiveTest ();
     // return chsizeTest ();
 }
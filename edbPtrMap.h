@@ -0,0 +1,106 @@
+//////////////////////////////////////////////////////////////////////////////
+//// This software module is developed by SciDM (Scientific Data Management) in 1998-2015
+//// 
+//// This program is free software; you can redistribute, reuse,
+//// or modify it with no restriction, under the terms of the MIT License.
+//// 
+//// This program is distributed in the hope that it will be useful,
+//// but WITHOUT ANY WARRANTY; without even the implied warranty of
+//// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//// 
+//// For any questions please contact Denis Kaznadzey at dkaznadzey@yahoo.com
+//////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef edbPtrMap_h
+#define edbPtrMap_h
+
+#include "edbTypes.h"
+#include <vector>
+
+// Flat hash table keyed by pointers: open addressing with linear probing, kept at most half full. 
+// Erase shifts the following entries of the probe run back, so there are no tombstones and the table 
+// allocates only when it grows
+
+namespace edb
+{
+
+template <class Value>
+class PtrMap
+{
+public:
+                PtrMap         () : count_ (0) { slots_.resize (16); }
+    Value*      find           (const void* key)
+    {
+        for (size_t pos = home_ (key); slots_ [pos].key_; pos = (pos + 1) & (slots_.size () - 1))
+            if (slots_ [pos].key_ == key)
+                return &slots_ [pos].value_;
+        return NULL;
+    }
+    void        insert         (const void* key, const Value& value) // replaces the value of a present key
+    {
+        if ((count_ + 1) * 2 > slots_.size ())
+            grow_ ();
+        size_t pos = home_ (key);
+        for (; slots_ [pos].key_; pos = (pos + 1) & (slots_.size () - 1))
+            if (slots_ [pos].key_ == key)
+            {
+                slots_ [pos].value_ = value;
+                return;
+            }
+        slots_ [pos].key_ = key;
+        slots_ [pos].value_ = value;
+        count_ ++;
+    }
+    bool        erase          (const void* key)
+    {
+        size_t mask = slots_.size () - 1;
+        size_t pos = home_ (key);
+        for (; slots_ [pos].key_ != key; pos = (pos + 1) & mask)
+            if (!slots_ [pos].key_)
+                return false;
+        // move back the entries that would not be found past the hole
+        for (size_t next = (pos + 1) & mask; slots_ [next].key_; next = (next + 1) & mask)
+        {
+            size_t home = home_ (slots_ [next].key_);
+            if (((next - home) & mask) >= ((next - pos) & mask))
+            {
+                slots_ [pos] = slots_ [next];
+                pos = next;
+            }
+        }
+        slots_ [pos].key_ = NULL;
+        count_ --;
+        return true;
+    }
+    size_t      size           () const { return count_; }
+
+private:
+    struct Slot
+    {
+        Slot () : key_ (NULL), value_ () {}
+        const void* key_;
+        Value       value_;
+    };
+    size_t      home_          (const void* key) const
+    {
+        uint64 h = (uint64) (size_t) key * 0x9E3779B97F4A7C15ULL;
+        return (size_t) (h >> 32) & (slots_.size () - 1);
+    }
+    void        grow_          ()
+    {
+        std::vector <Slot> old;
+        old.swap (slots_);
+        slots_.resize (old.size () * 2);
+        count_ = 0;
+        for (typename std::vector <Slot>::iterator itr = old.begin (); itr != old.end (); itr ++)
+            if (itr->key_)
+                insert (itr->key_, itr->value_);
+    }
+    std::vector <Slot> slots_;
+    size_t      count_;
+};
+
+};
+
+#endif
@@ -0,0 +1,205 @@
+//////////////////////////////////////////////////////////////////////////////
+//// This software module is developed by SciDM (Scientific Data Management) in 1998-2015
+//// 
+//// This program is free software; you can redistribute, reuse,
+//// or modify it with no restriction, under the terms of the MIT License.
+//// 
+//// This program is distributed in the hope that it will be useful,
+//// but WITHOUT ANY WARRANTY; without even the implied warranty of
+//// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//// 
+//// For any questions please contact Denis Kaznadzey at dkaznadzey@yahoo.com
+//////////////////////////////////////////////////////////////////////////////
+
+#include "edbShadow_imp.h"
+#include "edbExceptions.h"
+
+namespace edb
+{
+
+static const uint64 NOSLOT = (uint64) -1;
+
+Shadow::Shadow (File& file, File& store, uint32 pagesize)
+:
+file_ (file),
+store_ (store),
+pagesize_ (pagesize),
+saved_ (0)
+{
+    if (!pagesize) throw BadParameters ();
+}
+
+Shadow::~Shadow ()
+{
+    if (!snapshots_.empty ()) ERR("Shadow destroyed while snapshots are open");
+}
+
+uint64 Shadow::allocate_ ()
+{
+    if (!free_.empty ())
+    {
+        uint64 slot = free_.back ();
+        free_.pop_back ();
+        return slot;
+    }
+    refs_.push_back (0);
+    return refs_.size () - 1;
+}
+
+void Shadow::unref_ (uint64 slot)
+{
+    if (!-- refs_ [(size_t) slot])
+        free_.push_back (slot);
+}
+
+File& Shadow::snapshot ()
+{
+    MutexGuard guard (mutex_);
+    SnapshotFile* snapshot = new SnapshotFile (*this, file_.length ());
+    snapshots_.push_back (snapshot);
+    return *snapshot;
+}
+
+void Shadow::preserve (uint64 pageno, uint32 count)
+{
+    MutexGuard guard (mutex_);
+    if (snapshots_.empty ()) return;
+    bool loaded = false;
+    for (uint32 pgi = 0; pgi < count; pgi ++)
+    {
+        uint64 page = pageno + pgi;
+        uint64 slot = NOSLOT;
+        for (Snaplist::iterator itr = snapshots_.begin (); itr != snapshots_.end (); itr ++)
+        {
+            SnapshotFile& snapshot = **itr;
+            if (page * pagesize_ >= snapshot.length_ || snapshot.pages_.find (page) != snapshot.pages_.end ())
+                continue;
+            if (slot == NOSLOT)
+            {
+                // the old images are read only if some snapshot still sees them
+                if (!loaded)
+                {
+                    buf_.assign ((size_t) count * pagesize_, 0);
+                    // the page some snapshot sees is within the file; the pages after it in the row may be past its end
+                    BufLen want = (BufLen) min_ ((FilePos) count * pagesize_, file_.length () - pageno * pagesize_);
+                    if (file_.seek (pageno * pagesize_) != pageno * pagesize_) throw IOError ("Seek error");
+                    if (file_.read (&buf_ [0], want) != want) throw IOError ("Read error");
+                    loaded = true;
+                }
+                slot = allocate_ ();
+                if (store_.seek (slot * pagesize_) != slot * pagesize_) throw IOError ("Seek error");
+                if (store_.write (&buf_ [(size_t) pgi * pagesize_], pagesize_) != pagesize_) throw IOError ("Write error");
+                saved_ ++;
+            }
+            snapshot.pages_ [page] = slot;
+            refs_ [(size_t) slot] ++;
+        }
+    }
+}
+
+void Shadow::release (SnapshotFile& snapshot)
+{
+    MutexGuard guard (mutex_);
+    for (SnapshotFile::Pagemap::iterator itr = snapshot.pages_.begin (); itr != snapshot.pages_.end (); itr ++)
+        unref_ ((*itr).second);
+    snapshot.pages_.clear ();
+    snapshots_.remove (&snapshot);
+    if (snapshots_.empty ())
+    {
+        refs_.clear ();
+        free_.clear ();
+        if (!store_.chsize (0)) throw IOError ("Truncate error");
+    }
+}
+
+SnapshotFile::SnapshotFile (Shadow& shadow, FilePos length)
+:
+shadow_ (shadow),
+length_ (length),
+pos_ (0),
+open_ (true)
+{
+}
+
+bool SnapshotFile::isOpen () const
+{
+    return open_;
+}
+
+// the pages not copied to the shadow file are read from the file itself, by runs
+BufLen SnapshotFile::read (void* buf, BufLen byteno)
+{
+    MutexGuard guard (shadow_.mutex_);
+    if (!open_) throw FileNotOpen ();
+    if (pos_ >= length_) return 0;
+    if (byteno > length_ - pos_) byteno = (BufLen) (length_ - pos_);
+    uint32 pagesize = shadow_.pagesize_;
+    char* dest = (char*) buf;
+    BufLen done = 0;
+    while (done < byteno)
+    {
+        FilePos pos = pos_ + done;
+        uint64 page = pos / pagesize;
+        Pagemap::iterator itr = pages_.lower_bound (page);
+        BufLen len;
+        if (itr != pages_.end () && (*itr).first == page)
+        {
+            len = min_ (pagesize - (BufLen) (pos % pagesize), byteno - done);
+            FilePos off = (*itr).second * pagesize + pos % pagesize;
+            if (shadow_.store_.seek (off) != off) throw IOError ("Seek error");
+            if (shadow_.store_.read (dest + done, len) != len) throw IOError ("Read error");
+        }
+        else
+        {
+            FilePos end = (itr == pages_.end ()) ? pos_ + byteno : min_ (pos_ + byteno, (*itr).first * pagesize);
+            len = (BufLen) (end - pos);
+            // the file is not cut below the snapshot length before the pages cut off are preserved
+            if (shadow_.file_.seek (pos) != pos) throw IOError ("Seek error");
+            if (shadow_.file_.read (dest + done, len) != len) throw IOError ("Read error");
+        }
+        done += len;
+    }
+    pos_ += done;
+    return done;
+}
+
+BufLen SnapshotFile::write (const void*, BufLen)
+{
+    throw IOError ("Snapshot is read only");
+}
+
+FilePos SnapshotFile::seek (FilePos pos)
+{
+    pos_ = pos;
+    return pos_;
+}
+
+FilePos SnapshotFile::tell ()
+{
+    return pos_;
+}
+
+FilePos SnapshotFile::length ()
+{
+    return length_;
+}
+
+bool SnapshotFile::chsize (FilePos)
+{
+    throw IOError ("Snapshot is read only");
+}
+
+bool SnapshotFile::commit ()
+{
+    return true;
+}
+
+bool SnapshotFile::close ()
+{
+    if (!open_) return false;
+    open_ = false;
+    shadow_.release (*this);
+    return true;
+}
+
+};
@@ -0,0 +1,95 @@
+//////////////////////////////////////////////////////////////////////////////
+//// This software module is developed by SciDM (Scientific Data Management) in 1998-2015
+//// 
+//// This program is free software; you can redistribute, reuse,
+//// or modify it with no restriction, under the terms of the MIT License.
+//// 
+//// This program is distributed in the hope that it will be useful,
+//// but WITHOUT ANY WARRANTY; without even the implied warranty of
+//// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//// 
+//// For any questions please contact Denis Kaznadzey at dkaznadzey@yahoo.com
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef edbShadow_imp_h
+#define edbShadow_imp_h
+
+#ifdef _MSC_VER
+#pragma warning (disable : 4786)
+#endif
+
+#include "edbFile.h"
+#include "edbLatch.h"
+#include <list>
+#include <map>
+#include <vector>
+
+namespace edb
+{
+
+class SnapshotFile;
+
+// Keeps the pages of a file the way its snapshots see them. Before a page gets overwritten or cut off,
+// its old image goes to a slot of the shadow file, shared by all the open snapshots that have not got their own copy yet;
+// the page-mapping table of each snapshot tells where its images are. A slot returns to the free list 
+// when no snapshot refers to it any more, and the shadow file is emptied when the last snapshot is closed
+class Shadow
+{
+private:
+    typedef std::list <SnapshotFile*> Snaplist;
+
+    File&       file_;
+    File&       store_;
+    uint32      pagesize_;
+    Snaplist    snapshots_;
+    std::vector <uint32> refs_; // number of snapshots referring to each slot
+    std::vector <uint64> free_; // the slots nobody refers to
+    std::vector <char> buf_;
+    uint64      saved_; // pages copied to the shadow file
+    Mutex       mutex_;
+
+    uint64      allocate_   ();
+    void        unref_      (uint64 slot);
+
+public:
+                Shadow      (File& file, File& store, uint32 pagesize);
+                ~Shadow     ();
+    File&       snapshot    (); // the view of the file as it is now on disk
+    void        preserve    (uint64 pageno, uint32 count); // keeps the current images of the pages the snapshots see, before they change
+    void        release     (SnapshotFile& snapshot);
+    bool        empty       () const { return snapshots_.empty (); }
+    uint64      getSavedCount () const { return saved_; }
+
+friend class SnapshotFile;
+};
+
+// The read-only file seeing the pages of the shadowed file as they were when it was made
+class SnapshotFile : public File
+{
+private:
+    typedef std::map <uint64, uint64> Pagemap;
+
+    Shadow&     shadow_;
+    FilePos     length_;
+    FilePos     pos_;
+    bool        open_;
+    Pagemap     pages_; // page number -> shadow slot holding its image
+
+                SnapshotFile (Shadow& shadow, FilePos length);
+public:
+    bool        isOpen      () const;
+    BufLen      read        (void* buf, BufLen byteno);
+    BufLen      write       (const void* buf, BufLen byteno);
+    FilePos     seek        (FilePos pos);
+    FilePos     tell        ();
+    FilePos     length      ();
+    bool        chsize      (FilePos newLength);
+    bool        commit      ();
+    bool        close       ();
+
+friend class Shadow;
+};
+
+};
+
+#endif
@@ -78,6 +78,24 @@ BufLen SimpleCache_imp::write (File& file, FilePos offset, const void* buffer, B
     return size;
 }
 
+void* SimpleCache_imp::pin (File& file, FilePos offset, BufLen& size)
+{
+    uint32 pgsize = pager_->getPageSize ();
+    uint32 start = offset % pgsize;
+    if (size > pgsize - start)
+        size = pgsize - start;
+    char* b = (char*) pager_->fetch (file, offset / pgsize, true);
+    return b + start;
+}
+
+void SimpleCache_imp::unpin (const void* data, bool dirty)
+{
+    void* b = pager_->pageaddr (data);
+    if (dirty)
+        pager_->mark (b);
+    pager_->unlock (b);
+}
+
 bool SimpleCache_imp::flush (File& file)
 {
     return pager_->commit (file);
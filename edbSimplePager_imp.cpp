@@ -615,6 +615,39 @@ bool SimplePager::detach (File& file)
     return true;
 }
 
+// the write-ahead log is not supported here
+void SimplePager::setWal (File& file, Wal* wal)
+{
+    if (wal) ERR("Write-ahead log is not supported by SimplePager");
+}
+
+Wal* SimplePager::getWal (File& file)
+{
+    return NULL;
+}
+
+bool SimplePager::checkpoint (File& file)
+{
+    return true;
+}
+
+// neither are the snapshots
+void SimplePager::setShadow (File& file, File* shadow)
+{
+    if (shadow) ERR("Snapshots are not supported by SimplePager");
+}
+
+File& SimplePager::snapshot (File& file)
+{
+    ERR("Snapshots are not supported by SimplePager");
+    return file;
+}
+
+void SimplePager::setChecksums (File& file, File* sums)
+{
+    if (sums) ERR("Page checksums are not supported by SimplePager");
+}
+
 uint64 SimplePager::pageno (const void* page)
 {
     uint32 pgno = pageno_ (page);
@@ -651,6 +684,20 @@ void* SimplePager::checkpage (File& file, uint64 pageno, uint32* count)
     return arena_ + (*itr).second*pagesize_;
 }
 
+uint32 SimplePager::prefetch (File& file, const uint64* pagenos, uint32 count)
+{
+    // no batching here - just ask for the pages one by one
+    uint32 advised = 0;
+    for (uint32 idx = 0; idx < count; idx ++)
+    {
+        if (addrmap_.find (PageKey (file, pagenos [idx])) != addrmap_.end ())
+            continue;
+        file.prefetch (pagenos [idx]*pagesize_, pagesize_);
+        advised ++;
+    }
+    return advised;
+}
+
 uint64 SimplePager::getDumpCount () const
 {
     return dumpcnt_;
@@ -97,12 +97,19 @@ public:
     bool        chsize      (File& file, FilePos newSize);
     bool        close       (File& file);
     bool        detach      (File& file);
+    void        setWal      (File& file, Wal* wal);
+    Wal*        getWal      (File& file);
+    bool        checkpoint  (File& file);
+    void        setShadow   (File& file, File* shadow);
+    File&       snapshot    (File& file);
+    void        setChecksums (File& file, File* sums);
 
     uint64      pageno      (const void* page);
     File&       file        (const void* page);
     void*       pageaddr    (const void* ptr, uint32* count = NULL);
 
     void*       checkpage   (File& file, uint64 pageno, uint32* count = NULL);
+    uint32      prefetch    (File& file, const uint64* pagenos, uint32 count);
 
     uint32      getPageSize () const;
     uint32      getPoolSize () const;
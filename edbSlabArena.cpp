@@ -0,0 +1,213 @@
+//////////////////////////////////////////////////////////////////////////////
+//// This software module is developed by SciDM (Scientific Data Management) in 1998-2015
+//// 
+//// This program is free software; you can redistribute, reuse,
+//// or modify it with no restriction, under the terms of the MIT License.
+//// 
+//// This program is distributed in the hope that it will be useful,
+//// but WITHOUT ANY WARRANTY; without even the implied warranty of
+//// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//// 
+//// For any questions please contact Denis Kaznadzey at dkaznadzey@yahoo.com
+//////////////////////////////////////////////////////////////////////////////
+
+
+#include "edbSlabArena.h"
+#include "edbExceptions.h"
+#include <algorithm>
+
+namespace edb
+{
+
+static const BufLen SLAB_SIZE = 0x40000; // 256 Kb
+static const BufLen MIN_CHUNK = 0x20;
+static const BufLen MAX_CHUNK = SLAB_SIZE / 4; // larger ones are allocated one by one
+static const BufLen CHUNK_HDR = 8; // the owner slab of an allocated chunk, the next free chunk of a free one
+
+SlabArena::SlabArena (uint64 ceiling)
+:
+ceiling_ (ceiling),
+reserved_ (0),
+used_ (0),
+filled_ (NULL),
+spare_ (NULL),
+large_ (NULL)
+{
+    for (BufLen size = MIN_CHUNK; size <= MAX_CHUNK; size *= 2)
+    {
+        sizes_.push_back (size);
+        if (size < MAX_CHUNK)
+            sizes_.push_back (size + size / 2);
+    }
+    partial_.assign (sizes_.size (), (Slab*) NULL);
+}
+
+SlabArena::~SlabArena ()
+{
+    for (std::vector <Slab*>::iterator itr = partial_.begin (); itr != partial_.end (); itr ++)
+        release_all_ (*itr);
+    release_all_ (filled_);
+    release_all_ (large_);
+    if (spare_)
+        release_ (spare_);
+}
+
+void SlabArena::release_ (Slab* slab)
+{
+    reserved_ -= slab->len_;
+    delete [] slab->mem_;
+    delete slab;
+}
+
+void SlabArena::release_all_ (Slab*& list)
+{
+    while (list)
+    {
+        Slab* slab = list;
+        list = slab->next_;
+        release_ (slab);
+    }
+}
+
+void SlabArena::unlink_ (Slab*& list, Slab* slab)
+{
+    if (slab->prev_)
+        slab->prev_->next_ = slab->next_;
+    else
+        list = slab->next_;
+    if (slab->next_)
+        slab->next_->prev_ = slab->prev_;
+    slab->prev_ = slab->next_ = NULL;
+}
+
+void SlabArena::push_ (Slab*& list, Slab* slab)
+{
+    slab->prev_ = NULL;
+    slab->next_ = list;
+    if (list)
+        list->prev_ = slab;
+    list = slab;
+}
+
+inline bool SlabArena::full_ (const Slab* slab) const
+{
+    return !slab->free_ && slab->fresh_ + sizes_ [slab->class_] > slab->end_;
+}
+
+uint32 SlabArena::sizeClass (BufLen len) const
+{
+    if (len > MAX_CHUNK - CHUNK_HDR)
+        return LARGE_CLASS;
+    return (uint32) (std::lower_bound (sizes_.begin (), sizes_.end (), len + CHUNK_HDR) - sizes_.begin ());
+}
+
+uint32 SlabArena::chunkClass (const void* chunk) const
+{
+    return (*(Slab* const*) ((const char*) chunk - CHUNK_HDR))->class_;
+}
+
+void* SlabArena::alloc (BufLen len)
+{
+    uint32 cls = sizeClass (len);
+    Slab* slab;
+    if (cls == LARGE_CLASS)
+    {
+        uint64 size = (uint64) len + CHUNK_HDR;
+        if (reserved_ + size > ceiling_ && spare_)
+        {
+            release_ (spare_);
+            spare_ = NULL;
+        }
+        if (reserved_ + size > ceiling_)
+            return NULL;
+        slab = new Slab;
+        slab->mem_ = new char [(size_t) size];
+        slab->len_ = size;
+        slab->class_ = LARGE_CLASS;
+        slab->live_ = 1;
+        push_ (large_, slab);
+        reserved_ += size;
+        used_ += size;
+        *(Slab**) slab->mem_ = slab;
+        return slab->mem_ + CHUNK_HDR;
+    }
+    BufLen size = sizes_ [cls];
+    slab = partial_ [cls];
+    if (!slab)
+    {
+        // the spare slab, or a new one
+        slab = spare_;
+        if (slab)
+            spare_ = NULL;
+        else
+        {
+            if (reserved_ + SLAB_SIZE > ceiling_)
+                return NULL;
+            slab = new Slab;
+            slab->mem_ = new char [SLAB_SIZE];
+            slab->len_ = SLAB_SIZE;
+            reserved_ += SLAB_SIZE;
+        }
+        slab->class_ = cls;
+        slab->live_ = 0;
+        slab->free_ = NULL;
+        slab->fresh_ = slab->mem_;
+        slab->end_ = slab->mem_ + (SLAB_SIZE / size) * size;
+        push_ (partial_ [cls], slab);
+    }
+    char* chunk;
+    if (slab->free_)
+    {
+        chunk = slab->free_;
+        slab->free_ = *(char**) chunk;
+    }
+    else
+    {
+        chunk = slab->fresh_;
+        slab->fresh_ += size;
+    }
+    slab->live_ ++;
+    used_ += size;
+    if (full_ (slab))
+    {
+        unlink_ (partial_ [cls], slab);
+        push_ (filled_, slab);
+    }
+    *(Slab**) chunk = slab;
+    return chunk + CHUNK_HDR;
+}
+
+void SlabArena::free (void* data)
+{
+    char* chunk = (char*) data - CHUNK_HDR;
+    Slab* slab = *(Slab**) chunk;
+    if (slab->class_ == LARGE_CLASS)
+    {
+        unlink_ (large_, slab);
+        used_ -= slab->len_;
+        release_ (slab);
+        return;
+    }
+    if (!slab->live_)
+        ERR ("SlabArena: chunk freed twice");
+    uint32 cls = slab->class_;
+    if (full_ (slab))
+    {
+        unlink_ (filled_, slab);
+        push_ (partial_ [cls], slab);
+    }
+    *(char**) chunk = slab->free_;
+    slab->free_ = chunk;
+    slab->live_ --;
+    used_ -= sizes_ [cls];
+    if (!slab->live_)
+    {
+        // the empty slab replaces the spare one, which goes back to the system
+        unlink_ (partial_ [cls], slab);
+        if (spare_)
+            release_ (spare_);
+        spare_ = slab;
+    }
+}
+
+};
@@ -0,0 +1,76 @@
+//////////////////////////////////////////////////////////////////////////////
+//// This software module is developed by SciDM (Scientific Data Management) in 1998-2015
+//// 
+//// This program is free software; you can redistribute, reuse,
+//// or modify it with no restriction, under the terms of the MIT License.
+//// 
+//// This program is distributed in the hope that it will be useful,
+//// but WITHOUT ANY WARRANTY; without even the implied warranty of
+//// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//// 
+//// For any questions please contact Denis Kaznadzey at dkaznadzey@yahoo.com
+//////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef edbSlabArena_h
+#define edbSlabArena_h
+
+#include "edbTypes.h"
+#include <vector>
+
+// Size-classed allocator with a fixed memory ceiling, for the cache buffers. The classes go by powers of two 
+// and their midpoints, so a chunk wastes at most a third of itself. Memory is taken from the system by slabs, 
+// each serving a single class; a slab whose chunks are all free goes back to the system (one is kept aside 
+// for the next class needing a slab), so the memory follows the mix of the sizes in use. Chunks above the 
+// largest class are allocated one by one, within the same ceiling, which the slabs given back make room under
+
+namespace edb
+{
+
+class SlabArena
+{
+public:
+    enum { LARGE_CLASS = 0xffffffff };
+
+                SlabArena      (uint64 ceiling);
+                ~SlabArena     ();
+    void*       alloc          (BufLen len); // returns a chunk of at least len bytes, NULL if the ceiling is reached
+    void        free           (void* chunk);
+    uint32      sizeClass      (BufLen len) const; // the class alloc (len) serves from, LARGE_CLASS if above all
+    uint32      chunkClass     (const void* chunk) const; // the class of an allocated chunk
+    uint64      ceiling        () const { return ceiling_; }
+    uint64      reserved       () const { return reserved_; } // taken from the system
+    uint64      used           () const { return used_; } // in the allocated chunks
+
+private:
+    struct Slab
+    {
+        Slab*   prev_; // in the list of the partly used slabs of the class, of the full ones, or of the large chunks
+        Slab*   next_;
+        char*   free_; // the first freed chunk; the freed chunks are linked through their headers
+        char*   fresh_; // the chunks from here on were never used
+        char*   end_;
+        char*   mem_;
+        uint64  len_;
+        uint32  class_;
+        uint32  live_; // allocated chunks
+    };
+    void        unlink_        (Slab*& list, Slab* slab);
+    void        push_          (Slab*& list, Slab* slab);
+    bool        full_          (const Slab* slab) const;
+    void        release_       (Slab* slab); // gives the memory of the slab back to the system
+    void        release_all_   (Slab*& list);
+
+    uint64      ceiling_;
+    uint64      reserved_;
+    uint64      used_;
+    std::vector <BufLen> sizes_; // chunk size of each class, the header included
+    std::vector <Slab*> partial_; // per class: the slabs with free chunks
+    Slab*       filled_; // the slabs with no free chunks
+    Slab*       spare_; // an empty slab kept for reuse, if any
+    Slab*       large_; // the chunks above the largest class
+};
+
+};
+
+#endif
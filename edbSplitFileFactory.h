@@ -18,8 +18,22 @@
 
 namespace edb
 {
+
+class SplitFileFactory : public FileFactory
+{
+public:
+    using FileFactory::create;
+    // creates the file split into segments of segmentSize bytes instead of 1 Gb; open finds the size kept with the file
+    virtual File&       create         (const char* directory, const char* basename, FilePos segmentSize) = 0;
+    // reads and writes of several Mb spanning segments of the files opened or created afterwards are done 
+    // by up to that many threads at once, one segment each (1, the default, keeps them in the calling thread);
+    // as many threads look for and open the segments when a file is opened
+    virtual void        setIoThreads   (uint32 threads) = 0;
+    virtual uint32      getIoThreads   () const = 0;
+};
+
 #ifndef splitFileFactory_defined
-    extern FileFactory& splitFileFactory;
+    extern SplitFileFactory& splitFileFactory;
 #endif
 };
 
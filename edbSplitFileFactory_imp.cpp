@@ -22,7 +22,7 @@ namespace edb
 {
 
 static SplitFileFactory_imp theFileFactory;
-FileFactory& splitFileFactory = theFileFactory;
+SplitFileFactory& splitFileFactory = theFileFactory;
 
 static const unsigned MAXBUF = 4096;
 
@@ -30,6 +30,7 @@ File& SplitFileFactory_imp::open (const char* directory, const char* basename)
 {
     // create the File object
     SplitFile_imp& f = *new SplitFile_imp (directory, basename);
+    f.iothreads_ = iothreads_;
 
     // open
     if (!f.open ()) throw OpenError ();
@@ -40,6 +41,7 @@ File& SplitFileFactory_imp::open (const char* directory, const char* basename)
 File& SplitFileFactory_imp::create (const char* directory, const char* basename)
 {
     SplitFile_imp& f = *new SplitFile_imp (directory, basename);
+    f.iothreads_ = iothreads_;
 
     // create
     f.create ();
@@ -47,6 +49,16 @@ File& SplitFileFactory_imp::create (const char* directory, const char* basename)
     // the file is ready
     return f;
 }
+File& SplitFileFactory_imp::create (const char* directory, const char* basename, FilePos segmentSize)
+{
+    if (!segmentSize) throw BadParameters ();
+    SplitFile_imp& f = *new SplitFile_imp (directory, basename, segmentSize);
+    f.iothreads_ = iothreads_;
+
+    f.create ();
+
+    return f;
+}
 bool SplitFileFactory_imp::exists (const char* directory, const char* basename)
 {
     // create the File object
@@ -93,8 +105,19 @@ bool SplitFileFactory_imp::erase (const char* directory, const char* basename)
         }
         fno ++;
     }
+    name4segsize (f.base_name_.c_str (), name, MAXBUF);
+    ::sci_unlink (name);
+    errno = 0;
     return toR;
 }
+void SplitFileFactory_imp::setIoThreads (uint32 threads)
+{
+    iothreads_ = threads ? threads : 1;
+}
+uint32 SplitFileFactory_imp::getIoThreads () const
+{
+    return iothreads_;
+}
 bool SplitFileFactory_imp::rename (const char* src_directory, const char* src_basename, const char* dst_directory, const char* dst_basename)
 {
     return false;
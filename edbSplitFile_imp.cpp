@@ -13,13 +13,14 @@
 
 #include "edbSplitFile_imp.h"
 #include "edbExceptions.h"
-#include <sstream>
+#include "edbStats.h"
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stddef.h>
 #include "portability.h"
+#include "edbLatch.h"
 
 #ifdef _WIN32
 #define PATH_SPLIT_SYM "\\"
@@ -34,27 +35,58 @@ namespace edb
 // const int32 SPLIT_FACTOR = 0x10; // 16 bytes
 // const int32 SPLIT_FACTOR = 0x40; // 64 bytes
 
-const int32 SPLIT_FACTOR = 0x40000000; // 1Gb
+const FilePos SPLIT_FACTOR = 0x40000000; // 1Gb, the default segment size
 
-inline int32 fileNo (FilePos offset)
+// the space for appended data is reserved by extents of this size (not beyond the segment end)
+static const FilePos PREALLOC_EXTENT = 0x4000000; // 64 Mb
+
+// smaller requests are not split among the i/o threads
+static const FilePos SPREAD_MIN = 0x400000; // 4 Mb
+
+// the segments of a file being opened are looked for by this many at once, the first time and at most
+static const int32 OPEN_BATCH_MIN = 0x10;
+static const int32 OPEN_BATCH_MAX = 0x400;
+
+inline int32 SplitFile_imp::fileNo (FilePos offset) const
 {
-    return offset / SPLIT_FACTOR;
+    return (int32) (offset / segsize_);
 }
-inline int32 fileOff (FilePos offset)
+inline FilePos SplitFile_imp::fileOff (FilePos offset) const
 {
-    return offset % SPLIT_FACTOR;
+    return offset % segsize_;
 }
 
 
+// composes the name in place, as it is done for every segment of a file being opened
 void name4number (const char* base_name, int32 number, char* buffer, unsigned buflen)
 {
-    std::ostringstream created_name;
-    created_name.str ("");
-    created_name << base_name
-    <<  "."
-    << number
-    << ".edb";
-    const std::string& t = created_name.str ();
+    char digits [12];
+    int ndig = 0;
+    uint32 n = (uint32) number;
+    do
+    {
+        digits [ndig ++] = (char) ('0' + n % 10);
+        n /= 10;
+    }
+    while (n);
+    char* dst = buffer;
+    char* end = buffer + buflen - 1;
+    while (*base_name && dst < end)
+        *dst ++ = *base_name ++;
+    if (dst < end)
+        *dst ++ = '.';
+    while (ndig && dst < end)
+        *dst ++ = digits [-- ndig];
+    for (const char* ext = ".edb"; *ext && dst < end; )
+        *dst ++ = *ext ++;
+    *dst = 0;
+}
+
+// segment size other than the default is kept in a small text file beside the segments
+void name4segsize (const char* base_name, char* buffer, unsigned buflen)
+{
+    std::string t = base_name;
+    t += ".segsize";
     strncpy (buffer, t.c_str (), buflen-1);
     if (t.length () > buflen - 1)
         buffer [buflen - 1] = 0;
@@ -64,27 +96,64 @@ static const unsigned MAXBUF = 2048;
 
 bool SplitFile_imp::open ()
 {
-    int32 file_number = 0;
+    char name [MAXBUF];
+    name4segsize (base_name_.c_str (), name, MAXBUF);
+    FILE* sf = fopen (name, "r");
+    if (sf)
+    {
+        unsigned long long segsize = 0;
+        bool ok = (fscanf (sf, "%llu", &segsize) == 1 && segsize != 0);
+        fclose (sf);
+        if (!ok) throw FileStructureCorrupt ();
+        segsize_ = segsize;
+    }
+
+    // the segments are looked for by batches, growing up to OPEN_BATCH_MAX names, each batch opened by iothreads_ threads
     length_ = 0;
-    long len = 0;
-    while (1)
+    FilePos len = 0;
+    size_t baselen = base_name_.length () + 16;
+    int32 batch = OPEN_BATCH_MIN;
+    std::vector <char> names;
+    std::vector <const char*> nameptrs;
+    std::vector <Fid> fids;
+    std::vector <FilePos> sizes;
+    bool last = false;
+    while (!last)
     {
-        char name [MAXBUF];
-        name4number (base_name_.c_str (), file_number, name, MAXBUF);
-        Fid fid = fileHandleMgr.open (name);
-        if (fid != -1)
+        int32 first = (int32) fids_.size ();
+        names.resize (batch * baselen);
+        nameptrs.resize (batch);
+        fids.resize (batch);
+        sizes.resize (batch);
+        int32 i;
+        for (i = 0; i < batch; i ++)
         {
-            if (file_number > 0 && len != SPLIT_FACTOR) throw FileStructureCorrupt ();
-            fids_.push_back (fid);
-            int h = fileHandleMgr.handle (fid);
-            len = ::sci_filelength (h);
+            nameptrs [i] = &names [i * baselen];
+            name4number (base_name_.c_str (), first + i, &names [i * baselen], (unsigned) baselen);
+        }
+        fileHandleMgr.openMany (&nameptrs [0], batch, &fids [0], &sizes [0], iothreads_);
+        // the file ends before the first missing segment; all the ones before the last must be full
+        bool corrupt = false;
+        for (i = 0; i < batch && fids [i] != -1; i ++)
+        {
+            if (!fids_.empty () && len != segsize_)
+            {
+                corrupt = true;
+                break;
+            }
+            fids_.push_back (fids [i]);
+            len = sizes [i];
             length_ += len;
         }
-        else
-            break;
-        file_number ++;
+        last = corrupt || i < batch;
+        for (; i < batch; i ++)
+            if (fids [i] != -1)
+                fileHandleMgr.close (fids [i]);
+        if (corrupt) throw FileStructureCorrupt ();
+        batch = min_ (batch * 2, OPEN_BATCH_MAX);
     }
-    open_ = (file_number > 0);
+    open_ = !fids_.empty ();
+    reserved_ = length_;
     return open_;
 }
 
@@ -100,21 +169,68 @@ bool SplitFile_imp::create ()
         throw FileAllreadyExists ();
     }
 
+    // record the segment size, if not the default one
+    name4segsize (base_name_.c_str (), name, MAXBUF);
+    if (segsize_ != SPLIT_FACTOR)
+    {
+        FILE* sf = fopen (name, "w");
+        if (!sf) throw CreateError ();
+        bool ok = (fprintf (sf, "%llu\n", (unsigned long long) segsize_) > 0);
+        if (fclose (sf) != 0 || !ok) throw WriteError ();
+    }
+    else
+        ::sci_unlink (name);
+
     // create the very first, empty file
+    name4number (base_name_.c_str (), 0, name, MAXBUF);
     fid = fileHandleMgr.create (name);
     if (fid == -1) throw CreateError ();
     length_ = 0;
+    reserved_ = 0;
     fids_.push_back (fid);
     open_ = true;
     return true;
 }
 
-SplitFile_imp::SplitFile_imp (const char* directory, const char* basename)
+// reserves the disk space for the from..to range by whole extents, starting from the one at from or 
+// the first one not reserved yet, whichever is farther; the file length does not change
+void SplitFile_imp::reserve_ (FilePos from, FilePos to)
+{
+#if defined (SCI_HAVE_PREALLOCATE)
+    if (!prealloc_)
+        return;
+    FilePos extent = min_ (PREALLOC_EXTENT, segsize_);
+    FilePos pos = max_ (from, reserved_);
+    pos -= fileOff (pos) % extent;
+    while (pos < to)
+    {
+        int32 fno = fileNo (pos);
+        if (fno >= (int32) fids_.size ())
+            break;
+        FilePos len = min_ (extent, segsize_ - fileOff (pos));
+        PinnedHandle h (fids_ [fno]);
+        if (::sci_preallocate (h, fileOff (pos), len) != 0)
+        {
+            // not supported by the file system; running out of space is reported by the write
+            if (errno == EOPNOTSUPP || errno == ENOSYS)
+                prealloc_ = false;
+            errno = 0;
+            break;
+        }
+        pos += len;
+        reserved_ = max_ (reserved_, pos);
+    }
+#endif
+}
+
+SplitFile_imp::SplitFile_imp (const char* directory, const char* basename, FilePos segsize)
 :
 open_ (false),
+segsize_ (segsize),
 curPos_ (0L),
-curFile_ (0),
-cpsync_ (true)
+reserved_ (0),
+prealloc_ (true),
+iothreads_ (1)
 {
     base_name_ = "";
     base_name_ += directory;
@@ -131,6 +247,97 @@ SplitFile_imp::~SplitFile_imp ()
     }
 }
 
+// the segment handles are shared and have no position of their own: all i/o goes at explicit offsets
+static bool transfer_ (int h, char* data, BufLen len, FilePos off, bool write)
+{
+    BufLen done = 0;
+    while (done < len)
+    {
+        EDB_STAT_ADD (STAT_FILE_SYSCALLS, 1);
+#if defined (SCI_HAVE_PREAD)
+        long long moved = write ? ::sci_pwrite (h, data + done, len - done, off + done)
+                                : ::sci_pread  (h, data + done, len - done, off + done);
+#else
+        if ((FilePos) ::sci_lseek (h, off + done, SEEK_SET) != off + done)
+            return false;
+        EDB_STAT_ADD (STAT_FILE_SYSCALLS, 1);
+        long long moved = write ? ::sci_write (h, data + done, len - done)
+                                : ::sci_read  (h, data + done, len - done);
+#endif
+        if (moved <= 0)
+        {
+            if (!moved)
+                errno = EIO;
+            return false;
+        }
+        done += (BufLen) moved;
+    }
+    return true;
+}
+
+void SplitFile_imp::segio_ (void* arg)
+{
+    SegIo& io = *(SegIo*) arg;
+    if (!transfer_ (io.handle_, io.data_, io.len_, io.off_, io.write_))
+        io.errno_ = errno;
+}
+
+// pins the handles of the transfers one by one, then does them, each but the first by its own thread;
+// the pins are released on the way back, after the threads end or on an error
+void SplitFile_imp::wave_ (SegIo* ios, size_t number, Thread* threads, size_t pinned)
+{
+    if (pinned < number)
+    {
+        PinnedHandle h (ios [pinned].fid_);
+        ios [pinned].handle_ = h;
+        wave_ (ios, number, threads, pinned + 1);
+        return;
+    }
+    size_t i;
+    for (i = 1; i < number; i ++)
+        threads [i].start (segio_, &ios [i]);
+    segio_ (ios);
+    for (i = 1; i < number; i ++)
+        threads [i].join ();
+}
+
+// transfers the pieces of a request lying in different segments at the same time, each by its own thread 
+// through the segment's handle, up to iothreads_ of them at once. Returns false (nothing done) if the request 
+// is not worth that
+bool SplitFile_imp::spread_ (int32 first_file, FilePos first_off, int32 last_file, FilePos to_off, char* buf, bool write)
+{
+#if defined (SCI_HAVE_PREAD) && !defined (EDB_NO_THREADS)
+    if (iothreads_ < 2 || first_file >= last_file || (last_file - first_file) * segsize_ + to_off - first_off < SPREAD_MIN)
+        return false;
+    std::vector <SegIo> ios;
+    for (int32 fno = first_file; fno <= last_file; fno ++)
+    {
+        FilePos start = (fno == first_file)?first_off:0;
+        FilePos end   = (fno == last_file)?to_off:segsize_;
+        if (end > start)
+        {
+            SegIo io = {fids_ [fno], -1, start, buf, (BufLen) (end - start), write, 0};
+            ios.push_back (io);
+            buf += io.len_;
+        }
+    }
+    uint32 wave = iothreads_;
+    std::vector <Thread> threads (wave);
+    for (size_t first = 0; first < ios.size (); first += wave)
+        wave_ (&ios [first], min_ ((size_t) wave, ios.size () - first), &threads [0]);
+    for (std::vector <SegIo>::iterator itr = ios.begin (); itr != ios.end (); itr ++)
+        if (itr->errno_)
+        {
+            if (write && itr->errno_ == ENOSPC) throw NoDeviceSpace ();
+            if (write) ERR("Write error")
+            else ERR("Read error")
+        }
+    return true;
+#else
+    return false;
+#endif
+}
+
 bool SplitFile_imp::isOpen () const
 {
     return open_;
@@ -142,8 +349,9 @@ BufLen SplitFile_imp::read (void* buf, BufLen byteno)
 
     // read only up to the file end
     int32 first_file = fileNo (curPos_);
-    int32 first_off  = fileOff (curPos_);
-    int32 last_file, to_off;
+    FilePos first_off  = fileOff (curPos_);
+    int32 last_file;
+    FilePos to_off;
     if (curPos_ + byteno < length_)
     {
         last_file  = fileNo (curPos_ + byteno);
@@ -157,32 +365,30 @@ BufLen SplitFile_imp::read (void* buf, BufLen byteno)
     if (to_off == 0)
     {
         last_file --;
-        to_off = SPLIT_FACTOR;
+        to_off = segsize_;
     }
 
     BufLen curpos = 0;
+    if (spread_ (first_file, first_off, last_file, to_off, (char*) buf, false))
+    {
+        curpos = (BufLen) ((last_file - first_file) * segsize_ + to_off - first_off);
+        last_file = first_file - 1;
+    }
     for (int32 fno = first_file; fno <= last_file; fno ++)
     {
-        int32 start = (fno == first_file)?first_off:0;
-        int32 end   = (fno == last_file)?to_off:SPLIT_FACTOR;
-        int h = fileHandleMgr.handle (fids_ [fno]);
-        long rdpos = -1;
-        if (fno != first_file || !cpsync_)
-        {
-            rdpos  = ::sci_lseek (h, start, SEEK_SET);
-            if (rdpos != start) ERR ("Seek(for read) error")
-        }
+        FilePos start = (fno == first_file)?first_off:0;
+        FilePos end   = (fno == last_file)?to_off:segsize_;
         // if request is to read beyond the eof, do not (read zero bytes)
         if (end > start)
         {
-            int32 len   = end - start;
-            int rdlen = ::sci_read (h, ((char*) buf) + curpos, len);
-            if (rdlen != len) ERR("Read error");
+            PinnedHandle h (fids_ [fno]);
+            BufLen len   = (BufLen) (end - start);
+            if (!transfer_ (h, ((char*) buf) + curpos, len, start, false)) ERR("Read error");
             curpos += len;
         }
     }
     curPos_ += byteno;
-    seek (curPos_); // to adjust curFile_ and cpsync_ if necessary
+    EDB_STAT_RECORD (STAT_FILE_READ_BYTES, curpos);
     return curpos;
 }
 
@@ -190,73 +396,75 @@ BufLen SplitFile_imp::write (const void* buf, BufLen byteno)
 {
     if (!open_) throw FileNotOpen ();
 
-    int32 last_file_before = fids_.size () - 1;
     int32 first_file = fileNo (curPos_);
-    int32 first_off  = fileOff (curPos_);
+    FilePos first_off  = fileOff (curPos_);
     int32 last_file  = fileNo (curPos_ + byteno);
-    int32 to_off     = fileOff (curPos_ + byteno);
+    FilePos to_off     = fileOff (curPos_ + byteno);
     if (to_off == 0)
     {
         last_file --;
-        to_off = SPLIT_FACTOR;
+        to_off = segsize_;
     }
 
     BufLen curpos = 0;
 
-    for (int32 fno = first_file; fno <= last_file; fno ++)
+    // make the segments up to the last one written
+    for (int newFno = fids_.size () - 1; newFno <= last_file; newFno ++)
     {
-        int32 start = (fno == first_file)?first_off:0;
-        int32 end   = (fno == last_file)?to_off:SPLIT_FACTOR;
-        int32 len   = end - start;
-        for (int newFno = fids_.size () - 1; newFno <= fno; newFno ++)
+        Fid fid;
+        if (newFno >= fids_.size ())
         {
-            Fid fid;
-            if (newFno >= fids_.size ())
-            {
-                char new_name [MAXBUF];
-                name4number (base_name_.c_str (), newFno, new_name, MAXBUF);
-                fid = fileHandleMgr.create (new_name);
-                if (fid == -1) throw CreateError ();
-                fids_.push_back (fid);
-            }
-            else
-                fid = fids_ [newFno];
-            if (newFno < fno)
+            char new_name [MAXBUF];
+            name4number (base_name_.c_str (), newFno, new_name, MAXBUF);
+            fid = fileHandleMgr.create (new_name);
+            if (fid == -1) throw CreateError ();
+            fids_.push_back (fid);
+        }
+        else
+            fid = fids_ [newFno];
+        if (newFno < first_file)
+        {
+            PinnedHandle h (fid);
+            if (::sci_chsize (h, segsize_) != 0)
             {
-                if (::sci_chsize (fileHandleMgr.handle (fid), SPLIT_FACTOR) != 0)
-                {
-                    if (errno == ENOSPC) throw NoDeviceSpace ();
-                    else ERR("Unable to enlarge file");
-                }
+                if (errno == ENOSPC) throw NoDeviceSpace ();
+                else ERR("Unable to enlarge file");
             }
         }
-        int h = fileHandleMgr.handle (fids_ [fno]);
-        if (fno != last_file_before || !cpsync_)
+    }
+    // appending: reserve the space ahead
+    if (curPos_ + byteno > length_)
+        reserve_ (curPos_, curPos_ + byteno);
+
+    if (spread_ (first_file, first_off, last_file, to_off, (char*) buf, true))
+    {
+        curpos = byteno;
+        last_file = first_file - 1;
+    }
+    for (int32 fno = first_file; fno <= last_file; fno ++)
+    {
+        FilePos start = (fno == first_file)?first_off:0;
+        FilePos end   = (fno == last_file)?to_off:segsize_;
+        BufLen len   = (BufLen) (end - start);
+        PinnedHandle h (fids_ [fno]);
+        if (!transfer_ (h, ((char*) buf) + curpos, len, start, true))
         {
-            long wrpos  = ::sci_lseek (h, start, SEEK_SET);
-            if (wrpos != start) ERR ("Seek(for write) error")
+            if (errno == ENOSPC) throw NoDeviceSpace ();
+            else ERR("Write error");
         }
-        int wrlen = ::sci_write (h, ((char*) buf) + curpos, len);
-        if (wrlen != len) ERR("Write error");
         curpos += len;
     }
     if (curPos_ + byteno > length_)
         length_ = curPos_ + byteno;
     curPos_ += byteno;
-    seek (curPos_); // to adjust curFile_ and cpsync_ if necessary
+    EDB_STAT_RECORD (STAT_FILE_WRITE_BYTES, curpos);
     return curpos;
 }
 
 FilePos SplitFile_imp::seek (FilePos pos)
 {
     if (!open_) throw FileNotOpen ();
-    Fid fid = fileNo (pos);
-    if (curPos_ != pos || curFile_ != fid)
-    {
-        curPos_ = pos;
-        curFile_ = fid;
-        cpsync_ = false;
-    }
+    curPos_ = pos;
     return curPos_;
 }
 
@@ -278,11 +486,11 @@ bool SplitFile_imp::chsize (FilePos newLength)
 
     int32 cur_no_of_files = fids_.size ();
     int32 new_last_file   = fileNo (newLength);
-    int32 last_file_size  = fileOff (newLength);
+    FilePos last_file_size  = fileOff (newLength);
     if (last_file_size == 0 && new_last_file != 0)
     {
         new_last_file --;
-        last_file_size = SPLIT_FACTOR;
+        last_file_size = segsize_;
     }
 
     if (newLength > length_)
@@ -297,14 +505,16 @@ bool SplitFile_imp::chsize (FilePos newLength)
                 if (fid == -1) throw CreateError ();
                 fids_.push_back (fid);
             }
-            int h = fileHandleMgr.handle (fids_[fileno]);
-            int32 newsize = (fileno == new_last_file)?last_file_size:SPLIT_FACTOR;
+            PinnedHandle h (fids_[fileno]);
+            FilePos newsize = (fileno == new_last_file)?last_file_size:segsize_;
             if (::sci_chsize (h, newsize) != 0)
             {
                 if (errno == ENOSPC) throw NoDeviceSpace ();
                 else ERR("Unable to enlarge file");
             }
         }
+        // the space is reserved near the new end only: a far jump leaves a sparse gap
+        reserve_ ((newLength - length_ > PREALLOC_EXTENT) ? (newLength - PREALLOC_EXTENT) : length_, newLength);
     }
     else if (newLength < length_)
     {
@@ -317,14 +527,124 @@ bool SplitFile_imp::chsize (FilePos newLength)
             ::sci_unlink (name);
             fids_.pop_back ();
         }
-        int h = fileHandleMgr.handle (fids_[new_last_file]);
+        PinnedHandle h (fids_[new_last_file]);
         if (::sci_chsize (h, last_file_size) != 0) ERR("Unable to truncate file");
+        // truncation drops the space reserved past the end
+        reserved_ = newLength;
     }
     length_ = newLength;
-    cpsync_ = false; // not always, but we want to be on the safe side
 
     return true;
 }
+
+BufLen SplitFile_imp::readAt (void* buf, BufLen byteno, FilePos pos)
+{
+    if (!open_) throw FileNotOpen ();
+    if (pos >= length_)
+        return 0;
+    if (byteno > length_ - pos)
+        byteno = (BufLen) (length_ - pos);
+    BufLen done = 0;
+    while (done < byteno)
+    {
+        BufLen piece = (BufLen) min_ ((FilePos) (byteno - done), segsize_ - fileOff (pos + done));
+        PinnedHandle h (fids_ [fileNo (pos + done)]);
+        if (!transfer_ (h, ((char*) buf) + done, piece, fileOff (pos + done), false)) ERR("Read error");
+        done += piece;
+    }
+    EDB_STAT_RECORD (STAT_FILE_READ_BYTES, done);
+    return done;
+}
+
+bool SplitFile_imp::positional ()
+{
+#if defined (SCI_HAVE_PREAD)
+    return true;
+#else
+    return false;
+#endif
+}
+
+// advice only: errors are ignored, the later read reports them
+void SplitFile_imp::prefetch (FilePos pos, FilePos len)
+{
+    if (!open_) throw FileNotOpen ();
+#if defined (SCI_HAVE_READAHEAD)
+    if (pos >= length_)
+        return;
+    if (len > length_ - pos)
+        len = length_ - pos;
+    while (len)
+    {
+        FilePos piece = min_ (len, segsize_ - fileOff (pos));
+        PinnedHandle h (fids_ [fileNo (pos)]);
+        EDB_STAT_ADD (STAT_FILE_SYSCALLS, 1);
+        ::sci_readahead (h, fileOff (pos), piece);
+        pos += piece;
+        len -= piece;
+    }
+#endif
+}
+
+// overlapping ranges are copied in pieces not longer than the distance between them;
+// closer ranges are left to the caller
+static const FilePos MIN_COPY_DISTANCE = 0x10000;
+
+bool SplitFile_imp::copy (FilePos src, FilePos dest, FilePos len)
+{
+    if (!open_) throw FileNotOpen ();
+#if defined (SCI_HAVE_COPY_RANGE)
+    FilePos dist = (src > dest) ? (src - dest) : (dest - src);
+    if (!len || dist < MIN_COPY_DISTANCE || src + len > length_)
+        return false;
+    if (dest + len > length_)
+        chsize (dest + len);
+    bool forward = (dest < src); // moving down - copy the lowest pieces first
+    FilePos done = 0;
+    while (done < len)
+    {
+        FilePos piece = min_ (len - done, dist);
+        FilePos s, d;
+        if (forward)
+        {
+            s = src + done;
+            d = dest + done;
+            // stay within one segment on both sides
+            piece = min_ (piece, segsize_ - fileOff (s));
+            piece = min_ (piece, segsize_ - fileOff (d));
+        }
+        else
+        {
+            piece = min_ (piece, (FilePos) (fileOff (src + len - done - 1) + 1));
+            piece = min_ (piece, (FilePos) (fileOff (dest + len - done - 1) + 1));
+            s = src + len - done - piece;
+            d = dest + len - done - piece;
+        }
+        PinnedHandle hs (fids_ [fileNo (s)]);
+        PinnedHandle hd (fids_ [fileNo (d)]);
+        loff_t soff = fileOff (s);
+        loff_t doff = fileOff (d);
+        FilePos left = piece;
+        while (left)
+        {
+            ssize_t copied = ::sci_copy_range (hs, &soff, hd, &doff, left);
+            if (copied <= 0)
+            {
+                // not supported for these files - let the caller copy
+                if (done == 0 && left == piece && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP))
+                    return false;
+                ERR("Copy error");
+            }
+            left -= copied;
+        }
+        done += piece;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
 bool SplitFile_imp::commit ()
 {
     // commit all handles
@@ -339,6 +659,12 @@ bool SplitFile_imp::close ()
     if (!open_) throw FileNotOpen ();
 
     bool toRet = true;
+    // give back the space reserved past the end
+    if (reserved_ > length_ && fids_.size ())
+    {
+        PinnedHandle h (fids_.back ());
+        if (::sci_chsize (h, fileOff (length_) ? fileOff (length_) : (length_ ? segsize_ : 0)) != 0) toRet = false;
+    }
     open_ = false;
     for (FidVect::iterator itr = fids_.begin (); itr != fids_.end (); itr ++)
     {
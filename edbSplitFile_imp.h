@@ -15,6 +15,7 @@
 #define edbSplitFile_imp_h
 #include "edbFile.h"
 #include "edbFileHandleMgr.h"
+#include "edbSplitFileFactory.h"
 
 #include <string>
 #include <vector>
@@ -23,25 +24,50 @@ namespace edb
 {
 
 typedef std::vector <Fid> FidVect;
+class Thread;
 
+extern const FilePos SPLIT_FACTOR;
+
+// The file is kept in segments of segsize_ bytes, named by name4number. Appended data goes into the disk space 
+// reserved ahead by large extents (where the OS allows that), which is given back on close. Large requests 
+// spanning several segments may be done by several threads, one segment each, by positional i/o
 class SplitFile_imp : public File
 {
 private:
     bool        open_;
     std::string base_name_;
     FidVect     fids_;
+    FilePos     segsize_;
 
     FilePos     curPos_;
-    Fid         curFile_;
-    bool        cpsync_;
     FilePos     length_;
+    FilePos     reserved_; // the disk space is reserved up to here
+    bool        prealloc_; // false if the file system can not reserve space
+    uint32      iothreads_; // for the requests spanning several segments, and for opening the segments
+
+    struct SegIo // the piece of a request within one segment
+    {
+        Fid     fid_;
+        int     handle_;
+        FilePos off_;
+        char*   data_;
+        BufLen  len_;
+        bool    write_;
+        int     errno_;
+    };
 
 
     bool        open    ();
     bool        create  ();
+    int32       fileNo  (FilePos offset) const;
+    FilePos     fileOff (FilePos offset) const;
+    void        reserve_ (FilePos from, FilePos to);
+    bool        spread_ (int32 first_file, FilePos first_off, int32 last_file, FilePos to_off, char* buf, bool write);
+    static void segio_  (void* arg);
+    static void wave_   (SegIo* ios, size_t number, Thread* threads, size_t pinned = 0);
 
 protected:
-                SplitFile_imp  (const char* directory, const char* basename);
+                SplitFile_imp  (const char* directory, const char* basename, FilePos segsize = SPLIT_FACTOR);
 public:
                 ~SplitFile_imp ();
     bool        isOpen         () const;
@@ -53,17 +79,32 @@ public:
     bool        chsize         (FilePos newLength);
     bool        commit         ();
     bool        close          ();
+    void        prefetch       (FilePos pos, FilePos len);
+    // reads up to byteno bytes at pos, leaving the file position as it is; with positional () i/o
+    // several threads may read so at once
+    BufLen      readAt         (void* buf, BufLen byteno, FilePos pos);
+    static bool positional     ();
+    // copies len bytes from src to dest within the file by the OS, without passing them through the process memory;
+    // ranges may overlap. Returns false (nothing copied) when the OS can not do that
+    bool        copy           (FilePos src, FilePos dest, FilePos len);
+    FilePos     segmentSize    () const { return segsize_; }
 
 friend class SplitFileFactory_imp;
 };
 
 void name4number    (const char* base_name, int32 number, char* dest, unsigned destlen);
+void name4segsize   (const char* base_name, char* dest, unsigned destlen);
 
-class SplitFileFactory_imp : public FileFactory
+class SplitFileFactory_imp : public SplitFileFactory
 {
+    uint32      iothreads_;
 public:
+                SplitFileFactory_imp () : iothreads_ (1) {}
     File&       open           (const char* directory, const char* basename);
     File&       create         (const char* directory, const char* basename);
+    File&       create         (const char* directory, const char* basename, FilePos segmentSize);
+    void        setIoThreads   (uint32 threads);
+    uint32      getIoThreads   () const;
     bool        exists         (const char* directory, const char* basename);
     bool        erase          (const char* directory, const char* basename);	
     bool        rename         (const char* src_directory, const char* src_basename, const char* dst_directory, const char* dst_basename);
@@ -0,0 +1,318 @@
+//////////////////////////////////////////////////////////////////////////////
+//// This software module is developed by SciDM (Scientific Data Management) in 1998-2015
+////
+//// This program is free software; you can redistribute, reuse,
+//// or modify it with no restriction, under the terms of the MIT License.
+////
+//// This program is distributed in the hope that it will be useful,
+//// but WITHOUT ANY WARRANTY; without even the implied warranty of
+//// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+////
+//// For any questions please contact Denis Kaznadzey at dkaznadzey@yahoo.com
+//////////////////////////////////////////////////////////////////////////////
+
+#include "edbStats.h"
+#include "edbLatch.h"
+#include <string.h>
+
+#if !defined (EDB_STATS)
+#elif defined (_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+namespace edb
+{
+
+static const char* counterNames [STAT_COUNTERS] =
+{
+    "pager_fetch_hits",
+    "pager_fetch_misses",
+    "pager_pages_read",
+    "file_syscalls",
+    "btree_root_splits",
+    "btree_rotations",
+    "vstorage_alloc_end",
+    "vstorage_alloc_free"
+};
+
+static const char* histogramNames [STAT_HISTOGRAMS] =
+{
+    "fetch_hit_ns",
+    "fetch_miss_ns",
+    "dump_pages",
+    "file_read_bytes",
+    "file_write_bytes",
+    "btree_split_level",
+    "btree_reclaim_level",
+    "vstorage_alloc_bytes"
+};
+
+const char* statName (StatCounter c)
+{
+    return counterNames [c];
+}
+
+const char* statName (StatHistogram h)
+{
+    return histogramNames [h];
+}
+
+uint64 statBucketLow (uint32 bucket)
+{
+    if (bucket < STAT_EXACT) return bucket;
+    uint32 top = 4 + (bucket - STAT_EXACT) / STAT_SUBBUCKETS;
+    uint64 sub = (bucket - STAT_EXACT) % STAT_SUBBUCKETS;
+    return (STAT_SUBBUCKETS + sub) << (top - 3);
+}
+
+uint64 statBucketHigh (uint32 bucket)
+{
+    if (bucket < STAT_EXACT) return bucket;
+    uint32 top = 4 + (bucket - STAT_EXACT) / STAT_SUBBUCKETS;
+    return statBucketLow (bucket) + (((uint64) 1) << (top - 3)) - 1;
+}
+
+uint64 StatsSnapshot::count (StatHistogram h) const
+{
+    uint64 total = 0;
+    for (uint32 b = 0; b < STAT_BUCKETS; b ++)
+        total += buckets_ [h][b];
+    return total;
+}
+
+double StatsSnapshot::mean (StatHistogram h) const
+{
+    uint64 n = count (h);
+    return n ? ((double) sums_ [h]) / n : 0.0;
+}
+
+uint64 StatsSnapshot::percentile (StatHistogram h, double pct) const
+{
+    uint64 n = count (h);
+    if (!n) return 0;
+    // the rank of the value wanted, counting from 1
+    uint64 rank = (uint64) (pct * n / 100.0 + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > n) rank = n;
+    uint64 seen = 0;
+    for (uint32 b = 0; b < STAT_BUCKETS; b ++)
+    {
+        seen += buckets_ [h][b];
+        if (seen >= rank)
+            return statBucketHigh (b);
+    }
+    return 0;
+}
+
+#if defined (EDB_STATS)
+
+// all blocks ever given out; never freed, so a snapshot can walk them while threads come and go
+static StatBlock* blocks_ = NULL;
+// the totals at the last reset, taken off every snapshot
+static StatsSnapshot base_;
+uint64 statScale_ = 0;
+
+static Mutex& registry_ ()
+{
+    static Mutex mutex;
+    return mutex;
+}
+
+#if defined (EDB_NO_THREADS)
+StatBlock* statCurrent_ = NULL;
+#elif defined (_MSC_VER)
+__declspec (thread) StatBlock* statCurrent_ = NULL;
+#else
+__thread StatBlock* statCurrent_ = NULL;
+#endif
+
+#if defined (EDB_NO_THREADS)
+
+static void statWatch_ (StatBlock*)
+{
+}
+
+#elif defined (_WIN32)
+
+// the fiber local slot calls back when the thread ends, handing the block over to a later thread
+static VOID WINAPI statDetach_ (PVOID block)
+{
+    if (!block) return;
+    MutexGuard guard (registry_ ());
+    ((StatBlock*) block)->owned_ = false;
+}
+
+static void statWatch_ (StatBlock* block)
+{
+    static DWORD slot = FlsAlloc (statDetach_);
+    if (slot != FLS_OUT_OF_INDEXES)
+        FlsSetValue (slot, block);
+}
+
+#else
+
+// called when the thread ends, handing the block over to a later thread
+static void statDetach_ (void* block)
+{
+    MutexGuard guard (registry_ ());
+    ((StatBlock*) block)->owned_ = false;
+}
+
+static pthread_key_t statKey_ ()
+{
+    pthread_key_t key;
+    pthread_key_create (&key, statDetach_);
+    return key;
+}
+
+static void statWatch_ (StatBlock* block)
+{
+    static pthread_key_t key = statKey_ ();
+    pthread_setspecific (key, block);
+}
+
+#endif
+
+// spins a millisecond counting the ticks
+static uint64 calibrate_ ()
+{
+#if defined (EDB_STAT_TSC)
+    uint64 ns0 = statNanos (), ticks0 = statTicks ();
+    uint64 ns, ticks;
+    do
+    {
+        ns = statNanos ();
+        ticks = statTicks ();
+    }
+    while (ns - ns0 < 1000000 || ticks == ticks0);
+    return (uint64) ((double) (ns - ns0) / (ticks - ticks0) * 4294967296.0);
+#else
+    return ((uint64) 1) << 32;
+#endif
+}
+
+StatBlock* statAttach_ ()
+{
+    StatBlock* block;
+    {
+        MutexGuard guard (registry_ ());
+        if (!statScale_)
+            statScale_ = calibrate_ ();
+        for (block = blocks_; block; block = block->next_)
+            if (!block->owned_)
+                break;
+        if (!block)
+        {
+            block = new StatBlock;
+            memset (block, 0, sizeof (StatBlock));
+            block->next_ = blocks_;
+            blocks_ = block;
+        }
+        block->owned_ = true;
+    }
+    statWatch_ (block);
+    statCurrent_ = block;
+    return block;
+}
+
+uint64 statNanos ()
+{
+#if defined (_WIN32)
+    static LARGE_INTEGER freq = { 0 };
+    if (!freq.QuadPart)
+        QueryPerformanceFrequency (&freq);
+    LARGE_INTEGER now;
+    QueryPerformanceCounter (&now);
+    return (uint64) ((double) now.QuadPart * 1e9 / freq.QuadPart);
+#else
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (uint64) now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+// the totals over all blocks; the running threads may be counting meanwhile, which only makes it a moment older
+static void collect_ (StatsSnapshot& snap)
+{
+    memset (&snap, 0, sizeof (snap));
+    MutexGuard guard (registry_ ());
+    for (StatBlock* block = blocks_; block; block = block->next_)
+    {
+        uint32 i;
+        for (i = 0; i < STAT_COUNTERS; i ++)
+            snap.counters_ [i] += block->counters_ [i];
+        for (i = 0; i < STAT_HISTOGRAMS; i ++)
+        {
+            snap.sums_ [i] += block->sums_ [i];
+            for (uint32 b = 0; b < STAT_BUCKETS; b ++)
+                snap.buckets_ [i][b] += block->buckets_ [i][b];
+        }
+    }
+}
+
+bool statsEnabled ()
+{
+    return true;
+}
+
+void statsSnapshot (StatsSnapshot& snap)
+{
+    MutexGuard guard (registry_ ());
+    collect_ (snap);
+    uint32 i;
+    for (i = 0; i < STAT_COUNTERS; i ++)
+        snap.counters_ [i] -= base_.counters_ [i];
+    for (i = 0; i < STAT_HISTOGRAMS; i ++)
+    {
+        snap.sums_ [i] -= base_.sums_ [i];
+        for (uint32 b = 0; b < STAT_BUCKETS; b ++)
+            snap.buckets_ [i][b] -= base_.buckets_ [i][b];
+    }
+}
+
+// the blocks belong to their threads and are not written here: the reset only moves the base
+void statsReset ()
+{
+    MutexGuard guard (registry_ ());
+    collect_ (base_);
+}
+
+#else
+
+bool statsEnabled ()
+{
+    return false;
+}
+
+void statsSnapshot (StatsSnapshot& snap)
+{
+    memset (&snap, 0, sizeof (snap));
+}
+
+void statsReset ()
+{
+}
+
+#endif
+
+void statsDump (std::ostream& o)
+{
+    StatsSnapshot* snap = new StatsSnapshot;
+    statsSnapshot (*snap);
+    uint32 i;
+    for (i = 0; i < STAT_COUNTERS; i ++)
+        o << counterNames [i] << " " << snap->counter ((StatCounter) i) << std::endl;
+    for (i = 0; i < STAT_HISTOGRAMS; i ++)
+    {
+        StatHistogram h = (StatHistogram) i;
+        o << histogramNames [i] << " count " << snap->count (h);
+        if (snap->count (h))
+            o << " mean " << snap->mean (h) << " p50 " << snap->percentile (h, 50.0) << " p99 " << snap->percentile (h, 99.0) << " max " << snap->maximum (h);
+        o << std::endl;
+    }
+    delete snap;
+}
+
+};
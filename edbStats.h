@@ -0,0 +1,207 @@
+//////////////////////////////////////////////////////////////////////////////
+//// This software module is developed by SciDM (Scientific Data Management) in 1998-2015
+////
+//// This program is free software; you can redistribute, reuse,
+//// or modify it with no restriction, under the terms of the MIT License.
+////
+//// This program is distributed in the hope that it will be useful,
+//// but WITHOUT ANY WARRANTY; without even the implied warranty of
+//// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+////
+//// For any questions please contact Denis Kaznadzey at dkaznadzey@yahoo.com
+//////////////////////////////////////////////////////////////////////////////
+
+// Performance counters and value histograms shared by all the layers (pager, files, B-tree, storage).
+// Every thread counts into its own block, with no locking and no shared cache lines; a snapshot sums
+// the blocks of the running threads and of the finished ones. The histograms are log-linear: the values
+// below 16 get a bucket each, the larger ones 8 buckets per power of two, so any percentile is
+// within 1/8 of the true value.
+//
+// The latencies are taken for one operation in STAT_SAMPLE of each thread, as reading a clock costs
+// about as much as a cached page fetch; their histograms count the sampled operations only. The
+// clock is the processor time stamp counter where there is one, converted into nanoseconds by a
+// scale measured against the system clock when the first thread starts counting.
+//
+// The counting is compiled in with EDB_STATS defined. Without it the EDB_STAT_ macros expand to
+// nothing, and the snapshot and dump functions report empty statistics.
+
+#ifndef edbStats_h
+#define edbStats_h
+
+#include "edbTypes.h"
+#include <ostream>
+
+#if defined (_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined (__x86_64__) || defined (__i386__) || defined (_M_X64) || defined (_M_IX86)
+#define EDB_STAT_TSC
+#endif
+
+namespace edb
+{
+
+enum StatCounter
+{
+    STAT_PAGER_FETCH_HITS,
+    STAT_PAGER_FETCH_MISSES,
+    STAT_PAGER_PAGES_READ,      // from the files into the pager slots
+    STAT_FILE_SYSCALLS,         // reads, writes, seeks and read-ahead requests of the split file segments
+    STAT_BTREE_ROOT_SPLITS,
+    STAT_BTREE_ROTATIONS,       // redistributions with a sibling making room without a split
+    STAT_VSTORAGE_ALLOC_END,    // records allocated by extending the storage
+    STAT_VSTORAGE_ALLOC_FREE,   // records allocated in a free block
+    STAT_COUNTERS
+};
+
+enum StatHistogram
+{
+    STAT_FETCH_HIT_NS,          // Pager::fetch served from the slots, in nanoseconds, sampled
+    STAT_FETCH_MISS_NS,         // Pager::fetch reading the file, in nanoseconds, sampled
+    STAT_DUMP_PAGES,            // pages written out of the pager at once, into the file or the log
+    STAT_FILE_READ_BYTES,       // per split file read
+    STAT_FILE_WRITE_BYTES,      // per split file write
+    STAT_BTREE_SPLIT_LEVEL,     // level of the nodes split, 0 for the leaves
+    STAT_BTREE_RECLAIM_LEVEL,   // level of the emptied nodes given back to the free list
+    STAT_VSTORAGE_ALLOC_BYTES,
+    STAT_HISTOGRAMS
+};
+
+enum
+{
+    STAT_EXACT = 16,            // values below get a bucket each
+    STAT_SUBBUCKETS = 8,        // per power of two above
+    STAT_BUCKETS = STAT_EXACT + (64 - 4) * STAT_SUBBUCKETS,
+    STAT_SAMPLE = 16            // operations per latency taken; a power of two
+};
+
+// the totals over all threads since the start or since the last statsReset
+struct StatsSnapshot
+{
+    uint64      counters_ [STAT_COUNTERS];
+    uint64      sums_ [STAT_HISTOGRAMS];
+    uint64      buckets_ [STAT_HISTOGRAMS][STAT_BUCKETS];
+
+    uint64      counter    (StatCounter c) const { return counters_ [c]; }
+    uint64      count      (StatHistogram h) const; // values recorded
+    uint64      sum        (StatHistogram h) const { return sums_ [h]; }
+    double      mean       (StatHistogram h) const;
+    uint64      percentile (StatHistogram h, double pct) const; // the upper bound of the bucket holding it, 0 if empty
+    uint64      maximum    (StatHistogram h) const { return percentile (h, 100.0); }
+};
+
+bool        statsEnabled  ();
+void        statsSnapshot (StatsSnapshot& snap);
+void        statsReset    ();
+void        statsDump     (std::ostream& o); // one line per counter and per histogram
+const char* statName      (StatCounter c);
+const char* statName      (StatHistogram h);
+
+// the histogram bucket a value goes to, and the values each bucket holds
+inline uint32 statBucket (uint64 value)
+{
+    if (value < STAT_EXACT) return (uint32) value;
+#if defined (_MSC_VER)
+    unsigned long top;
+    _BitScanReverse64 (&top, value);
+#else
+    uint32 top = 63 - __builtin_clzll (value);
+#endif
+    return STAT_EXACT + (top - 4) * STAT_SUBBUCKETS + (uint32) ((value >> (top - 3)) & (STAT_SUBBUCKETS - 1));
+}
+uint64 statBucketLow  (uint32 bucket);
+uint64 statBucketHigh (uint32 bucket);
+
+#if defined (EDB_STATS)
+
+// what a thread counts; owned by the thread while it runs, reused by a later one after it ends
+struct StatBlock
+{
+    uint64      counters_ [STAT_COUNTERS];
+    uint64      sums_ [STAT_HISTOGRAMS];
+    uint64      buckets_ [STAT_HISTOGRAMS][STAT_BUCKETS];
+    uint32      timed_; // operations passed by the latency sampling
+    StatBlock*  next_;
+    bool        owned_;
+};
+
+// nanoseconds per 2^32 ticks
+extern uint64 statScale_;
+#if defined (EDB_NO_THREADS)
+extern StatBlock* statCurrent_;
+#elif defined (_MSC_VER)
+extern __declspec (thread) StatBlock* statCurrent_;
+#else
+extern __thread StatBlock* statCurrent_;
+#endif
+StatBlock* statAttach_ (); // gives the calling thread its block
+
+inline StatBlock& statBlock_ ()
+{
+    StatBlock* block = statCurrent_;
+    return block ? *block : *statAttach_ ();
+}
+
+inline void statAdd (StatCounter c, uint64 n)
+{
+    statBlock_ ().counters_ [c] += n;
+}
+
+inline void statRecord (StatHistogram h, uint64 value)
+{
+    StatBlock& block = statBlock_ ();
+    block.sums_ [h] += value;
+    block.buckets_ [h][statBucket (value)] ++;
+}
+
+uint64 statNanos (); // the system clock, nanoseconds from an arbitrary point
+
+// ticks from an arbitrary point
+inline uint64 statTicks ()
+{
+#if !defined (EDB_STAT_TSC)
+    return statNanos ();
+#elif defined (_MSC_VER)
+    return __rdtsc ();
+#else
+    return __builtin_ia32_rdtsc ();
+#endif
+}
+
+// the ticks now for the operation sampled, 0 for the others
+inline uint64 statSample ()
+{
+    if (++ statBlock_ ().timed_ & (STAT_SAMPLE - 1))
+        return 0;
+    return statTicks ();
+}
+
+// records the nanoseconds since statSample () returned started, if it was sampled
+inline void statLatency (StatHistogram h, uint64 started)
+{
+    if (!started) return;
+    uint64 ticks = statTicks () - started;
+    // the block first: taking it may measure the scale
+    StatBlock& block = statBlock_ ();
+    uint64 ns = (ticks >> 32) * statScale_ + (((ticks & 0xffffffff) * statScale_) >> 32);
+    block.sums_ [h] += ns;
+    block.buckets_ [h][statBucket (ns)] ++;
+}
+
+#define EDB_STAT_ADD(c, n)          edb::statAdd (edb::c, n)
+#define EDB_STAT_RECORD(h, v)       edb::statRecord (edb::h, v)
+#define EDB_STAT_START(t)           edb::uint64 t = edb::statSample ()
+#define EDB_STAT_LATENCY(h, t)      edb::statLatency (edb::h, t)
+
+#else
+
+#define EDB_STAT_ADD(c, n)
+#define EDB_STAT_RECORD(h, v)
+#define EDB_STAT_START(t)
+#define EDB_STAT_LATENCY(h, t)
+
+#endif
+
+};
+
+#endif
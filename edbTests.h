@@ -21,6 +21,7 @@ bool testFileHandleMgr ();
 bool testFile ();
 bool testBufferedFile ();
 bool testVLPagedFile ();
+bool testVLPagedCache ();
 bool testPager ();
 bool testPagedFile ();
 bool testVStorage ();
@@ -22,14 +22,18 @@ namespace edb
 static VLPagedCacheFactory_imp theFactory;
 VLPagedCacheFactory& pagedCacheFactory = theFactory;
 
+// number of the least recently used unlocked buffers searched for one of the size class needed
+static const uint32 EVICT_SCAN = 32;
+
 ///////////////////////
 // VLPagedCache
 
 VLPagedCache_imp::VLPagedCache_imp (Pager& pager, uint32 lcachesize) 
 :
 pager_ (pager),
-maxsize_ (lcachesize),
-cursize_ (0)
+arena_ (lcachesize),
+mruhead_ (NULL),
+mrutail_ (NULL)
 {
 }
 
@@ -37,64 +41,172 @@ VLPagedCache_imp::~VLPagedCache_imp ()
 {
 }
 
-void VLPagedCache_imp::ensurespace_ (BufLen len)
+size_t VLPagedCache_imp::find_ (File* file, FilePos off) const
+{
+    size_t lo = 0, hi = index_.size ();
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        const Buffer& buf = *index_ [mid];
+        if (buf.file_ < file || (buf.file_ == file && buf.off_ < off))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+VLPagedCache_imp::Buffer* VLPagedCache_imp::covering_ (File& file, FilePos off, BufLen len) const
+{
+    // the buffers do not overlap: only the one starting at off or the last one before it may hold the range
+    size_t pos = find_ (&file, off);
+    if (pos < index_.size () && index_ [pos]->file_ == &file && index_ [pos]->off_ == off)
+        return (index_ [pos]->size_ >= len) ? index_ [pos] : NULL;
+    if (pos > 0)
+    {
+        Buffer* buf = index_ [pos - 1];
+        if (buf->file_ == &file && buf->off_ + buf->size_ >= off + len)
+            return buf;
+    }
+    return NULL;
+}
+
+bool VLPagedCache_imp::overlapped_ (File& file, FilePos off, BufLen len) const
+{
+    size_t pos = find_ (&file, off);
+    if (pos < index_.size () && index_ [pos]->file_ == &file && index_ [pos]->off_ < off + len)
+        return true;
+    if (pos > 0 && index_ [pos - 1]->file_ == &file && index_ [pos - 1]->off_ + index_ [pos - 1]->size_ > off)
+        return true;
+    return false;
+}
+
+size_t VLPagedCache_imp::after_ (const void* ptr) const
 {
-   Bptrlist::reverse_iterator lruitr = mrulist_.rbegin ();
-    while (maxsize_ < cursize_ + len)
+    size_t lo = 0, hi = addrs_.size ();
+    while (lo < hi)
     {
-        // if it is not locked
-        if (lruitr == mrulist_.rend ()) ERR("Could not fit into cache size due to locks!");
-        if (!(*lruitr)->lockcnt_)
+        size_t mid = (lo + hi) / 2;
+        if ((const char*) addrs_ [mid] <= (const char*) ptr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+void* VLPagedCache_imp::inner_ (Buffer& buf, FilePos off)
+{
+    return (char*) buf.data () + (off - buf.off_);
+}
+
+VLPagedCache_imp::Buffer* VLPagedCache_imp::lookup_ (const void* ptr) const
+{
+    // only the last buffer starting at or below ptr may hold it
+    size_t pos = after_ (ptr);
+    if (!pos)
+        return NULL;
+    Buffer* buf = addrs_ [pos - 1];
+    if ((const char*) ptr < (const char*) buf->data () || (const char*) ptr >= (const char*) buf->data () + buf->size_)
+        return NULL;
+    return buf;
+}
+
+void VLPagedCache_imp::touch_ (Buffer& buf)
+{
+    if (mruhead_ == &buf)
+        return;
+    // unlink
+    if (buf.mruprev_)
+        buf.mruprev_->mrunext_ = buf.mrunext_;
+    if (buf.mrunext_)
+        buf.mrunext_->mruprev_ = buf.mruprev_;
+    else if (mrutail_ == &buf)
+        mrutail_ = buf.mruprev_;
+    // put in front
+    buf.mruprev_ = NULL;
+    buf.mrunext_ = mruhead_;
+    if (mruhead_)
+        mruhead_->mruprev_ = &buf;
+    mruhead_ = &buf;
+    if (!mrutail_)
+        mrutail_ = &buf;
+}
+
+void VLPagedCache_imp::evict_ (uint32 sizeClass)
+{
+    // a chunk of the same class is reused at once; other ones help only when they empty a slab
+    Buffer* victim = NULL;
+    uint32 scanned = 0;
+    for (Buffer* buf = mrutail_; buf && scanned < EVICT_SCAN; buf = buf->mruprev_)
+    {
+        if (buf->lockcnt_)
+            continue;
+        if (!victim)
+            victim = buf;
+        if (arena_.chunkClass (buf) == sizeClass)
         {
-            // dump it
-            dump_ (*(*lruitr));
-            // free memory
-            free_ (*(*lruitr));
+            victim = buf;
+            break;
         }
-        // pick next lru item
-        lruitr ++;
+        scanned ++;
     }
+    if (!victim) ERR("Could not fit into cache size due to locks!");
+    dump_ (*victim);
+    free_ (*victim);
 }
 
-VLPagedCache_imp::Buffer& VLPagedCache_imp::add_ (VLPagedCache_imp::BufKey& key, BufLen len)
-{
-    // check weather it is the time to free some space
-    ensurespace_ (len);
-    // allocate new Buffer
-    Buffer& buf = keymap_ [key];
-    // allocate memory 
-    char* data = new char [len];
-    if (!data) throw NotEnoughMemory ();
-    cursize_ += len;
-    buf.init (key.file_, key.off_, len, data);
-    ptrmap_ [data] = &buf;
-    mrulist_.push_front (&buf);
-    buf.mrupos_ = mrulist_.begin ();
+VLPagedCache_imp::Buffer& VLPagedCache_imp::alloc_ (File& file, FilePos off, BufLen len)
+{
+    // free some space if the arena is full
+    void* chunk;
+    while ((chunk = arena_.alloc (sizeof (Buffer) + len)) == NULL)
+        evict_ (arena_.sizeClass (sizeof (Buffer) + len));
+    Buffer& buf = *(Buffer*) chunk;
+    buf.init (&file, off, len);
     return buf;
 }
 
+void VLPagedCache_imp::link_ (Buffer& buf)
+{
+    index_.insert (index_.begin () + find_ (buf.file_, buf.off_), &buf);
+    addrs_.insert (addrs_.begin () + after_ (&buf), &buf);
+    touch_ (buf);
+}
+
 void VLPagedCache_imp::free_ (Buffer& buf)
 {
-    mrulist_.erase (buf.mrupos_);
-    ptrmap_.erase (buf.data_);
-    delete buf.data_;
-    cursize_ -= buf.size_;
-    keymap_.erase (BufKey (*buf.file_, buf.off_));
+    size_t pos = find_ (buf.file_, buf.off_);
+    if (pos == index_.size () || index_ [pos] != &buf) ERR("Cache buffer not indexed");
+    index_.erase (index_.begin () + pos);
+    pos = after_ (&buf);
+    if (!pos || addrs_ [pos - 1] != &buf) ERR("Cache buffer not indexed");
+    addrs_.erase (addrs_.begin () + pos - 1);
+    if (buf.mruprev_)
+        buf.mruprev_->mrunext_ = buf.mrunext_;
+    else
+        mruhead_ = buf.mrunext_;
+    if (buf.mrunext_)
+        buf.mrunext_->mruprev_ = buf.mruprev_;
+    else
+        mrutail_ = buf.mruprev_;
+    arena_.free (&buf);
 }
 
-void VLPagedCache_imp::fill_ (Buffer& buf)
+// copies the file range from..to (lying within the buffer) from the pages
+void VLPagedCache_imp::fill_ (Buffer& buf, FilePos from, FilePos to)
 {
     uint32 pgsize = pager_.getPageSize ();
-    uint64 pageno = buf.off_  / pgsize;
-    uint64 pageno_end = (buf.off_ + buf.size_ - 1) / pgsize;
-    uint32 accum = 0;
+    uint64 pageno = from / pgsize;
+    uint64 pageno_end = (to - 1) / pgsize;
+    uint32 accum = (uint32) (from - buf.off_);
     for (uint64 p = pageno; p <= pageno_end; p++)
     {
         char* pagedata = (char*) pager_.fetch (*buf.file_, p);
-        uint32 start = (p == pageno)?(buf.off_ % pgsize):(0);
-        uint32 end   = (p == pageno_end)?((buf.off_ + buf.size_) % pgsize):(pgsize);
+        uint32 start = (p == pageno)?(from % pgsize):(0);
+        uint32 end   = (p == pageno_end)?(to % pgsize):(pgsize);
         if (!end) end = pgsize;
-        memcpy (((char*) buf.data_) + accum, pagedata + start, end - start);
+        memcpy (((char*) buf.data ()) + accum, pagedata + start, end - start);
         accum += end - start;
     }
 }
@@ -112,59 +224,71 @@ void VLPagedCache_imp::dump_ (Buffer& buf)
         uint32 end   = (p == pageno_end)?((buf.off_ + buf.size_) % pgsize):(pgsize);
         if (!end) end = pgsize;
         char* pagedata = ((p == pageno && start != 0) || (p == pageno_end && end != pgsize)) ? (char*) pager_.fetch (*buf.file_, p) : (char*) pager_.fake (*buf.file_, p);
-        memcpy (pagedata + start, ((char*) buf.data_) + accum, end - start);
+        memcpy (pagedata + start, ((char*) buf.data ()) + accum, end - start);
         accum += end - start;
         pager_.mark (pagedata);
     }
     buf.markcnt_ = 0;
 }
 
-// Checks managed buffers for overlap with given key:len range.
-// the buffers which overlap and not locked are dumped and freed. If there is 
-//   a locked one, returns false - (this is an error in caller's logic)
-void VLPagedCache_imp::resolve_overlaps_ (const Bkeymap::iterator& itr, const BufKey& key, BufLen len)
+// Builds the buffer for the off:len range together with all the managed buffers it overlaps. Their data, 
+// dirty or not, is moved into the new buffer, which takes their mark; only the gaps between them are 
+// copied from the pages (and not even those when the range is to be overwritten). If an overlapped 
+// buffer is locked, throws BufferLocked - (this is an error in caller's logic)
+VLPagedCache_imp::Buffer& VLPagedCache_imp::place_ (File& file, FilePos off, BufLen len, bool read)
 {
-    // check forward neighbours (including current one). Perfect match is not overlap here!
-    Bkeymap::iterator i1 = itr;
-    std::vector<Buffer*> toErase;
-
-    while (i1 != keymap_.end ())
+    check_paged_overlaps_ (file, off, len);
+    std::vector<Buffer*> parts;
+    size_t pos = find_ (&file, off);
+    if (pos > 0 && index_ [pos - 1]->file_ == &file && index_ [pos - 1]->off_ + index_ [pos - 1]->size_ > off)
+        pos --;
+    for (; pos < index_.size () && index_ [pos]->file_ == &file && index_ [pos]->off_ < off + len; pos ++)
     {
-        Buffer& buf = (*i1).second;
-        if ((key.off_ < buf.off_ + buf.size_) && (buf.off_ < key.off_ + len) && !(key.off_ == buf.off_ && len == buf.size_))
-        {
-            if (buf.lockcnt_) throw BufferLocked ();
-            else { dump_ (buf); toErase.push_back (&buf); }
-        }
-        else
-            break; // end of overlapped zone
-        i1 ++;
+        if (index_ [pos]->lockcnt_) throw BufferLocked ();
+        parts.push_back (index_ [pos]);
     }
-    // check prev neighbour
-    i1 = itr;
-    if (i1 != keymap_.begin ()) do
+    FilePos lo = off, hi = off + len;
+    if (parts.size ())
     {
-        i1 --;
-        Buffer& buf = (*i1).second;
-        if ((key.off_ < buf.off_ + buf.size_) && (buf.off_ < key.off_ + len))
-        {
-            if (buf.lockcnt_)  throw BufferLocked ();
-            else { dump_ (buf); toErase.push_back (&buf); }
-        }
-        else
-            break; // end of overlapped zone
+        if (parts.front ()->off_ < lo)
+            lo = parts.front ()->off_;
+        if (parts.back ()->off_ + parts.back ()->size_ > hi)
+            hi = parts.back ()->off_ + parts.back ()->size_;
     }
-    while (i1 != keymap_.begin ());
 
-    for (std::vector<Buffer*>::iterator ei = toErase.begin (); ei != toErase.end (); ei ++)
-        free_ (*(*ei));
-}
-
-void VLPagedCache_imp::process_overlaps_ (File& file, FilePos off, BufLen len)
-{
-    BufKey key (file, off);
-    Bkeymap::iterator itr = keymap_.lower_bound (key);
-    resolve_overlaps_ (itr, key, len);
+    // the parts stay locked while the space is being found, so that they are not evicted
+    std::vector<Buffer*>::iterator pi;
+    for (pi = parts.begin (); pi != parts.end (); pi ++)
+        (*pi)->lockcnt_ ++;
+    Buffer* bufp;
+    try
+    {
+        bufp = &alloc_ (file, lo, (BufLen) (hi - lo));
+    }
+    catch (...)
+    {
+        for (pi = parts.begin (); pi != parts.end (); pi ++)
+            (*pi)->lockcnt_ --;
+        throw;
+    }
+    Buffer& buf = *bufp;
+    FilePos filled = lo;
+    for (pi = parts.begin (); pi != parts.end (); pi ++)
+    {
+        Buffer& part = **pi;
+        if (read && filled < part.off_)
+            fill_ (buf, filled, part.off_);
+        memcpy ((char*) buf.data () + (part.off_ - lo), part.data (), part.size_);
+        if (part.markcnt_)
+            buf.markcnt_ = 1;
+        filled = part.off_ + part.size_;
+        part.lockcnt_ --;
+        free_ (part);
+    }
+    if (read && filled < hi)
+        fill_ (buf, filled, hi);
+    link_ (buf);
+    return buf;
 }
 
 void VLPagedCache_imp::check_paged_overlaps_ (File& file, FilePos off, BufLen len)
@@ -184,76 +308,42 @@ void VLPagedCache_imp::check_paged_overlaps_ (File& file, FilePos off, BufLen le
     }
 }
 
-VLPagedCache_imp::Buffer& VLPagedCache_imp::fetch_ (File& file, FilePos off, BufLen len)
+void* VLPagedCache_imp::access_ (File& file, FilePos off, BufLen len, bool lock, bool read)
 {
-    check_paged_overlaps_ (file, off, len);
-    // check weather in managed cache allready
-    BufKey key (file, off);
-    Bkeymap::iterator itr = keymap_.lower_bound (key);
-    if ((*itr).first == key)  // length are guaranteed to be equal here (non-equal are treated as overlaps and allready removed from cache on the way here)
-        return (*itr).second;
-    else
+    // lies within a managed buffer
+    Buffer* buf = covering_ (file, off, len);
+    if (buf)
     {
-        // add buffer
-        Buffer& buf = add_ (key, len);
-        // fetch pages and copy them into allocated memory
-        fill_ (buf);
-        return buf;
+        touch_ (*buf);
+        if (lock) buf->lockcnt_ ++;
+        return inner_ (*buf, off);
     }
-}
-
-VLPagedCache_imp::Buffer& VLPagedCache_imp::fake_ (File& file, FilePos off, BufLen len)
-{
-    check_paged_overlaps_ (file, off, len);
-    // check weather in managed cache allready
-    BufKey key (file, off);
-    Bkeymap::iterator itr = keymap_.lower_bound (key);
-    if ((*itr).first == key) // length are guaranteed to be equal here (non-equal are treated as overlaps and allready removed from cache on the way here)
-        return (*itr).second;
-    else
-        return  add_ (key, len);
-}
-
-void* VLPagedCache_imp::fetch (File& file, FilePos off, BufLen len, bool lock)
-{
-    process_overlaps_ (file, off, len);
     // determine if should be managed or external
     uint32 pgsize = getPageSize ();
     uint64 pageno = off / pgsize;
     uint64 pageno_end = (off + len - 1) / pgsize;
-    if (pageno != pageno_end)
+    if (pageno != pageno_end || overlapped_ (file, off, len))
     {
-        Buffer& buf = fetch_ (file, off, len);
-        if (lock) buf.lockcnt_ ++;
-        return buf.data_;
+        Buffer& placed = place_ (file, off, len, read);
+        if (lock) placed.lockcnt_ ++;
+        return inner_ (placed, off);
     }
     else
     {
-        char* pagebuf =  (char*) pager_.fetch (file, pageno, lock);
+        char* pagebuf =  (char*) (read ? pager_.fetch (file, pageno, lock) : pager_.fake (file, pageno, lock));
         uint32 pageoff = off % pgsize;
         return pagebuf + pageoff;
     }
 }
 
+void* VLPagedCache_imp::fetch (File& file, FilePos off, BufLen len, bool lock)
+{
+    return access_ (file, off, len, lock, true);
+}
+
 void* VLPagedCache_imp::fake (File& file, FilePos off, BufLen len, bool lock)
 {
-    process_overlaps_ (file, off, len);
-    // determine if should be managed or external
-    uint32 pgsize = getPageSize ();
-    uint64 pageno = off / pgsize;
-    uint64 pageno_end = (off + len - 1) / pgsize;
-    if (pageno != pageno_end)
-    {
-        Buffer& buf = fake_ (file, off, len);
-        if (lock) buf.lockcnt_ ++;
-        return buf.data_;
-    }
-    else
-    {
-        char* pagebuf =  (char*) pager_.fake (file, pageno, lock);
-        uint32 pageoff = off % pgsize;
-        return pagebuf + pageoff;
-    }
+    return access_ (file, off, len, lock, false);
 }
 
 bool VLPagedCache_imp::locked	(const void* buffer)
@@ -261,9 +351,9 @@ bool VLPagedCache_imp::locked	(const void* buffer)
     void* pageaddr = pager_.pageaddr (buffer);
     if (pageaddr) 
         return pager_.locked (pageaddr);
-    Bptrmap::iterator itr = ptrmap_.find (buffer);
-    if (itr == ptrmap_.end ()) throw InvalidBufptr ();
-    return ((*itr).second->lockcnt_ != 0);
+    Buffer* found = lookup_ (buffer);
+    if (!found) throw InvalidBufptr ();
+    return (found->lockcnt_ != 0);
 }
 
 void VLPagedCache_imp::lock (const void* buffer)
@@ -273,9 +363,9 @@ void VLPagedCache_imp::lock (const void* buffer)
         pager_.lock (pageaddr);
     else
     {
-        Bptrmap::iterator itr = ptrmap_.find (buffer);
-        if (itr == ptrmap_.end ()) throw InvalidBufptr ();
-        (*itr).second->lockcnt_ ++;
+        Buffer* found = lookup_ (buffer);
+        if (!found) throw InvalidBufptr ();
+        found->lockcnt_ ++;
     }
 }
 
@@ -286,10 +376,10 @@ void VLPagedCache_imp::unlock (const void* buffer)
         pager_.unlock (pageaddr);
     else
     {
-        Bptrmap::iterator itr = ptrmap_.find (buffer);
-        if (itr == ptrmap_.end ()) throw InvalidBufptr ();
-        if ((*itr).second->lockcnt_)
-            (*itr).second->lockcnt_ --;
+        Buffer* found = lookup_ (buffer);
+        if (!found) throw InvalidBufptr ();
+        if (found->lockcnt_)
+            found->lockcnt_ --;
     }
 }
 
@@ -298,9 +388,9 @@ bool VLPagedCache_imp::marked (const void* buffer)
     void* pageaddr = pager_.pageaddr (buffer);
     if (pageaddr) 
         return pager_.marked (pageaddr);
-    Bptrmap::iterator itr = ptrmap_.find (buffer);
-    if (itr == ptrmap_.end ()) throw InvalidBufptr ();
-    return ((*itr).second->markcnt_ != 0);
+    Buffer* found = lookup_ (buffer);
+    if (!found) throw InvalidBufptr ();
+    return (found->markcnt_ != 0);
 }
 
 void VLPagedCache_imp::mark (const void* buffer)
@@ -310,9 +400,9 @@ void VLPagedCache_imp::mark (const void* buffer)
         pager_.mark (pageaddr);
     else
     {
-        Bptrmap::iterator itr = ptrmap_.find (buffer);
-        if (itr == ptrmap_.end ()) throw InvalidBufptr ();
-        (*itr).second->markcnt_ ++;
+        Buffer* found = lookup_ (buffer);
+        if (!found) throw InvalidBufptr ();
+        found->markcnt_ ++;
     }
 }
 
@@ -323,24 +413,18 @@ void VLPagedCache_imp::unmark (const void* buffer)
         pager_.unmark (pageaddr);
     else
     {
-        Bptrmap::iterator itr = ptrmap_.find (buffer);
-        if (itr == ptrmap_.end ()) throw InvalidBufptr ();
-        if ((*itr).second->markcnt_)
-            (*itr).second->markcnt_ --;
+        Buffer* found = lookup_ (buffer);
+        if (!found) throw InvalidBufptr ();
+        if (found->markcnt_)
+            found->markcnt_ --;
     }
 }
 
 bool VLPagedCache_imp::commit (File& file)
 {
     // dump all dirty buffers that belong to file
-    BufKey startKey (file, 0);
-    BufKey endKey   (*((&file)+1), 0);
-
-    Bkeymap::iterator start = keymap_.lower_bound (startKey);
-    Bkeymap::iterator end   = keymap_.lower_bound (endKey);
-
-    for (Bkeymap::iterator itr = start; itr != end; itr ++)
-        dump_ ((*itr).second);
+    for (size_t pos = find_ (&file, 0); pos < index_.size () && index_ [pos]->file_ == &file; pos ++)
+        dump_ (*index_ [pos]);
     
     return pager_.commit (file);
 }
@@ -348,28 +432,21 @@ bool VLPagedCache_imp::commit (File& file)
 bool VLPagedCache_imp::chsize (File& file, FilePos newSize)
 {
     // if shrinking - free all buffers that belong to file and lay above newSize; 
-    // dump and free overlapping one
+    // dump overlapping one
     if (newSize < file.length ())
     {
-        BufKey startKey (file, newSize);
-        BufKey endKey   (*((&file)+1), 0);
-
-        Bkeymap::iterator start = keymap_.lower_bound (startKey);
-        Bkeymap::iterator end   = keymap_.lower_bound (endKey);
+        size_t start = find_ (&file, newSize);
 
         // check for the possible overlap
-        Bkeymap::iterator prev = start;
-        if (prev != keymap_.begin ())
+        if (start > 0)
         {
-            prev --;
-            if ((*prev).second.off_ + (*prev).second.size_ > newSize)
-                dump_ ((*prev).second);
+            Buffer& prev = *index_ [start - 1];
+            if (prev.file_ == &file && prev.off_ + prev.size_ > newSize)
+                dump_ (prev);
         }
 
-        for (Bkeymap::iterator itr = start; itr != end; itr ++)
-            free_ ((*itr).second);
-
-        keymap_.erase (start, end);
+        while (start < index_.size () && index_ [start]->file_ == &file)
+            free_ (*index_ [start]);
     }
 
     return pager_.chsize (file, newSize);
@@ -378,19 +455,12 @@ bool VLPagedCache_imp::chsize (File& file, FilePos newSize)
 bool VLPagedCache_imp::close (File& file)
 {
     // dump and free all buffers that belongs to file
-    BufKey startKey (file, 0);
-    BufKey endKey   (*((&file)+1), 0);
-
-    Bkeymap::iterator start = keymap_.lower_bound (startKey);
-    Bkeymap::iterator end   = keymap_.lower_bound (endKey);
-
-    for (Bkeymap::iterator itr = start; itr != end; itr ++)
+    size_t start = find_ (&file, 0);
+    while (start < index_.size () && index_ [start]->file_ == &file)
     {
-        dump_ ((*itr).second);
-        free_ ((*itr).second);
+        dump_ (*index_ [start]);
+        free_ (*index_ [start]);
     }
-
-    keymap_.erase (start, end);
     
     return pager_.close (file);
 }
@@ -432,4 +502,4 @@ VLPagedCache& VLPagedCacheFactory_imp::create (Pager& pager, uint32 lcachesize)
     return *new VLPagedCache_imp (pager, lcachesize);
 }
 
-}
\ No newline at end of file
+}
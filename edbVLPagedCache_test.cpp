@@ -0,0 +1,371 @@
+//////////////////////////////////////////////////////////////////////////////
+//// This software module is developed by SciDM (Scientific Data Management) in 1998-2015
+//// 
+//// This program is free software; you can redistribute, reuse,
+//// or modify it with no restriction, under the terms of the MIT License.
+//// 
+//// This program is distributed in the hope that it will be useful,
+//// but WITHOUT ANY WARRANTY; without even the implied warranty of
+//// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//// 
+//// For any questions please contact Denis Kaznadzey at dkaznadzey@yahoo.com
+//////////////////////////////////////////////////////////////////////////////
+
+
+#include "edbPager.h"
+#include "edbPagerFactory.h"
+#include "edbVLPagedCacheFactory.h"
+#include "edbSplitFileFactory.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "i64out.h"
+#if defined (__linux__)
+#include <unistd.h>
+#include <stdio.h>
+#endif
+
+namespace edb
+{
+
+static const char* tdir  = ".";
+static const char* tfile = "vlcache_tst";
+static const uint32 pagesize = 0x1000;
+static const uint32 poolsize = 2048; // 8 Mb of pages
+static const uint32 cachesize = 0x1000000; // 16 Mb of assembled buffers
+
+// records of 4 .. 16 Kb, each spanning several pages, at fixed places; most accesses go to the hot eighth.
+// Set SOAK_SECONDS to 86400 for the day-long run
+static const uint32 SOAK_RECS = 8000;
+static const FilePos SOAK_SPAN = 0x4000;
+static const uint32 SOAK_SECONDS = 30;
+static const uint32 SOAK_REPORT = 5;
+
+static BufLen soakLen (uint32 rec)
+{
+    return 4200 + (rec * 7919) % 12000;
+}
+
+static uint64 residentKb ()
+{
+#if defined (__linux__)
+    FILE* f = fopen ("/proc/self/statm", "r");
+    if (!f)
+        return 0;
+    unsigned long size = 0, resident = 0;
+    if (fscanf (f, "%lu %lu", &size, &resident) != 2)
+        resident = 0;
+    fclose (f);
+    return (uint64) resident * sysconf (_SC_PAGESIZE) / 1024;
+#else
+    return 0;
+#endif
+}
+
+static void stamp (char* buf, uint32 rec, uint32 version)
+{
+    BufLen len = soakLen (rec);
+    memcpy (buf, &rec, sizeof (rec));
+    memcpy (buf + sizeof (rec), &version, sizeof (version));
+    memcpy (buf + len - sizeof (version), &version, sizeof (version));
+}
+
+static void check (const char* buf, uint32 rec, uint32 version)
+{
+    BufLen len = soakLen (rec);
+    uint32 r, v1, v2;
+    memcpy (&r, buf, sizeof (r));
+    memcpy (&v1, buf + sizeof (r), sizeof (v1));
+    memcpy (&v2, buf + len - sizeof (v2), sizeof (v2));
+    if (r != rec || v1 != version || v2 != version)
+        ERR ("soakTest: buffer holds wrong data");
+}
+
+static bool soakTest ()
+{
+    if (splitFileFactory.exists (tdir, tfile))
+        splitFileFactory.erase (tdir, tfile);
+    File& file = splitFileFactory.create (tdir, tfile);
+    Pager& pager = pagerFactory.create (pagesize, poolsize);
+    VLPagedCache& cache = pagedCacheFactory.create (pager, cachesize);
+    cache.chsize (file, SOAK_RECS * SOAK_SPAN);
+
+    std::vector <uint32> versions (SOAK_RECS, 0);
+    uint32 rec;
+    for (rec = 0; rec < SOAK_RECS; rec ++)
+    {
+        char* buf = (char*) cache.fake (file, rec * SOAK_SPAN, soakLen (rec));
+        memset (buf, 0, soakLen (rec));
+        stamp (buf, rec, 0);
+        cache.mark (buf);
+    }
+    cache.commit (file);
+
+    srand (SOAK_RECS);
+    uint64 ops = 0, reported = 0;
+    uint64 firstRss = 0, maxRss = 0;
+    time_t start = time (NULL), last = start;
+    const void* held = NULL;
+    while (time (NULL) - start < (time_t) SOAK_SECONDS)
+    {
+        for (uint32 step = 0; step < 1000; step ++, ops ++)
+        {
+            rec = (uint32) rand () % SOAK_RECS;
+            if (rand () % 10 < 8)
+                rec %= SOAK_RECS / 8;
+            char* buf = (char*) cache.fetch (file, rec * SOAK_SPAN, soakLen (rec));
+            check (buf, rec, versions [rec]);
+            if (rand () % 4 == 0)
+            {
+                stamp (buf, rec, ++ versions [rec]);
+                cache.mark (buf);
+            }
+            // now and then one buffer stays locked for a while
+            if (step == 0)
+            {
+                if (held)
+                    cache.unlock (held);
+                cache.lock (buf);
+                held = buf;
+            }
+        }
+        time_t now = time (NULL);
+        if (now - last >= (time_t) SOAK_REPORT)
+        {
+            uint64 rss = residentKb ();
+            if (!firstRss)
+                firstRss = rss;
+            if (rss > maxRss)
+                maxRss = rss;
+            std::cerr << "Soak: " << now - start << " sec, " << (ops - reported) / (now - last) << " ops/sec, resident " << rss << " Kb" << std::endl;
+            reported = ops;
+            last = now;
+        }
+    }
+    if (held)
+        cache.unlock (held);
+    std::cerr << "Soak: " << ops << " operations, resident memory " << firstRss << " Kb at first report, " << maxRss << " Kb at most" << std::endl;
+    cache.close (file);
+
+    // the dumped buffers reached the file
+    File& rfile = splitFileFactory.open (tdir, tfile);
+    VLPagedCache& rcache = pagedCacheFactory.create (pager, cachesize);
+    for (rec = 0; rec < SOAK_RECS; rec ++)
+        check ((const char*) rcache.fetch (rfile, rec * SOAK_SPAN, soakLen (rec)), rec, versions [rec]);
+    rcache.close (rfile);
+    splitFileFactory.erase (tdir, tfile);
+    return true;
+}
+
+// records read by pieces at varying offsets, as VStorage does: the header alone, the whole record, 
+// some slice of it. The pieces lying within a cached buffer are served from it, the ones reaching 
+// into cached buffers are merged with them
+static const uint32 SLICE_SECONDS = 10;
+
+static char pattern (FilePos pos)
+{
+    return (char) ((pos * 31) ^ (pos >> 9));
+}
+
+static void checkSlice (const char* buf, FilePos pos, BufLen len)
+{
+    if (buf [0] != pattern (pos) || buf [len / 2] != pattern (pos + len / 2) || buf [len - 1] != pattern (pos + len - 1))
+        ERR ("sliceTest: slice holds wrong data");
+}
+
+static void checkHead (const char* buf, uint32 rec, uint32 version)
+{
+    uint32 r, v;
+    memcpy (&r, buf, sizeof (r));
+    memcpy (&v, buf + sizeof (r), sizeof (v));
+    if (r != rec || v != version)
+        ERR ("sliceTest: record header holds wrong data");
+}
+
+static const BufLen HEAD = 8;
+
+static bool sliceTest ()
+{
+    if (splitFileFactory.exists (tdir, tfile))
+        splitFileFactory.erase (tdir, tfile);
+    File& file = splitFileFactory.create (tdir, tfile);
+    Pager& pager = pagerFactory.create (pagesize, poolsize);
+    VLPagedCache& cache = pagedCacheFactory.create (pager, cachesize);
+    cache.chsize (file, SOAK_RECS * SOAK_SPAN);
+
+    std::vector <uint32> versions (SOAK_RECS, 0);
+    uint32 rec;
+    for (rec = 0; rec < SOAK_RECS; rec ++)
+    {
+        FilePos base = rec * SOAK_SPAN;
+        char* buf = (char*) cache.fake (file, base, soakLen (rec));
+        for (BufLen i = 0; i < soakLen (rec); i ++)
+            buf [i] = pattern (base + i);
+        memcpy (buf, &rec, sizeof (rec));
+        memcpy (buf + sizeof (rec), &versions [rec], sizeof (uint32));
+        cache.mark (buf);
+    }
+    cache.commit (file);
+
+    // a piece within a cached record is a pointer into it, and stands for it
+    char* whole = (char*) cache.fetch (file, 0, soakLen (0));
+    char* piece = (char*) cache.fetch (file, 100, 3000);
+    if (piece != whole + 100) ERR ("sliceTest: contained piece not served from the cached buffer");
+    cache.lock (piece);
+    if (!cache.locked (whole)) ERR ("sliceTest: lock through an inner pointer missed the buffer");
+    cache.unlock (piece);
+    // a piece reaching past the record takes it in, dirty data included
+    memcpy (whole + HEAD, "dirty", 5);
+    cache.mark (whole);
+    char* merged = (char*) cache.fetch (file, 2000, SOAK_SPAN - 2000);
+    if (memcmp (merged - 2000 + HEAD, "dirty", 5)) ERR ("sliceTest: merged buffer lost the dirty data");
+    checkSlice (merged, 2000, soakLen (0) - 2000);
+    for (BufLen i = HEAD; i < HEAD + 5; i ++)
+        (merged - 2000) [i] = pattern (i);
+    cache.mark (merged);
+
+    srand (SOAK_RECS);
+    uint64 ops = 0;
+    time_t start = time (NULL);
+    const void* held = NULL;
+    while (time (NULL) - start < (time_t) SLICE_SECONDS)
+    {
+        for (uint32 step = 0; step < 1000; step ++, ops ++)
+        {
+            rec = (uint32) rand () % SOAK_RECS;
+            if (rand () % 10 < 8)
+                rec %= SOAK_RECS / 8;
+            FilePos base = rec * SOAK_SPAN;
+            BufLen len = soakLen (rec);
+            const char* buf;
+            // a whole record is locked now and then: the pieces of it stay within
+            switch (step ? rand () % 3 : 0)
+            {
+                case 0:
+                    buf = (const char*) cache.fetch (file, base, len);
+                    checkHead (buf, rec, versions [rec]);
+                    checkSlice (buf + HEAD, base + HEAD, len - HEAD);
+                    break;
+                case 1:
+                {
+                    BufLen off = HEAD + (BufLen) rand () % (len - HEAD - 16);
+                    BufLen part = 16 + (BufLen) rand () % (len - off - 15);
+                    buf = (const char*) cache.fetch (file, base + off, part);
+                    checkSlice (buf, base + off, part);
+                    break;
+                }
+                default:
+                {
+                    char* head = (char*) cache.fetch (file, base, HEAD);
+                    checkHead (head, rec, versions [rec]);
+                    if (rand () % 2)
+                    {
+                        ++ versions [rec];
+                        memcpy (head + sizeof (rec), &versions [rec], sizeof (uint32));
+                        cache.mark (head);
+                    }
+                    buf = head;
+                }
+            }
+            if (step == 0)
+            {
+                if (held)
+                    cache.unlock (held);
+                cache.lock (buf);
+                held = buf;
+            }
+        }
+    }
+    if (held)
+        cache.unlock (held);
+    std::cerr << "Slices: " << ops / SLICE_SECONDS << " ops/sec" << std::endl;
+    cache.close (file);
+
+    File& rfile = splitFileFactory.open (tdir, tfile);
+    VLPagedCache& rcache = pagedCacheFactory.create (pager, cachesize);
+    for (rec = 0; rec < SOAK_RECS; rec ++)
+    {
+        const char* buf = (const char*) rcache.fetch (rfile, rec * SOAK_SPAN, soakLen (rec));
+        checkHead (buf, rec, versions [rec]);
+        checkSlice (buf + HEAD, rec * SOAK_SPAN + HEAD, soakLen (rec) - HEAD);
+    }
+    rcache.close (rfile);
+    splitFileFactory.erase (tdir, tfile);
+    return true;
+}
+
+// small buffers filling the whole cache, then large ones above the largest slab class mixed with them:
+// the slabs emptied by the evictions make room for the large buffers
+static const uint32 MIXED_CACHE = 0x100000; // 1 Mb
+static const uint32 MIXED_SMALL = 400;
+static const FilePos MIXED_SMALL_SPAN = 0x2000;
+static const BufLen MIXED_SMALL_LEN = 6000;
+static const uint32 MIXED_LARGE = 8;
+static const FilePos MIXED_LARGE_SPAN = 0x40000;
+static const uint32 MIXED_OPS = 20000;
+
+static BufLen mixedLargeLen (uint32 rec)
+{
+    return 0x20000 + (rec * 7919) % 0x20000; // 128 .. 256 Kb
+}
+
+static bool mixedTest ()
+{
+    if (splitFileFactory.exists (tdir, tfile))
+        splitFileFactory.erase (tdir, tfile);
+    File& file = splitFileFactory.create (tdir, tfile);
+    FilePos largeBase = MIXED_SMALL * MIXED_SMALL_SPAN;
+    FilePos total = largeBase + MIXED_LARGE * MIXED_LARGE_SPAN;
+    std::vector <char> data ((size_t) total);
+    for (FilePos pos = 0; pos < total; pos ++)
+        data [(size_t) pos] = pattern (pos);
+    file.write (&data [0], (BufLen) total);
+    Pager& pager = pagerFactory.create (pagesize, MIXED_CACHE / pagesize);
+    VLPagedCache& cache = pagedCacheFactory.create (pager, MIXED_CACHE);
+
+    uint32 rec;
+    for (rec = 0; rec < MIXED_SMALL; rec ++)
+        checkSlice ((const char*) cache.fetch (file, rec * MIXED_SMALL_SPAN + 100, MIXED_SMALL_LEN), rec * MIXED_SMALL_SPAN + 100, MIXED_SMALL_LEN);
+    checkSlice ((const char*) cache.fetch (file, largeBase, mixedLargeLen (0)), largeBase, mixedLargeLen (0));
+
+    srand (MIXED_SMALL);
+    for (uint32 op = 0; op < MIXED_OPS; op ++)
+    {
+        FilePos pos;
+        BufLen len;
+        if (rand () % 5)
+        {
+            rec = (uint32) rand () % MIXED_SMALL;
+            pos = rec * MIXED_SMALL_SPAN + 100;
+            len = MIXED_SMALL_LEN;
+        }
+        else
+        {
+            rec = (uint32) rand () % MIXED_LARGE;
+            pos = largeBase + rec * MIXED_LARGE_SPAN;
+            len = mixedLargeLen (rec);
+        }
+        char* buf = (char*) cache.fetch (file, pos, len);
+        checkSlice (buf, pos, len);
+        // rewritten with the same data, so that the dirty buffers get dumped on eviction
+        if (rand () % 4 == 0)
+        {
+            buf [len / 3] = pattern (pos + len / 3);
+            cache.mark (buf);
+        }
+    }
+    std::cerr << "Mixed: " << MIXED_OPS << " fetches of " << MIXED_SMALL_LEN << " bytes and of 128 to 256 Kb in " << MIXED_CACHE / 1024 << " Kb cache" << std::endl;
+    cache.close (file);
+    splitFileFactory.erase (tdir, tfile);
+    return true;
+}
+
+bool testVLPagedCache ()
+{
+    return sliceTest () && mixedTest () && soakTest ();
+}
+
+};
@@ -0,0 +1,130 @@
+//////////////////////////////////////////////////////////////////////////////
+//// This software module is developed by SciDM (Scientific Data Management) in 1998-2015
+//// 
+//// This program is free software; you can redistribute, reuse,
+//// or modify it with no restriction, under the terms of the MIT License.
+//// 
+//// This program is distributed in the hope that it will be useful,
+//// but WITHOUT ANY WARRANTY; without even the implied warranty of
+//// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//// 
+//// For any questions please contact Denis Kaznadzey at dkaznadzey@yahoo.com
+//////////////////////////////////////////////////////////////////////////////
+
+#include "edbVStorage.h"
+#include "edbExceptions.h"
+
+namespace edb
+{
+
+// reads and writes are split at the multiples of this record offset
+static const BufLen STREAM_CHUNK = 0x100000; // 1 Mb
+
+VRecStream::VRecStream (VStorage& storage, RecLocator locator)
+:
+storage_ (storage),
+locator_ (locator),
+length_ (storage.getRecLen (locator)),
+pos_ (0),
+mapped_ (NULL),
+mappedLen_ (0),
+mappedWrite_ (false)
+{
+}
+
+VRecStream::~VRecStream ()
+{
+    if (mapped_)
+        storage_.unmapRec (mapped_, mappedWrite_);
+}
+
+void VRecStream::seek (RecOff offset)
+{
+    unmap ();
+    if (offset > length_)
+        throw BadParameters ();
+    pos_ = offset;
+}
+
+BufLen VRecStream::read (void* data, BufLen len)
+{
+    unmap ();
+    if (len > length_ - pos_)
+        len = (BufLen) (length_ - pos_);
+    BufLen done = 0;
+    while (done < len)
+    {
+        BufLen chunk = STREAM_CHUNK - (BufLen) (pos_ % STREAM_CHUNK);
+        if (chunk > len - done)
+            chunk = len - done;
+        storage_.readRec (locator_, ((char*) data) + done, chunk, pos_);
+        pos_ += chunk;
+        done += chunk;
+    }
+    return done;
+}
+
+BufLen VRecStream::write (const void* data, BufLen len)
+{
+    unmap ();
+    if (len > length_ - pos_)
+        len = (BufLen) (length_ - pos_);
+    BufLen done = 0;
+    while (done < len)
+    {
+        BufLen chunk = STREAM_CHUNK - (BufLen) (pos_ % STREAM_CHUNK);
+        if (chunk > len - done)
+            chunk = len - done;
+        storage_.writeRec (locator_, ((const char*) data) + done, chunk, pos_);
+        pos_ += chunk;
+        done += chunk;
+    }
+    return done;
+}
+
+void VRecStream::append (const void* data, BufLen len)
+{
+    unmap ();
+    // the last record in the file is extended in place
+    locator_ = storage_.reallocRec (locator_, length_ + len);
+    pos_ = length_;
+    length_ += len;
+    write (data, len);
+}
+
+const void* VRecStream::map (BufLen& len)
+{
+    return map_ (len, false);
+}
+
+void* VRecStream::mapWrite (BufLen& len)
+{
+    return map_ (len, true);
+}
+
+void* VRecStream::map_ (BufLen& len, bool write)
+{
+    unmap ();
+    if (len > length_ - pos_)
+        len = (BufLen) (length_ - pos_);
+    if (!len)
+        return NULL;
+    mapped_ = storage_.mapRec (locator_, pos_, len, write);
+    if (!mapped_)
+        return NULL;
+    mappedLen_ = len;
+    mappedWrite_ = write;
+    return mapped_;
+}
+
+void VRecStream::unmap ()
+{
+    if (!mapped_)
+        return;
+    storage_.unmapRec (mapped_, mappedWrite_);
+    mapped_ = NULL;
+    pos_ += mappedLen_;
+    mappedLen_ = 0;
+}
+
+};
@@ -26,6 +26,25 @@ struct VRecDescriptor
     RecLen length_;
 };
 
+// Receives the locator changes made by VStorage::compact,
+// so that the references to moved records can be updated in the same pass
+class VRecRemap
+{
+public:
+    virtual             ~VRecRemap     () {}
+    virtual void        remap          (RecLocator oldLocator, RecLocator newLocator, RecLen length) = 0;
+};
+
+// Receives the records found by VStorage::scan
+class VRecScan
+{
+public:
+    virtual             ~VRecScan      () {}
+    // called from the scanning threads, possibly at the same time: data [i] points to recs [i].length_ bytes 
+    // of the record, valid until the call returns
+    virtual void        records        (const VRecDescriptor* recs, const void* const* data, uint32 number) = 0;
+};
+
 class VStorage
 {
 public:
@@ -37,9 +56,17 @@ public:
     virtual RecLocator  addRec         (const void* data, RecLen len) = 0;
     virtual RecLocator  reallocRec     (RecLocator locator, RecLen len) = 0;
     virtual bool        readRec        (RecLocator locator, void* data, BufLen len, RecOff offset = 0) = 0;
+    // reads recs [i].length_ bytes from the start of each record into buffers [i]; the records are read 
+    // in the file order, the ones lying close to each other by a single read
+    virtual bool        readRecs       (const VRecDescriptor* recs, uint32 number, void* const* buffers) = 0;
     virtual bool        writeRec       (RecLocator locator, const void* data, BufLen len, RecOff offset = 0) = 0;
     virtual bool        freeRec        (RecLocator locator) = 0;
 	virtual RecLocator  sliceRec       (RecLocator locator, const void* data, BufLen data_len, RecOff offset, RecLen old_data_len, RecLen full_len) = 0;
+    // direct access to the record data in the file cache: pointer to up to len bytes at offset (len is reduced 
+    // to what is contiguous in the cache), or NULL if the storage file is not cached. The mapping must be 
+    // released by unmapRec before any other operation on the storage. See VRecStream
+    virtual void*       mapRec         (RecLocator locator, RecOff offset, BufLen& len, bool write) = 0;
+    virtual void        unmapRec       (const void* data, bool dirty) = 0;
 
     // hinted prefetch 
     virtual void        hintAdd        (VRecDescriptor* descriptors, uint32 number) = 0;
@@ -49,11 +76,18 @@ public:
     virtual RecNum      getRecCount    () const = 0;
     virtual bool        firstRec	   (VRecDescriptor& rec) = 0;
     virtual bool        nextRec	       (VRecDescriptor& rec) = 0;
+    // passes all the records with their data to the receiver, by batches in no particular order. The file is split 
+    // into ranges read by large portions, each by its own thread; no other operation may run on the storage meanwhile
+    virtual void        scan           (VRecScan& receiver, uint32 threads) = 0;
 
     // storage - level operations     
     virtual bool        flush          () = 0;
     virtual bool        close          () = 0;
     virtual bool        isOpen         () const = 0;
+    // slides records toward the file start over the free blocks, at least one and about maxBytes of data per call;
+    // cuts the freed tail from the file. Returns true when no free space is left to compact
+    // (blocks too short for the free lists are only picked up when a compacted region reaches them)
+    virtual bool        compact        (VRecRemap& remap, uint64 maxBytes) = 0;
 
     // statistics
     virtual uint64      usedSpace      () const = 0;
@@ -62,12 +96,44 @@ public:
     virtual uint64      freeCount      () const = 0;
 };
 
+// Sequential access to a single record, for records too large to be read or written by one call.
+// read and write go straight between the caller's buffer and the storage file; map gives the 
+// cached page itself when the storage sits on a CachedFile; append grows the record in place
+// when it is the last one in the file, otherwise the record may be moved (see locator ())
+class VRecStream
+{
+public:
+                VRecStream     (VStorage& storage, RecLocator locator);
+                ~VRecStream    ();
+    RecLocator  locator        () const { return locator_; }
+    RecLen      length         () const { return length_; }
+    RecOff      tell           () const { return pos_; }
+    void        seek           (RecOff offset);
+    BufLen      read           (void* data, BufLen len); // reads up to len bytes at current position, returns number of bytes read
+    BufLen      write          (const void* data, BufLen len); // overwrites up to len bytes at current position, returns number of bytes written
+    void        append         (const void* data, BufLen len); // extends the record by len bytes of data, positions after them
+    const void* map            (BufLen& len); // maps up to len bytes at current position for reading, NULL if not cached
+    void*       mapWrite       (BufLen& len); // maps up to len bytes at current position for writing, NULL if not cached
+    void        unmap          (); // releases the mapping, advancing position past the mapped bytes
+private:
+    void*       map_           (BufLen& len, bool write);
+    VStorage&   storage_;
+    RecLocator  locator_;
+    RecLen      length_;
+    RecOff      pos_;
+    void*       mapped_;
+    BufLen      mappedLen_;
+    bool        mappedWrite_;
+};
+
 class VStorageFactory
 {
 public:
     virtual             ~VStorageFactory () {}
     virtual VStorage&   wrap           (File& file) = 0;
-    virtual VStorage&   init           (File& file) = 0;
+    // compressed: records are kept LZ4-packed by frames of 64 Kb, see CompressedVStorage_imp; 
+    // wrap recognizes such files by their signature
+    virtual VStorage&   init           (File& file, bool compressed = false) = 0;
     virtual bool        validate       (File& file) = 0;
 };
 
@@ -14,6 +14,10 @@
 #define VStorageFactory_defined
 #include "edbVStorage_imp.h"
 #include "edbExceptions.h"
+#include "edbStats.h"
+#include "edbSplitFile_imp.h"
+#include "edbCompressedVStorage_imp.h"
+#include <algorithm>
 
 namespace edb
 {
@@ -24,18 +28,55 @@ VStorageFactory& vStorageFactory = theFactory;
 
 //#define SMALL_LADDER
 #ifndef SMALL_LADDER
-static uint64 DEF_BANDBOUNDS [] = {0x10000000, 0x4000000, 0x1000000, 0x400000, 0x100000, 0x40000, 0x10000, 0x4000}; // 256 Mb, 64Mb, 16Mb, 4Mb, 1Mb, 256Kb, 64Kb, 16Kb
+// Segregated-fit ladder: BAND_STEPS size classes per power of two, 
+// from 256 Mb down to the smallest free block (sizeof (FreePos)), so that every free block is tracked
+static const uint64 BAND_TOP = 0x10000000;
+static const uint64 BAND_BOTTOM = 0x10;
+static const uint32 BAND_STEPS = 4;
+
+static std::vector <uint64> def_ladder_ ()
+{
+    std::vector <uint64> bounds;
+    for (uint64 pow2 = BAND_TOP; pow2 >= BAND_BOTTOM; pow2 >>= 1)
+        for (uint32 step = BAND_STEPS; step > 0; step --)
+        {
+            uint64 bound = pow2 + ((pow2 / BAND_STEPS) * (step - 1));
+            if (bound <= BAND_TOP)
+                bounds.push_back (bound);
+        }
+    return bounds;
+}
+static std::vector <uint64> DEF_LADDER = def_ladder_ ();
 #else
 static uint64 DEF_BANDBOUNDS [] = {0x100, 0x80, 0x40}; // 256 bytes. 128 bytes , 64 bytes
-#endif
 static uint32 DEF_BANDNO = (sizeof (DEF_BANDBOUNDS)/sizeof (uint64));
+#endif
+
+// number of slots in the block header cache, power of 2. Live block headers are at least 
+// sizeof (BlockHdr) apart, so the slot is picked by locator / META_CACHE_GRAIN
+static const uint32 META_CACHE_SLOTS = 0x10000;
+static const uint32 META_CACHE_GRAIN = 16;
+
+// scan () reads the file by portions of this size, passes the records to the receiver by batches of up to SCAN_BATCH
+static const BufLen SCAN_PORTION = 0x400000;
+static const uint32 SCAN_BATCH = 256;
+
+// readRecs () joins into one read the blocks lying up to READ_GAP bytes apart (a page read over costs less than 
+// another call to the file), as long as the read stays within READ_SPAN; longer records are read alone, straight 
+// into the caller's buffer
+static const BufLen READ_GAP = 0x1000;
+static const BufLen READ_SPAN = 0x100000;
 
 
 
 VStorage_imp::VStorage_imp (File& file)
 :
 file_ (file),
-bands_ (NULL)
+cached_ (dynamic_cast <CachedFile*> (&file)),
+split_ (dynamic_cast <SplitFile_imp*> (&file)),
+bands_ (NULL),
+compact_hole_ (RECLOCATOR_MAX),
+packed_ (false)
 {
 }
 
@@ -58,11 +99,17 @@ inline RecLen VStorage_imp::datalen_ (VStorage_imp::BlockHdr& blockhdr, RecLocat
 
 uint32 VStorage_imp::calc_band_ (RecLen reclen)
 {
-    uint32 bidx;
-    for (bidx = 0; bidx < hdr_.band_count_; bidx ++)
-        if (reclen >= bands_ [bidx].minsize_)
-            break;
-    return bidx;
+    // bands are in decreasing order of minsize_: find the first one not exceeding reclen
+    uint32 lo = 0, hi = hdr_.band_count_;
+    while (lo < hi)
+    {
+        uint32 mid = (lo + hi) >> 1;
+        if (reclen >= bands_ [mid].minsize_)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
 }
 
 void VStorage_imp::read_bhdr_ (VStorage_imp::BlockHdr& blockhdr, RecLocator locator)
@@ -71,6 +118,12 @@ void VStorage_imp::read_bhdr_ (VStorage_imp::BlockHdr& blockhdr, RecLocator loca
     if ((locator > hdr_.last_off_) || (locator < firstoff_ ()))
         ERR("read_bhdr_: wrong locator passed");
 #endif
+    MetaEntry& entry = meta_entry_ (locator);
+    if (entry.hdr_state_ != META_NONE)
+    {
+        blockhdr = entry.hdr_;
+        return;
+    }
     // seek to locator
     FilePos seekpos = file_.seek (locator);
     if (seekpos != locator) 
@@ -82,6 +135,8 @@ void VStorage_imp::read_bhdr_ (VStorage_imp::BlockHdr& blockhdr, RecLocator loca
     // check weather it has proper signature
     if (memcmp (blockhdr.sign_, BlockSignature, sizeof (BlockSignature)))
         throw BadLocator ();
+    entry.hdr_ = blockhdr;
+    entry.hdr_state_ = META_CLEAN;
 }
 
 void VStorage_imp::write_bhdr_ (VStorage_imp::BlockHdr& blockhdr, RecLocator locator)
@@ -93,14 +148,14 @@ void VStorage_imp::write_bhdr_ (VStorage_imp::BlockHdr& blockhdr, RecLocator loc
     if (memcmp (blockhdr.sign_, BlockSignature, sizeof (BlockSignature)))
         throw BadParameters ();
 #endif
-    // seek to locator
-    FilePos seekpos = file_.seek (locator);
-    if (seekpos != locator) 
-        throw BadLocator ();
-    // read block header
-    BufLen wrlen = file_.write (&blockhdr, sizeof (blockhdr));
-    if (wrlen != sizeof (blockhdr))
-        throw BadLocator ();
+    // the file is updated on write-back
+    meta_drop_ (locator, locator + sizeof (BlockHdr));
+    MetaEntry& entry = meta_entry_ (locator);
+    entry.hdr_ = blockhdr;
+    entry.hdr_state_ = META_DIRTY;
+    // except for the sentinel: the file always extends to it, so that all record data is within the file
+    if (blockhdr.next_ == RECLOCATOR_MAX)
+        meta_store_ (entry);
 }
 
 void VStorage_imp::read_freepos_ (VStorage_imp::FreePos& freepos, RecLocator locator)
@@ -109,10 +164,18 @@ void VStorage_imp::read_freepos_ (VStorage_imp::FreePos& freepos, RecLocator loc
     if ((locator > hdr_.last_off_) || (locator < firstoff_ ()))
         throw BadParameters ();
 #endif
+    MetaEntry& entry = meta_entry_ (locator);
+    if (entry.fp_state_ != META_NONE)
+    {
+        freepos = entry.fp_;
+        return;
+    }
     if (file_.seek (locator + sizeof (BlockHdr)) != locator + sizeof (BlockHdr))
         throw BadParameters ();
     if (file_.read (&freepos, sizeof (freepos)) != sizeof (freepos))
         throw BadParameters ();
+    entry.fp_ = freepos;
+    entry.fp_state_ = META_CLEAN;
 }
 
 void VStorage_imp::write_freepos_ (VStorage_imp::FreePos& freepos, RecLocator locator)
@@ -121,10 +184,90 @@ void VStorage_imp::write_freepos_ (VStorage_imp::FreePos& freepos, RecLocator lo
     if ((locator > hdr_.last_off_) || (locator < firstoff_ ()))
         throw BadParameters ();
 #endif
-    if (file_.seek (locator + sizeof (BlockHdr)) != locator + sizeof (BlockHdr))
-        throw BadParameters ();
-    if (file_.write (&freepos, sizeof (freepos)) != sizeof (freepos))
-        throw BadParameters ();
+    // the file is updated on write-back
+    meta_drop_ (locator + sizeof (BlockHdr), locator + sizeof (BlockHdr) + sizeof (FreePos));
+    MetaEntry& entry = meta_entry_ (locator);
+    entry.fp_ = freepos;
+    entry.fp_state_ = META_DIRTY;
+}
+
+VStorage_imp::MetaEntry& VStorage_imp::meta_entry_ (RecLocator locator)
+{
+    MetaEntry& entry = meta_ [(locator / META_CACHE_GRAIN) & (META_CACHE_SLOTS - 1)];
+    if (entry.locator_ != locator)
+    {
+        meta_store_ (entry);
+        entry.locator_ = locator;
+        entry.hdr_state_ = META_NONE;
+        entry.fp_state_ = META_NONE;
+    }
+    return entry;
+}
+
+void VStorage_imp::meta_store_ (MetaEntry& entry)
+{
+    RecLocator locator = entry.locator_;
+    // blocks past the sentinel are gone; the file is cut there on close
+    if (locator == RECLOCATOR_MAX || locator > hdr_.last_off_)
+        return;
+    if (entry.hdr_state_ == META_DIRTY)
+    {
+        if (file_.seek (locator) != locator) 
+            throw BadLocator ();
+        if (file_.write (&entry.hdr_, sizeof (entry.hdr_)) != sizeof (entry.hdr_))
+            throw BadLocator ();
+        entry.hdr_state_ = META_CLEAN;
+    }
+    if (entry.fp_state_ == META_DIRTY)
+    {
+        if (file_.seek (locator + sizeof (BlockHdr)) != locator + sizeof (BlockHdr))
+            throw BadParameters ();
+        if (file_.write (&entry.fp_, sizeof (entry.fp_)) != sizeof (entry.fp_))
+            throw BadParameters ();
+        entry.fp_state_ = META_CLEAN;
+    }
+}
+
+void VStorage_imp::meta_writeback_ ()
+{
+    for (MetaCache::iterator itr = meta_.begin (); itr != meta_.end (); itr ++)
+        meta_store_ (*itr);
+}
+
+void VStorage_imp::meta_reset_ ()
+{
+    meta_.assign (META_CACHE_SLOTS, MetaEntry ());
+}
+
+void VStorage_imp::meta_drop_ (FilePos start, FilePos end)
+{
+    // the written range is not overlapped by any live block header or free list link, 
+    // so the cached ones that overlap it are left over from former blocks
+    if (start >= end)
+        return;
+    FilePos from = (start > sizeof (BlockHdr) + sizeof (FreePos)) ? (start - sizeof (BlockHdr) - sizeof (FreePos) + 1) : 0;
+    uint64 slotno = (end - 1) / META_CACHE_GRAIN - from / META_CACHE_GRAIN + 1;
+    if (slotno > META_CACHE_SLOTS) 
+        slotno = META_CACHE_SLOTS;
+    for (uint64 slot = from / META_CACHE_GRAIN; slotno; slot ++, slotno --)
+    {
+        MetaEntry& entry = meta_ [slot & (META_CACHE_SLOTS - 1)];
+        if (entry.locator_ < from || entry.locator_ >= end)
+            continue;
+        FilePos fpStart = entry.locator_ + sizeof (BlockHdr);
+        if (fpStart > start)
+            entry.hdr_state_ = META_NONE;
+        if (fpStart < end && fpStart + sizeof (FreePos) > start)
+            entry.fp_state_ = META_NONE;
+    }
+}
+
+const VStorage_imp::BlockHdr* VStorage_imp::meta_hdr_ (RecLocator locator) const
+{
+    const MetaEntry& entry = meta_ [(locator / META_CACHE_GRAIN) & (META_CACHE_SLOTS - 1)];
+    if (entry.locator_ != locator || entry.hdr_state_ == META_NONE)
+        return NULL;
+    return &entry.hdr_;
 }
 
 void VStorage_imp::move_freepos_ (VStorage_imp::FreePos& freepos, uint32 bandno, RecLocator newPlace)
@@ -182,11 +325,11 @@ void VStorage_imp::free_remove_ (RecLocator locator, uint32 bandno, RecLen space
     read_freepos_ (freepos, locator);
 
     // removeRec
-    free_removeRec_ (freepos, bandno, space);
+    free_removeRec_ (locator, freepos, bandno, space);
 
 }
 
-void VStorage_imp::free_removeRec_ (VStorage_imp::FreePos& freepos, uint32 bandno, RecLen space)
+void VStorage_imp::free_removeRec_ (RecLocator locator, VStorage_imp::FreePos& freepos, uint32 bandno, RecLen space)
 {
 #ifdef VSTORAGE_IMP_DEBUG
     if (bandno >= hdr_.band_count_)
@@ -227,7 +370,7 @@ void VStorage_imp::free_removeRec_ (VStorage_imp::FreePos& freepos, uint32 bandn
     if (bands_ [bandno].count_ == 0 && bands_[bandno].space_ != 0) 
         ERR("!");
 #endif
-
+    index_remove_ (locator, bandno, space);
 
     hdr_.free_count_ --;
     hdr_.free_space_ -= space;
@@ -273,11 +416,56 @@ void VStorage_imp::free_add_ (RecLocator locator, uint32 bandno, RecLen space)
         }
         bands_ [bandno].count_ ++;
         bands_ [bandno].space_ += space;
+        index_add_ (locator, bandno, space);
     }
     hdr_.free_count_ ++;
     hdr_.free_space_ += space;
 }
 
+void VStorage_imp::index_add_ (RecLocator locator, uint32 bandno, RecLen space)
+{
+    if (bandno < hdr_.band_count_)
+        free_index_ [bandno].insert (FreeExtent (space, locator));
+}
+
+void VStorage_imp::index_remove_ (RecLocator locator, uint32 bandno, RecLen space)
+{
+    if (locator == compact_hole_)
+        compact_hole_ = RECLOCATOR_MAX;
+    if (bandno < hdr_.band_count_)
+    {
+#ifdef VSTORAGE_IMP_DEBUG
+        if (!free_index_ [bandno].erase (FreeExtent (space, locator)))
+            ERR("index_remove_: block is not in the free index");
+#else
+        free_index_ [bandno].erase (FreeExtent (space, locator));
+#endif
+    }
+}
+
+void VStorage_imp::index_rebuild_ ()
+{
+    free_index_.clear ();
+    free_index_.resize (hdr_.band_count_);
+    for (uint32 bidx = 0; bidx < hdr_.band_count_; bidx ++)
+    {
+        RecLocator locator = bands_ [bidx].first_;
+        while (locator != RECLOCATOR_MAX)
+        {
+            BlockHdr block;
+            read_bhdr_ (block, locator);
+            if (block.free_ != FREEFLAG)
+                throw FileStructureCorrupt ();
+            free_index_ [bidx].insert (FreeExtent (datalen_ (block, locator), locator));
+            FreePos freepos;
+            read_freepos_ (freepos, locator);
+            locator = freepos.nextfree_;
+        }
+        if (free_index_ [bidx].size () != bands_ [bidx].count_)
+            throw FileStructureCorrupt ();
+    }
+}
+
 
 void VStorage_imp::join_bhdrs_ (RecLocator loc, BlockHdr& block, RecLocator nextLoc, BlockHdr& nextBlock)
 {
@@ -335,7 +523,7 @@ void VStorage_imp::split_free_ (RecLocator locator, BlockHdr& block, RecLen len)
         if (splitBand != oldBand) // if band changed
         {
             // remove block from freelist
-            free_removeRec_ (oldFreePos, oldBand, oldLen);
+            free_removeRec_ (locator, oldFreePos, oldBand, oldLen);
             // add splitBlock to freelist
             free_add_ (splitLocator, splitBand, splitLen);
         }
@@ -343,6 +531,8 @@ void VStorage_imp::split_free_ (RecLocator locator, BlockHdr& block, RecLen len)
         {
             // 'reuse' the freepos - write it to the new (split) position
             move_freepos_ (oldFreePos, oldBand, splitLocator);
+            index_remove_ (locator, oldBand, oldLen);
+            index_add_ (splitLocator, oldBand, splitLen);
 
             // adjust global info
             bands_[oldBand].space_ -= oldLen;
@@ -490,6 +680,7 @@ void VStorage_imp::resize_mid_ (RecLocator locator, VStorage_imp::BlockHdr& bloc
     RecLen oldLen = datalen_ (block, locator);
 
     // remember next block's FreePos
+    RecLocator nextLocator = block.next_;
     RecLen nextLen = datalen_ (nextBlock, block.next_);
     uint32 nextBand = calc_band_ (nextLen);
     FreePos nextFreePos;
@@ -519,7 +710,7 @@ void VStorage_imp::resize_mid_ (RecLocator locator, VStorage_imp::BlockHdr& bloc
     if (nextBand != newNextBand)
     {
         if (nextBand != hdr_.band_count_)
-            free_removeRec_ (nextFreePos, nextBand, nextLen);
+            free_removeRec_ (nextLocator, nextFreePos, nextBand, nextLen);
         else
         {
             hdr_.free_count_ --;
@@ -533,6 +724,8 @@ void VStorage_imp::resize_mid_ (RecLocator locator, VStorage_imp::BlockHdr& bloc
         {
             // change the prevfree and nextfree references to next block; save nextFreePos into the next block
             move_freepos_ (nextFreePos, nextBand, newNextLocator);
+            index_remove_ (nextLocator, nextBand, nextLen);
+            index_add_ (newNextLocator, nextBand, newNextLen);
             // update statistics
             bands_ [nextBand].space_ -= nextLen;
             bands_ [nextBand].space_ += newNextLen;
@@ -544,13 +737,18 @@ void VStorage_imp::resize_mid_ (RecLocator locator, VStorage_imp::BlockHdr& bloc
     hdr_.used_space_ += newLen;
 }
 
-void VStorage_imp::init_ (const uint64* bandbounds, uint32 bandno)
+void VStorage_imp::init_ (const uint64* bandbounds, uint32 bandno, bool packed)
 {
     // set default parameters if needed
     if (!bandbounds || !bandno)
     {
+#ifndef SMALL_LADDER
+        bandno = DEF_LADDER.size ();
+        bandbounds = &DEF_LADDER.front ();
+#else
         bandno = DEF_BANDNO;
         bandbounds = DEF_BANDBOUNDS;
+#endif
     }
 
 #ifdef VSTORAGE_IMP_DEBUG
@@ -572,8 +770,11 @@ void VStorage_imp::init_ (const uint64* bandbounds, uint32 bandno)
     bands_ = new Band [hdr_.band_count_];
     for (uint32 bidx = 0; bidx < hdr_.band_count_; bidx ++)
         bands_ [bidx].minsize_ = bandbounds [bidx];
+    free_index_.clear ();
+    free_index_.resize (hdr_.band_count_);
 
-    memcpy (hdr_.sign_, FileSignature, sizeof (FileSignature));
+    packed_ = packed;
+    memcpy (hdr_.sign_, packed_ ? PackedSignature : FileSignature, sizeof (FileSignature));
     hdr_.last_off_ = firstoff_ ();
     hdr_.used_count_ = 0L;
     hdr_.free_count_ = 0L;
@@ -581,6 +782,8 @@ void VStorage_imp::init_ (const uint64* bandbounds, uint32 bandno)
     hdr_.free_space_ = 0L;
 
     // shrink the file
+    meta_reset_ ();
+    compact_hole_ = RECLOCATOR_MAX;
     file_.chsize (0);
 
     // write header
@@ -595,13 +798,16 @@ void VStorage_imp::init_ (const uint64* bandbounds, uint32 bandno)
 void VStorage_imp::open_ ()
 {
     // clean header
+    meta_reset_ ();
+    compact_hole_ = RECLOCATOR_MAX;
     hdr_.clean_ ();
     // position at the beginning
     file_.seek (0L);
     // read signature
     file_.read (&hdr_, sizeof (hdr_));
     // check signature
-    if (memcmp (hdr_.sign_, FileSignature, sizeof (FileSignature)))
+    packed_ = !memcmp (hdr_.sign_, PackedSignature, sizeof (PackedSignature));
+    if (!packed_ && memcmp (hdr_.sign_, FileSignature, sizeof (FileSignature)))
         throw WrongFileType ();
     // read last_off_
     if (bands_) delete [] bands_;
@@ -609,14 +815,22 @@ void VStorage_imp::open_ ()
     // read bands
     if (file_.read (bands_, sizeof (Band)*hdr_.band_count_) != sizeof (Band)*hdr_.band_count_)
         throw FileStructureCorrupt ();
+    // load free blocks into memory index
+    index_rebuild_ ();
 }
 
 bool VStorage_imp::isValid (RecLocator locator)
 {
     // read the record header
     BlockHdr blockhdr;
-    file_.seek (locator);
-    file_.read (&blockhdr, sizeof (blockhdr));
+    MetaEntry& entry = meta_ [(locator / META_CACHE_GRAIN) & (META_CACHE_SLOTS - 1)];
+    if (entry.locator_ == locator && entry.hdr_state_ != META_NONE)
+        blockhdr = entry.hdr_;
+    else
+    {
+        file_.seek (locator);
+        file_.read (&blockhdr, sizeof (blockhdr));
+    }
     // check weather it has proper signature
     if (memcmp (blockhdr.sign_, BlockSignature, sizeof (BlockSignature)))
         return false;
@@ -628,18 +842,28 @@ bool VStorage_imp::isValid (RecLocator locator)
 
 RecLocator VStorage_imp::allocRec (RecLen len)
 {
-    // find largest non-empty band
-    uint32 bandidx = 0;
-    while ((bandidx < hdr_.band_count_) && !bands_ [bandidx].count_) bandidx ++;
-    // check weather this band is large enough
-    if ((bandidx && len >= bands_ [bandidx - 1].minsize_ ) || (bandidx == hdr_.band_count_))
-        return alloc_at_end_ (len);
-    else
-        return alloc_at_band_ (len, bandidx);
+    EDB_STAT_RECORD (STAT_VSTORAGE_ALLOC_BYTES, len);
+    // best fit within the own size class, then the smallest block of the nearest larger non-empty class
+    uint32 bandidx = calc_band_ (len);
+    if (bandidx < hdr_.band_count_)
+    {
+        FreeSet::iterator itr = free_index_ [bandidx].lower_bound (FreeExtent (len, 0));
+        if (itr != free_index_ [bandidx].end ())
+            return alloc_at_free_ (len, itr->second);
+    }
+    while (bandidx)
+    {
+        bandidx --;
+        if (!free_index_ [bandidx].empty ())
+            return alloc_at_free_ (len, free_index_ [bandidx].begin ()->second);
+    }
+    // nothing fits - allocate at the end
+    return alloc_at_end_ (len);
 }
 
 RecLocator VStorage_imp::alloc_at_end_ (RecLen len)
 {
+    EDB_STAT_ADD (STAT_VSTORAGE_ALLOC_END, 1);
     // read the sentinel block
     BlockHdr oldSentinel;
     RecLocator oldSentinelLocator = hdr_.last_off_;
@@ -669,27 +893,26 @@ RecLocator VStorage_imp::alloc_at_end_ (RecLen len)
     return oldSentinelLocator;
 }
 
-RecLocator VStorage_imp::alloc_at_band_ (RecLen len, uint32 bandno)
+RecLocator VStorage_imp::alloc_at_free_ (RecLen len, RecLocator locator)
 {
+    EDB_STAT_ADD (STAT_VSTORAGE_ALLOC_FREE, 1);
+    // load the free block
+    BlockHdr block;
+    read_bhdr_ (block, locator);
+    RecLen blockLen = datalen_ (block, locator);
+
 #ifdef VSTORAGE_IMP_DEBUG
-    if (bands_ [bandno].first_ == RECLOCATOR_MAX)
-        ERR("alloc_at_band_: allocating from empty band");
+    if (block.free_ != FREEFLAG)
+        ERR("alloc_at_free_: allocating from used block");
+    if (len > blockLen)
+        ERR("alloc_at_free_: free block is too short");
 #endif
-    // load the first block from band
-    BlockHdr firstBlock;
-    RecLocator firstLocator = bands_ [bandno].first_;
-    read_bhdr_ (firstBlock, firstLocator);
-
-    // check whether fits
-    RecLen firstLen = datalen_ (firstBlock, firstLocator);
-    if (len > firstLen) // if not, call alloc_at_end
-        return alloc_at_end_ (len);
-    else if ((len <= firstLen) && (len + sizeof (BlockHdr) + sizeof (FreePos) > firstLen)) // reuse
-        reuse_block_ (firstLocator, firstBlock);
+    if (len + sizeof (BlockHdr) + sizeof (FreePos) > blockLen) // no space for the remainder - reuse
+        reuse_block_ (locator, block);
     else
-        split_free_ (firstLocator, firstBlock, len); 
+        split_free_ (locator, block, len); 
 
-    return firstLocator;
+    return locator;
 }
 
 bool VStorage_imp::firstRec_ (VRec_impDescriptor& rec)
@@ -794,6 +1017,34 @@ RecLocator VStorage_imp::reallocRec (RecLocator locator, RecLen newLen)
 		return locator;
 }
 
+bool VStorage_imp::extendRec_ (RecLocator locator, RecLen newLen)
+{
+    BlockHdr block;
+    read_bhdr_ (block, locator);
+    RecLen oldLen = datalen_ (block, locator);
+    if (newLen <= oldLen)
+        return true;
+    BlockHdr nextBlock;
+    read_bhdr_ (nextBlock, block.next_);
+    // last block grows into the file end
+    if (nextBlock.next_ == RECLOCATOR_MAX)
+    {
+        resize_last_ (locator, block, nextBlock, newLen);
+        return true;
+    }
+    if (nextBlock.free_ != FREEFLAG)
+        return false;
+    // followed by free block: take its space, whole or in part
+    RecLen unitedSpace = datalen_ (nextBlock, block.next_) + oldLen + sizeof (BlockHdr);
+    if (newLen > unitedSpace)
+        return false;
+    if (newLen + sizeof (BlockHdr) + sizeof (FreePos) > unitedSpace)
+        join_blocks_ (locator, block, nextBlock);
+    else
+        resize_mid_ (locator, block, nextBlock, newLen);
+    return true;
+}
+
 void VStorage_imp::move_rec_ (RecLocator destLoc, VStorage_imp::BlockHdr& srcBlock, RecLocator srcLoc)
 {
     BlockHdr destBlock;
@@ -811,6 +1062,10 @@ void VStorage_imp::move_rec_ (RecLocator destLoc, VStorage_imp::BlockHdr& srcBlo
 #define TRANSFER_SZ 0x20000  
 void VStorage_imp::move_data_ (FilePos srcStart, FilePos srcEnd, FilePos destStart)
 {
+    meta_drop_ (destStart, destStart + (srcEnd - srcStart));
+    // let the OS copy large ranges
+    if (split_ && srcEnd - srcStart >= TRANSFER_SZ && split_->copy (srcStart, destStart, srcEnd - srcStart))
+        return;
     char transfer_buf [TRANSFER_SZ];
 	if (srcStart > destStart)
 	{
@@ -862,6 +1117,75 @@ bool VStorage_imp::readRec (RecLocator locator, void* data, BufLen len, RecOff o
     return true;
 }
 
+// orders the record indexes by locator
+struct ByLocator
+{
+    ByLocator (const VRecDescriptor* recs) : recs_ (recs) {}
+    bool operator () (uint32 i1, uint32 i2) const { return recs_ [i1].locator_ < recs_ [i2].locator_; }
+    const VRecDescriptor* recs_;
+};
+
+bool VStorage_imp::readRecs (const VRecDescriptor* recs, uint32 number, void* const* buffers)
+{
+    std::vector <uint32> order (number);
+    for (uint32 ridx = 0; ridx < number; ridx ++)
+        order [ridx] = ridx;
+    std::sort (order.begin (), order.end (), ByLocator (recs));
+    std::vector <char> buf;
+    uint32 pos = 0;
+    while (pos < number)
+    {
+        const VRecDescriptor& first = recs [order [pos]];
+        if (first.locator_ < firstoff_ () || first.locator_ >= hdr_.last_off_)
+            throw BadLocator ();
+        if (sizeof (BlockHdr) + first.length_ > READ_SPAN)
+        {
+            readRec (first.locator_, buffers [order [pos]], (BufLen) first.length_);
+            pos ++;
+            continue;
+        }
+        // the run of records fitting into one read
+        FilePos start = first.locator_;
+        FilePos end = start + sizeof (BlockHdr) + first.length_;
+        uint32 last = pos + 1;
+        for (; last < number; last ++)
+        {
+            const VRecDescriptor& rec = recs [order [last]];
+            FilePos recEnd = rec.locator_ + sizeof (BlockHdr) + rec.length_;
+            if (rec.locator_ > end + READ_GAP || max_ (end, recEnd) - start > READ_SPAN || rec.locator_ >= hdr_.last_off_)
+                break;
+            if (recEnd > end)
+                end = recEnd;
+        }
+        buf.resize ((size_t) (end - start));
+        if (file_.seek (start) != start)
+            throw BadLocator ();
+        BufLen got = file_.read (&buf [0], (BufLen) (end - start));
+        // headers come from the buffer unless changed in the header cache
+        for (; pos < last; pos ++)
+        {
+            const VRecDescriptor& rec = recs [order [pos]];
+            BufLen off = (BufLen) (rec.locator_ - start);
+            if (off + sizeof (BlockHdr) > got)
+                throw BadLocator ();
+            BlockHdr block;
+            const BlockHdr* cached = meta_hdr_ (rec.locator_);
+            if (cached)
+                block = *cached;
+            else
+                memcpy (&block, &buf [off], sizeof (block));
+            if (memcmp (block.sign_, BlockSignature, sizeof (BlockSignature)))
+                throw BadLocator ();
+            if (block.free_ == FREEFLAG)
+                throw FreeBlockUsed ();
+            if (rec.length_ > datalen_ (block, rec.locator_) || off + sizeof (BlockHdr) + rec.length_ > got)
+                throw BadParameters ();
+            memcpy (buffers [order [pos]], &buf [off + sizeof (BlockHdr)], (size_t) rec.length_);
+        }
+    }
+    return true;
+}
+
 bool VStorage_imp::writeRec (RecLocator locator, const void* data, BufLen len, RecOff offset)
 {
     // read header; this (usually) fetches first portion of record in cache
@@ -874,6 +1198,7 @@ bool VStorage_imp::writeRec (RecLocator locator, const void* data, BufLen len, R
     if (offset + len > datalen_ (blockhdr, locator))
         throw BadParameters ();
     // seek and write
+    meta_drop_ (locator + sizeof (BlockHdr) + offset, locator + sizeof (BlockHdr) + offset + len);
     FilePos seekpos = file_.seek (locator + sizeof (BlockHdr) + offset);
     if (seekpos != locator + sizeof (BlockHdr) + offset)
         throw BadParameters ();
@@ -935,6 +1260,8 @@ bool VStorage_imp::freeRec (RecLocator locator)
             {
                 bands_[old_band].space_ -= oldlen;
                 bands_[old_band].space_ += newlen;
+                index_remove_ (prevLocator, old_band, oldlen);
+                index_add_ (prevLocator, old_band, newlen);
             }
             hdr_.free_space_ += (newlen - oldlen);
         }
@@ -1026,6 +1353,8 @@ bool VStorage_imp::freeRec (RecLocator locator)
                 {
                     bands_[prev_band].space_ += newlen;
                     bands_[prev_band].space_ -= prevlen;
+                    index_remove_ (prevLocator, prev_band, prevlen);
+                    index_add_ (prevLocator, prev_band, newlen);
                 }
                 hdr_.free_space_ += newlen;
                 hdr_.free_space_ -= prevlen;
@@ -1084,6 +1413,7 @@ void VStorage_imp::move_and_fill_ (RecLocator src_locator, RecLocator dest_locat
 	// fill in the data if any
 	if (data_len)
 	{
+		meta_drop_ (dest_locator + sizeof (BlockHdr) + offset, dest_locator + sizeof (BlockHdr) + offset + data_len);
 		FilePos seekpos = file_.seek (dest_locator + sizeof (BlockHdr) + offset);
 		if (seekpos != dest_locator + sizeof (BlockHdr) + offset) throw BadParameters ();
 		BufLen wrsize = file_.write (data, data_len);
@@ -1188,6 +1518,29 @@ RecLocator VStorage_imp::sliceRec (RecLocator locator, const void* data, BufLen
 }
 
 
+void* VStorage_imp::mapRec (RecLocator locator, RecOff offset, BufLen& len, bool write)
+{
+    if (!cached_)
+        return NULL;
+    BlockHdr blockhdr;
+    read_bhdr_ (blockhdr, locator);
+    if (blockhdr.free_ == FREEFLAG)
+        throw FreeBlockUsed ();
+    if (offset + len > datalen_ (blockhdr, locator))
+        throw BadParameters ();
+    FilePos pos = locator + sizeof (BlockHdr) + offset;
+    void* data = cached_->pin (pos, len);
+    if (data && write)
+        meta_drop_ (pos, pos + len);
+    return data;
+}
+
+void VStorage_imp::unmapRec (const void* data, bool dirty)
+{
+    if (cached_)
+        cached_->unpin (data, dirty);
+}
+
 void VStorage_imp::hintAdd (VRecDescriptor* descriptors, uint32 number)
 {
 }
@@ -1229,11 +1582,191 @@ bool VStorage_imp::nextRec (VRecDescriptor& rec)
     return true;
 }
 
+void VStorage_imp::scan (VRecScan& receiver, uint32 threads)
+{
+    // block headers are taken from the file
+    meta_writeback_ ();
+    ScanState state (receiver);
+    if (SplitFile_imp::positional ())
+    {
+        // the threads read the segments at their own offsets; under the cache, once it has written its dirty pages out
+        state.direct_ = split_;
+        if (!state.direct_ && cached_)
+        {
+            state.direct_ = dynamic_cast <SplitFile_imp*> (&cached_->file ());
+            if (state.direct_ && !cached_->commit ())
+                throw WriteError ();
+        }
+    }
+    RecLocator start = firstoff_ ();
+    uint64 span = hdr_.last_off_ - start;
+    // a portion per thread at least
+    uint64 maxThreads = span / SCAN_PORTION + 1;
+    if (threads > maxThreads)
+        threads = (uint32) maxThreads;
+    if (!threads)
+        threads = 1;
+    // A range may start only on a block known to be real, not on a header faked inside a record's data: on the free
+    // blocks of the index. Each share of the file but the first starts its range on the first free block within it;
+    // a share with no free block is joined to the range before.
+    std::vector <RecLocator> shares (threads), starts (threads, RECLOCATOR_MAX);
+    uint32 tidx;
+    for (tidx = 0; tidx < threads; tidx ++)
+        shares [tidx] = start + span * tidx / threads;
+    starts [0] = start;
+    if (threads > 1)
+        for (std::vector <FreeSet>::iterator band = free_index_.begin (); band != free_index_.end (); band ++)
+            for (FreeSet::iterator itr = band->begin (); itr != band->end (); itr ++)
+            {
+                RecLocator locator = itr->second;
+                size_t share = std::upper_bound (shares.begin (), shares.end (), locator) - shares.begin () - 1;
+                if (share && locator < starts [share])
+                    starts [share] = locator;
+            }
+    starts.erase (std::remove (starts.begin (), starts.end (), RECLOCATOR_MAX), starts.end ());
+    threads = (uint32) starts.size ();
+    ScanRange* ranges = new ScanRange [threads];
+    Thread* workers = new Thread [threads];
+    for (tidx = 0; tidx < threads; tidx ++)
+    {
+        ranges [tidx].storage_ = this;
+        ranges [tidx].state_ = &state;
+        ranges [tidx].from_ = starts [tidx];
+        ranges [tidx].to_ = (tidx + 1 < threads) ? starts [tidx + 1] : hdr_.last_off_;
+    }
+    // the calling thread takes the first range
+    for (tidx = 1; tidx < threads; tidx ++)
+        workers [tidx].start (scan_worker_, ranges + tidx);
+    scan_worker_ (ranges);
+    for (tidx = 1; tidx < threads; tidx ++)
+        workers [tidx].join ();
+    delete [] workers;
+    delete [] ranges;
+    if (state.failed_)
+        throw state.error_;
+}
+
+void VStorage_imp::scan_worker_ (void* arg)
+{
+    ScanRange& range = *(ScanRange*) arg;
+    ScanState& state = *range.state_;
+    try
+    {
+        range.storage_->scan_range_ (range);
+    }
+    catch (Error& e)
+    {
+        MutexGuard guard (state.io_);
+        if (!state.failed_)
+            state.error_ = e;
+        state.failed_ = true;
+    }
+    catch (...)
+    {
+        MutexGuard guard (state.io_);
+        if (!state.failed_)
+            state.error_ = Error ("scan: receiver failed");
+        state.failed_ = true;
+    }
+}
+
+BufLen VStorage_imp::scan_read_ (ScanState& state, char* buf, FilePos pos, BufLen len)
+{
+    if (state.direct_)
+        return state.direct_->readAt (buf, len, pos);
+    MutexGuard guard (state.io_);
+    if (file_.seek (pos) != pos)
+        throw SeekError ();
+    return file_.read (buf, len);
+}
+
+void VStorage_imp::scan_range_ (ScanRange& range)
+{
+    ScanState& state = *range.state_;
+    FilePos end = hdr_.last_off_ + sizeof (BlockHdr);
+    std::vector <char> buf (SCAN_PORTION);
+    FilePos bufPos = 0;
+    BufLen bufLen = 0;
+    VRecDescriptor recs [SCAN_BATCH];
+    const void* data [SCAN_BATCH];
+    uint32 count = 0;
+
+    RecLocator locator = range.from_;
+    while (locator < range.to_)
+    {
+        // the header must be in the buffer; the batch points into it, so it goes out before the buffer is reloaded
+        if (locator + sizeof (BlockHdr) > bufPos + bufLen)
+        {
+            if (count)
+                state.receiver_.records (recs, data, count);
+            count = 0;
+            bufPos = locator;
+            bufLen = scan_read_ (state, &buf [0], bufPos, (BufLen) min_ (SCAN_PORTION, end - bufPos));
+            if (bufLen < sizeof (BlockHdr))
+                throw FileStructureCorrupt ();
+        }
+        BlockHdr block;
+        memcpy (&block, &buf [locator - bufPos], sizeof (block));
+        if (memcmp (block.sign_, BlockSignature, sizeof (BlockSignature)) || block.next_ < locator + sizeof (BlockHdr) || block.next_ > hdr_.last_off_)
+            throw FileStructureCorrupt ();
+        if (block.free_ != FREEFLAG)
+        {
+            RecLen len = datalen_ (block, locator);
+            FilePos dataPos = locator + sizeof (BlockHdr);
+            if (dataPos + len > bufPos + bufLen)
+            {
+                if (count)
+                    state.receiver_.records (recs, data, count);
+                count = 0;
+                if (sizeof (BlockHdr) + len <= SCAN_PORTION)
+                {
+                    // read again from the block start
+                    if (bufPos == locator) // the file ends within the block
+                        throw FileStructureCorrupt ();
+                    bufLen = 0;
+                    continue;
+                }
+                // longer than the portion - read alone
+                std::vector <char> rec ((size_t) len);
+                for (RecLen done = 0; done < len; )
+                {
+                    BufLen part = (BufLen) min_ (SCAN_PORTION, len - done);
+                    if (scan_read_ (state, &rec [done], dataPos + done, part) != part)
+                        throw ReadError ();
+                    done += part;
+                }
+                recs [0].locator_ = locator;
+                recs [0].length_ = len;
+                data [0] = &rec [0];
+                state.receiver_.records (recs, data, 1);
+            }
+            else
+            {
+                recs [count].locator_ = locator;
+                recs [count].length_ = len;
+                data [count] = &buf [0] + (dataPos - bufPos);
+                if (++ count == SCAN_BATCH)
+                {
+                    state.receiver_.records (recs, data, count);
+                    count = 0;
+                }
+            }
+        }
+        locator = block.next_;
+    }
+    if (count)
+        state.receiver_.records (recs, data, count);
+    // the chain comes to the start of the next range
+    if (locator != range.to_)
+        throw FileStructureCorrupt ();
+}
+
 
 // storage - level operations 
 bool VStorage_imp::flush ()
 {
-    // write control structures (header and bands)
+    // write cached block headers and control structures (header and bands)
+    meta_writeback_ ();
     flush_hdr_ ();
     // flush the file
     return file_.commit ();
@@ -1241,7 +1774,8 @@ bool VStorage_imp::flush ()
 
 bool VStorage_imp::close ()
 {
-    // write control structures (header and bands)
+    // write cached block headers and control structures (header and bands)
+    meta_writeback_ ();
     flush_hdr_ ();
     // cut file after the end
     file_.commit ();
@@ -1255,6 +1789,118 @@ bool VStorage_imp::isOpen () const
     return file_.isOpen ();
 }
 
+RecLocator VStorage_imp::lowest_free_ ()
+{
+    RecLocator lowest = RECLOCATOR_MAX;
+    for (std::vector <FreeSet>::iterator band = free_index_.begin (); band != free_index_.end (); band ++)
+        for (FreeSet::iterator itr = band->begin (); itr != band->end (); itr ++)
+            if (itr->second < lowest)
+                lowest = itr->second;
+    return lowest;
+}
+
+void VStorage_imp::trim_tail_ ()
+{
+    meta_writeback_ ();
+    flush_hdr_ ();
+    file_.commit ();
+    file_.chsize (hdr_.last_off_ + sizeof (BlockHdr));
+}
+
+RecLen VStorage_imp::slide_hole_ (VRecRemap& remap)
+{
+    // .........
+    // hole          FREE
+    // rec           USED (or sentinel)
+    // next          ????
+    // becomes
+    // rec           USED, at hole's locator
+    // hole          FREE, joined with next if it is free, or the sentinel
+    RecLocator holeLoc = compact_hole_;
+    BlockHdr hole;
+    read_bhdr_ (hole, holeLoc);
+    RecLen holeLen = datalen_ (hole, holeLoc);
+#ifdef VSTORAGE_IMP_DEBUG
+    if (hole.free_ != FREEFLAG)
+        ERR("slide_hole_: compaction hole is not free");
+#endif
+    RecLocator recLoc = hole.next_;
+    BlockHdr rec;
+    read_bhdr_ (rec, recLoc);
+
+    // take the hole out of the free space control structures (this resets compact_hole_)
+    free_remove_ (holeLoc, calc_band_ (holeLen), holeLen);
+
+    if (rec.next_ == RECLOCATOR_MAX) // the hole is followed by sentinel - it becomes the sentinel
+    {
+        hole.next_ = RECLOCATOR_MAX;
+        write_bhdr_ (hole, holeLoc);
+        hdr_.last_off_ = holeLoc;
+        trim_tail_ ();
+        return 0;
+    }
+#ifdef VSTORAGE_IMP_DEBUG
+    if (rec.free_ != USEDFLAG)
+        ERR("slide_hole_: free block follows the compaction hole");
+#endif
+    RecLen recLen = datalen_ (rec, recLoc);
+    RecLocator nextLoc = rec.next_;
+    BlockHdr next;
+    read_bhdr_ (next, nextLoc);
+
+    // slide the record data down
+    move_data_ (recLoc + sizeof (BlockHdr), recLoc + sizeof (BlockHdr) + recLen, holeLoc + sizeof (BlockHdr));
+
+    // the record takes the hole's place, the hole goes after it
+    RecLocator newHoleLoc = holeLoc + sizeof (BlockHdr) + recLen;
+    hole.free_ = USEDFLAG;
+    hole.next_ = newHoleLoc;
+    write_bhdr_ (hole, holeLoc);
+    BlockHdr newHole;
+    newHole.prev_ = holeLoc;
+
+    if (next.next_ == RECLOCATOR_MAX) // next is sentinel - the hole becomes the sentinel
+    {
+        write_bhdr_ (newHole, newHoleLoc);
+        hdr_.last_off_ = newHoleLoc;
+        remap.remap (recLoc, holeLoc, recLen);
+        trim_tail_ ();
+        return recLen;
+    }
+    if (next.free_ == FREEFLAG) // join with the next free block
+    {
+        RecLen nextLen = datalen_ (next, nextLoc);
+        free_remove_ (nextLoc, calc_band_ (nextLen), nextLen);
+        RecLocator nextNextLoc = next.next_;
+        BlockHdr nextNext;
+        read_bhdr_ (nextNext, nextNextLoc);
+        join_bhdrs_ (newHoleLoc, newHole, nextNextLoc, nextNext);
+    }
+    else
+        join_bhdrs_ (newHoleLoc, newHole, nextLoc, next);
+    RecLen newHoleLen = datalen_ (newHole, newHoleLoc);
+    free_add_ (newHoleLoc, calc_band_ (newHoleLen), newHoleLen);
+    compact_hole_ = newHoleLoc;
+    remap.remap (recLoc, holeLoc, recLen);
+    return recLen;
+}
+
+bool VStorage_imp::compact (VRecRemap& remap, uint64 maxBytes)
+{
+    uint64 moved = 0;
+    while (true)
+    {
+        // continue with the hole left by the previous step, or start from the first free block
+        if (compact_hole_ == RECLOCATOR_MAX)
+            compact_hole_ = lowest_free_ ();
+        if (compact_hole_ == RECLOCATOR_MAX)
+            return true;
+        if (moved && moved >= maxBytes)
+            return false;
+        moved += slide_hole_ (remap) + sizeof (BlockHdr);
+    }
+}
+
 uint64      VStorage_imp::usedSpace      () const
 {
     return hdr_.used_space_;
@@ -1281,14 +1927,22 @@ VStorage& VStorageFactory_imp::wrap (File& file)
 {
     VStorage_imp& storage = *new VStorage_imp (file);
     storage.open_ ();
-    return storage;
+    if (!storage.packed_)
+        return storage;
+    CompressedVStorage_imp& packed = *new CompressedVStorage_imp (storage);
+    packed.open_ ();
+    return packed;
 }
 
-VStorage& VStorageFactory_imp::init (File& file)
+VStorage& VStorageFactory_imp::init (File& file, bool compressed)
 {
     VStorage_imp& storage = *new VStorage_imp (file);
-    storage.init_ ();
-    return storage;
+    storage.init_ (NULL, 0, compressed);
+    if (!compressed)
+        return storage;
+    CompressedVStorage_imp& packed = *new CompressedVStorage_imp (storage);
+    packed.init_ ();
+    return packed;
 }
 
 bool VStorageFactory_imp::validate (File& file)
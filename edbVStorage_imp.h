@@ -17,12 +17,19 @@
 #include "edbTypes.h"
 #include "edbFile.h"
 #include "edbVStorage.h"
+#include "edbCachedFile.h"
+#include "edbLatch.h"
+#include "edbError.h"
 #include <vector>
+#include <set>
+#include <utility>
 #include <string.h>
 
 namespace edb
 {
 
+class SplitFile_imp;
+
     // The layout for the variable-length storage file:
 
 // --BEGIN OF FILE--
@@ -55,6 +62,7 @@ namespace edb
 
 static const char BlockSignature [] = {'V', 's', 'B'}; 
 static const char FileSignature  [] = {'V', 'a', 'R', 'l', 'E', 'n', 'G', 't', 'H', 's', 'T', 'o', 'R', 'a', 'G', 'e'}; 
+static const char PackedSignature[] = {'V', 'a', 'R', 'l', 'E', 'n', 'G', 't', 'H', 'p', 'A', 'c', 'K', 'e', 'D', 's'}; // records hold compressed frames, see CompressedVStorage_imp
 static const unsigned char FREEFLAG = '\xff';
 static const unsigned char USEDFLAG = '\0';
 
@@ -128,9 +136,52 @@ class VStorage_imp : public VStorage
 #pragma pack (pop)
 #endif
     
+    // in-memory index of the free blocks, one ordered set of (length, locator) per band;
+    // rebuilt from the on-disk free lists at open and used for the best-fit lookups
+    typedef std::pair <RecLen, RecLocator> FreeExtent;
+    typedef std::set <FreeExtent> FreeSet;
+
+    // write-back cache of block headers and free list links: direct-mapped by block locator,
+    // the entry displaced from a slot is written out; all are written out on flush ()
+    enum { META_NONE, META_CLEAN, META_DIRTY };
+    struct MetaEntry
+    {
+        MetaEntry () : locator_ (RECLOCATOR_MAX), hdr_state_ (META_NONE), fp_state_ (META_NONE) {}
+        RecLocator      locator_;
+        BlockHdr        hdr_;
+        FreePos         fp_;
+        unsigned char   hdr_state_;
+        unsigned char   fp_state_;
+    };
+    typedef std::vector <MetaEntry> MetaCache;
+
+    // shared by the threads of scan ()
+    struct ScanState
+    {
+        ScanState (VRecScan& receiver) : receiver_ (receiver), direct_ (NULL), failed_ (false), error_ ("") {}
+        VRecScan&   receiver_;
+        SplitFile_imp* direct_; // read by every thread at its own offsets, past the cache; NULL if the file is read under io_
+        Mutex       io_; // serializes the file access, and the error reports
+        bool        failed_; // set by the first failed thread, together with error_
+        Error       error_;
+    };
+    struct ScanRange
+    {
+        VStorage_imp*   storage_;
+        ScanState*      state_;
+        RecLocator      from_; // the chain is followed from the block at from_ to the block at to_
+        RecLocator      to_;
+    };
+
     File&       file_;
+    CachedFile* cached_; // file_, if it is a CachedFile
+    SplitFile_imp* split_; // file_, if it is a SplitFile_imp: relocations are then copied by the OS
     FileHdr     hdr_;
     Band*       bands_;
+    std::vector <FreeSet> free_index_;
+    MetaCache   meta_;
+    RecLocator  compact_hole_; // free block being moved toward the end by compact (), RECLOCATOR_MAX if not known
+    bool        packed_; // the file carries PackedSignature
 
 
 protected:
@@ -146,9 +197,18 @@ protected:
     void        write_freepos_ (FreePos& freepos, RecLocator locator); // writes out the FreePos at locator
     void        move_freepos_  (FreePos& freepos, uint32 bandno, RecLocator newplace); // writes the freepos at newplace, adjusting the next and prev free blocks
     void        flush_hdr_     (); // flushes control structures (header) to disk
+    MetaEntry&  meta_entry_    (RecLocator locator); // returns the cache entry for the block at locator, writing back the one it displaces
+    void        meta_store_    (MetaEntry& entry); // writes the dirty parts of the entry to the file
+    void        meta_writeback_(); // writes all dirty block headers and free list links to the file
+    void        meta_reset_    (); // empties the block header cache, discarding the changes
+    void        meta_drop_     (FilePos start, FilePos end); // forgets cached entries overlapped by data written to [start, end)
+    const BlockHdr* meta_hdr_  (RecLocator locator) const; // the cached header of the block at locator, NULL if not cached
     void        free_remove_   (RecLocator locator, uint32 bandno, RecLen space); // removes the block at Locator from free space control structures
-    void        free_removeRec_(FreePos& freepos, uint32 bandno, RecLen space); // removes the FreePos from free space control structures
+    void        free_removeRec_(RecLocator locator, FreePos& freepos, uint32 bandno, RecLen space); // removes the FreePos of the block at locator from free space control structures
     void        free_add_      (RecLocator locator, uint32 bandno, RecLen space); // adds block at locator to free space control structures
+    void        index_add_     (RecLocator locator, uint32 bandno, RecLen space); // adds the free block to the in-memory free index
+    void        index_remove_  (RecLocator locator, uint32 bandno, RecLen space); // removes the free block from the in-memory free index
+    void        index_rebuild_ (); // reloads the in-memory free index from the on-disk free lists
     void        join_bhdrs_    (RecLocator loc, BlockHdr& block, RecLocator nextLoc, BlockHdr& nextBlock); // joins together the two blocks (makes them point to each other)
     void        split_free_    (RecLocator loc, BlockHdr& block, RecLen len); // splits the FREE block into two, first one of the size len. Marks first block as used, second as free.
     void        split_used_    (RecLocator loc, BlockHdr& block, RecLocator nextLocator, BlockHdr& nextBlock, RecLen len); // splits the USED block into two, first one of the size len. Marks first block as used, second as free. Assumes that the splitted block is followed by USED block.
@@ -158,17 +218,26 @@ protected:
     void        resize_last_   (RecLocator loc, BlockHdr& block, BlockHdr& nextBlock, RecLen len); // change size of the last block
     void        resize_mid_    (RecLocator loc, BlockHdr& block, BlockHdr& nextBlock, RecLen len); // change size of the intermediate
     RecLocator  alloc_at_end_  (RecLen len); // allocate the new block at the end of file
-    RecLocator  alloc_at_band_ (RecLen len, uint32 bandno); // allocate the new block out of the free band
+    RecLocator  alloc_at_free_ (RecLen len, RecLocator locator); // allocate the new block out of the free block at locator
     void        move_rec_      (RecLocator dest, BlockHdr& srcBlock, RecLocator srcLoc);
 	void		move_data_     (FilePos src_start, FilePos src_end, FilePos dest_start);
 	void		move_and_fill_ (RecLocator src_locator, RecLocator dest_locator, const void* data, BufLen data_len, RecOff offset, RecLen old_data_len, RecLen full_len);
+    RecLocator  lowest_free_   (); // finds the free block closest to the file start
+    RecLen      slide_hole_    (VRecRemap& remap); // moves the record following compact_hole_ in front of it, returns the record length
+    void        trim_tail_     (); // cuts the file after the sentinel
+    bool        extendRec_     (RecLocator locator, RecLen len); // grows the block to hold len bytes if this can be done without moving it
 
     // walk over ALL blocks (both free and used
     bool        firstRec_	   (VRec_impDescriptor& rec);
     bool        nextRec_       (VRec_impDescriptor& rec);
 
+    // parallel scan
+    static void scan_worker_   (void* range); // runs scan_range_ for the ScanRange, keeps the error in its ScanState
+    void        scan_range_    (ScanRange& range); // passes the records of the range to the receiver
+    BufLen      scan_read_     (ScanState& state, char* buf, FilePos pos, BufLen len); // reads up to len bytes at pos
+
     // high_level functions
-    void        init_          (const uint64* bandbounds = NULL, uint32 bandno = 0); // initializes the VS file
+    void        init_          (const uint64* bandbounds = NULL, uint32 bandno = 0, bool packed = false); // initializes the VS file
     void        open_          (); // opens the VS file and reads in the control structures
 
 
@@ -183,9 +252,12 @@ public:
     RecLocator  addRec         (const void* data, RecLen len);
     RecLocator  reallocRec     (RecLocator locator, RecLen len);
     bool        readRec        (RecLocator locator, void* data, BufLen len, RecOff offset = 0);
+    bool        readRecs       (const VRecDescriptor* recs, uint32 number, void* const* buffers);
     bool        writeRec       (RecLocator locator, const void* data, BufLen len, RecOff offset = 0);
     bool        freeRec        (RecLocator locator);
 	RecLocator  sliceRec       (RecLocator locator, const void* data, BufLen data_len, RecOff offset, RecLen old_data_len, RecLen full_len);
+    void*       mapRec         (RecLocator locator, RecOff offset, BufLen& len, bool write);
+    void        unmapRec       (const void* data, bool dirty);
 
     // hinted prefetch 
     void        hintAdd        (VRecDescriptor* descriptors, uint32 number);
@@ -195,11 +267,13 @@ public:
     RecNum      getRecCount    () const;
     bool        firstRec	   (VRecDescriptor& rec);
     bool        nextRec	       (VRecDescriptor& rec);
+    void        scan           (VRecScan& receiver, uint32 threads);
 
     // storage - level operations     
     bool        flush          ();
     bool        close          ();
     bool        isOpen         () const;
+    bool        compact        (VRecRemap& remap, uint64 maxBytes);
 
     //statistics
     uint64      usedSpace      () const;
@@ -208,6 +282,7 @@ public:
     uint64      freeCount      () const;
 
     friend class VStorageFactory_imp;
+    friend class CompressedVStorage_imp;
 };
 
 class VStorageFactory_imp : public VStorageFactory
@@ -215,7 +290,7 @@ class VStorageFactory_imp : public VStorageFactory
 public:
                 ~VStorageFactory_imp () {}
     VStorage&   wrap           (File& file);
-    VStorage&   init           (File& file);
+    VStorage&   init           (File& file, bool compressed = false);
     bool        validate       (File& file);
 };
 
@@ -15,14 +15,22 @@
 #include "edbSplitFileFactory.h"
 #include "edbCachedFileFactory.h"
 #include "edbVStorageFactory.h"
+#include "edbLatch.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 // #include <conio.h>
 #include <iostream>
 #include <iomanip>
 #include "i64out.h"
 #include <set>
+#include <vector>
+#include <algorithm>
+#include <time.h>
+#if !defined (_WIN32)
+#include <sys/time.h>
+#endif
 
 #include "portability.h"
 
@@ -456,10 +464,753 @@ bool allocTest ()
     return true;
 }
 
+// Long update churn over a fixed population of records: each step frees
+// a random record and allocates one of random size in its place. With a
+// good allocator the file stops growing once free space can be reused.
+static const uint32 CHURNRECS = 20000;
+static const uint32 CHURNSTEPS = 1000000;
+static const uint32 CHURNREPORT = 100000;
+
+bool churnTest ()
+{
+    if (splitFileFactory.exists (tstd, tstn))
+        splitFileFactory.erase (tstd, tstn);
+    File& f = splitFileFactory.create (tstd, tstn);
+    File& cf = cachedFileFactory.wrap (f);
+    VStorage& vs = vStorageFactory.init (cf);
+
+    srand (1);
+    RecLocator* recs = new RecLocator [CHURNRECS];
+    uint32 i;
+    for (i = 0; i < CHURNRECS; i ++)
+    {
+        RecLen rlen = sizeof (RecLocator) + randrecsz ();
+        recs [i] = vs.allocRec (rlen);
+        vs.writeRec (recs [i], &recs [i], sizeof (RecLocator));
+    }
+    time_t tbeg = time (0);
+    for (uint32 step = 1; step <= CHURNSTEPS; step ++)
+    {
+        i = (rand () * rand ()) % CHURNRECS;
+        RecLocator check;
+        vs.readRec (recs [i], &check, sizeof (check));
+        if (check != recs [i])
+            ERR ("churnTest: record content lost");
+        vs.freeRec (recs [i]);
+        RecLen rlen = sizeof (RecLocator) + randrecsz ();
+        recs [i] = vs.allocRec (rlen);
+        vs.writeRec (recs [i], &recs [i], sizeof (RecLocator));
+        if (step % CHURNREPORT == 0)
+        {
+            vs.flush ();
+            uint64 total = vs.usedSpace () + vs.freeSpace ();
+            std::cerr << "Steps : " << std::setw (9) << step 
+                << ", file size : " << std::setw (11) << cf.length () 
+                << ", usedSpace : " << std::setw (11) << vs.usedSpace () 
+                << ", freeCount : " << std::setw (7) << vs.freeCount () 
+                << ", fragmentation : " << std::setw (5) << (total ? (vs.freeSpace () * 100) / total : 0) << "%"
+                << ", elapsed " << time (0) - tbeg << std::endl;
+        }
+    }
+    // reopen: the free index is rebuilt from the on-disk lists, records must survive
+    uint64 freecnt = vs.freeCount ();
+    vs.close ();
+    File& rf = splitFileFactory.open (tstd, tstn);
+    File& rcf = cachedFileFactory.wrap (rf);
+    VStorage& rvs = vStorageFactory.wrap (rcf);
+    if (rvs.freeCount () != freecnt)
+        ERR ("churnTest: free count changed on reopen");
+    for (i = 0; i < CHURNRECS; i ++)
+    {
+        RecLocator check;
+        rvs.readRec (recs [i], &check, sizeof (check));
+        if (check != recs [i])
+            ERR ("churnTest: record content lost on reopen");
+        rvs.freeRec (recs [i]);
+    }
+    delete [] recs;
+    rvs.close ();
+    splitFileFactory.erase (tstd, tstn);
+    return true;
+}
+
+// Small-record update throughput: resizes, frees and allocations of short records,
+// dominated by block header and free list maintenance
+static const uint32 SMALLRECS = 100000;
+static const uint32 SMALLOPS = 2000000;
+static const uint32 SMALLMAX = 64;
+
+bool smallUpdTest ()
+{
+    if (splitFileFactory.exists (tstd, tstn))
+        splitFileFactory.erase (tstd, tstn);
+    File& f = splitFileFactory.create (tstd, tstn);
+    File& cf = cachedFileFactory.wrap (f);
+    VStorage& vs = vStorageFactory.init (cf);
+
+    srand (1);
+    RecLocator* recs = new RecLocator [SMALLRECS];
+    uint32 i;
+    for (i = 0; i < SMALLRECS; i ++)
+    {
+        recs [i] = vs.allocRec (sizeof (RecLocator) + rand () % SMALLMAX);
+        vs.writeRec (recs [i], &recs [i], sizeof (RecLocator));
+    }
+    clock_t tbeg = clock ();
+    for (uint32 op = 0; op < SMALLOPS; op ++)
+    {
+        i = (rand () * rand ()) % SMALLRECS;
+        RecLocator check;
+        vs.readRec (recs [i], &check, sizeof (check));
+        if (check != recs [i])
+            ERR ("smallUpdTest: record content lost");
+        RecLen rlen = sizeof (RecLocator) + rand () % SMALLMAX;
+        if (op & 1)
+            recs [i] = vs.reallocRec (recs [i], rlen);
+        else
+        {
+            vs.freeRec (recs [i]);
+            recs [i] = vs.allocRec (rlen);
+        }
+        vs.writeRec (recs [i], &recs [i], sizeof (RecLocator));
+    }
+    vs.flush ();
+    double secs = double (clock () - tbeg) / CLOCKS_PER_SEC;
+    std::cerr << SMALLOPS << " small record updates in " << secs << " sec, " << uint64 (SMALLOPS / (secs ? secs : 1e-6)) << " ops/sec" << std::endl;
+    delete [] recs;
+    vs.close ();
+    splitFileFactory.erase (tstd, tstn);
+    return true;
+}
+
+// Compaction: free every other record, then compact in bounded steps.
+// The records keep their index; the remap callback keeps the locator table current.
+static const uint32 COMPACTRECS = 50000;
+static const uint64 COMPACTSTEP = 0x10000;
+
+class LocatorRemap : public VRecRemap
+{
+public:
+    LocatorRemap (RecLocator* locs) : locs_ (locs), moves_ (0) {}
+    void remap (RecLocator oldLocator, RecLocator newLocator, RecLen length)
+    {
+        uint32 idx = 0;
+        vs_->readRec (newLocator, &idx, sizeof (idx));
+        if (locs_ [idx] != oldLocator)
+            ERR ("compactTest: unexpected locator remapped");
+        locs_ [idx] = newLocator;
+        moves_ ++;
+    }
+    VStorage* vs_;
+    RecLocator* locs_;
+    uint64 moves_;
+};
+
+bool compactTest ()
+{
+    if (splitFileFactory.exists (tstd, tstn))
+        splitFileFactory.erase (tstd, tstn);
+    File& f = splitFileFactory.create (tstd, tstn);
+    File& cf = cachedFileFactory.wrap (f);
+    VStorage& vs = vStorageFactory.init (cf);
+
+    srand (1);
+    RecLocator* recs = new RecLocator [COMPACTRECS];
+    uint32 i;
+    for (i = 0; i < COMPACTRECS; i ++)
+    {
+        recs [i] = vs.allocRec (sizeof (uint32) + randrecsz ());
+        vs.writeRec (recs [i], &i, sizeof (i));
+    }
+    for (i = 0; i < COMPACTRECS; i += 2)
+        vs.freeRec (recs [i]);
+    vs.flush ();
+    FilePos before = cf.length ();
+
+    LocatorRemap remap (recs);
+    remap.vs_ = &vs;
+    uint32 calls = 1;
+    clock_t tbeg = clock ();
+    while (!vs.compact (remap, COMPACTSTEP))
+        calls ++;
+    double secs = double (clock () - tbeg) / CLOCKS_PER_SEC;
+
+    if (vs.freeCount () != 0 || vs.freeSpace () != 0)
+        ERR ("compactTest: free space left after compaction");
+    VRecDescriptor d;
+    uint64 seen = 0;
+    for (bool ok = vs.firstRec (d); ok; ok = vs.nextRec (d))
+        seen ++;
+    if (seen != vs.usedCount ())
+        ERR ("compactTest: record walk does not match used count");
+    for (i = 1; i < COMPACTRECS; i += 2)
+    {
+        uint32 idx;
+        vs.readRec (recs [i], &idx, sizeof (idx));
+        if (idx != i)
+            ERR ("compactTest: record content lost");
+    }
+    std::cerr << "Compaction: " << remap.moves_ << " records moved in " << calls << " steps, " << secs << " sec, file size " << before << " -> " << cf.length () << std::endl;
+    delete [] recs;
+    vs.close ();
+    splitFileFactory.erase (tstd, tstn);
+    return true;
+}
+
+// Streaming access to a large record: appended in chunks, read back by copying and by mapping cached pages
+static const uint32 STREAMCHUNK = 0x10000;
+static const uint32 STREAMCHUNKS = 1024; // 64 Mb record
+
+bool streamTest ()
+{
+    if (splitFileFactory.exists (tstd, tstn))
+        splitFileFactory.erase (tstd, tstn);
+    File& f = splitFileFactory.create (tstd, tstn);
+    File& cf = cachedFileFactory.wrap (f);
+    VStorage& vs = vStorageFactory.init (cf);
+
+    uint32* buf = new uint32 [STREAMCHUNK / sizeof (uint32)];
+    uint32 words = STREAMCHUNK / sizeof (uint32);
+    uint32 i, c;
+    RecLocator before = vs.addRec ("head", 4);
+    RecLocator loc = vs.allocRec (0x10);
+    {
+        VRecStream s (vs, loc);
+        clock_t tbeg = clock ();
+        for (c = 0; c < STREAMCHUNKS; c ++)
+        {
+            for (i = 0; i < words; i ++)
+                buf [i] = c * words + i;
+            s.append (buf, STREAMCHUNK);
+        }
+        double secs = double (clock () - tbeg) / CLOCKS_PER_SEC;
+        if (s.locator () != loc)
+            ERR ("streamTest: last record moved on append");
+        std::cerr << "Stream append: " << (STREAMCHUNKS * (STREAMCHUNK >> 10)) / 1024 << " Mb in " << secs << " sec" << std::endl;
+    }
+    {
+        VRecStream s (vs, loc);
+        s.seek (0x10);
+        clock_t tbeg = clock ();
+        for (c = 0; c < STREAMCHUNKS; c ++)
+        {
+            if (s.read (buf, STREAMCHUNK) != STREAMCHUNK)
+                ERR ("streamTest: short read");
+            if (buf [0] != c * words || buf [words - 1] != (c + 1) * words - 1)
+                ERR ("streamTest: wrong data read");
+        }
+        double secs = double (clock () - tbeg) / CLOCKS_PER_SEC;
+        if (s.read (buf, STREAMCHUNK) != 0)
+            ERR ("streamTest: read past the end");
+        std::cerr << "Stream read: " << secs << " sec" << std::endl;
+    }
+    {
+        VRecStream s (vs, loc);
+        s.seek (0x10);
+        uint64 mapped = 0;
+        clock_t tbeg = clock ();
+        BufLen len = STREAMCHUNK;
+        const void* p;
+        while ((p = s.map (len)) != NULL)
+        {
+            // check the first and the last byte of the mapped piece
+            const unsigned char* b = (const unsigned char*) p;
+            uint64 off = s.tell () - 0x10;
+            if (b [0] != (unsigned char) ((off / sizeof (uint32)) >> (8 * (off % sizeof (uint32)))))
+                ERR ("streamTest: wrong data mapped");
+            off += len - 1;
+            if (b [len - 1] != (unsigned char) ((off / sizeof (uint32)) >> (8 * (off % sizeof (uint32)))))
+                ERR ("streamTest: wrong data mapped");
+            mapped += len;
+            s.unmap ();
+            len = STREAMCHUNK;
+        }
+        double secs = double (clock () - tbeg) / CLOCKS_PER_SEC;
+        if (s.tell () != s.length () || mapped != s.length () - 0x10)
+            ERR ("streamTest: mapping stopped before the end");
+        std::cerr << "Stream map: " << secs << " sec" << std::endl;
+
+        s.seek (0x10);
+        len = sizeof (uint32);
+        uint32* w = (uint32*) s.mapWrite (len);
+        if (w && len == sizeof (uint32))
+        {
+            *w = 0xdeadbeef;
+            s.unmap ();
+            uint32 check;
+            vs.readRec (loc, &check, sizeof (check), 0x10);
+            if (check != 0xdeadbeef)
+                ERR ("streamTest: mapped write lost");
+        }
+    }
+    char head [4];
+    vs.readRec (before, head, 4);
+    if (memcmp (head, "head", 4))
+        ERR ("streamTest: neighbour record damaged");
+    delete [] buf;
+    vs.close ();
+    splitFileFactory.erase (tstd, tstn);
+    return true;
+}
+
+// Relocation of large records: the record is grown while followed by another one,
+// so that reallocRec has to move it. The storage sits on the split file directly.
+static const RecLen MOVESIZES [] = {0x100000, 0x1000000, 0x10000000, 0x40000000}; // 1 Mb .. 1 Gb
+
+bool moveTest ()
+{
+    const BufLen chunk = 0x100000;
+    uint32* buf = new uint32 [chunk / sizeof (uint32)];
+    for (uint32 sz = 0; sz < sizeof (MOVESIZES) / sizeof (*MOVESIZES); sz ++)
+    {
+        if (splitFileFactory.exists (tstd, tstn))
+            splitFileFactory.erase (tstd, tstn);
+        File& f = splitFileFactory.create (tstd, tstn);
+        VStorage& vs = vStorageFactory.init (f);
+
+        RecLen size = MOVESIZES [sz];
+        RecLocator loc = vs.allocRec (size);
+        {
+            VRecStream s (vs, loc);
+            for (RecOff off = 0; off < size; off += chunk)
+            {
+                for (uint32 i = 0; i < chunk / sizeof (uint32); i ++)
+                    buf [i] = uint32 (off / sizeof (uint32)) + i;
+                s.write (buf, chunk);
+            }
+        }
+        vs.addRec ("next", 4);
+
+        clock_t tbeg = clock ();
+        time_t wbeg = time (0);
+        RecLocator moved = vs.reallocRec (loc, size + 1);
+        vs.flush ();
+        double secs = double (clock () - tbeg) / CLOCKS_PER_SEC;
+        if (moved == loc)
+            ERR ("moveTest: record was not moved");
+
+        RecOff checks [] = {0, (size / chunk / 2) * chunk, size - chunk};
+        for (uint32 c = 0; c < 3; c ++)
+        {
+            vs.readRec (moved, buf, chunk, checks [c]);
+            if (buf [0] != checks [c] / sizeof (uint32) || buf [chunk / sizeof (uint32) - 1] != (checks [c] + chunk) / sizeof (uint32) - 1)
+                ERR ("moveTest: moved data differs");
+        }
+        std::cerr << "Relocated " << (size >> 20) << " Mb record: " << secs << " sec cpu, " << time (0) - wbeg << " sec elapsed" << std::endl;
+        vs.close ();
+        splitFileFactory.erase (tstd, tstn);
+    }
+    delete [] buf;
+    return true;
+}
+
+// Compressed storage: JSON-like records written and read back by the plain and the compressed storage,
+// then partial reads and rewrites of a record spanning many frames
+static const uint32 ZRECS = 20000;
+static const uint32 ZMAXLEN = 4000;
+
+static uint32 jsonRec (char* buf, uint32 no)
+{
+    uint32 len = 200 + (no * 2654435761U) % (ZMAXLEN - 400);
+    uint32 pos = 0;
+    for (uint32 item = 0; pos < len; item ++)
+        pos += sprintf (buf + pos, "{\"id\":%u,\"name\":\"item-%u-%u\",\"active\":%s,\"tags\":[\"t%u\",\"t%u\"],\"value\":%u},", 
+                        no, no, item, (item & 1) ? "true" : "false", item % 7, no % 13, (no ^ item) * 31);
+    return len;
+}
+
+bool compressTest ()
+{
+    char* buf = new char [ZMAXLEN + 400];
+    char* rbuf = new char [ZMAXLEN + 400];
+    RecLocator* recs = new RecLocator [ZRECS];
+    uint32 i;
+    for (int compressed = 0; compressed < 2; compressed ++)
+    {
+        if (splitFileFactory.exists (tstd, tstn))
+            splitFileFactory.erase (tstd, tstn);
+        File& f = splitFileFactory.create (tstd, tstn);
+        File& cf = cachedFileFactory.wrap (f);
+        VStorage& vs = vStorageFactory.init (cf, compressed != 0);
+        clock_t tbeg = clock ();
+        for (i = 0; i < ZRECS; i ++)
+            recs [i] = vs.addRec (buf, jsonRec (buf, i));
+        vs.flush ();
+        double wsecs = double (clock () - tbeg) / CLOCKS_PER_SEC;
+        tbeg = clock ();
+        for (i = 0; i < ZRECS; i ++)
+        {
+            uint32 len = jsonRec (buf, i);
+            if (vs.getRecLen (recs [i]) != len)
+                ERR ("compressTest: wrong record length");
+            vs.readRec (recs [i], rbuf, len);
+            if (memcmp (buf, rbuf, len))
+                ERR ("compressTest: wrong data read");
+        }
+        double rsecs = double (clock () - tbeg) / CLOCKS_PER_SEC;
+        std::cerr << (compressed ? "Compressed" : "Plain") << " storage: " << ZRECS << " records, file size " << cf.length () 
+                  << ", written in " << wsecs << " sec, read in " << rsecs << " sec" << std::endl;
+        vs.close ();
+    }
+
+    // large record: allocated, filled by stream, read and rewritten by parts
+    File& f = splitFileFactory.open (tstd, tstn);
+    File& cf = cachedFileFactory.wrap (f);
+    VStorage& vs = vStorageFactory.wrap (cf);
+    if (vs.getRecCount () != ZRECS)
+        ERR ("compressTest: wrong record count after reopen");
+    const uint32 words = 0x100000;
+    uint32* big = new uint32 [words];
+    for (i = 0; i < words; i ++)
+        big [i] = i / 3;
+    uint64 usedBase = vs.usedSpace ();
+    RecLocator loc = vs.allocRec (words * sizeof (uint32));
+    {
+        VRecStream s (vs, loc);
+        s.write (big, words * sizeof (uint32));
+    }
+    uint64 used = vs.usedSpace ();
+    uint32 part [0x1000];
+    for (uint32 off = 0; off < words; off += 0x3f01)
+    {
+        uint32 cnt = min_ (0x1000, words - off);
+        vs.readRec (loc, part, cnt * sizeof (uint32), off * sizeof (uint32));
+        if (memcmp (part, big + off, cnt * sizeof (uint32)))
+            ERR ("compressTest: wrong data read by part");
+    }
+    // rewrites growing the packed record (random data) keep the locator
+    for (i = 0; i < 0x1000; i ++)
+        part [i] = i * 2654435761U;
+    for (uint32 off = 0x100; off < words; off += 0x40000)
+    {
+        vs.writeRec (loc, part, sizeof (part), off * sizeof (uint32));
+        memcpy (big + off, part, sizeof (part));
+        used += vs.usedSpace ();
+        vs.addRec ("next", 4);
+        used -= vs.usedSpace ();
+    }
+    vs.readRec (loc, big + words / 2, 0); // zero length read at the middle is valid
+    uint32* check = new uint32 [words];
+    vs.readRec (loc, check, words * sizeof (uint32));
+    if (memcmp (check, big, words * sizeof (uint32)))
+        ERR ("compressTest: wrong data after rewrite");
+    std::cerr << "Compressed storage: " << (words * sizeof (uint32) >> 20) << " Mb record stored in " << used - usedBase << " bytes" << std::endl;
+    vs.close ();
+    splitFileFactory.erase (tstd, tstn);
+    delete [] check;
+    delete [] big;
+    delete [] recs;
+    delete [] rbuf;
+    delete [] buf;
+    return true;
+}
+
+#if !defined (_WIN32)
+// Parallel scan against the sequential enumeration: every record is seen once with its data
+
+static const uint32 SCANRECS = 200000;
+
+static uint64 msecs ()
+{
+    struct timeval tv;
+    gettimeofday (&tv, 0);
+    return uint64 (tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+}
+
+class ScanCheck : public VRecScan
+{
+public:
+    ScanCheck () : count_ (0), sum_ (0), bytes_ (0) {}
+    void records (const VRecDescriptor* recs, const void* const* data, uint32 number)
+    {
+        uint64 sum = 0, bytes = 0;
+        for (uint32 i = 0; i < number; i ++)
+        {
+            uint32 no;
+            memcpy (&no, data [i], sizeof (no));
+            if (recs [i].length_ != 16 + no % 1500 || ((const unsigned char*) data [i]) [recs [i].length_ - 1] != (unsigned char) no)
+                ERR ("scanTest: wrong record data");
+            sum += no;
+            bytes += recs [i].length_;
+        }
+        MutexGuard guard (lock_);
+        count_ += number;
+        sum_ += sum;
+        bytes_ += bytes;
+    }
+    Mutex lock_;
+    uint64 count_;
+    uint64 sum_;
+    uint64 bytes_;
+};
+
+bool scanTest ()
+{
+    unsigned char buf [1600];
+    for (int compressed = 0; compressed < 2; compressed ++)
+    {
+        if (splitFileFactory.exists (tstd, tstn))
+            splitFileFactory.erase (tstd, tstn);
+        File& f = splitFileFactory.create (tstd, tstn);
+        File& cf = cachedFileFactory.wrap (f);
+        VStorage& vs = vStorageFactory.init (cf, compressed != 0);
+        uint64 count = 0, sum = 0;
+        for (uint32 no = 0; no < SCANRECS; no ++)
+        {
+            uint32 len = 16 + no % 1500;
+            memset (buf, (unsigned char) no, len);
+            memcpy (buf, &no, sizeof (no));
+            RecLocator loc = vs.addRec (buf, len);
+            // every fifth record is freed, leaving holes
+            if (no % 5 == 3)
+                vs.freeRec (loc);
+            else
+                count ++, sum += no;
+        }
+        vs.flush ();
+
+        uint64 tbeg = msecs ();
+        ScanCheck seq;
+        VRecDescriptor rec;
+        for (bool more = vs.firstRec (rec); more; more = vs.nextRec (rec))
+        {
+            vs.readRec (rec.locator_, buf, (BufLen) rec.length_);
+            const void* data = buf;
+            seq.records (&rec, &data, 1);
+        }
+        std::cerr << (compressed ? "Compressed: " : "") << "enumeration of " << seq.count_ << " records: " << msecs () - tbeg << " msec" << std::endl;
+        if (seq.count_ != count || seq.sum_ != sum)
+            ERR ("scanTest: enumeration missed records");
+
+        for (uint32 threads = 1; threads <= 8; threads *= 2)
+        {
+            ScanCheck par;
+            tbeg = msecs ();
+            vs.scan (par, threads);
+            std::cerr << (compressed ? "Compressed: " : "") << "scan in " << threads << " threads: " << msecs () - tbeg << " msec" << std::endl;
+            if (par.count_ != count || par.sum_ != sum || par.bytes_ != seq.bytes_)
+                ERR ("scanTest: scan missed records");
+        }
+        vs.close ();
+    }
+    splitFileFactory.erase (tstd, tstn);
+    return true;
+}
+
+// Scan of a storage whose large records carry chains of fake block headers in their data. The fakes link to each
+// other, and the shares of the file given to the threads start within these records; the ranges still start on the
+// real blocks, at the free ones left between the small records.
+
+static const uint32 DECOYS = 4;
+static const uint32 DECOYLEN = 0x600000;
+static const uint32 DECOYSTEP = 64; // bytes between the fake headers
+static const uint32 FILLERS = 500; // small records around each decoy
+
+class ScanCollect : public VRecScan
+{
+public:
+    void records (const VRecDescriptor* recs, const void* const*, uint32 number)
+    {
+        MutexGuard guard (lock_);
+        for (uint32 i = 0; i < number; i ++)
+            found_.push_back (std::make_pair (recs [i].locator_, recs [i].length_));
+    }
+    Mutex lock_;
+    std::vector <std::pair <RecLocator, RecLen> > found_;
+};
+
+// writes a block header of hdrlen bytes as VStorage_imp lays it out: the signature and the free flag, then
+// the previous and the next block at the end
+static void fakeHeader (unsigned char* dest, uint32 hdrlen, RecLocator prev, RecLocator next)
+{
+    memset (dest, 0, hdrlen);
+    memcpy (dest, "VsB", 3);
+    memcpy (dest + hdrlen - 2 * sizeof (RecLocator), &prev, sizeof (prev));
+    memcpy (dest + hdrlen - sizeof (RecLocator), &next, sizeof (next));
+}
+
+bool fakeHeaderTest ()
+{
+    if (splitFileFactory.exists (tstd, tstn))
+        splitFileFactory.erase (tstd, tstn);
+    File& f = splitFileFactory.create (tstd, tstn);
+    File& cf = cachedFileFactory.wrap (f);
+    VStorage& vs = vStorageFactory.init (cf);
+    std::vector <std::pair <RecLocator, RecLen> > expected;
+    std::vector <unsigned char> decoy (DECOYLEN);
+    unsigned char buf [1024];
+    uint32 hdrlen = 0;
+    for (uint32 d = 0; d <= DECOYS; d ++)
+    {
+        for (uint32 no = 0; no < FILLERS; no ++)
+        {
+            uint32 len = 16 + (no * 7) % 1000;
+            memset (buf, (unsigned char) no, len);
+            RecLocator loc = vs.addRec (buf, len);
+            if (no % 100 == 50)
+                vs.freeRec (loc);
+            else
+                expected.push_back (std::make_pair (loc, (RecLen) len));
+        }
+        // the block header size, as the records are stored one after the other
+        if (!hdrlen)
+            hdrlen = (uint32) (expected [1].first - expected [0].first - expected [0].second);
+        if (d == DECOYS)
+            break;
+        RecLocator loc = vs.allocRec (DECOYLEN);
+        RecLen len = vs.getRecLen (loc);
+        // the fakes link to each other, the first one back to the real block holding them and the last one on to the block after it
+        RecLocator first = loc + hdrlen, last = first + (DECOYLEN / DECOYSTEP - 1) * DECOYSTEP;
+        for (RecLocator fake = first; fake <= last; fake += DECOYSTEP)
+            fakeHeader (&decoy [fake - first], hdrlen, fake == first ? loc : fake - DECOYSTEP, fake == last ? loc + hdrlen + len : fake + DECOYSTEP);
+        vs.writeRec (loc, &decoy [0], DECOYLEN);
+        expected.push_back (std::make_pair (loc, len));
+    }
+    vs.flush ();
+    std::sort (expected.begin (), expected.end ());
+
+    for (uint32 threads = 1; threads <= 8; threads ++)
+    {
+        ScanCollect collect;
+        vs.scan (collect, threads);
+        std::sort (collect.found_.begin (), collect.found_.end ());
+        if (collect.found_ != expected)
+            ERR ("fakeHeaderTest: scan took fake headers for blocks");
+    }
+    std::cerr << "Scan skipped the fake headers in " << DECOYS << " records of " << DECOYLEN / DECOYSTEP << " each" << std::endl;
+    vs.close ();
+    splitFileFactory.erase (tstd, tstn);
+    return true;
+}
+
+// batched reads of records picked near each other, as the ones stored together and fetched by one request
+static const uint32 BATCHRECS = 100000;
+static const uint32 BATCHSIZE = 300;
+static const uint32 BATCHWINDOW = 3000;
+static const uint32 BATCHES = 1000;
+
+static void fillRec (unsigned char* buf, uint32 no, uint32 len, uint32 version)
+{
+    memset (buf, (unsigned char) (no + version), len);
+    memcpy (buf, &no, sizeof (no));
+}
+
+bool readRecsTest ()
+{
+    std::vector <RecLocator> locs (BATCHRECS);
+    std::vector <uint32> lens (BATCHRECS);
+    std::vector <uint32> versions (BATCHRECS, 0);
+    std::vector <unsigned char> buf (1700);
+    for (int compressed = 0; compressed < 2; compressed ++)
+    {
+        if (splitFileFactory.exists (tstd, tstn))
+            splitFileFactory.erase (tstd, tstn);
+        // uncached, so that every read goes to the file
+        File& f = splitFileFactory.create (tstd, tstn);
+        VStorage& vs = vStorageFactory.init (f, compressed != 0);
+        uint32 no;
+        for (no = 0; no < BATCHRECS; no ++)
+        {
+            lens [no] = 16 + no % 1500;
+            fillRec (&buf [0], no, lens [no], 0);
+            locs [no] = vs.addRec (&buf [0], lens [no]);
+        }
+        vs.flush ();
+        // changes not yet flushed: grown (maybe moved) and rewritten records, freed neighbours
+        for (no = 0; no < BATCHRECS; no += 7)
+        {
+            lens [no] += 100;
+            versions [no] = 1;
+            locs [no] = vs.reallocRec (locs [no], lens [no]);
+            fillRec (&buf [0], no, lens [no], 1);
+            vs.writeRec (locs [no], &buf [0], lens [no]);
+        }
+        for (no = 3; no < BATCHRECS; no += 11)
+        {
+            vs.freeRec (locs [no]);
+            locs [no] = RECLOCATOR_MAX;
+        }
+
+        srand (BATCHRECS);
+        std::vector <VRecDescriptor> recs (BATCHSIZE);
+        std::vector <uint32> nos (BATCHSIZE);
+        std::vector <std::vector <unsigned char> > data (BATCHSIZE, std::vector <unsigned char> (1700));
+        std::vector <void*> buffers (BATCHSIZE);
+        uint64 single = 0, batched = 0;
+        for (uint32 batch = 0; batch < BATCHES; batch ++)
+        {
+            uint32 base = (uint32) ((rand () * (RAND_MAX + 1.0) + rand ()) / ((RAND_MAX + 1.0) * (RAND_MAX + 1.0)) * (BATCHRECS - BATCHWINDOW));
+            uint32 ridx;
+            for (ridx = 0; ridx < BATCHSIZE; ridx ++)
+            {
+                do
+                    no = base + rand () % BATCHWINDOW;
+                while (locs [no] == RECLOCATOR_MAX);
+                nos [ridx] = no;
+                recs [ridx].locator_ = locs [no];
+                // a part of the record now and then
+                recs [ridx].length_ = (ridx % 10 == 9) ? lens [no] / 2 + 4 : lens [no];
+                buffers [ridx] = &data [ridx][0];
+            }
+            uint64 tbeg = msecs ();
+            for (ridx = 0; ridx < BATCHSIZE; ridx ++)
+                vs.readRec (recs [ridx].locator_, &data [ridx][0], (BufLen) recs [ridx].length_);
+            single += msecs () - tbeg;
+            for (ridx = 0; ridx < BATCHSIZE; ridx ++)
+                memset (&data [ridx][0], 0xee, data [ridx].size ());
+            tbeg = msecs ();
+            vs.readRecs (&recs [0], BATCHSIZE, &buffers [0]);
+            batched += msecs () - tbeg;
+            for (ridx = 0; ridx < BATCHSIZE; ridx ++)
+            {
+                no = nos [ridx];
+                fillRec (&buf [0], no, lens [no], versions [no]);
+                if (memcmp (&data [ridx][0], &buf [0], (size_t) recs [ridx].length_))
+                    ERR ("readRecsTest: wrong record data");
+            }
+        }
+        std::cerr << (compressed ? "Compressed: " : "") << BATCHES << " batches of " << BATCHSIZE << " records: by readRec " << single << " msec, by readRecs " << batched << " msec" << std::endl;
+
+        // a freed record is refused
+        VRecDescriptor freed;
+        freed.locator_ = locs [5];
+        freed.length_ = 1;
+        vs.freeRec (locs [5]);
+        void* dest = &buf [0];
+        bool failed = false;
+        try
+        {
+            vs.readRecs (&freed, 1, &dest);
+        }
+        catch (Error&)
+        {
+            failed = true;
+        }
+        if (!failed)
+            ERR ("readRecsTest: freed record read");
+        vs.close ();
+        std::fill (versions.begin (), versions.end (), 0);
+    }
+    splitFileFactory.erase (tstd, tstn);
+    return true;
+}
+#endif
+
 bool testVStorage ()
 {
     //return casesTest ();
     //return reallocTest ();
+    churnTest ();
+    smallUpdTest ();
+    compactTest ();
+    streamTest ();
+    moveTest ();
+    compressTest ();
+#if !defined (_WIN32)
+    scanTest ();
+    fakeHeaderTest ();
+    readRecsTest ();
+#endif
     opTest ();
     // readTest ();
     // delTest ();
@@ -0,0 +1,52 @@
+//////////////////////////////////////////////////////////////////////////////
+//// This software module is developed by SciDM (Scientific Data Management) in 1998-2015
+//// 
+//// This program is free software; you can redistribute, reuse,
+//// or modify it with no restriction, under the terms of the MIT License.
+//// 
+//// This program is distributed in the hope that it will be useful,
+//// but WITHOUT ANY WARRANTY; without even the implied warranty of
+//// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//// 
+//// For any questions please contact Denis Kaznadzey at dkaznadzey@yahoo.com
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef edbWal_h
+#define edbWal_h
+
+#include "edbFile.h"
+#include "edbError.h"
+
+namespace edb
+{
+
+// Write-ahead log of the page images of one paged file. The images appended since the previous commit make 
+// a transaction, which counts once its commit record is on disk; the file itself gets the committed images later.
+// Positions in the log are returned as the log sequence numbers
+class Wal
+{
+public:
+    virtual             ~Wal            () {}
+    virtual uint64      append          (uint64 pageno, const void* pages, uint32 count) = 0; // logs the images of count pages starting from pageno
+    virtual uint64      commit          () = 0; // ends the transaction with the commit record; returns the log position after it
+    virtual void        sync            (uint64 lsn) = 0; // returns once the log is on disk up to lsn; the threads syncing together share one fsync
+    virtual void        flush           () = 0; // puts on disk all the log written
+    virtual bool        read            (uint64 pageno, void* page) = 0; // copies the latest logged image of the page the file has not got yet; false if none
+    virtual void        applied         (uint64 pageno, uint32 count) = 0; // tells that the latest images of the pages were written to the file (after flush)
+    virtual uint64      committed       (uint64 pageno, void* page) = 0; // copies the committed image the file lacks of the first page from pageno on; returns its number, UINT64_MAX if none
+    virtual bool        checkpoint      (File& file) = 0; // writes the committed images the file lacks into it, syncs it and empties the log if no uncommitted images follow
+    virtual uint32      getPageSize     () const = 0;
+    virtual uint64      getCommitCount  () const = 0;
+    virtual uint64      getSyncCount    () const = 0;
+};
+
+class WalFactory
+{
+public:
+    virtual             ~WalFactory     () {};
+    virtual Wal&        open            (File& log, uint32 pagesize) = 0; // recovers the log: drops whatever follows its last complete commit record
+};
+
+};
+
+#endif
@@ -0,0 +1,351 @@
+//////////////////////////////////////////////////////////////////////////////
+//// This software module is developed by SciDM (Scientific Data Management) in 1998-2015
+//// 
+//// This program is free software; you can redistribute, reuse,
+//// or modify it with no restriction, under the terms of the MIT License.
+//// 
+//// This program is distributed in the hope that it will be useful,
+//// but WITHOUT ANY WARRANTY; without even the implied warranty of
+//// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//// 
+//// For any questions please contact Denis Kaznadzey at dkaznadzey@yahoo.com
+//////////////////////////////////////////////////////////////////////////////
+
+#define walFactory_defined
+#include "edbWal_imp.h"
+#include "edbExceptions.h"
+#include <string.h>
+
+namespace edb
+{
+
+static WalFactory_imp theFactory;
+WalFactory& walFactory = theFactory;
+
+static const FilePos NONE = (FilePos) -1;
+static const uint32 WAL_MAGIC = 0x4c415745; // "EWAL"
+// the records are written out once that much collects
+static const size_t WAL_BUFFER = 0x100000; // 1 Mb
+// the longest run of pages copied into the file at once by checkpoint
+static const uint32 CHECKPOINT_RUN = 64;
+
+struct WalRecord
+{
+    uint32  magic_;
+    uint32  count_; // page images following; 0 for the commit record
+    uint64  pageno_; // of the first image; the number of the commit for the commit record
+    uint64  seq_;
+    uint64  sum_; // of the header with sum_ zeroed and of the images
+};
+
+// FNV-1a by 64-bit words
+static uint64 checksum (const void* data, size_t len, uint64 sum = 14695981039346656037ULL)
+{
+    const uint64* p = (const uint64*) data;
+    for (size_t i = 0; i < len / sizeof (uint64); i ++)
+        sum = (sum ^ p [i]) * 1099511628211ULL;
+    return sum;
+}
+
+static uint64 checksum (const WalRecord& rec, const void* pages, size_t len)
+{
+    WalRecord hdr = rec;
+    hdr.sum_ = 0;
+    return checksum (pages, len, checksum (&hdr, sizeof (hdr)));
+}
+
+Wal_imp::Frame::Frame ()
+:
+latest_ (NONE),
+committed_ (NONE),
+applied_ (NONE)
+{
+}
+
+Wal_imp::Wal_imp (File& log, uint32 pagesize)
+:
+log_ (log),
+pagesize_ (pagesize),
+written_ (0),
+commitend_ (0),
+durable_ (0),
+base_ (0),
+seq_ (0),
+commits_ (0),
+syncs_ (0),
+syncing_ (false)
+{
+    if (!pagesize || pagesize % sizeof (uint64)) throw BadParameters ();
+}
+
+FilePos Wal_imp::committed_ (const Frame& frame) const
+{
+    return (frame.latest_ != NONE && frame.latest_ < commitend_) ? frame.latest_ : frame.committed_;
+}
+
+void Wal_imp::record_ (uint32 count, uint64 pageno, const void* pages)
+{
+    WalRecord rec;
+    rec.magic_ = WAL_MAGIC;
+    rec.count_ = count;
+    rec.pageno_ = pageno;
+    rec.seq_ = seq_ ++;
+    rec.sum_ = 0;
+    rec.sum_ = checksum (rec, pages, (size_t) count * pagesize_);
+    size_t pos = buf_.size ();
+    buf_.resize (pos + sizeof (rec) + (size_t) count * pagesize_);
+    memcpy (&buf_ [pos], &rec, sizeof (rec));
+    if (count)
+        memcpy (&buf_ [pos + sizeof (rec)], pages, (size_t) count * pagesize_);
+}
+
+void Wal_imp::write_ ()
+{
+    if (buf_.empty () || syncing_) return;
+    if (log_.seek (written_) != written_) throw IOError ("Seek error");
+    if (log_.write (&buf_ [0], (BufLen) buf_.size ()) != buf_.size ()) throw IOError ("Write error");
+    written_ += buf_.size ();
+    buf_.clear ();
+}
+
+void Wal_imp::sync_ ()
+{
+    write_ ();
+    FilePos upto = written_;
+    syncing_ = true;
+    mutex_.release ();
+    bool ok;
+    try
+    {
+        ok = log_.commit ();
+    }
+    catch (...)
+    {
+        mutex_.acquire ();
+        syncing_ = false;
+        synced_.broadcast ();
+        throw;
+    }
+    mutex_.acquire ();
+    syncing_ = false;
+    synced_.broadcast ();
+    if (!ok) throw IOError ("Commit error");
+    durable_ = upto;
+    syncs_ ++;
+}
+
+void Wal_imp::await_ (uint64 lsn)
+{
+    // nothing past the log end is to come
+    if (lsn > base_ + end_ ())
+        lsn = base_ + end_ ();
+    while (base_ + durable_ < lsn)
+    {
+        if (syncing_)
+            synced_.wait (mutex_);
+        else
+            sync_ ();
+    }
+}
+
+void Wal_imp::readlog_ (FilePos pos, void* dest, BufLen len)
+{
+    if (pos >= written_)
+        memcpy (dest, &buf_ [(size_t) (pos - written_)], len);
+    else
+    {
+        if (log_.seek (pos) != pos) throw IOError ("Seek error");
+        if (log_.read (dest, len) != len) throw IOError ("Read error");
+    }
+}
+
+// takes the records in order while they are whole and right; the images count from the commit record following them
+void Wal_imp::recover_ ()
+{
+    FilePos loglen = log_.length ();
+    // all there is comes from the file
+    written_ = loglen;
+    FilePos pos = 0;
+    std::vector <char> pages;
+    std::vector <std::pair <uint64, FilePos> > pending;
+    uint64 seq = 0;
+    WalRecord rec;
+    while (pos + sizeof (rec) <= loglen)
+    {
+        readlog_ (pos, &rec, sizeof (rec));
+        if (rec.magic_ != WAL_MAGIC || (pos && rec.seq_ != seq))
+            break;
+        size_t len = (size_t) rec.count_ * pagesize_;
+        if (pos + sizeof (rec) + len > loglen)
+            break;
+        pages.resize (len);
+        if (len)
+            readlog_ (pos + sizeof (rec), &pages [0], (BufLen) len);
+        if (checksum (rec, len ? &pages [0] : NULL, len) != rec.sum_)
+            break;
+        seq = rec.seq_ + 1;
+        for (uint32 i = 0; i < rec.count_; i ++)
+            pending.push_back (std::make_pair (rec.pageno_ + i, pos + sizeof (rec) + (FilePos) i * pagesize_));
+        pos += sizeof (rec) + len;
+        if (!rec.count_)
+        {
+            for (size_t p = 0; p < pending.size (); p ++)
+                frames_ [pending [p].first].latest_ = pending [p].second;
+            pending.clear ();
+            commitend_ = pos;
+            seq_ = seq;
+        }
+    }
+    written_ = durable_ = commitend_;
+    if (loglen > commitend_)
+    {
+        if (!log_.chsize (commitend_)) throw IOError ("Truncate error");
+        log_.commit ();
+    }
+}
+
+uint64 Wal_imp::append (uint64 pageno, const void* pages, uint32 count)
+{
+    MutexGuard guard (mutex_);
+    FilePos pos = end_ () + sizeof (WalRecord);
+    record_ (count, pageno, pages);
+    for (uint32 i = 0; i < count; i ++)
+    {
+        Frame& frame = frames_ [pageno + i];
+        if (frame.latest_ != NONE && frame.latest_ < commitend_)
+            frame.committed_ = frame.latest_;
+        frame.latest_ = pos + (FilePos) i * pagesize_;
+    }
+    if (buf_.size () >= WAL_BUFFER)
+        write_ ();
+    return base_ + end_ ();
+}
+
+uint64 Wal_imp::commit ()
+{
+    MutexGuard guard (mutex_);
+    record_ (0, commits_, NULL);
+    write_ ();
+    commitend_ = end_ ();
+    commits_ ++;
+    return base_ + commitend_;
+}
+
+void Wal_imp::sync (uint64 lsn)
+{
+    MutexGuard guard (mutex_);
+    await_ (lsn);
+}
+
+void Wal_imp::flush ()
+{
+    MutexGuard guard (mutex_);
+    await_ (base_ + end_ ());
+}
+
+bool Wal_imp::read (uint64 pageno, void* page)
+{
+    MutexGuard guard (mutex_);
+    if (frames_.empty ()) return false;
+    Framemap::iterator itr = frames_.find (pageno);
+    if (itr == frames_.end ()) return false;
+    Frame& frame = (*itr).second;
+    if (frame.latest_ == NONE || frame.latest_ == frame.applied_) return false;
+    readlog_ (frame.latest_, page, pagesize_);
+    return true;
+}
+
+void Wal_imp::applied (uint64 pageno, uint32 count)
+{
+    MutexGuard guard (mutex_);
+    if (frames_.empty ()) return;
+    for (Framemap::iterator itr = frames_.lower_bound (pageno); itr != frames_.end () && (*itr).first < pageno + count; itr ++)
+        (*itr).second.applied_ = (*itr).second.latest_;
+}
+
+uint64 Wal_imp::committed (uint64 pageno, void* page)
+{
+    MutexGuard guard (mutex_);
+    for (Framemap::iterator itr = frames_.lower_bound (pageno); itr != frames_.end (); itr ++)
+    {
+        FilePos pos = committed_ ((*itr).second);
+        if (pos == NONE || pos == (*itr).second.applied_) continue;
+        readlog_ (pos, page, pagesize_);
+        return (*itr).first;
+    }
+    return UINT64_MAX;
+}
+
+bool Wal_imp::checkpoint (File& file)
+{
+    MutexGuard guard (mutex_);
+    // the images go to the file only after they are on disk in the log, with the ones committed while an fsync
+    // released the mutex; holding it from then on, no more come
+    while (durable_ < end_ ())
+    {
+        if (syncing_)
+            synced_.wait (mutex_);
+        else
+            sync_ ();
+    }
+    std::vector <char> run ((size_t) CHECKPOINT_RUN * pagesize_);
+    Framemap::iterator itr = frames_.begin ();
+    while (itr != frames_.end ())
+    {
+        FilePos pos = committed_ ((*itr).second);
+        if (pos == NONE || pos == (*itr).second.applied_)
+        {
+            itr ++;
+            continue;
+        }
+        uint64 first = (*itr).first;
+        uint32 count = 0;
+        while (itr != frames_.end () && count < CHECKPOINT_RUN && (*itr).first == first + count)
+        {
+            pos = committed_ ((*itr).second);
+            if (pos == NONE || pos == (*itr).second.applied_)
+                break;
+            readlog_ (pos, &run [(size_t) count * pagesize_], pagesize_);
+            (*itr).second.applied_ = pos;
+            count ++;
+            itr ++;
+        }
+        if (file.seek (first * pagesize_) != first * pagesize_) throw IOError ("Seek error");
+        if (file.write (&run [0], count * pagesize_) != count * pagesize_) throw IOError ("Write error");
+    }
+    if (!file.commit ()) return false;
+    // with the file on disk, the log is needed no more unless it holds the images of a transaction going on
+    if (commitend_ == end_ ())
+    {
+        if (!log_.chsize (0)) throw IOError ("Truncate error");
+        log_.commit ();
+        frames_.clear ();
+        base_ += commitend_;
+        written_ = durable_ = commitend_ = 0;
+    }
+    return true;
+}
+
+uint32 Wal_imp::getPageSize () const
+{
+    return pagesize_;
+}
+
+uint64 Wal_imp::getCommitCount () const
+{
+    return commits_;
+}
+
+uint64 Wal_imp::getSyncCount () const
+{
+    return syncs_;
+}
+
+Wal& WalFactory_imp::open (File& log, uint32 pagesize)
+{
+    Wal_imp& wal = *new Wal_imp (log, pagesize);
+    wal.recover_ ();
+    return wal;
+}
+
+};
@@ -0,0 +1,99 @@
+//////////////////////////////////////////////////////////////////////////////
+//// This software module is developed by SciDM (Scientific Data Management) in 1998-2015
+//// 
+//// This program is free software; you can redistribute, reuse,
+//// or modify it with no restriction, under the terms of the MIT License.
+//// 
+//// This program is distributed in the hope that it will be useful,
+//// but WITHOUT ANY WARRANTY; without even the implied warranty of
+//// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//// 
+//// For any questions please contact Denis Kaznadzey at dkaznadzey@yahoo.com
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef edbWal_imp_h
+#define edbWal_imp_h
+
+#ifdef _MSC_VER
+#pragma warning (disable : 4786)
+#endif
+
+#include "edbWal.h"
+#include "edbLatch.h"
+#include <map>
+#include <vector>
+
+namespace edb
+{
+
+// The log is a row of records, each a header followed by count page images; the commit record has no pages.
+// A record counts only if its checksum and sequence number are right, so a torn tail is found and dropped on open.
+// The positions of the images of every page logged are kept in an ordered map, so the images the file lacks 
+// are found for reading and copied by the runs of adjacent pages at checkpoint.
+//
+// Group commit: the first thread to sync is the leader. It writes out all the log collected, releases the mutex
+// for the fsync and wakes the threads waiting when it is done. The records appended meanwhile stay in the buffer,
+// so the log is not written during the fsync; whoever finds its commit still not on disk then leads the next one
+class Wal_imp : public Wal
+{
+private:
+    struct Frame // positions of the images of a page in the log; NONE if no such one
+    {
+        Frame ();
+        FilePos latest_;
+        FilePos committed_; // the latest one before the last commit record, kept while latest_ is after it
+        FilePos applied_; // the one the file has got
+    };
+    typedef std::map <uint64, Frame> Framemap;
+
+    File&       log_;
+    uint32      pagesize_;
+    Framemap    frames_;
+    std::vector <char> buf_; // the tail of the log not written out yet
+    FilePos     written_; // length of the log written out
+    FilePos     commitend_; // log position after the last commit record
+    FilePos     durable_; // length of the log known to be on disk
+    uint64      base_; // the log sequence number of the log start: the length of the logs emptied by checkpoints
+    uint64      seq_; // of the next record
+    uint64      commits_;
+    uint64      syncs_;
+    bool        syncing_; // a leader is in the fsync, without the mutex
+    Mutex       mutex_;
+    CondVar     synced_; // the leader is out of the fsync
+
+    FilePos     end_            () const { return written_ + buf_.size (); }
+    FilePos     committed_      (const Frame& frame) const; // the committed image position
+    void        record_         (uint32 count, uint64 pageno, const void* pages); // puts the record into buf_
+    void        write_          (); // writes buf_ out to the log, unless the fsync is going on
+    void        sync_           (); // leads the fsync of the log written out
+    void        await_          (uint64 lsn); // syncs or waits for the leader until the log is on disk up to lsn
+    void        readlog_        (FilePos pos, void* dest, BufLen len);
+    void        recover_        ();
+
+protected:
+                Wal_imp         (File& log, uint32 pagesize);
+public:
+    uint64      append          (uint64 pageno, const void* pages, uint32 count);
+    uint64      commit          ();
+    void        sync            (uint64 lsn);
+    void        flush           ();
+    bool        read            (uint64 pageno, void* page);
+    void        applied         (uint64 pageno, uint32 count);
+    uint64      committed       (uint64 pageno, void* page);
+    bool        checkpoint      (File& file);
+    uint32      getPageSize     () const;
+    uint64      getCommitCount  () const;
+    uint64      getSyncCount    () const;
+
+friend class WalFactory_imp;
+};
+
+class WalFactory_imp : public WalFactory
+{
+public:
+    Wal&        open            (File& log, uint32 pagesize);
+};
+
+};
+
+#endif
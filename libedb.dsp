@@ -41,7 +41,7 @@ RSC=rc.exe
 # PROP Intermediate_Dir "Release"
 # PROP Target_Dir ""
 # ADD BASE CPP /nologo /W3 /GX /O2 /D "WIN32" /D "NDEBUG" /D "_MBCS" /D "_LIB" /YX /FD /c
-# ADD CPP /nologo /MD /W3 /GX /O2 /D "WIN32" /D "NDEBUG" /D "_MBCS" /D "_LIB" /D "USE_SGI_STL" /YX /FD /c
+# ADD CPP /nologo /MD /W3 /GX /O2 /D "WIN32" /D "NDEBUG" /D "_MBCS" /D "_LIB" /D "USE_SGI_STL" /D "EDB_STATS" /YX /FD /c
 # ADD BASE RSC /l 0x409 /d "NDEBUG"
 # ADD RSC /l 0x409 /d "NDEBUG"
 BSC32=bscmake.exe
@@ -64,7 +64,7 @@ LIB32=xilink6.exe -lib
 # PROP Intermediate_Dir "Debug"
 # PROP Target_Dir ""
 # ADD BASE CPP /nologo /W3 /Gm /GX /ZI /Od /D "WIN32" /D "_DEBUG" /D "_MBCS" /D "_LIB" /YX /FD /GZ /c
-# ADD CPP /nologo /MDd /W3 /Gm /GX /ZI /Od /D "WIN32" /D "_DEBUG" /D "_MBCS" /D "_LIB" /D "USE_SGI_STL" /FR /YX /FD /GZ /c
+# ADD CPP /nologo /MDd /W3 /Gm /GX /ZI /Od /D "WIN32" /D "_DEBUG" /D "_MBCS" /D "_LIB" /D "USE_SGI_STL" /D "EDB_STATS" /FR /YX /FD /GZ /c
 # ADD BASE RSC /l 0x409 /d "_DEBUG"
 # ADD RSC /l 0x409 /d "_DEBUG"
 BSC32=bscmake.exe
@@ -93,6 +93,14 @@ SOURCE=.\edbCachedFile_imp.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\edbCompressedVStorage_imp.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\edbCrc32c.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\edbError.cpp
 # End Source File
 # Begin Source File
@@ -105,6 +113,10 @@ SOURCE=.\edbFStorage_imp.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\edbLZ4.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\edbPagedFile_imp.cpp
 # End Source File
 # Begin Source File
@@ -117,10 +129,18 @@ SOURCE=.\edbPagerMgr_imp.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\edbShadow_imp.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\edbSimpleCache_imp.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\edbSlabArena.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\edbSplitFile_imp.cpp
 # End Source File
 # Begin Source File
@@ -129,6 +149,10 @@ SOURCE=.\edbSplitFileFactory_imp.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\edbStats.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\edbSystemCache.cpp
 # End Source File
 # Begin Source File
@@ -137,8 +161,20 @@ SOURCE=.\edbThePagerMgr.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\edbVLPagedCache_imp.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\edbVRecStream.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\edbVStorage_imp.cpp
 # End Source File
+# Begin Source File
+
+SOURCE=.\edbWal_imp.cpp
+# End Source File
 # End Group
 # Begin Group "Header Files"
 
@@ -157,6 +193,14 @@ SOURCE=.\edbCachedFile_imp.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\edbCompressedVStorage_imp.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\edbCrc32c.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\edbError.h
 # End Source File
 # Begin Source File
@@ -189,6 +233,14 @@ SOURCE=.\edbFStorage_imp.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\edbLatch.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\edbLZ4.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\edbPagedFile.h
 # End Source File
 # Begin Source File
@@ -221,6 +273,14 @@ SOURCE=.\edbPagerMgrFactory.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\edbPtrMap.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\edbShadow_imp.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\edbSimpleCache_imp.h
 # End Source File
 # Begin Source File
@@ -229,10 +289,18 @@ SOURCE=.\edbSimpleCacheFactory.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\edbSlabArena.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\edbSplitFile_imp.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\edbStats.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\edbSystemCache.h
 # End Source File
 # Begin Source File
@@ -245,12 +313,28 @@ SOURCE=.\edbTypes.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\edbVLPagedCache_imp.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\edbVStorage.h
 # End Source File
 # Begin Source File
 
 SOURCE=.\edbVStorage_imp.h
 # End Source File
+# Begin Source File
+
+SOURCE=.\edbWal.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\edbWal_imp.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\edbWalFactory.h
+# End Source File
 # End Group
 # End Target
 # End Project
@@ -115,6 +115,10 @@ SOURCE=.\edbPager_test.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\edbVLPagedCache_test.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\edbVStorage_test.cpp
 # End Source File
 # End Group
@@ -85,6 +85,24 @@
     }
     #define sci_chsize ftruncate64
     #define sci_unlink unlink
+    // positional i/o, leaving the file pointer where it is
+    #define SCI_HAVE_PREAD
+    #define sci_pread pread64
+    #define sci_pwrite pwrite64
+    #if defined (__linux__) && defined (__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+        // in-kernel copy between file ranges (may share extents on file systems supporting reflinks)
+        #define SCI_HAVE_COPY_RANGE
+        #define sci_copy_range(FDIN, OFFIN, FDOUT, OFFOUT, LEN) copy_file_range(FDIN, OFFIN, FDOUT, OFFOUT, LEN, 0)
+    #endif
+    #if defined (__linux__) && defined (__GLIBC__)
+        // reserves the disk space for a range without changing the file length
+        #include <fcntl.h>
+        #define SCI_HAVE_PREALLOCATE
+        #define sci_preallocate(FD, OFF, LEN) fallocate64(FD, FALLOC_FL_KEEP_SIZE, OFF, LEN)
+        // asks the kernel to start reading a range into the page cache, without waiting for it
+        #define SCI_HAVE_READAHEAD
+        #define sci_readahead(FD, OFF, LEN) posix_fadvise64(FD, OFF, LEN, POSIX_FADV_WILLNEED)
+    #endif
 #endif
 
 #if defined (_MSC_VER)
@@ -79,6 +79,11 @@ Cursor::~Cursor ()
 		cursor_ = NULL;
 	}
 }
+unsigned int Cursor::fetchBatch (BTree* btree, void *keys, void *vals, unsigned int maxRows)
+{
+	if (!btree->btree_) throw UnInit ();
+	return btree->btree_->fetchBatch (*cursor_, keys, vals, maxRows);
+}
 
 
 BTree::BTree ()
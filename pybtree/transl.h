@@ -28,6 +28,10 @@ public:
     {
         return memcmp (key_, key, len_) != 0;
     }
+    bool monotone () const
+    {
+        return true;
+    }
 } ;
 
 // exceptions
@@ -45,6 +49,8 @@ public:
 	friend class BTree;
 };
 
+class BTree;
+
 class Cursor 
 {
 protected:
@@ -52,6 +58,7 @@ protected:
 public:
 	Cursor ();
 	~Cursor ();
+	unsigned int fetchBatch (BTree* btree, void *keys, void *vals, unsigned int maxRows);
 	friend class BTree;
 };
 
@@ -82,6 +89,7 @@ public:
 	bool	isVarkey () const;
 	bool	isRange () const;
 
+	friend class Cursor;
 };
 
 